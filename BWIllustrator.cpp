@@ -1,56 +1,174 @@
 // BWIllustrator.cpp is a derived class that maps white pixels to 0 and any non-white pixel to 1,
-// then outputs PBM text format (P1).
+// then outputs PBM text format (P1), or bit-packed binary P4 when the export mode is BINARY.
 //
 // Note: We consider a pixel white only if R=G=B=255 (exact white), which
-// matches how UJImage initialises new pixels to white.
+// matches how UJImage initialises new pixels to white. The test runs a row at a time
+// in the PixelKernels module (SIMD where available).
+//
+// setDither() keeps the tones instead (for printers and e-ink that only have black):
+//  - DITHER_ORDERED: intensity against an 8 x 8 Bayer matrix, a SIMD kernel per row; each
+//    row depends only on its own index, so bands and tiles work as usual
+//  - DITHER_DIFFUSION: Floyd-Steinberg (Dither.cpp); exportRows() runs it as a parallel
+//    wavefront on the encode threads, encodeRow() serially with the error kept in RowScratch
+//
+// Undithered, a procedural flag is encoded by the fused pipeline MaskValues + PackedBits /
+// DecimalText (RenderPipeline).
 
 module;
-#include <sstream>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <span>
 #include <string>
+#include <utility>
+#include <vector>
 
 export module BWIllustrator;
 
 import LibUtility;
 import FlagIllustrator;
+import UJImage;
+import ImageSink;
+import TextEncoder;
+import PixelKernels;
+import Dither;
+import FlagRasterizer;
+import RenderPipeline;
+import Metrics;
 
 export class BWIllustrator : public FlagIllustrator
 {
 public:
     BWIllustrator();
     BWIllustrator(int intHeight, int intWidth);
+    explicit BWIllustrator(UJImage objImage); // adopts objImage (see FlagIllustrator)
+
+    using FlagIllustrator::exportImage;
+    void exportImage(ImageSink& objSink) const override;
+    std::size_t exportSize() const override;
+    std::string formatHeader(int intHeight, int intWidth) const override;
+    // P1: "0 " / "1 " per pixel; P4: 8 pixels per byte.
+    void encodeRow(std::span<const UJPixel> arrRow, RowScratch& recScratch, ImageSink& objSink) const override;
+    // exportRows: the wavefront error diffusion for DITHER_DIFFUSION, the default otherwise.
+    void exportRows(ImageSink& objSink, int intRowBegin, int intRowEnd) const override;
+
+protected:
+    bool exportRuns(const FlagRasterizer& objRaster, ImageSink& objSink, int intRowBegin, int intRowEnd) const override;
 
-    std::string exportImage() const override;
 private:
-    bool isWhite(const UJPixel& recPixel) const;
+    // writeMask: one row of 0/1 values (1 = black) as P1 text or P4 bits.
+    void writeMask(std::span<const std::uint8_t> arrMask, RowScratch& recScratch, ImageSink& objSink) const;
 };
 
 BWIllustrator::BWIllustrator() : FlagIllustrator() {}
 BWIllustrator::BWIllustrator(int intHeight, int intWidth)
 : FlagIllustrator(intHeight, intWidth) {}
+BWIllustrator::BWIllustrator(UJImage objImage)
+: FlagIllustrator(std::move(objImage)) {}
+
+// exportImage: produce the PBM header then a grid of bits, one row at a time.
+void BWIllustrator::exportImage(ImageSink& objSink) const
+{
+    objSink.write(exportHeader());
+    exportRows(objSink, 0, getHeight());
+}
 
-// exportImage: produce "P1" PBM header then a grid of bits.
-std::string BWIllustrator::exportImage() const
+// exportSize: P1 is "0 " or "1 " per pixel plus '\n' per row; P4 is (width + 7) / 8 bytes per row.
+std::size_t BWIllustrator::exportSize() const
 {
-    std::stringstream ssPBM;
-    ssPBM << "P1" << std::endl
-          << _image->getWidth() << ' ' << _image->getHeight() << std::endl;
+    std::size_t intWidth  = static_cast<std::size_t>(getWidth());
+    std::size_t intHeight = static_cast<std::size_t>(getHeight());
+    if(_eMode == BINARY)
+        return exportHeader().size() + (intWidth + 7) / 8 * intHeight;
+    return exportHeader().size() + (2 * intWidth + 1) * intHeight;
+}
+
+std::string BWIllustrator::formatHeader(int intHeight, int intWidth) const
+{
+    return pnmHeader(_eMode == BINARY ? "P4" : "P1", intWidth, intHeight, 0);
+}
 
-    for(int r = 0; r < _image->getHeight(); ++r)
+// encodeRow: bit value 0 for white, 1 for non-white (black), or dithered (see setDither()).
+// P4 packs each row into (width + 7) / 8 bytes. The leftmost pixel is the most significant
+// bit; the last byte of a row is padded with 0 bits because every row starts on a byte boundary.
+void BWIllustrator::encodeRow(std::span<const UJPixel> arrRow, RowScratch& recScratch, ImageSink& objSink) const
+{
+    std::vector<std::uint8_t>& vecValues = recScratch.vecBytes; // 0/1 values (P1) or packed bits (P4)
+    int intRow = recScratch.intNextRow++;
+    if(_eDither == DITHER_ORDERED)
+    {
+        vecValues.resize(arrRow.size());
+        rowToOrderedMask(arrRow, intRow, vecValues.data());
+        writeMask(vecValues, recScratch, objSink);
+    }
+    else if(_eDither == DITHER_DIFFUSION)
     {
-        for(int c = 0; c < _image->getWidth(); ++c)
-        {
-            // Bit value: 0 for white, 1 for non-white (black).
-            int intBitValue = isWhite(_image->getPixel(r, c)) ? 0 : 1;
-            ssPBM << intBitValue << ' ';
-        }
-        ssPBM << std::endl;
+        // vecError: the incoming error row, then the outgoing one (column c at index c + 1)
+        std::size_t intErrorSize = arrRow.size() + 2;
+        std::vector<std::int16_t>& vecError = recScratch.vecError;
+        if(vecError.size() != 2 * intErrorSize)
+            vecError.assign(2 * intErrorSize, 0);
+        std::fill(vecError.begin() + static_cast<std::ptrdiff_t>(intErrorSize), vecError.end(), std::int16_t{0});
+        vecValues.resize(arrRow.size());
+        rowToGray(arrRow, vecValues.data());
+        int intCarry = 0;
+        diffuseSpan(vecValues.data(), vecError.data(), vecError.data() + intErrorSize, 0, static_cast<int>(arrRow.size()), intCarry);
+        std::copy(vecError.begin() + static_cast<std::ptrdiff_t>(intErrorSize), vecError.end(), vecError.begin());
+        writeMask(vecValues, recScratch, objSink);
+    }
+    else if(_eMode == BINARY)
+    {
+        vecValues.resize((arrRow.size() + 7) / 8);
+        rowToPackedBits(arrRow, vecValues.data());
+        objSink.write(reinterpret_cast<const char*>(vecValues.data()), vecValues.size());
+    }
+    else
+    {
+        vecValues.resize(arrRow.size());
+        rowToBlackMask(arrRow, vecValues.data());
+        writeTextRow(vecValues, recScratch.vecText, objSink);
     }
-    return ssPBM.str();
 }
 
-// isWhite: check whether pixel is exactly white.
-bool BWIllustrator::isWhite(const UJPixel& recPixel) const
+void BWIllustrator::exportRows(ImageSink& objSink, int intRowBegin, int intRowEnd) const
 {
-    return recPixel.intRed == 255 && recPixel.intGreen == 255 && recPixel.intBlue == 255;
+    if(_eDither != DITHER_DIFFUSION)
+    {
+        FlagIllustrator::exportRows(objSink, intRowBegin, intRowEnd);
+        return;
+    }
+    StageTimer objTimer(STAGE_ENCODE);
+    std::size_t intStart = objSink.bytesWritten();
+    RowScratch recScratch;
+    diffuseRows(intRowEnd - intRowBegin, getWidth(), _encodeThreads,
+                [this, intRowBegin](int intRow, std::vector<UJPixel>& vecRow) { return pixelRow(intRowBegin + intRow, vecRow); },
+                [&](int, std::span<const std::uint8_t> arrMask) { writeMask(arrMask, recScratch, objSink); });
+    countPixels(static_cast<std::size_t>(intRowEnd - intRowBegin) * static_cast<std::size_t>(getWidth()));
+    countBytes(objSink.bytesWritten() - intStart);
+}
 
+// exportRuns: dithered rows depend on more than their own pixels, so only DITHER_NONE is fused.
+bool BWIllustrator::exportRuns(const FlagRasterizer& objRaster, ImageSink& objSink, int intRowBegin, int intRowEnd) const
+{
+    if(_eDither != DITHER_NONE)
+        return false;
+    if(_eMode == BINARY)
+        encodeFused<MaskValues, PackedBits>(objRaster, objSink, intRowBegin, intRowEnd);
+    else
+        encodeFused<MaskValues, DecimalText>(objRaster, objSink, intRowBegin, intRowEnd);
+    return true;
+}
+
+void BWIllustrator::writeMask(std::span<const std::uint8_t> arrMask, RowScratch& recScratch, ImageSink& objSink) const
+{
+    if(_eMode == BINARY)
+    {
+        // the packed bits go to vecText's storage: arrMask may be vecBytes itself
+        std::vector<char>& vecPacked = recScratch.vecText;
+        vecPacked.resize((arrMask.size() + 7) / 8);
+        packBits(arrMask, reinterpret_cast<std::uint8_t*>(vecPacked.data()));
+        objSink.write(vecPacked.data(), vecPacked.size());
+    }
+    else
+        writeTextRow(arrMask, recScratch.vecText, objSink);
 }
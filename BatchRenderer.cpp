@@ -0,0 +1,356 @@
+// BatchRenderer.cpp renders many flag jobs in one process.
+// Responsibilities:
+//  - parse a job list (flag, height, width, illustrator, output path, optional "binary" / "aa")
+//  - run the jobs concurrently on a small pool of worker threads
+//  - reuse image buffers: each worker keeps one illustrator per IllustratorType and
+//    resizes it for the next job instead of allocating a new one
+//  - optionally serve jobs from a RenderCache, so repeated jobs are encoded only once; a job
+//    too large for the cache budget is rendered and streamed like an uncached one
+//  - optionally render procedurally (no pixel grid; rows are generated while encoding);
+//    jobs over MAX_GRID_PIXELS always are, and bypass the cache, so poster-sized jobs
+//    stream to disk in fixed memory
+//  - report per-job and total throughput, and with -DUJ_METRICS each job's own stage times
+//
+// Job list format, one job per line (blank lines and lines starting with '#' are skipped):
+//   <FlagType 0..flagCount()-1> <height> <width> <IllustratorType 0..4> <output path> [binary] [aa]
+// "binary" selects P6 / P5 / P4 and "aa" anti-aliased circle edges (--antialias), in either order.
+// QOI and PNG (3, 4) need a height and width of at least 1.
+// e.g.
+//   1 480 640 0 out/japan.ppm
+//   2 1080 1920 2 out/nigeria.pbm binary
+//   0 1080 1920 4 out/austria.png
+//   1 1080 1920 1 out/japan.pgm binary aa
+
+module;
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+export module BatchRenderer;
+
+import LibUtility;
+import FlagLibrary;
+import ImageSink;
+import FlagIllustrator;
+import IllustratorFactory;
+import RenderCache;
+import Metrics;
+
+export struct RenderJob
+{
+    FlagType eFlag;
+    int intHeight;
+    int intWidth;
+    IllustratorType eIllustrator;
+    ExportMode eMode;
+    std::string strOutput;
+    bool blnAntiAlias = false;
+};
+
+export struct JobReport
+{
+    bool blnOk = false;
+    std::size_t intBytes = 0; // encoded bytes written
+    double dblSeconds = 0.0;  // illustrate + export + write
+    RenderStats recStats;     // this job's metrics alone (empty unless METRICS_ENABLED)
+};
+
+export class BatchRenderer
+{
+public:
+    explicit BatchRenderer(int intWorkers);
+
+    // parseJobs: reads the job list format above.
+    // Exits with ERROR_ARGS (naming the line) on the first malformed job.
+    static std::vector<RenderJob> parseJobs(std::istream& isJobs);
+
+    // parseJobLine: one job line (not blank, not a comment) into recJob.
+    // Returns false, with the reason in strError, if the line is malformed.
+    static bool parseJobLine(const std::string& strLine, RenderJob& recJob, std::string& strError);
+
+    // run: renders every job, then prints one line per job (in job order) and the
+    // totals to osReport. Returns the number of jobs that failed.
+    int run(const std::vector<RenderJob>& vecJobs, std::ostream& osReport);
+
+    // setCache: serve jobs through pCache (not owned; nullptr renders every job).
+    void setCache(RenderCache* pCache);
+    // setProcedural: encode jobs with FlagIllustrator::illustrateProcedural (ignored for cached jobs).
+    void setProcedural(bool blnProcedural);
+
+private:
+    // work: worker loop, takes the next unclaimed job index until none are left.
+    static void work(const std::vector<RenderJob>& vecJobs, std::vector<JobReport>& vecReports,
+                     std::atomic<std::size_t>& intNext, RenderCache* pCache, bool blnProcedural);
+    static void renderJob(const RenderJob& recJob, std::unique_ptr<FlagIllustrator>& pIllustrator, bool blnProcedural,
+                          JobReport& recReport);
+    static void cachedJob(const RenderJob& recJob, RenderCache& objCache, JobReport& recReport);
+
+    int _workers;
+    RenderCache* _cache = nullptr;
+    bool _procedural = false;
+};
+
+// ---------- Implementations ----------
+
+using BatchClock = std::chrono::steady_clock;
+
+// formatMagic: the format a job produces, for the report.
+static const char* formatMagic(IllustratorType eType, ExportMode eMode)
+{
+    static const char* arrMagic[2][5] = {{"P3", "P2", "P1", "QOI", "PNG"}, {"P6", "P5", "P4", "QOI", "PNG"}};
+    return arrMagic[eMode == BINARY ? 1 : 0][eType];
+}
+
+static void failJobLine(int intLine, const std::string& strWhy)
+{
+    std::cerr << "ERROR! Batch job line " << intLine << ": " << strWhy << ". Terminating." << std::endl;
+    std::exit(ERROR_ARGS);
+}
+
+BatchRenderer::BatchRenderer(int intWorkers)
+: _workers(intWorkers < 1 ? 1 : intWorkers)
+{}
+
+std::vector<RenderJob> BatchRenderer::parseJobs(std::istream& isJobs)
+{
+    std::vector<RenderJob> vecJobs;
+    std::string strLine;
+    int intLine = 0;
+    while(std::getline(isJobs, strLine))
+    {
+        ++intLine;
+        std::stringstream ssLine{strLine};
+        std::string strFirst;
+        if(!(ssLine >> strFirst) || strFirst[0] == '#')
+            continue; // blank or comment
+
+        RenderJob recJob{};
+        std::string strError;
+        if(!parseJobLine(strLine, recJob, strError))
+            failJobLine(intLine, strError);
+        vecJobs.push_back(recJob);
+    }
+    return vecJobs;
+}
+
+bool BatchRenderer::parseJobLine(const std::string& strLine, RenderJob& recJob, std::string& strError)
+{
+    std::stringstream ssFields{strLine};
+    int intFlag = 0, intHeight = 0, intWidth = 0, intIllustrator = 0;
+    std::string strOutput;
+    if(!(ssFields >> intFlag >> intHeight >> intWidth >> intIllustrator >> strOutput))
+    {
+        strError = "expected <flag> <height> <width> <illustrator> <output> [binary] [aa]";
+        return false;
+    }
+    if(!isValidFlag(intFlag))
+    {
+        strError = "FlagType must be in [0, " + std::to_string(flagCount() - 1) + "]";
+        return false;
+    }
+    if(intHeight < 0 || intHeight > MAX_DIMENSION || intWidth < 0 || intWidth > MAX_DIMENSION)
+    {
+        strError = "height and width must be in [0, " + std::to_string(MAX_DIMENSION) + "]";
+        return false;
+    }
+    if(intIllustrator < 0 || intIllustrator > PNG)
+    {
+        strError = "IllustratorType must be in [0, 4]";
+        return false;
+    }
+    if(isCompressed(static_cast<IllustratorType>(intIllustrator)) && (intHeight == 0 || intWidth == 0))
+    {
+        strError = "QOI and PNG images need a height and width of at least 1";
+        return false;
+    }
+
+    ExportMode eMode = ASCII;
+    bool blnAntiAlias = false;
+    std::string strOption;
+    while(ssFields >> strOption)
+    {
+        if(strOption == "binary" && eMode == ASCII)
+            eMode = BINARY;
+        else if(strOption == "aa" && !blnAntiAlias)
+            blnAntiAlias = true;
+        else
+        {
+            strError = "unexpected '" + strOption + "' (the options are 'binary' and 'aa', once each)";
+            return false;
+        }
+    }
+
+    recJob.eFlag        = static_cast<FlagType>(intFlag);
+    recJob.intHeight    = intHeight;
+    recJob.intWidth     = intWidth;
+    recJob.eIllustrator = static_cast<IllustratorType>(intIllustrator);
+    recJob.eMode        = eMode;
+    recJob.blnAntiAlias = blnAntiAlias;
+    recJob.strOutput    = strOutput;
+    return true;
+}
+
+int BatchRenderer::run(const std::vector<RenderJob>& vecJobs, std::ostream& osReport)
+{
+    std::vector<JobReport> vecReports(vecJobs.size());
+    std::atomic<std::size_t> intNext{0};
+
+    // no point starting more workers than there are jobs
+    std::size_t intWorkers = std::min<std::size_t>(static_cast<std::size_t>(_workers), vecJobs.size());
+    BatchClock::time_point tmStart = BatchClock::now();
+    std::vector<std::thread> vecThreads;
+    for(std::size_t t = 1; t < intWorkers; ++t)
+        vecThreads.emplace_back(&BatchRenderer::work, std::cref(vecJobs), std::ref(vecReports), std::ref(intNext), _cache, _procedural);
+    work(vecJobs, vecReports, intNext, _cache, _procedural); // the calling thread is a worker too
+    for(std::thread& objThread : vecThreads)
+        objThread.join();
+    double dblWall = std::chrono::duration<double>(BatchClock::now() - tmStart).count();
+
+    // ---- report ----
+    int intFailed = 0;
+    std::size_t intTotalBytes = 0;
+    double dblTotalPixels = 0.0;
+    osReport << std::fixed << std::setprecision(3);
+    for(std::size_t i = 0; i < vecJobs.size(); ++i)
+    {
+        const RenderJob& recJob = vecJobs[i];
+        const JobReport& recReport = vecReports[i];
+        double dblPixels = static_cast<double>(recJob.intHeight) * recJob.intWidth;
+        osReport << "job " << i + 1 << ": " << flagTypeName(recJob.eFlag) << ' '
+                 << recJob.intHeight << 'x' << recJob.intWidth << ' '
+                 << illustratorTypeName(recJob.eIllustrator) << ' '
+                 << formatMagic(recJob.eIllustrator, recJob.eMode) << (recJob.blnAntiAlias ? " aa" : "") << " -> " << recJob.strOutput << ": ";
+        if(!recReport.blnOk)
+        {
+            ++intFailed;
+            osReport << "FAILED (could not open or write output)" << '\n';
+            continue;
+        }
+        intTotalBytes  += recReport.intBytes;
+        dblTotalPixels += dblPixels;
+        osReport << recReport.intBytes << " bytes in " << recReport.dblSeconds * 1e3 << " ms ("
+                 << (recReport.dblSeconds > 0 ? dblPixels / recReport.dblSeconds / 1e6 : 0.0) << " Mpx/s)";
+        if constexpr(METRICS_ENABLED)
+        {
+            osReport << " [";
+            for(int s = 0; s < STAGE_COUNT; ++s)
+                osReport << (s == 0 ? "" : ", ") << stageName(static_cast<Stage>(s)) << ' '
+                         << recReport.recStats.seconds(static_cast<Stage>(s)) * 1e3 << " ms";
+            osReport << ']';
+        }
+        osReport << '\n';
+    }
+    osReport << "batch: " << vecJobs.size() << " jobs (" << intFailed << " failed) on "
+             << intWorkers << " workers in " << dblWall * 1e3 << " ms: "
+             << (dblWall > 0 ? vecJobs.size() / dblWall : 0.0) << " jobs/s, "
+             << (dblWall > 0 ? dblTotalPixels / dblWall / 1e6 : 0.0) << " Mpx/s, "
+             << (dblWall > 0 ? intTotalBytes / dblWall / 1e6 : 0.0) << " MB/s" << std::endl;
+    if(_cache != nullptr)
+    {
+        CacheStats recStats = _cache->getStats();
+        osReport << "cache: " << recStats.intHits << " hits, " << recStats.intDiskHits << " disk hits, "
+                 << recStats.intMisses << " misses, " << recStats.intEvictions << " evictions, "
+                 << recStats.intEntries << " entries (" << recStats.intBytes << " bytes)" << std::endl;
+    }
+    return intFailed;
+}
+
+void BatchRenderer::setCache(RenderCache* pCache)
+{
+    _cache = pCache;
+}
+
+void BatchRenderer::setProcedural(bool blnProcedural)
+{
+    _procedural = blnProcedural;
+}
+
+void BatchRenderer::work(const std::vector<RenderJob>& vecJobs, std::vector<JobReport>& vecReports,
+                         std::atomic<std::size_t>& intNext, RenderCache* pCache, bool blnProcedural)
+{
+    // One illustrator per type, kept across jobs so their pixel buffers are reused.
+    std::unique_ptr<FlagIllustrator> arrIllustrators[PNG + 1];
+    for(std::size_t i = intNext++; i < vecJobs.size(); i = intNext++)
+    {
+        const RenderJob& recJob = vecJobs[i];
+        bool blnHuge = static_cast<std::size_t>(recJob.intHeight) * static_cast<std::size_t>(recJob.intWidth) > MAX_GRID_PIXELS;
+        RenderMetrics objMetrics; // the jobs on the other workers record elsewhere
+        {
+            MetricsScope objScope(&objMetrics);
+            if(pCache != nullptr && !blnHuge
+               && pCache->cacheable({recJob.eFlag, recJob.intHeight, recJob.intWidth, recJob.eIllustrator, recJob.eMode, recJob.blnAntiAlias}))
+                cachedJob(recJob, *pCache, vecReports[i]);
+            else
+                renderJob(recJob, arrIllustrators[recJob.eIllustrator], blnProcedural || blnHuge, vecReports[i]);
+        }
+        vecReports[i].recStats = objMetrics.snapshot();
+    }
+}
+
+void BatchRenderer::renderJob(const RenderJob& recJob, std::unique_ptr<FlagIllustrator>& pIllustrator, bool blnProcedural,
+                              JobReport& recReport)
+{
+    BatchClock::time_point tmStart = BatchClock::now();
+    // Opened first, so a job with an unwritable output fails before it renders anything.
+    std::ofstream ofsOut(recJob.strOutput, std::ios::binary | std::ios::trunc);
+    if(!ofsOut)
+        return; // recReport.blnOk stays false
+    if(blnProcedural)
+    {
+        if(pIllustrator == nullptr)
+            pIllustrator = createIllustrator(recJob.eIllustrator, 0, 0); // never drawn into
+        pIllustrator->setAntiAlias(recJob.blnAntiAlias);
+        pIllustrator->illustrateProcedural(recJob.eFlag, recJob.intHeight, recJob.intWidth);
+    }
+    else
+    {
+        if(pIllustrator == nullptr)
+            pIllustrator = createIllustrator(recJob.eIllustrator, recJob.intHeight, recJob.intWidth);
+        else
+            pIllustrator->resize(recJob.intHeight, recJob.intWidth);
+        pIllustrator->setAntiAlias(recJob.blnAntiAlias);
+        pIllustrator->illustrate(recJob.eFlag);
+    }
+    pIllustrator->setExportMode(recJob.eMode);
+
+    {
+        ImageSink objSink(ofsOut);
+        pIllustrator->exportImage(objSink);
+        recReport.intBytes = objSink.bytesWritten();
+    } // sink flushes on destruction
+    ofsOut.close();
+    if(!ofsOut)
+        return;
+
+    recReport.blnOk = true;
+    recReport.dblSeconds = std::chrono::duration<double>(BatchClock::now() - tmStart).count();
+}
+
+// cachedJob: like renderJob, but the encoded image comes from (or goes into) the cache.
+void BatchRenderer::cachedJob(const RenderJob& recJob, RenderCache& objCache, JobReport& recReport)
+{
+    BatchClock::time_point tmStart = BatchClock::now();
+    std::ofstream ofsOut(recJob.strOutput, std::ios::binary | std::ios::trunc);
+    if(!ofsOut)
+        return; // recReport.blnOk stays false
+    std::shared_ptr<const std::string> pImage =
+        objCache.get({recJob.eFlag, recJob.intHeight, recJob.intWidth, recJob.eIllustrator, recJob.eMode, recJob.blnAntiAlias});
+    ofsOut.write(pImage->data(), static_cast<std::streamsize>(pImage->size()));
+    ofsOut.close();
+    if(!ofsOut)
+        return;
+
+    recReport.intBytes = pImage->size();
+    recReport.blnOk = true;
+    recReport.dblSeconds = std::chrono::duration<double>(BatchClock::now() - tmStart).count();
+}
@@ -0,0 +1,255 @@
+// Benchmark.cpp is a separate entry point that times the render and export paths.
+// For every flag x illustrator x export mode x size it measures, separately:
+//  - alloc       : constructing the illustrator (UJImage allocation + white fill)
+//  - illustrate  : illustrate(flag)
+//  - export      : exportImage(ImageSink&) into a sink that only counts bytes
+//  - copy        : deep copy through the copy constructor
+//  - end_to_end  : construct + illustrate + export
+//  - procedural  : construct (no grid) + illustrateProcedural + export; for the PNM formats
+//                  this is the fused pipeline (RenderPipeline), reported as "fused": true
+//  - procedural_unfused : the same with setFusedExport(false), every row generated and
+//                  passed to encodeRow(), so the two gains can be told apart:
+//                  "grid_speedup"  = end_to_end / procedural_unfused (skipping the pixel grid),
+//                  "fused_speedup" = procedural_unfused / procedural (fusion alone) and
+//                  "total_speedup" = end_to_end / procedural (both; all min over min)
+// Each measurement is repeated --reps times; min and median are reported in ms.
+// Results are printed to stdout as one JSON document so runs can be diffed / tracked.
+//
+// Usage:
+//   bench [--reps N] [--sizes HxW,HxW,...] [--pool]
+// --pool allocates every pixel buffer through a PixelPool (instead of the heap) and adds its
+// reuse counters to the output.
+// Sizes default to 2x2 up to 10000x10000 (any size up to MAX_DIMENSION may be given);
+// a single number N means NxN.
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+import LibUtility;
+import FlagLibrary;
+import ImageSink;
+import PixelKernels;
+import PixelPool;
+import FlagIllustrator;
+import ColourIllustrator;
+import GrayscaleIllustrator;
+import BWIllustrator;
+import QOIIllustrator;
+import PNGIllustrator;
+import IllustratorFactory;
+
+using BenchClock = std::chrono::steady_clock;
+
+struct BenchSize
+{
+    int intHeight;
+    int intWidth;
+};
+
+struct Timing
+{
+    double dblMin    = 0.0; // ms
+    double dblMedian = 0.0; // ms
+};
+
+// summarise: min and median of the samples (in ms).
+static Timing summarise(std::vector<double> vecSamples)
+{
+    std::sort(vecSamples.begin(), vecSamples.end());
+    Timing recTiming;
+    recTiming.dblMin    = vecSamples.front();
+    recTiming.dblMedian = vecSamples[vecSamples.size() / 2];
+    return recTiming;
+}
+
+static double elapsedMs(BenchClock::time_point tmStart)
+{
+    return std::chrono::duration<double, std::milli>(BenchClock::now() - tmStart).count();
+}
+
+// copyIllustrator: deep copy through the concrete class's copy constructor.
+static std::unique_ptr<FlagIllustrator> copyIllustrator(IllustratorType eType, const FlagIllustrator& objOriginal)
+{
+    switch(eType)
+    {
+        case COLOUR:    return std::make_unique<ColourIllustrator>(static_cast<const ColourIllustrator&>(objOriginal));
+        case GRAYSCALE: return std::make_unique<GrayscaleIllustrator>(static_cast<const GrayscaleIllustrator&>(objOriginal));
+        case BW:        return std::make_unique<BWIllustrator>(static_cast<const BWIllustrator&>(objOriginal));
+        case QOI:       return std::make_unique<QOIIllustrator>(static_cast<const QOIIllustrator&>(objOriginal));
+        case PNG:       return std::make_unique<PNGIllustrator>(static_cast<const PNGIllustrator&>(objOriginal));
+    }
+    return nullptr;
+}
+
+// exportCounted: runs the streaming export into a sink that discards the bytes.
+static std::size_t exportCounted(const FlagIllustrator& objIllustrator)
+{
+    std::size_t intBytes = 0;
+    ImageSink objSink([&intBytes](const char*, std::size_t intSize) { intBytes += intSize; });
+    objIllustrator.exportImage(objSink);
+    objSink.flush();
+    return intBytes;
+}
+
+static void printTiming(std::ostream& osOut, const char* strName, const Timing& recTiming)
+{
+    osOut << '"' << strName << "\": {\"min\": " << recTiming.dblMin << ", \"median\": " << recTiming.dblMedian << '}';
+}
+
+// speedup: how many times faster recFast is than recSlow (min over min; 0 if not measurable).
+static double speedup(const Timing& recSlow, const Timing& recFast)
+{
+    return recFast.dblMin > 0 ? recSlow.dblMin / recFast.dblMin : 0.0;
+}
+
+static std::vector<BenchSize> parseSizes(const std::string& strList)
+{
+    std::vector<BenchSize> vecSizes;
+    std::stringstream ssList{strList};
+    std::string strItem;
+    while(std::getline(ssList, strItem, ','))
+    {
+        std::size_t intX = strItem.find('x');
+        int intHeight = 0;
+        int intWidth  = 0;
+        try
+        {
+            intHeight = std::stoi(strItem.substr(0, intX));
+            intWidth  = intX == std::string::npos ? intHeight : std::stoi(strItem.substr(intX + 1));
+        }
+        catch(...)
+        {
+            intHeight = -1;
+        }
+        if(intHeight < 1 || intHeight > MAX_DIMENSION || intWidth < 1 || intWidth > MAX_DIMENSION)
+        {
+            std::cerr << "ERROR! Bad size '" << strItem << "' (expected HxW or N, 1.." << MAX_DIMENSION << "). Terminating." << std::endl;
+            std::exit(ERROR_ARGS);
+        }
+        vecSizes.push_back({intHeight, intWidth});
+    }
+    return vecSizes;
+}
+
+int main(int argc, char** argv)
+{
+    int intReps = 3;
+    bool blnPool = false;
+    std::vector<BenchSize> vecSizes = {{2, 2}, {64, 64}, {480, 640}, {1080, 1920}, {4000, 4000}, {10000, 10000}};
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string arg(argv[i]);
+        if(arg == "--reps" && i + 1 < argc)
+            intReps = std::max(1, std::atoi(argv[++i]));
+        else if(arg == "--sizes" && i + 1 < argc)
+            vecSizes = parseSizes(argv[++i]);
+        else if(arg == "--pool")
+            blnPool = true;
+        else
+        {
+            std::cerr << "ERROR! Usage: " << argv[0] << " [--reps N] [--sizes HxW,HxW,...] [--pool]. Terminating." << std::endl;
+            std::exit(ERROR_ARGS);
+        }
+    }
+
+    PixelPool objPool; // outlives every illustrator below
+    if(blnPool)
+        setDefaultPixelAllocator(&objPool);
+
+    std::cout << std::fixed << std::setprecision(4);
+    std::cout << "{\n  \"kernel\": \"" << kernelLevelName(getKernelLevel()) << "\",\n"
+              << "  \"reps\": " << intReps << ",\n  \"allocator\": \"" << (blnPool ? "pool" : "heap")
+              << "\",\n  \"results\": [";
+
+    bool blnFirst = true;
+    for(const BenchSize& recSize : vecSizes)
+    for(FlagType eFlag : {AUSTRIA, JAPAN, NIGERIA})
+    for(IllustratorType eType : {COLOUR, GRAYSCALE, BW, QOI, PNG})
+    for(ExportMode eMode : {ASCII, BINARY})
+    {
+        if(isCompressed(eType) && eMode == ASCII)
+            continue; // always binary
+        std::vector<double> vecAlloc, vecDraw, vecExport, vecCopy, vecTotal, vecProcedural, vecUnfused;
+        std::size_t intBytes = 0;
+        for(int r = 0; r < intReps; ++r)
+        {
+            BenchClock::time_point tmStart = BenchClock::now();
+            std::unique_ptr<FlagIllustrator> pIllustrator = createIllustrator(eType, recSize.intHeight, recSize.intWidth);
+            pIllustrator->setExportMode(eMode);
+            vecAlloc.push_back(elapsedMs(tmStart));
+
+            BenchClock::time_point tmDraw = BenchClock::now();
+            pIllustrator->illustrate(eFlag);
+            vecDraw.push_back(elapsedMs(tmDraw));
+
+            BenchClock::time_point tmExport = BenchClock::now();
+            intBytes = exportCounted(*pIllustrator);
+            vecExport.push_back(elapsedMs(tmExport));
+            vecTotal.push_back(elapsedMs(tmStart));
+
+            BenchClock::time_point tmCopy = BenchClock::now();
+            std::unique_ptr<FlagIllustrator> pCopy = copyIllustrator(eType, *pIllustrator);
+            vecCopy.push_back(elapsedMs(tmCopy));
+
+            BenchClock::time_point tmProcedural = BenchClock::now();
+            std::unique_ptr<FlagIllustrator> pProcedural = createIllustrator(eType, 0, 0);
+            pProcedural->setExportMode(eMode);
+            pProcedural->illustrateProcedural(eFlag, recSize.intHeight, recSize.intWidth);
+            exportCounted(*pProcedural);
+            vecProcedural.push_back(elapsedMs(tmProcedural));
+
+            BenchClock::time_point tmUnfused = BenchClock::now();
+            std::unique_ptr<FlagIllustrator> pUnfused = createIllustrator(eType, 0, 0);
+            pUnfused->setExportMode(eMode);
+            pUnfused->setFusedExport(false);
+            pUnfused->illustrateProcedural(eFlag, recSize.intHeight, recSize.intWidth);
+            exportCounted(*pUnfused);
+            vecUnfused.push_back(elapsedMs(tmUnfused));
+        }
+
+        Timing recExport = summarise(vecExport);
+        Timing recTotal = summarise(vecTotal);
+        Timing recProcedural = summarise(vecProcedural);
+        Timing recUnfused = summarise(vecUnfused);
+        double dblPixels = static_cast<double>(recSize.intHeight) * recSize.intWidth;
+        std::cout << (blnFirst ? "\n" : ",\n") << "    {\"flag\": \"" << flagTypeName(eFlag)
+                  << "\", \"illustrator\": \"" << illustratorTypeName(eType)
+                  << "\", \"mode\": \"" << (eMode == BINARY ? "binary" : "ascii")
+                  << "\", \"height\": " << recSize.intHeight << ", \"width\": " << recSize.intWidth
+                  << ", \"bytes\": " << intBytes << ", ";
+        printTiming(std::cout, "alloc_ms", summarise(vecAlloc));      std::cout << ", ";
+        printTiming(std::cout, "illustrate_ms", summarise(vecDraw));  std::cout << ", ";
+        printTiming(std::cout, "export_ms", recExport);               std::cout << ", ";
+        printTiming(std::cout, "copy_ms", summarise(vecCopy));        std::cout << ", ";
+        printTiming(std::cout, "end_to_end_ms", recTotal);            std::cout << ", ";
+        printTiming(std::cout, "procedural_ms", recProcedural);       std::cout << ", ";
+        printTiming(std::cout, "procedural_unfused_ms", recUnfused);
+        std::cout << ", \"fused\": " << (isCompressed(eType) ? "false" : "true")
+                  << ", \"grid_speedup\": " << speedup(recTotal, recUnfused)
+                  << ", \"fused_speedup\": " << speedup(recUnfused, recProcedural)
+                  << ", \"total_speedup\": " << speedup(recTotal, recProcedural);
+        double dblExportSec = recExport.dblMin / 1e3;
+        std::cout << ", \"export_mb_per_s\": " << (dblExportSec > 0 ? intBytes / dblExportSec / 1e6 : 0.0)
+                  << ", \"export_mpx_per_s\": " << (dblExportSec > 0 ? dblPixels / dblExportSec / 1e6 : 0.0) << '}';
+        blnFirst = false;
+    }
+    std::cout << "\n  ]";
+    if(blnPool)
+    {
+        PoolStats recStats = objPool.getStats();
+        std::cout << ",\n  \"pool\": {\"allocations\": " << recStats.intAllocations << ", \"reuses\": " << recStats.intReuses
+                  << ", \"reuse_rate\": " << recStats.reuseRate() << ", \"resident_bytes\": " << recStats.residentBytes()
+                  << ", \"peak_bytes\": " << recStats.intPeakBytes << '}';
+    }
+    std::cout << "\n}" << std::endl;
+    return SUCCESS;
+}
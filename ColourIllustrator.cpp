@@ -1,24 +1,47 @@
 // ColourIllustrator.cpp is a concrete derived class that outputs the full-colour P3 PPM.
-// Purpose: demonstrate polymorphism — exportImage() returns a P3 string
+// Purpose: demonstrate polymorphism — exportImage() streams a P3 (or binary P6) image
 // that is different from Grayscale and BW derived classes.
+// A procedural flag is encoded by the fused pipeline RGBValues + RawBytes / DecimalText (RenderPipeline).
 
 module;
-#include <sstream>
+#include <cstddef>
+#include <cstdint>
+#include <span>
 #include <string>
+#include <utility>
+#include <vector>
 
 export module ColourIllustrator;
 
 import LibUtility;
 import FlagIllustrator;
+import UJImage;
+import ImageSink;
+import TextEncoder;
+import FlagRasterizer;
+import RenderPipeline;
+import Metrics;
 
 export class ColourIllustrator : public FlagIllustrator
 {
 public:
     ColourIllustrator();
     ColourIllustrator(int intHeight, int intWidth);
+    explicit ColourIllustrator(UJImage objImage); // adopts objImage (see FlagIllustrator)
 
     // Polymorphic override of the pure virtual exportImage in FlagIllustrator.
-    std::string exportImage() const override;
+    using FlagIllustrator::exportImage;
+    void exportImage(ImageSink& objSink) const override;
+    std::size_t exportSize() const override;
+    // exportReserve: P3 as at most "255 " per value plus the newlines, without the exact pass.
+    std::size_t exportReserve() const override;
+    std::string formatHeader(int intHeight, int intWidth) const override;
+    void encodeRow(std::span<const UJPixel> arrRow, RowScratch& recScratch, ImageSink& objSink) const override;
+    // Adds a bulk P6 path for drawn RGB888 images.
+    void exportRows(ImageSink& objSink, int intRowBegin, int intRowEnd) const override;
+
+protected:
+    bool exportRuns(const FlagRasterizer& objRaster, ImageSink& objSink, int intRowBegin, int intRowEnd) const override;
 };
 
 // Default ctor: uses base default size via FlagIllustrator()
@@ -29,10 +52,81 @@ ColourIllustrator::ColourIllustrator(int intHeight, int intWidth)
 : FlagIllustrator(intHeight, intWidth)
 {}
 
-// exportImage: delegates to UJImage::toPPM() which produces a P3 colour image.
+// Adopting ctor: takes over an existing image without copying its pixels
+ColourIllustrator::ColourIllustrator(UJImage objImage)
+: FlagIllustrator(std::move(objImage))
+{}
+
+// exportImage: a P3 / P6 colour image, the same bytes as UJImage::writePPM() / writeRawPPM().
 // Because derived classes override exportImage, main can call it polymorphically.
-std::string ColourIllustrator::exportImage() const
+void ColourIllustrator::exportImage(ImageSink& objSink) const
+{
+    objSink.write(exportHeader());
+    exportRows(objSink, 0, getHeight());
+}
+
+std::size_t ColourIllustrator::exportSize() const
+{
+    if(!isProcedural())
+        return _eMode == BINARY ? _image.rawPPMSize() : _image.ppmSize();
+
+    std::size_t intPixels = static_cast<std::size_t>(getHeight()) * static_cast<std::size_t>(getWidth());
+    if(_eMode == BINARY)
+        return pnmHeader("P6", getWidth(), getHeight(), 255).size() + intPixels * 3;
+    std::size_t intSize = pnmHeader("P3", getWidth(), getHeight(), 255).size() + static_cast<std::size_t>(getHeight());
+    std::vector<UJPixel> vecRow;
+    std::vector<std::uint8_t> vecChannels;
+    for(int r = 0; r < getHeight(); ++r)
+        intSize += textSize(UJImage::pixelChannels(pixelRow(r, vecRow), vecChannels));
+    return intSize;
+}
+
+std::size_t ColourIllustrator::exportReserve() const
+{
+    if(_eMode == BINARY)
+        return exportSize(); // closed form
+    std::size_t intRowBytes = static_cast<std::size_t>(getWidth()) * 3 * TEXT_BYTES_PER_VALUE + 1;
+    return pnmHeader("P3", getWidth(), getHeight(), 255).size() + static_cast<std::size_t>(getHeight()) * intRowBytes;
+}
+
+std::string ColourIllustrator::formatHeader(int intHeight, int intWidth) const
+{
+    return pnmHeader(_eMode == BINARY ? "P6" : "P3", intWidth, intHeight, 255);
+}
+
+// encodeRow: no transformations needed — just encode the pixels as PPM.
+void ColourIllustrator::encodeRow(std::span<const UJPixel> arrRow, RowScratch& recScratch, ImageSink& objSink) const
+{
+    std::span<const std::uint8_t> arrChannels = UJImage::pixelChannels(arrRow, recScratch.vecBytes); // copies RGBA only
+    if(_eMode == BINARY)
+        objSink.write(reinterpret_cast<const char*>(arrChannels.data()), arrChannels.size());
+    else
+        writeTextRow(arrChannels, recScratch.vecText, objSink);
+}
+
+void ColourIllustrator::exportRows(ImageSink& objSink, int intRowBegin, int intRowEnd) const
+{
+    if(_eMode == BINARY && !isProcedural() && sizeof(UJPixel) == 3)
+    {
+        // Drawn RGB888 rows are back to back and already the P6 payload: hand them over as-is.
+        StageTimer objTimer(STAGE_ENCODE);
+        _image.checkRect(intRowBegin, 0, intRowEnd - intRowBegin, getWidth()); // the subspan below is unchecked
+        std::size_t intWidth = static_cast<std::size_t>(getWidth());
+        std::span<const UJPixel> arrRows = _image.pixels().subspan(static_cast<std::size_t>(intRowBegin) * intWidth,
+                                                                   static_cast<std::size_t>(intRowEnd - intRowBegin) * intWidth);
+        objSink.write(reinterpret_cast<const char*>(arrRows.data()), arrRows.size() * 3);
+        countPixels(arrRows.size());
+        countBytes(arrRows.size() * 3);
+        return;
+    }
+    FlagIllustrator::exportRows(objSink, intRowBegin, intRowEnd);
+}
+
+bool ColourIllustrator::exportRuns(const FlagRasterizer& objRaster, ImageSink& objSink, int intRowBegin, int intRowEnd) const
 {
-    // No transformations needed — just convert internal image to PPM string.
-    return _image->toPPM();
-}
\ No newline at end of file
+    if(_eMode == BINARY)
+        encodeFused<RGBValues, RawBytes>(objRaster, objSink, intRowBegin, intRowEnd);
+    else
+        encodeFused<RGBValues, DecimalText>(objRaster, objSink, intRowBegin, intRowEnd);
+    return true;
+}
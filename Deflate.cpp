@@ -0,0 +1,508 @@
+// Deflate.cpp is a small self-contained zlib / deflate (RFC 1950 / 1951) encoder for the PNG output.
+// Responsibilities:
+//  - compress a segment of bytes into deflate blocks that end on a byte boundary, so segments
+//    compressed independently (on different threads) can simply be concatenated
+//  - the pieces around them: zlib header, closing block, Adler-32 (and combining the Adler-32
+//    of consecutive segments) and the CRC-32 PNG puts on every chunk
+//
+// Compression: greedy LZ77 over a 32 KB window with 3-byte hash chains, then one dynamic
+// Huffman block per MAX_BLOCK_TOKENS tokens. Flag images are long constant runs, which the
+// PNG filters turn into long runs of zero bytes, so before the hash chains every position first
+// tries a match at distance 1: a run costs one 258-byte compare per 258 bytes, and with dynamic
+// codes a couple of bits. The window never reaches back into an earlier segment.
+
+module;
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <utility>
+#include <vector>
+
+export module Deflate;
+
+// ZLIB_HEADER: deflate, 32 KB window, "fastest" level hint, no dictionary.
+export constexpr std::array<std::uint8_t, 2> ZLIB_HEADER{0x78, 0x01};
+// DEFLATE_END: an empty final block (fixed codes, just the end-of-block code).
+export constexpr std::array<std::uint8_t, 2> DEFLATE_END{0x03, 0x00};
+
+// deflateSegment: arrData as non-final deflate blocks appended to vecOut, ending with an empty
+// stored block (a "sync flush"), so the next segment starts on a byte boundary.
+export void deflateSegment(std::span<const std::uint8_t> arrData, std::vector<std::uint8_t>& vecOut);
+
+// Adler-32 (zlib's checksum of the uncompressed data), continued from intAdler (1 to start).
+export std::uint32_t adler32(std::span<const std::uint8_t> arrData, std::uint32_t intAdler = 1);
+// adler32Combine: the Adler-32 of A followed by B from adler32(A), adler32(B) and B's length.
+export std::uint32_t adler32Combine(std::uint32_t intAdlerA, std::uint32_t intAdlerB, std::size_t intLengthB);
+// CRC-32 (ISO-HDLC, as used by PNG chunks), continued from intCrc (0 to start).
+export std::uint32_t crc32(std::span<const std::uint8_t> arrData, std::uint32_t intCrc = 0);
+
+// ---------- Implementations ----------
+
+static constexpr int WINDOW_SIZE      = 32768;
+static constexpr int HASH_BITS        = 15;
+static constexpr int MIN_MATCH        = 3;
+static constexpr int MAX_MATCH        = 258;
+static constexpr int MAX_CHAIN        = 16;     // candidates tried per position
+static constexpr int MAX_INSERT       = 16;     // longer matches do not hash the positions inside
+static constexpr std::size_t MAX_BLOCK_TOKENS = 1 << 15;
+static constexpr int LITLEN_CODES     = 286;
+static constexpr int DIST_CODES       = 30;
+static constexpr int CODELEN_CODES    = 19;
+static constexpr std::uint32_t ADLER_MOD = 65521;
+
+// Base values and extra bits of the length codes 257..285 and the distance codes 0..29.
+static constexpr std::array<int, 29> LENGTH_BASE{3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                                 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static constexpr std::array<int, 29> LENGTH_EXTRA{0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                                  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static constexpr std::array<int, 30> DIST_BASE{1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+                                               513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static constexpr std::array<int, 30> DIST_EXTRA{0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7,
+                                                8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+// Order in which the code length code lengths are stored.
+static constexpr std::array<int, CODELEN_CODES> CODELEN_ORDER{16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+// SymbolTables: the length code (0..28) of every match length and the distance code of every
+// distance, the latter as in zlib: distances up to 256 directly, larger ones by (d - 1) >> 7.
+struct SymbolTables
+{
+    std::array<std::uint8_t, MAX_MATCH + 1> arrLengthCode;
+    std::array<std::uint8_t, 512> arrDistCode;
+};
+
+// makeSymbolTables: a TU-local function rather than a constructor, because the (module-linkage)
+// struct may not reference the static constants above.
+static constexpr SymbolTables makeSymbolTables()
+{
+    SymbolTables recTables{};
+    for(int c = 0; c < 29; ++c)
+        for(int l = LENGTH_BASE[c]; l < LENGTH_BASE[c] + (1 << LENGTH_EXTRA[c]) && l <= MAX_MATCH; ++l)
+            recTables.arrLengthCode[l] = static_cast<std::uint8_t>(c);
+    recTables.arrLengthCode[MAX_MATCH] = 28; // 258 has its own code (227 + 31 would be 258 too)
+    for(int c = 0; c < DIST_CODES; ++c)
+        for(int d = DIST_BASE[c]; d < DIST_BASE[c] + (1 << DIST_EXTRA[c]); ++d)
+        {
+            if(d <= 256)
+                recTables.arrDistCode[d - 1] = static_cast<std::uint8_t>(c);
+            else
+                recTables.arrDistCode[256 + ((d - 1) >> 7)] = static_cast<std::uint8_t>(c);
+        }
+    return recTables;
+}
+static constexpr SymbolTables SYMBOLS = makeSymbolTables();
+
+static int distCode(int intDist)
+{
+    return intDist <= 256 ? SYMBOLS.arrDistCode[intDist - 1] : SYMBOLS.arrDistCode[256 + ((intDist - 1) >> 7)];
+}
+
+// BitWriter: deflate's LSB-first bit stream.
+class BitWriter
+{
+public:
+    explicit BitWriter(std::vector<std::uint8_t>& vecOut) : _out(vecOut) {}
+
+    void put(std::uint32_t intBits, int intCount)
+    {
+        _bits |= static_cast<std::uint64_t>(intBits) << _count;
+        _count += intCount;
+        while(_count >= 8)
+        {
+            _out.push_back(static_cast<std::uint8_t>(_bits));
+            _bits >>= 8;
+            _count -= 8;
+        }
+    }
+
+    // align: pad with 0 bits to the next byte boundary.
+    void align()
+    {
+        if(_count > 0)
+            put(0, 8 - _count);
+    }
+
+private:
+    std::vector<std::uint8_t>& _out;
+    std::uint64_t _bits = 0;
+    int _count = 0;
+};
+
+// HuffmanCode: code lengths and the matching canonical codes, bit-reversed for the LSB-first stream.
+struct HuffmanCode
+{
+    std::vector<std::uint8_t> vecLengths;
+    std::vector<std::uint16_t> vecCodes;
+};
+
+// huffmanLengths: optimal code lengths for the frequencies, limited to intMaxBits by halving the
+// frequencies until the tree is shallow enough. At least two symbols get a code, so every code
+// is complete (a lone symbol would make an incomplete code, which decoders may reject).
+static std::vector<std::uint8_t> huffmanLengths(std::vector<std::uint32_t> vecFreq, int intMaxBits)
+{
+    std::size_t intSymbols = vecFreq.size();
+    for(std::size_t s = 0; s < intSymbols; ++s)
+    {
+        if(std::count_if(vecFreq.begin(), vecFreq.end(), [](std::uint32_t intFreq) { return intFreq != 0; }) >= 2)
+            break;
+        if(vecFreq[s] == 0)
+            vecFreq[s] = 1;
+    }
+
+    std::vector<std::uint8_t> vecLengths(intSymbols, 0);
+    for(;;)
+    {
+        // Leaves sorted by frequency; the inner nodes are created in increasing order of weight,
+        // so the two lightest nodes are always at the front of one of the two lists.
+        std::vector<std::pair<std::uint32_t, int>> vecLeaves;
+        for(std::size_t s = 0; s < intSymbols; ++s)
+            if(vecFreq[s] != 0)
+                vecLeaves.push_back({vecFreq[s], static_cast<int>(s)});
+        std::sort(vecLeaves.begin(), vecLeaves.end());
+        int intLeaves = static_cast<int>(vecLeaves.size());
+        int intNodes  = 2 * intLeaves - 1;
+        std::vector<std::uint64_t> vecWeight(static_cast<std::size_t>(intNodes));
+        std::vector<int> vecParent(static_cast<std::size_t>(intNodes), -1);
+        for(int i = 0; i < intLeaves; ++i)
+            vecWeight[i] = vecLeaves[i].first;
+        int intLeaf = 0, intInner = intLeaves;
+        for(int intNext = intLeaves; intNext < intNodes; ++intNext)
+        {
+            int arrPick[2];
+            for(int& intPick : arrPick)
+            {
+                if(intLeaf < intLeaves && (intInner >= intNext || vecWeight[intLeaf] <= vecWeight[intInner]))
+                    intPick = intLeaf++;
+                else
+                    intPick = intInner++;
+            }
+            vecWeight[intNext] = vecWeight[arrPick[0]] + vecWeight[arrPick[1]];
+            vecParent[arrPick[0]] = vecParent[arrPick[1]] = intNext;
+        }
+
+        // depths from the root down (a parent always has a higher index than its children)
+        std::vector<int> vecDepth(static_cast<std::size_t>(intNodes), 0);
+        int intDeepest = 0;
+        for(int i = intNodes - 2; i >= 0; --i)
+        {
+            vecDepth[i] = vecDepth[vecParent[i]] + 1;
+            intDeepest = std::max(intDeepest, vecDepth[i]);
+        }
+        if(intDeepest <= intMaxBits)
+        {
+            for(int i = 0; i < intLeaves; ++i)
+                vecLengths[vecLeaves[i].second] = static_cast<std::uint8_t>(vecDepth[i]);
+            return vecLengths;
+        }
+        for(std::uint32_t& intFreq : vecFreq)
+            if(intFreq != 0)
+                intFreq = (intFreq + 1) / 2;
+    }
+}
+
+// huffmanCode: canonical codes for the lengths (RFC 1951 3.2.2).
+static HuffmanCode huffmanCode(std::vector<std::uint8_t> vecLengths)
+{
+    HuffmanCode recCode;
+    std::array<int, 16> arrCount{};
+    for(std::uint8_t intLength : vecLengths)
+        ++arrCount[intLength];
+    arrCount[0] = 0;
+    std::array<int, 16> arrNext{};
+    for(int b = 1, intCode = 0; b < 16; ++b)
+    {
+        intCode = (intCode + arrCount[b - 1]) << 1;
+        arrNext[b] = intCode;
+    }
+    recCode.vecCodes.assign(vecLengths.size(), 0);
+    for(std::size_t s = 0; s < vecLengths.size(); ++s)
+    {
+        int intLength = vecLengths[s];
+        if(intLength == 0)
+            continue;
+        std::uint32_t intReversed = 0;
+        for(int b = 0, intCode = arrNext[intLength]++; b < intLength; ++b)
+            intReversed |= ((intCode >> b) & 1u) << (intLength - 1 - b);
+        recCode.vecCodes[s] = static_cast<std::uint16_t>(intReversed);
+    }
+    recCode.vecLengths = std::move(vecLengths);
+    return recCode;
+}
+
+// Token: a literal byte (intDist == 0) or a match of intValue bytes intDist back.
+struct Token
+{
+    std::uint16_t intValue;
+    std::uint16_t intDist;
+};
+
+// writeBlock: one non-final block with dynamic codes for vecTokens.
+static void writeBlock(const std::vector<Token>& vecTokens, BitWriter& objBits)
+{
+    std::vector<std::uint32_t> vecLitFreq(LITLEN_CODES, 0), vecDistFreq(DIST_CODES, 0);
+    for(const Token& recToken : vecTokens)
+    {
+        if(recToken.intDist == 0)
+            ++vecLitFreq[recToken.intValue];
+        else
+        {
+            ++vecLitFreq[257 + SYMBOLS.arrLengthCode[recToken.intValue]];
+            ++vecDistFreq[distCode(recToken.intDist)];
+        }
+    }
+    vecLitFreq[256] = 1; // end of block
+    HuffmanCode recLit  = huffmanCode(huffmanLengths(vecLitFreq, 15));
+    HuffmanCode recDist = huffmanCode(huffmanLengths(vecDistFreq, 15));
+
+    int intLitCount = LITLEN_CODES;
+    while(intLitCount > 257 && recLit.vecLengths[intLitCount - 1] == 0)
+        --intLitCount;
+    int intDistCount = DIST_CODES;
+    while(intDistCount > 1 && recDist.vecLengths[intDistCount - 1] == 0)
+        --intDistCount;
+
+    // The two length lists as one sequence, run-length coded with the code length alphabet:
+    // 16 = repeat the previous length 3..6 times, 17 / 18 = 3..10 / 11..138 zeros.
+    std::vector<std::uint8_t> vecAll(recLit.vecLengths.begin(), recLit.vecLengths.begin() + intLitCount);
+    vecAll.insert(vecAll.end(), recDist.vecLengths.begin(), recDist.vecLengths.begin() + intDistCount);
+    std::vector<std::pair<std::uint8_t, std::uint8_t>> vecRle; // symbol, extra bits value
+    for(std::size_t i = 0; i < vecAll.size();)
+    {
+        std::size_t intRun = 1;
+        while(i + intRun < vecAll.size() && vecAll[i + intRun] == vecAll[i])
+            ++intRun;
+        if(vecAll[i] == 0 && intRun >= 3)
+        {
+            std::size_t intTake = std::min<std::size_t>(intRun, 138);
+            if(intTake >= 11)
+                vecRle.push_back({18, static_cast<std::uint8_t>(intTake - 11)});
+            else
+                vecRle.push_back({17, static_cast<std::uint8_t>(intTake - 3)});
+            i += intTake;
+        }
+        else if(vecAll[i] != 0 && intRun >= 4)
+        {
+            std::size_t intTake = std::min<std::size_t>(intRun - 1, 6);
+            vecRle.push_back({vecAll[i], 0});
+            vecRle.push_back({16, static_cast<std::uint8_t>(intTake - 3)});
+            i += intTake + 1;
+        }
+        else
+        {
+            vecRle.push_back({vecAll[i], 0});
+            ++i;
+        }
+    }
+    std::vector<std::uint32_t> vecLenFreq(CODELEN_CODES, 0);
+    for(const std::pair<std::uint8_t, std::uint8_t>& recSymbol : vecRle)
+        ++vecLenFreq[recSymbol.first];
+    HuffmanCode recLen = huffmanCode(huffmanLengths(vecLenFreq, 7));
+    int intLenCount = CODELEN_CODES;
+    while(intLenCount > 4 && recLen.vecLengths[CODELEN_ORDER[intLenCount - 1]] == 0)
+        --intLenCount;
+
+    objBits.put(0, 1); // not the final block
+    objBits.put(2, 2); // dynamic Huffman codes
+    objBits.put(static_cast<std::uint32_t>(intLitCount - 257), 5);
+    objBits.put(static_cast<std::uint32_t>(intDistCount - 1), 5);
+    objBits.put(static_cast<std::uint32_t>(intLenCount - 4), 4);
+    for(int i = 0; i < intLenCount; ++i)
+        objBits.put(recLen.vecLengths[CODELEN_ORDER[i]], 3);
+    for(const std::pair<std::uint8_t, std::uint8_t>& recSymbol : vecRle)
+    {
+        objBits.put(recLen.vecCodes[recSymbol.first], recLen.vecLengths[recSymbol.first]);
+        if(recSymbol.first == 16)
+            objBits.put(recSymbol.second, 2);
+        else if(recSymbol.first == 17)
+            objBits.put(recSymbol.second, 3);
+        else if(recSymbol.first == 18)
+            objBits.put(recSymbol.second, 7);
+    }
+
+    for(const Token& recToken : vecTokens)
+    {
+        if(recToken.intDist == 0)
+        {
+            objBits.put(recLit.vecCodes[recToken.intValue], recLit.vecLengths[recToken.intValue]);
+            continue;
+        }
+        int intLengthCode = SYMBOLS.arrLengthCode[recToken.intValue];
+        objBits.put(recLit.vecCodes[257 + intLengthCode], recLit.vecLengths[257 + intLengthCode]);
+        objBits.put(static_cast<std::uint32_t>(recToken.intValue - LENGTH_BASE[intLengthCode]), LENGTH_EXTRA[intLengthCode]);
+        int intDistCode = distCode(recToken.intDist);
+        objBits.put(recDist.vecCodes[intDistCode], recDist.vecLengths[intDistCode]);
+        objBits.put(static_cast<std::uint32_t>(recToken.intDist - DIST_BASE[intDistCode]), DIST_EXTRA[intDistCode]);
+    }
+    objBits.put(recLit.vecCodes[256], recLit.vecLengths[256]);
+}
+
+// matchLength: how many bytes (up to intMax) from pA on equal those from pB, 8 at a time.
+static int matchLength(const std::uint8_t* pA, const std::uint8_t* pB, int intMax)
+{
+    int intLength = 0;
+    if constexpr(std::endian::native == std::endian::little)
+    {
+        for(; intLength + 8 <= intMax; intLength += 8)
+        {
+            std::uint64_t intA, intB;
+            std::memcpy(&intA, pA + intLength, 8);
+            std::memcpy(&intB, pB + intLength, 8);
+            if(intA != intB)
+                return intLength + std::countr_zero(intA ^ intB) / 8;
+        }
+    }
+    while(intLength < intMax && pA[intLength] == pB[intLength])
+        ++intLength;
+    return intLength;
+}
+
+static std::uint32_t hash3(const std::uint8_t* pData)
+{
+    std::uint32_t intKey = static_cast<std::uint32_t>(pData[0]) | static_cast<std::uint32_t>(pData[1]) << 8
+                         | static_cast<std::uint32_t>(pData[2]) << 16;
+    return (intKey * 2654435761u) >> (32 - HASH_BITS);
+}
+
+void deflateSegment(std::span<const std::uint8_t> arrData, std::vector<std::uint8_t>& vecOut)
+{
+    const std::uint8_t* pData = arrData.data();
+    int intSize = static_cast<int>(arrData.size());
+    std::vector<int> vecHead(std::size_t{1} << HASH_BITS, -1);
+    std::vector<int> vecPrev(WINDOW_SIZE, -1);
+    auto fnInsert = [&](int intPos)
+    {
+        if(intPos + MIN_MATCH > intSize)
+            return;
+        std::uint32_t intHash = hash3(pData + intPos);
+        vecPrev[intPos & (WINDOW_SIZE - 1)] = vecHead[intHash];
+        vecHead[intHash] = intPos;
+    };
+
+    BitWriter objBits(vecOut);
+    std::vector<Token> vecTokens;
+    vecTokens.reserve(MAX_BLOCK_TOKENS);
+    for(int i = 0; i < intSize;)
+    {
+        int intMax = std::min(MAX_MATCH, intSize - i);
+        int intBest = 0, intBestDist = 0;
+        if(intMax >= MIN_MATCH)
+        {
+            // run fast path: a repeat of the previous byte
+            if(i > 0 && pData[i] == pData[i - 1])
+            {
+                intBest = matchLength(pData + i, pData + i - 1, intMax);
+                intBestDist = 1;
+            }
+            if(intBest < intMax)
+            {
+                int intCandidate = vecHead[hash3(pData + i)];
+                for(int c = 0; c < MAX_CHAIN && intCandidate >= 0 && i - intCandidate <= WINDOW_SIZE; ++c)
+                {
+                    if(pData[intCandidate + intBest] == pData[i + intBest])
+                    {
+                        int intLength = matchLength(pData + i, pData + intCandidate, intMax);
+                        if(intLength > intBest)
+                        {
+                            intBest = intLength;
+                            intBestDist = i - intCandidate;
+                            if(intBest == intMax)
+                                break;
+                        }
+                    }
+                    int intOlder = vecPrev[intCandidate & (WINDOW_SIZE - 1)];
+                    if(intOlder >= intCandidate)
+                        break; // the slot was reused by a newer position
+                    intCandidate = intOlder;
+                }
+            }
+        }
+
+        if(intBest >= MIN_MATCH)
+        {
+            vecTokens.push_back({static_cast<std::uint16_t>(intBest), static_cast<std::uint16_t>(intBestDist)});
+            int intInsertEnd = intBest <= MAX_INSERT ? i + intBest : i + 1;
+            for(int p = i; p < intInsertEnd; ++p)
+                fnInsert(p);
+            i += intBest;
+        }
+        else
+        {
+            vecTokens.push_back({pData[i], 0});
+            fnInsert(i);
+            ++i;
+        }
+        if(vecTokens.size() == MAX_BLOCK_TOKENS)
+        {
+            writeBlock(vecTokens, objBits);
+            vecTokens.clear();
+        }
+    }
+    if(!vecTokens.empty())
+        writeBlock(vecTokens, objBits);
+
+    // sync flush: an empty stored block, which pads to a byte boundary
+    objBits.put(0, 3);
+    objBits.align();
+    for(std::uint8_t intByte : {0x00, 0x00, 0xFF, 0xFF})
+        vecOut.push_back(intByte);
+}
+
+// adler32: the sums are reduced every 5552 bytes, the most that cannot overflow 32 bits.
+std::uint32_t adler32(std::span<const std::uint8_t> arrData, std::uint32_t intAdler)
+{
+    std::uint32_t intA = intAdler & 0xFFFF;
+    std::uint32_t intB = intAdler >> 16;
+    std::size_t intSize = arrData.size();
+    for(std::size_t intStart = 0; intStart < intSize; intStart += 5552)
+    {
+        std::size_t intEnd = std::min(intSize, intStart + 5552);
+        for(std::size_t i = intStart; i < intEnd; ++i)
+        {
+            intA += arrData[i];
+            intB += intA;
+        }
+        intA %= ADLER_MOD;
+        intB %= ADLER_MOD;
+    }
+    return intB << 16 | intA;
+}
+
+// adler32Combine: A's sums continue over B's bytes: a = aA + aB - 1, b = bA + bB + len * (aA - 1).
+std::uint32_t adler32Combine(std::uint32_t intAdlerA, std::uint32_t intAdlerB, std::size_t intLengthB)
+{
+    std::uint64_t intLength = intLengthB % ADLER_MOD;
+    std::uint64_t intA1 = intAdlerA & 0xFFFF, intB1 = intAdlerA >> 16;
+    std::uint64_t intA2 = intAdlerB & 0xFFFF, intB2 = intAdlerB >> 16;
+    std::uint64_t intA = (intA1 + intA2 + ADLER_MOD - 1) % ADLER_MOD;
+    std::uint64_t intB = (intB1 + intB2 + intLength * ((intA1 + ADLER_MOD - 1) % ADLER_MOD)) % ADLER_MOD;
+    return static_cast<std::uint32_t>(intB << 16 | intA);
+}
+
+// CRC_TABLE: the CRC of every byte value (reflected polynomial 0xEDB88320).
+struct CrcTable
+{
+    std::array<std::uint32_t, 256> arrValues{};
+
+    constexpr CrcTable()
+    {
+        for(std::uint32_t n = 0; n < 256; ++n)
+        {
+            std::uint32_t intCrc = n;
+            for(int k = 0; k < 8; ++k)
+                intCrc = (intCrc & 1) ? 0xEDB88320u ^ (intCrc >> 1) : intCrc >> 1;
+            arrValues[n] = intCrc;
+        }
+    }
+};
+static constexpr CrcTable CRC_TABLE{};
+
+std::uint32_t crc32(std::span<const std::uint8_t> arrData, std::uint32_t intCrc)
+{
+    intCrc = ~intCrc;
+    for(std::uint8_t intByte : arrData)
+        intCrc = CRC_TABLE.arrValues[(intCrc ^ intByte) & 0xFF] ^ (intCrc >> 8);
+    return ~intCrc;
+}
@@ -0,0 +1,191 @@
+// Dither.cpp is Floyd-Steinberg error diffusion for the black & white formats.
+// Responsibilities:
+//  - diffuse one row (or a column range of it) given the error the row above passed down
+//  - diffuse a whole image on several threads with a row-skewed wavefront, handing the
+//    finished rows to a sink strictly in order
+//
+// Error diffusion is inherently sequential along a row (each pixel pushes 7/16 of its
+// error to the right) and from row to row (3/16, 5/16, 1/16 to the three pixels below).
+// But row r only needs row r - 1 to be finished up to one column to the right of where it
+// is, so consecutive rows can run at the same time, each a little behind the one above.
+// The workers take rows in order and work through them in chunks of WAVE_CHUNK columns,
+// waiting before each chunk until the row above is far enough ahead. The arithmetic per
+// pixel is the same whichever thread runs it, so the result is identical for any thread count.
+//
+// Values are intensities ((R + G + B) / 3, as in the grayscale formats); errors are kept
+// in 1/16 grey levels, so every share is an integer shift. Black (mask 1) below 128.
+//
+// Memory: a ring of 2 * threads + 2 row buffers (intensities / mask and error), whatever
+// the image height.
+
+module;
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+export module Dither;
+
+import LibUtility;
+import PixelKernels;
+import Metrics;
+
+// DitherRowSource: row intRow of the image; may use vecScratch (one per thread) for storage.
+export using DitherRowSource = std::function<std::span<const UJPixel>(int intRow, std::vector<UJPixel>& vecScratch)>;
+// DitherMaskSink: the 0/1 mask (1 = black) of row intRow; called for every row in order.
+export using DitherMaskSink = std::function<void(int intRow, std::span<const std::uint8_t> arrMask)>;
+
+// diffuseSpan: columns [intBegin, intEnd) of one row. pValues holds the row's intensities and
+// is overwritten with the mask (column by column, so it may be read and written in place).
+// pErrorIn is the error passed down by the row above and pErrorOut the one this row passes
+// down (zeroed before the row starts), both with column c at index c + 1. intCarry is the
+// error travelling right, 0 at the start of a row.
+export void diffuseSpan(std::uint8_t* pValues, const std::int16_t* pErrorIn, std::int16_t* pErrorOut,
+                        int intBegin, int intEnd, int& intCarry);
+
+// diffuseRows: the masks of an intRows x intWidth image, computed on intThreads threads
+// (the calling thread runs fnSink, the workers fnSource). intThreads <= 1 runs on the
+// calling thread alone.
+export void diffuseRows(int intRows, int intWidth, int intThreads, const DitherRowSource& fnSource, const DitherMaskSink& fnSink);
+
+// ---------- Implementations ----------
+
+static constexpr int WAVE_CHUNK = 256;      // columns between two waits on the row above
+static constexpr int ONE = 16;              // one grey level in error units
+static constexpr int BLACK_BELOW = 128 * ONE;
+
+void diffuseSpan(std::uint8_t* pValues, const std::int16_t* pErrorIn, std::int16_t* pErrorOut,
+                 int intBegin, int intEnd, int& intCarry)
+{
+    for(int c = intBegin; c < intEnd; ++c)
+    {
+        int intValue = pValues[c] * ONE + pErrorIn[c + 1] + intCarry;
+        bool blnBlack = intValue < BLACK_BELOW;
+        int intError = intValue - (blnBlack ? 0 : 255 * ONE);
+        pValues[c] = blnBlack ? 1 : 0;
+        pErrorOut[c]     = static_cast<std::int16_t>(pErrorOut[c] + ((intError * 3) >> 4));
+        pErrorOut[c + 1] = static_cast<std::int16_t>(pErrorOut[c + 1] + ((intError * 5) >> 4));
+        pErrorOut[c + 2] = static_cast<std::int16_t>(pErrorOut[c + 2] + (intError >> 4));
+        intCarry = (intError * 7) >> 4;
+    }
+}
+
+// diffuseSerial: one row after the other on the calling thread.
+static void diffuseSerial(int intRows, int intWidth, const DitherRowSource& fnSource, const DitherMaskSink& fnSink)
+{
+    std::size_t intCols = static_cast<std::size_t>(intWidth);
+    std::vector<UJPixel> vecRow;
+    std::vector<std::uint8_t> vecValues(intCols);
+    std::vector<std::int16_t> vecErrorIn(intCols + 2, 0);
+    std::vector<std::int16_t> vecErrorOut(intCols + 2, 0);
+    for(int r = 0; r < intRows; ++r)
+    {
+        rowToGray(fnSource(r, vecRow), vecValues.data());
+        std::fill(vecErrorOut.begin(), vecErrorOut.end(), std::int16_t{0});
+        int intCarry = 0;
+        diffuseSpan(vecValues.data(), vecErrorIn.data(), vecErrorOut.data(), 0, intWidth, intCarry);
+        fnSink(r, vecValues);
+        vecErrorIn.swap(vecErrorOut);
+    }
+}
+
+void diffuseRows(int intRows, int intWidth, int intThreads, const DitherRowSource& fnSource, const DitherMaskSink& fnSink)
+{
+    intThreads = std::min(intThreads, intRows);
+    if(intThreads <= 1 || intWidth == 0)
+    {
+        diffuseSerial(intRows, intWidth, fnSource, fnSink);
+        return;
+    }
+
+    // Row r uses slot r % intSlots for its values / mask and its incoming error, and writes the
+    // error of row r + 1 into the next slot. Slot progress is r * (width + 1) + columns done,
+    // so a waiter can never mistake an earlier row in the same slot for the one it waits for.
+    struct Slot
+    {
+        std::vector<std::uint8_t> vecValues;
+        std::vector<std::int16_t> vecErrorIn;
+        std::atomic<long long> intProgress{-1};
+    };
+    int intSlots = 2 * intThreads + 2;
+    long long intStride = static_cast<long long>(intWidth) + 1;
+    std::unique_ptr<Slot[]> arrSlots = std::make_unique<Slot[]>(static_cast<std::size_t>(intSlots));
+    for(int s = 0; s < intSlots; ++s)
+    {
+        arrSlots[s].vecValues.resize(static_cast<std::size_t>(intWidth));
+        arrSlots[s].vecErrorIn.assign(static_cast<std::size_t>(intWidth) + 2, 0);
+    }
+
+    std::atomic<int> intNextRow{0};
+    std::mutex objMutex;
+    std::condition_variable cvDone;  // a row finished (the sink waits)
+    std::condition_variable cvFree;  // a row was written (workers wait for slots)
+    int intWritten = 0;              // rows handed to the sink, guarded by objMutex
+
+    auto fnWorker = [&]()
+    {
+        std::vector<UJPixel> vecRow;
+        for(int r = intNextRow++; r < intRows; r = intNextRow++)
+        {
+            {
+                // row r overwrites the values of row r - slots and the error input of row r + 1 - slots
+                std::unique_lock<std::mutex> lckWait(objMutex);
+                cvFree.wait(lckWait, [&] { return intWritten >= r + 2 - intSlots; });
+            }
+            Slot& recSlot = arrSlots[r % intSlots];
+            Slot& recNext = arrSlots[(r + 1) % intSlots];
+            rowToGray(fnSource(r, vecRow), recSlot.vecValues.data());
+            std::fill(recNext.vecErrorIn.begin(), recNext.vecErrorIn.end(), std::int16_t{0});
+
+            const Slot* pAbove = r > 0 ? &arrSlots[(r - 1) % intSlots] : nullptr;
+            int intCarry = 0;
+            for(int c = 0; c < intWidth; c += WAVE_CHUNK)
+            {
+                int intEnd = std::min(intWidth, c + WAVE_CHUNK);
+                // the row above must be done one column past this chunk (the 1/16 share)
+                long long intNeeded = static_cast<long long>(r - 1) * intStride + std::min(intWidth, intEnd + 1);
+                while(pAbove != nullptr && pAbove->intProgress.load(std::memory_order_acquire) < intNeeded)
+                    std::this_thread::yield();
+                diffuseSpan(recSlot.vecValues.data(), recSlot.vecErrorIn.data(), recNext.vecErrorIn.data(), c, intEnd, intCarry);
+                recSlot.intProgress.store(static_cast<long long>(r) * intStride + intEnd, std::memory_order_release);
+            }
+            {
+                std::lock_guard<std::mutex> lckDone(objMutex);
+            }
+            cvDone.notify_all();
+        }
+    };
+
+    RenderMetrics* pMetrics = currentRenderMetrics(); // the workers record into the caller's scope too
+    std::vector<std::thread> vecWorkers;
+    for(int t = 0; t < intThreads; ++t)
+        vecWorkers.emplace_back([&fnWorker, pMetrics]()
+                                {
+                                    MetricsScope objScope(pMetrics);
+                                    fnWorker();
+                                });
+    for(int r = 0; r < intRows; ++r)
+    {
+        Slot& recSlot = arrSlots[r % intSlots];
+        long long intFinished = static_cast<long long>(r) * intStride + intWidth;
+        {
+            std::unique_lock<std::mutex> lckWait(objMutex);
+            cvDone.wait(lckWait, [&] { return recSlot.intProgress.load(std::memory_order_acquire) == intFinished; });
+        }
+        fnSink(r, recSlot.vecValues);
+        {
+            std::lock_guard<std::mutex> lckWritten(objMutex);
+            intWritten = r + 1;
+        }
+        cvFree.notify_all();
+    }
+    for(std::thread& objWorker : vecWorkers)
+        objWorker.join();
+}
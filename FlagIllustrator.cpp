@@ -1,26 +1,77 @@
 // FlagIllustrator.cpp is an abstract base class for producing flags as images.
 // Responsibilities:
-//  - maintain a UJImage on the heap (_image)
-//  - provide drawing helpers for flags (AUSTRIA, JAPAN, NIGERIA)
-//  - own allocation/deallocation of _image
+//  - own a UJImage (_image) by value, so copies are deep and moves just hand the buffer over
+//  - adopt an existing UJImage (including one over a borrowed buffer) and release it again,
+//    so an image can pass between illustrators / threads without copying pixels
+//  - draw flags (any FlagLibrary flag) into _image, run by run, via FlagRasterizer
+//  - or, in procedural mode, keep only the FlagRasterizer and let the exporters generate
+//    each row on demand (pixelRow), so no pixel grid exists at all: O(width) memory; formats
+//    with a fused pipeline (RenderPipeline) encode straight from the flag's runs instead (exportRuns)
 //  - declare pure virtual exportImage() so derived classes implement different
-//    output formats (colour P3, grayscale P2, PBM P1).
+//    output formats (colour P3/P6, grayscale P2/P5, PBM P1/P4, QOI, PNG).
+//  - declare pure virtual formatHeader() / encodeRow(), the per-format pieces of an export,
+//    so one row of pixels can be encoded by any number of illustrators (see MultiExporter)
+//  - encode fixed bands of rows on several threads and write them in order (encodeBandsInOrder),
+//    for the compressed formats and TiledRenderer
 //
-// This file contains the implementation for non-virtual helpers and the ctor/dtor.
+// This file contains the implementation for non-virtual helpers and the ctors.
 // exportImage() is declared pure virtual so this class is abstract.
-// The virtual destructor calls dealloc() so deleting via base pointer frees memory.
+// The destructor is virtual so deleting via base pointer runs the derived destructor;
+// the image frees itself (RAII).
 
 module;
-#include <cassert>
-#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <cstdlib>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <optional>
+#include <span>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 export module FlagIllustrator;
 
 import LibUtility;
 import UJImage;
+import ImageSink;
+import FlagRasterizer;
+import Metrics;
+
+// RowScratch: buffers encodeRow() reuses from row to row (one per thread and output).
+// Dithered BW rows also depend on where they are in the image: intNextRow is the image row
+// the next encodeRow() call encodes (exportRows() sets it, the BW encoder advances it), and
+// error diffusion carries the error of the previous row in vecError, so such rows must be
+// encoded in order with one scratch (a fresh scratch starts at row 0 with no error).
+// The compressed formats (QOI, PNG) collect a band of rows in vecPixels and compress it when
+// it is complete; they end the stream after row intRows - 1, so intRows must be set too.
+export struct RowScratch
+{
+    std::vector<std::uint8_t> vecBytes; // intensities, 0/1 values, packed bits or channels
+    std::vector<char> vecText;          // one encoded text row
+    std::vector<std::int16_t> vecError; // error diffusion: incoming and outgoing error rows
+    std::vector<UJPixel> vecPixels;     // QOI / PNG: the rows of the band being compressed
+    std::uint32_t intChecksum = 1;      // PNG: Adler-32 of the rows compressed so far
+    int intNextRow = 0;
+    int intRows = 0;                    // height of the image being encoded
+};
+
+// BandEncoder: encodes rows [intBegin, intEnd) into vecOut, with the calling thread's recScratch.
+export using BandEncoder = std::function<void(int intBegin, int intEnd, RowScratch& recScratch, std::vector<std::uint8_t>& vecOut)>;
+
+// encodeBandsInOrder: rows [intRowBegin, intRowEnd) cut into bands at the multiples of
+// intBandRows, encoded by fnBand on up to intThreads threads (the caller is one of them, and
+// the others record into its metrics scope). Each thread reuses its scratch and band buffer
+// from band to band; the buffers go to objSink in row order, and at most one per thread
+// exists at a time.
+export void encodeBandsInOrder(ImageSink& objSink, int intRowBegin, int intRowEnd, int intBandRows,
+                               int intThreads, const BandEncoder& fnBand);
 
 export class FlagIllustrator
 {
@@ -28,7 +79,13 @@ public:
     //public
     FlagIllustrator(); // default dims
     FlagIllustrator(int intHeight, int intWidth);
-    FlagIllustrator(const FlagIllustrator& objOriginal);
+    // Adopts objImage (same size limits as above): pass std::move(image) to avoid a copy,
+    // or an image over a borrowed buffer to draw straight into that buffer.
+    explicit FlagIllustrator(UJImage objImage);
+    FlagIllustrator(const FlagIllustrator& objOriginal);            // deep copy
+    FlagIllustrator(FlagIllustrator&& objOriginal) noexcept;        // objOriginal is left 0x0
+    FlagIllustrator& operator=(const FlagIllustrator& objOriginal); // deep copy
+    FlagIllustrator& operator=(FlagIllustrator&& objOriginal) noexcept;
 
     // Virtual destructor: required because we delete derived objects via base pointer.
     virtual ~FlagIllustrator();
@@ -36,29 +93,131 @@ public:
     // The drawing function: this will set pixels in _image according to eType.
     // Derived classes then choose how to export the image bytes / values.
     void illustrate(FlagType eType);
+    // Same, split into intThreads bands of consecutive rows drawn in parallel.
+    // Every pixel depends only on its own (row, col), so the result is identical
+    // to the single-threaded call for any thread count.
+    void illustrate(FlagType eType, int intThreads);
+
+    // illustrateProcedural: describe the flag instead of drawing it. Nothing is written to
+    // the image; exportImage() generates every row from the description while encoding,
+    // which keeps memory at one row and reads no pixels back. The first form keeps the
+    // current size (and leaves the pixel buffer untouched), the second one sets a new size
+    // and frees the pixel buffer. illustrate(), resize() and releaseImage() end the mode.
+    void illustrateProcedural(FlagType eType);
+    void illustrateProcedural(FlagType eType, int intHeight, int intWidth);
+    bool isProcedural() const;
+
+    // Dimensions of the flag exportImage() writes (the described size in procedural mode).
+    int getHeight() const;
+    int getWidth() const;
 
     // ---- PURE VIRTUAL ----
     // Requirement: exportImage is pure virtual, making this an abstract base class.
     // Derived classes must override exportImage() to produce different formats.
-    virtual std::string exportImage() const = 0;
+    // The encoded image is streamed into objSink in fixed-size chunks, so memory
+    // stays bounded no matter how large the image is.
+    virtual void exportImage(ImageSink& objSink) const = 0;
+
+    // Exact number of bytes exportImage() will produce for the current image and mode.
+    // Cheap for the PNM formats (a closed form, or a counting pass for P3 / P2), but QOI / PNG
+    // compress the whole image to count it: the callers that need a size up front (RenderCache,
+    // RenderServer, TiledRenderer) check isCompressed() first and never call it for those.
+    virtual std::size_t exportSize() const = 0;
+
+    // The export split in two, so an image can be encoded in row bands (on several threads,
+    // into several files, ...) and the pieces concatenated:
+    //   exportImage() == exportHeader() + exportRows(0, getHeight())
+    // and exportRows(a, b) + exportRows(b, c) == exportRows(a, c).
+    std::string exportHeader() const; // formatHeader(getHeight(), getWidth())
+    // exportRows: pixelRow() + encodeRow() for every row (derived classes may add fast paths).
+    virtual void exportRows(ImageSink& objSink, int intRowBegin, int intRowEnd) const;
+
+    // The format itself, independent of this illustrator's own image:
+    // formatHeader is the header of an intHeight x intWidth image in this format and mode,
+    // encodeRow appends one row of pixels (of any image) encoded in this format and mode.
+    virtual std::string formatHeader(int intHeight, int intWidth) const = 0;
+    virtual void encodeRow(std::span<const UJPixel> arrRow, RowScratch& recScratch, ImageSink& objSink) const = 0;
+
+    // pixelRow: row intRow of the flag, e.g. for the exporters. A view of _image normally; in
+    // procedural mode the row is generated into vecScratch (resized as needed) and viewed there.
+    std::span<const UJPixel> pixelRow(int intRow, std::vector<UJPixel>& vecScratch) const;
+    // pixelRows: rows [intRowBegin, intRowEnd) back to back, the same way.
+    std::span<const UJPixel> pixelRows(int intRowBegin, int intRowEnd, std::vector<UJPixel>& vecScratch) const;
+
+    // Thin wrapper over the streaming export: the whole encoded image as one string,
+    // allocated once at exportReserve() bytes.
+    // (Derived classes bring it into scope with `using FlagIllustrator::exportImage;`.)
+    std::string exportImage() const;
+    // exportReserve: bytes to reserve for the string above; exportSize() unless that would
+    // mean encoding the image twice (the compressed formats return 0) or a pass over every
+    // pixel (P3 / P2 return an upper bound).
+    virtual std::size_t exportReserve() const;
+
+    // resize: new image dimensions (same limits as the constructor), all pixels white.
+    // The pixel buffer is reused when it is large enough.
+    void resize(int intHeight, int intWidth);
+
+    // The drawn image, e.g. for another stage to read (not the flag in procedural mode).
+    const UJImage& getImage() const;
+    // releaseImage: moves the image out (no pixel copy); this illustrator is left 0x0
+    // until resize() is called.
+    UJImage releaseImage();
+
+    // Output flavour used by exportImage(): ASCII (P3/P2/P1, default) or BINARY (P6/P5/P4).
+    void setExportMode(ExportMode eMode);
+    ExportMode getExportMode() const;
+
+    // Dithering for the BW formats (P1 / P4), ignored by the other illustrators.
+    // DITHER_DIFFUSION needs every row in order, so exportRows(a, b) + exportRows(b, c) ==
+    // exportRows(a, c) does not hold for it (nor for QOI / PNG, which are one compressed stream).
+    void setDither(DitherMode eDither);
+    DitherMode getDither() const;
+
+    // Threads exportRows() may use to encode (1 by default): the error diffusion wavefront
+    // (see Dither.cpp) and the QOI / PNG compression. The output does not depend on the count.
+    void setEncodeThreads(int intThreads);
+    int getEncodeThreads() const;
+
+    // Anti-aliased circle edges for the next illustrate() / illustrateProcedural() call
+    // (off by default: hard edges, see FlagRasterizer).
+    void setAntiAlias(bool blnAntiAlias);
+    bool getAntiAlias() const;
+
+    // Whether procedural exports may use the format's fused pipeline (exportRuns, on by default).
+    // Off, every row is generated and passed to encodeRow(): the same bytes, e.g. for the
+    // benchmark to time fusion separately from skipping the grid.
+    void setFusedExport(bool blnFused);
+    bool getFusedExport() const;
 
     static constexpr int DEF_HEIGHT = 480;
     static constexpr int DEF_WIDTH  = 640;
 
 protected:
     // Protected so derived classes can read _image to produce outputs.
-    UJImage* _image;
+    UJImage _image;
+    ExportMode _eMode = ASCII;
+    DitherMode _eDither = DITHER_NONE;
+    int _encodeThreads = 1;
+
+    // encodeBands: encodeBandsInOrder on the encode threads (setEncodeThreads).
+    void encodeBands(ImageSink& objSink, int intRowBegin, int intRowEnd, int intBandRows, const BandEncoder& fnBand) const;
+
+    // exportRuns: procedural mode, rows [intRowBegin, intRowEnd) of objRaster encoded straight from
+    // its runs by this format's fused pipeline (see RenderPipeline), the same bytes as encodeRow().
+    // Returns false (the default) if the format has none in the current mode: exportRows() then
+    // generates the rows and calls encodeRow().
+    virtual bool exportRuns(const FlagRasterizer& objRaster, ImageSink& objSink, int intRowBegin, int intRowEnd) const;
 
 private:
-    // Drawing helpers are implementation details (private).
-    void drawAuFlag();
-    void drawJPFlag();
-    void drawNGFlag();
-    double distance(int intY1, int intY2, int intX1, int intX2) const;
-    void alloc(int intRows, int intCols);
-    void clone(const FlagIllustrator& objOriginal);
-    void dealloc();
-    void enforceRange(int intArg, int intMin, int intMax) const;
+    // Drawing helper is an implementation detail (private).
+    // Draws rows [intRowBegin, intRowEnd) of the flag described by objRaster.
+    void drawRows(const FlagRasterizer& objRaster, int intRowBegin, int intRowEnd);
+    static int checkedSize(int intSize); // enforceRange(0, MAX_DIMENSION) usable in initialisers
+    static void enforceRange(int intArg, int intMin, int intMax);
+
+    std::optional<FlagRasterizer> _raster; // set in procedural mode only
+    bool _blnAntiAlias = false;
+    bool _blnFused = true;
 };
 
 // -------- implementations --------
@@ -66,142 +225,310 @@ private:
 // ctor delegates to the parameterised ctor (constructor chaining)
 FlagIllustrator::FlagIllustrator() : FlagIllustrator(DEF_HEIGHT, DEF_WIDTH) {}
 
+// Range checks are defensive programming to match the course style.
 FlagIllustrator::FlagIllustrator(int intHeight, int intWidth)
-{
-    // Range checks are defensive programming to match the course style.
-    enforceRange(intHeight, 0, 10000);
-    enforceRange(intWidth,  0, 10000);
-    alloc(intHeight, intWidth); // allocate UJImage on heap
-}
+: _image(checkedSize(intHeight), checkedSize(intWidth))
+{}
 
-FlagIllustrator::FlagIllustrator(const FlagIllustrator& objOriginal)
-: FlagIllustrator(objOriginal._image->getHeight(), objOriginal._image->getWidth())
+FlagIllustrator::FlagIllustrator(UJImage objImage)
+: _image(std::move(objImage))
 {
-    // After allocation, deep-copy the pixel data
-    clone(objOriginal);
+    checkedSize(_image.getHeight());
+    checkedSize(_image.getWidth());
 }
 
-// Virtual destructor: deallocates the _image (so deleting base pointer deletes UJImage).
-FlagIllustrator::~FlagIllustrator()
+// The copy ctor / copy assignment deep-copy the pixels through UJImage's own copy operations
+// (the assignment reuses this object's buffer when it is large enough).
+FlagIllustrator::FlagIllustrator(const FlagIllustrator& objOriginal) = default;
+FlagIllustrator::FlagIllustrator(FlagIllustrator&& objOriginal) noexcept = default;
+FlagIllustrator& FlagIllustrator::operator=(const FlagIllustrator& objOriginal) = default;
+FlagIllustrator& FlagIllustrator::operator=(FlagIllustrator&& objOriginal) noexcept = default;
+
+// Virtual destructor: _image frees its own buffer.
+FlagIllustrator::~FlagIllustrator() = default;
+
+// illustrate: draw the whole image on the calling thread
+void FlagIllustrator::illustrate(FlagType eType)
 {
-    dealloc();
+    StageTimer objTimer(STAGE_ILLUSTRATE);
+    _raster.reset();
+    FlagRasterizer objRaster(eType, _image.getHeight(), _image.getWidth(), _blnAntiAlias);
+    drawRows(objRaster, 0, _image.getHeight());
 }
 
-// illustrate: choose the correct helper based on FlagType
-void FlagIllustrator::illustrate(FlagType eType)
+// illustrate: split the rows into intThreads contiguous bands; the calling thread
+// draws the last band itself and then waits for the others.
+void FlagIllustrator::illustrate(FlagType eType, int intThreads)
 {
-    switch(eType)
+    StageTimer objTimer(STAGE_ILLUSTRATE);
+    _raster.reset();
+    int intRows = _image.getHeight();
+    enforceRange(intThreads, 1, 1024);
+    if(intThreads > intRows)
+        intThreads = intRows > 0 ? intRows : 1;
+
+    FlagRasterizer objRaster(eType, intRows, _image.getWidth(), _blnAntiAlias);
+    RenderMetrics* pMetrics = currentRenderMetrics(); // the workers record into this render's scope too
+    std::vector<std::thread> vecWorkers;
+    vecWorkers.reserve(intThreads - 1);
+    for(int t = 0; t < intThreads; ++t)
     {
-        case AUSTRIA: drawAuFlag(); break;
-        case JAPAN:   drawJPFlag(); break;
-        case NIGERIA: drawNGFlag(); break;
+        // band t covers rows [t * rows / threads, (t + 1) * rows / threads)
+        int intBegin = static_cast<int>(static_cast<long long>(intRows) * t / intThreads);
+        int intEnd   = static_cast<int>(static_cast<long long>(intRows) * (t + 1) / intThreads);
+        if(t == intThreads - 1)
+            drawRows(objRaster, intBegin, intEnd);
+        else
+            vecWorkers.emplace_back([this, &objRaster, pMetrics, intBegin, intEnd]()
+                                    {
+                                        MetricsScope objScope(pMetrics);
+                                        drawRows(objRaster, intBegin, intEnd);
+                                    });
     }
+    for(std::thread& objWorker : vecWorkers)
+        objWorker.join();
 }
 
-// ----- Drawing helpers -----
-// Each helper fills _image with the appropriate pixels for the flag.
+void FlagIllustrator::illustrateProcedural(FlagType eType)
+{
+    _raster.emplace(eType, _image.getHeight(), _image.getWidth(), _blnAntiAlias);
+}
 
-void FlagIllustrator::drawAuFlag()
+void FlagIllustrator::illustrateProcedural(FlagType eType, int intHeight, int intWidth)
 {
-    // Austria = horizontal stripes: red, white, red
-    int intThickness = _image->getHeight() / 3;
-    UJPixel recRed   = {239, 51, 64};   // approximate Austria red
-    UJPixel recWhite = {255, 255, 255}; // white
+    _raster.emplace(eType, checkedSize(intHeight), checkedSize(intWidth), _blnAntiAlias);
+    _image = UJImage(0, 0); // the grid is not needed any more
+}
 
-    for(int r = 0; r < _image->getHeight(); ++r)
-    {
-        for(int c = 0; c < _image->getWidth(); ++c)
-        {
-            if(r > intThickness && r < intThickness * 2)
-                _image->setPixel(r, c, recWhite); // middle stripe
-            else
-                _image->setPixel(r, c, recRed);
-        }
-    }
+bool FlagIllustrator::isProcedural() const
+{
+    return _raster.has_value();
+}
+
+int FlagIllustrator::getHeight() const
+{
+    return _raster ? _raster->getHeight() : _image.getHeight();
+}
+
+int FlagIllustrator::getWidth() const
+{
+    return _raster ? _raster->getWidth() : _image.getWidth();
+}
+
+void FlagIllustrator::resize(int intHeight, int intWidth)
+{
+    _raster.reset();
+    _image.resize(checkedSize(intHeight), checkedSize(intWidth));
+}
+
+const UJImage& FlagIllustrator::getImage() const
+{
+    return _image;
 }
 
-void FlagIllustrator::drawJPFlag()
+UJImage FlagIllustrator::releaseImage()
 {
-    // Japan = white background with a central red circle (diameter = 60% of height)
-    UJPixel recRed   = {188, 0, 45};
-    UJPixel recWhite = {255, 255, 255};
-    double dblRadius = 0.3 * static_cast<double>(_image->getHeight());
-    int intCR = _image->getHeight() / 2; // center row
-    int intCC = _image->getWidth()  / 2; // center column
+    _raster.reset();
+    return std::move(_image);
+}
+
+std::span<const UJPixel> FlagIllustrator::pixelRow(int intRow, std::vector<UJPixel>& vecScratch) const
+{
+    if(!_raster)
+        return _image.row(intRow);
+    vecScratch.resize(static_cast<std::size_t>(_raster->getWidth()));
+    _raster->fillRow(intRow, vecScratch);
+    return vecScratch;
+}
 
-    for(int r = 0; r < _image->getHeight(); ++r)
+std::span<const UJPixel> FlagIllustrator::pixelRows(int intRowBegin, int intRowEnd, std::vector<UJPixel>& vecScratch) const
+{
+    std::size_t intWidth = static_cast<std::size_t>(getWidth());
+    if(!_raster)
     {
-        for(int c = 0; c < _image->getWidth(); ++c)
-        {
-            // distance from (r,c) to circle center
-            if(distance(r, intCR, c, intCC) <= dblRadius)
-                _image->setPixel(r, c, recRed);
-            else
-                _image->setPixel(r, c, recWhite);
-        }
+        _image.checkRect(intRowBegin, 0, intRowEnd - intRowBegin, _image.getWidth());
+        return _image.pixels().subspan(static_cast<std::size_t>(intRowBegin) * intWidth,
+                                       static_cast<std::size_t>(intRowEnd - intRowBegin) * intWidth);
     }
+    vecScratch.resize(static_cast<std::size_t>(intRowEnd - intRowBegin) * intWidth);
+    std::span<UJPixel> arrRows = vecScratch;
+    for(int r = intRowBegin; r < intRowEnd; ++r)
+        _raster->fillRow(r, arrRows.subspan(static_cast<std::size_t>(r - intRowBegin) * intWidth, intWidth));
+    return vecScratch;
 }
 
-void FlagIllustrator::drawNGFlag()
+std::string FlagIllustrator::exportHeader() const
 {
-    // Nigeria = vertical stripes: green, white, green
-    int intThickness = _image->getWidth() / 3;
-    UJPixel recGreen = {27, 115, 57};
-    UJPixel recWhite = {255, 255, 255};
+    return formatHeader(getHeight(), getWidth());
+}
 
-    for(int r = 0; r < _image->getHeight(); ++r)
+void FlagIllustrator::exportRows(ImageSink& objSink, int intRowBegin, int intRowEnd) const
+{
+    StageTimer objTimer(STAGE_ENCODE);
+    std::size_t intStart = objSink.bytesWritten();
+    std::vector<UJPixel> vecRow; // only used in procedural mode
+    RowScratch recScratch;
+    recScratch.intNextRow = intRowBegin;
+    recScratch.intRows = getHeight();
+    if(!_raster)
     {
-        for(int c = 0; c < _image->getWidth(); ++c)
-        {
-            if(c > intThickness && c < intThickness * 2)
-                _image->setPixel(r, c, recWhite);
-            else
-                _image->setPixel(r, c, recGreen);
-        }
+        // Drawn image: check the band once, then walk the rows unchecked.
+        _image.checkRect(intRowBegin, 0, intRowEnd - intRowBegin, _image.getWidth());
+        for(int r = intRowBegin; r < intRowEnd; ++r)
+            encodeRow(_image.rowUnchecked(r), recScratch, objSink);
     }
+    else if(!_blnFused || !exportRuns(*_raster, objSink, intRowBegin, intRowEnd))
+    {
+        for(int r = intRowBegin; r < intRowEnd; ++r)
+            encodeRow(pixelRow(r, vecRow), recScratch, objSink);
+    }
+    countPixels(static_cast<std::size_t>(intRowEnd - intRowBegin) * static_cast<std::size_t>(getWidth()));
+    countBytes(objSink.bytesWritten() - intStart);
+}
+
+std::string FlagIllustrator::exportImage() const
+{
+    std::string strImage;
+    strImage.reserve(exportReserve());
+    {
+        ImageSink objSink([&strImage](const char* pData, std::size_t intSize) { strImage.append(pData, intSize); });
+        exportImage(objSink);
+    } // sink flushes on destruction
+    return strImage;
 }
 
-// Euclidean distance helper for the Japan flag circle calculation.
-double FlagIllustrator::distance(int intY1, int intY2, int intX1, int intX2) const
+std::size_t FlagIllustrator::exportReserve() const
 {
-    return std::sqrt(std::pow(intX2 - intX1, 2) + std::pow(intY2 - intY1, 2));
+    return exportSize();
 }
 
-// alloc: puts a new UJImage on the heap (must be freed later).
-void FlagIllustrator::alloc(int intHeight, int intWidth)
+bool FlagIllustrator::exportRuns(const FlagRasterizer&, ImageSink&, int, int) const
 {
-    _image = new UJImage(intHeight, intWidth);
+    return false;
 }
 
-// clone: deep copy pixel data from another FlagIllustrator's _image.
-void FlagIllustrator::clone(const FlagIllustrator& objOriginal)
+void FlagIllustrator::setExportMode(ExportMode eMode)
 {
-    assert(_image->getHeight() == objOriginal._image->getHeight());
-    assert(_image->getWidth()  == objOriginal._image->getWidth());
-    for(int r = 0; r < _image->getHeight(); ++r)
-    {
-        for(int c = 0; c < _image->getWidth(); ++c)
-            _image->setPixel(r, c, objOriginal._image->getPixel(r, c));
-    }
+    _eMode = eMode;
+}
+
+ExportMode FlagIllustrator::getExportMode() const
+{
+    return _eMode;
+}
+
+void FlagIllustrator::setDither(DitherMode eDither)
+{
+    _eDither = eDither;
+}
+
+DitherMode FlagIllustrator::getDither() const
+{
+    return _eDither;
+}
+
+void FlagIllustrator::setEncodeThreads(int intThreads)
+{
+    enforceRange(intThreads, 1, 1024);
+    _encodeThreads = intThreads;
+}
+
+int FlagIllustrator::getEncodeThreads() const
+{
+    return _encodeThreads;
+}
+
+void FlagIllustrator::setAntiAlias(bool blnAntiAlias)
+{
+    _blnAntiAlias = blnAntiAlias;
+}
+
+bool FlagIllustrator::getAntiAlias() const
+{
+    return _blnAntiAlias;
+}
+
+void FlagIllustrator::setFusedExport(bool blnFused)
+{
+    _blnFused = blnFused;
+}
+
+bool FlagIllustrator::getFusedExport() const
+{
+    return _blnFused;
 }
 
-// dealloc: deletes the heap UJImage (calls UJImage::~UJImage which frees the 2D arrays).
-// Called from FlagIllustrator::~FlagIllustrator() -> ensures no memory leaks from _image.
-void FlagIllustrator::dealloc()
+// encodeBandsInOrder: each thread takes the next band, encodes it into its own buffer and waits
+// for its turn to write it.
+void encodeBandsInOrder(ImageSink& objSink, int intRowBegin, int intRowEnd, int intBandRows,
+                        int intThreads, const BandEncoder& fnBand)
 {
-    if(_image != nullptr)
+    int intFirstBand = intRowBegin / intBandRows;
+    int intBands = intRowEnd > intRowBegin ? (intRowEnd - 1) / intBandRows + 1 - intFirstBand : 0;
+    std::atomic<int> intNext{0};
+    std::mutex objMutex;
+    std::condition_variable cvTurn;
+    int intTurn = 0; // next band to be written
+    RenderMetrics* pMetrics = currentRenderMetrics();
+    auto fnWorker = [&]()
     {
-        delete _image;  // UJImage destructor handles inner arrays
-        _image = nullptr;
-    }
+        MetricsScope objScope(pMetrics);
+        RowScratch recScratch;
+        std::vector<std::uint8_t> vecBand;
+        for(int b = intNext++; b < intBands; b = intNext++)
+        {
+            vecBand.clear(); // keeps its capacity
+            int intBegin = std::max(intRowBegin, (intFirstBand + b) * intBandRows);
+            int intEnd   = std::min(intRowEnd, (intFirstBand + b + 1) * intBandRows);
+            fnBand(intBegin, intEnd, recScratch, vecBand);
+
+            std::unique_lock<std::mutex> objLock(objMutex);
+            cvTurn.wait(objLock, [&] { return intTurn == b; });
+            objSink.write(reinterpret_cast<const char*>(vecBand.data()), vecBand.size());
+            ++intTurn;
+            cvTurn.notify_all();
+        }
+    };
+
+    intThreads = std::min(intThreads, std::max(1, intBands));
+    std::vector<std::thread> vecWorkers;
+    for(int t = 1; t < intThreads; ++t)
+        vecWorkers.emplace_back(fnWorker);
+    fnWorker(); // the calling thread is a worker too
+    for(std::thread& objWorker : vecWorkers)
+        objWorker.join();
+}
+
+void FlagIllustrator::encodeBands(ImageSink& objSink, int intRowBegin, int intRowEnd, int intBandRows,
+                                  const BandEncoder& fnBand) const
+{
+    encodeBandsInOrder(objSink, intRowBegin, intRowEnd, intBandRows, _encodeThreads, fnBand);
+}
+
+// ----- Drawing helpers -----
+// drawRows: each row is a few constant-colour runs (see FlagRasterizer), filled in bulk.
+// Sizes (stripe thickness, circle centre) come from the whole image, never the band.
+// The band is range-checked once; the rows inside it are then taken unchecked.
+void FlagIllustrator::drawRows(const FlagRasterizer& objRaster, int intRowBegin, int intRowEnd)
+{
+    _image.checkRect(intRowBegin, 0, intRowEnd - intRowBegin, _image.getWidth());
+    for(int r = intRowBegin; r < intRowEnd; ++r)
+        objRaster.fillRow(r, _image.rowUnchecked(r));
+}
+
+int FlagIllustrator::checkedSize(int intSize)
+{
+    enforceRange(intSize, 0, MAX_DIMENSION);
+    return intSize;
 }
 
 // enforceRange: defensive checks used throughout the class to catch invalid values early.
-void FlagIllustrator::enforceRange(int intArg, int intMin, int intMax) const
+void FlagIllustrator::enforceRange(int intArg, int intMin, int intMax)
 {
     if(intArg < intMin || intArg > intMax)
     {
         std::cerr << intArg << " must be in [" << intMin << ", " << intMax << "]" << std::endl;
         std::exit(ERROR_RANGE);
     }
-}
\ No newline at end of file
+}
+
@@ -0,0 +1,447 @@
+// FlagLibrary.cpp is the registry of flags the program can draw, each one a declarative description.
+// Responsibilities:
+//  - parse flag descriptions (a small text format, see below) and keep them, numbered in
+//    the order they were added: FlagType n is the n-th flag
+//  - provide the built-in flags (AUSTRIA, JAPAN, NIGERIA) in that same format, so every
+//    flag is drawn by the same engine (FlagRasterizer) and adding one needs no code
+//  - look flags up by number or name
+//  - fingerprint a flag's description (flagSpecHash), e.g. to key cached images by it
+//
+// Format (one directive per line, blank lines are ignored; a line starting with '#' is a comment,
+// and so is the rest of a line after a '#' followed by a space, so #RRGGBB colours are safe):
+//   flag <NAME>                                    starts a new flag; names are unique (case-insensitive),
+//                                                  made of letters, digits, '_' and '-', not only digits
+//   background <colour>                            the colour of every pixel not covered by a shape
+//   rect <top> <left> <bottom> <right> <colour>    rows [top, bottom), columns [left, right)
+//   circle <row> <col> <radius> <colour>           pixels whose distance to the centre is <= radius
+//   hstripes <n> <colour> x n                      n horizontal bands of equal height
+//   vstripes <n> <colour> x n                      n vertical bands of equal width
+// Shapes are painted in order over the background, so later shapes cover earlier ones.
+//   <colour>   #RRGGBB
+//   <radius>   a fraction of the height or width: 0.3h, 0.25w; at most MAX_RADIUS (4h, 4w)
+//   coordinates (rows relative to the height H, columns to the width W):
+//     k/n      k cells of a grid of n equal cells: k * (H / n) with integer division, so the
+//              last cell takes the remainder; 0 and 1 are short for 0/1 and 1/1
+//     k/n+p    the same moved by p pixels (k/n-p: by -p)
+//   Results are clamped to the image. Stripe band i is [i/n, (i+1)/n), the last one ends at 1.
+//
+// The registry is filled before rendering starts (built-ins at first use, files via
+// loadFlagFile); it is only read afterwards, so any number of threads may render.
+
+module;
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <istream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+export module FlagLibrary;
+
+import LibUtility;
+
+// FlagCoord: intNum * (length / intDen) + intOffset, clamped to [0, length].
+export struct FlagCoord
+{
+    int intNum = 0;
+    int intDen = 1;
+    int intOffset = 0;
+
+    int resolve(int intLength) const;
+};
+
+export enum ShapeKind
+{
+    SHAPE_RECT = 0,
+    SHAPE_CIRCLE
+};
+
+export struct FlagShape
+{
+    ShapeKind eKind = SHAPE_RECT;
+    FlagCoord recTop, recLeft, recBottom, recRight; // SHAPE_RECT
+    FlagCoord recRow, recCol;                       // SHAPE_CIRCLE centre
+    double dblRadius = 0.0;                         // SHAPE_CIRCLE, times the height (or width)
+    bool blnRadiusOfWidth = false;
+    UJPixel recColour{};
+};
+
+export struct FlagSpec
+{
+    std::string strName;
+    UJPixel recBackground{255, 255, 255};
+    std::vector<FlagShape> vecShapes;
+};
+
+// parseFlags: every flag described in isSpec. Exits with ERROR_ARGS on the first malformed
+// line, naming strSource and the line number.
+export std::vector<FlagSpec> parseFlags(std::istream& isSpec, const std::string& strSource);
+// tryParseFlags: the same without exiting. Returns false on the first malformed line, with
+// its number in intErrorLine and the reason in strError; vecFlags then holds the flags so far.
+export bool tryParseFlags(std::istream& isSpec, std::vector<FlagSpec>& vecFlags, int& intErrorLine, std::string& strError);
+
+// addFlag: registers recSpec as the next FlagType and returns it. Exits with ERROR_ARGS if
+// the name is already taken.
+export FlagType addFlag(FlagSpec recSpec);
+// loadFlagFile: parses strPath and registers all of its flags. Exits with ERROR_ARGS if the
+// file cannot be read or is malformed.
+export void loadFlagFile(const std::string& strPath);
+
+export int flagCount();
+export bool isValidFlag(int intFlag);
+// flagSpec: the description of eType, which must be valid.
+export const FlagSpec& flagSpec(FlagType eType);
+// flagTypeName: the registered name, e.g. for reports ("UNKNOWN" for an invalid FlagType).
+export const std::string& flagTypeName(FlagType eType);
+// findFlag: the flag named strName (case-insensitive). Returns false if there is none.
+export bool findFlag(const std::string& strName, FlagType& eType);
+// flagSpecHash: a 64-bit FNV-1a hash of everything that decides the pixels of eType (not its
+// name), so a flag redefined under the same name (--flags) hashes differently.
+export std::uint64_t flagSpecHash(FlagType eType);
+
+// ---------- Implementations ----------
+
+// The built-in flags, numbered as the FlagType enumerators. Every pixel is the same as
+// in the original hand-written drawing code:
+//  - AUSTRIA: the white band is the rows strictly between H/3 and 2*(H/3)
+//  - JAPAN:   a red disc of radius 0.3 * H around (H/2, W/2), exact Euclidean test
+//  - NIGERIA: the white band is the columns strictly between W/3 and 2*(W/3)
+static const char* BUILTIN_FLAGS = R"(
+flag AUSTRIA
+background #EF3340
+rect 1/3+1 0 2/3 1 #FFFFFF
+
+flag JAPAN
+background #FFFFFF
+circle 1/2 1/2 0.3h #BC002D
+
+flag NIGERIA
+background #1B7339
+rect 0 1/3+1 1 2/3 #FFFFFF
+)";
+
+int FlagCoord::resolve(int intLength) const
+{
+    long long intValue = static_cast<long long>(intNum) * (intLength / intDen) + intOffset;
+    return static_cast<int>(std::clamp<long long>(intValue, 0, intLength));
+}
+
+// registry: built-ins first, at first use. A deque keeps every entry at a fixed address.
+static std::deque<FlagSpec>& registry()
+{
+    static std::deque<FlagSpec> deqFlags = []
+    {
+        std::istringstream issBuiltin(BUILTIN_FLAGS);
+        std::vector<FlagSpec> vecBuiltin = parseFlags(issBuiltin, "built-in flags");
+        return std::deque<FlagSpec>(vecBuiltin.begin(), vecBuiltin.end());
+    }();
+    return deqFlags;
+}
+
+static std::string upperCase(std::string strText)
+{
+    for(char& chValue : strText)
+        chValue = static_cast<char>(std::toupper(static_cast<unsigned char>(chValue)));
+    return strText;
+}
+
+static bool isHexDigit(char chValue)
+{
+    return std::isxdigit(static_cast<unsigned char>(chValue)) != 0;
+}
+
+static bool isDigit(char chValue)
+{
+    return std::isdigit(static_cast<unsigned char>(chValue)) != 0;
+}
+
+// isFlagName: names end up in file names (RenderCache) and must not look like a FlagType number.
+static bool isFlagName(const std::string& strName)
+{
+    bool blnLetter = false;
+    for(char chValue : strName)
+    {
+        if(!std::isalnum(static_cast<unsigned char>(chValue)) && chValue != '_' && chValue != '-')
+            return false;
+        blnLetter = blnLetter || !isDigit(chValue);
+    }
+    return blnLetter;
+}
+
+// stripComment: strLine without its comment (see the format at the top).
+static std::string stripComment(const std::string& strLine)
+{
+    std::size_t intFirst = strLine.find_first_not_of(" \t");
+    if(intFirst != std::string::npos && strLine[intFirst] == '#')
+        return "";
+    for(std::size_t i = 0; i < strLine.size(); ++i)
+    {
+        if(strLine[i] == '#' && (i + 1 == strLine.size() || std::isspace(static_cast<unsigned char>(strLine[i + 1]))))
+            return strLine.substr(0, i);
+    }
+    return strLine;
+}
+
+[[noreturn]] static void failFlagLine(const std::string& strSource, int intLine, const std::string& strReason)
+{
+    std::cerr << "ERROR! " << strSource << " line " << intLine << ": " << strReason << ". Terminating." << std::endl;
+    std::exit(ERROR_ARGS);
+}
+
+// parseColour: #RRGGBB
+static bool parseColour(const std::string& strText, UJPixel& recColour)
+{
+    if(strText.size() != 7 || strText[0] != '#' || !std::all_of(strText.begin() + 1, strText.end(), isHexDigit))
+        return false;
+    unsigned long intValue = std::stoul(strText.substr(1), nullptr, 16);
+    recColour = {static_cast<std::uint8_t>(intValue >> 16), static_cast<std::uint8_t>(intValue >> 8), static_cast<std::uint8_t>(intValue)};
+    return true;
+}
+
+// parseInt: a whole token of decimal digits (at most 9) into intValue.
+static bool parseInt(const std::string& strText, int& intValue)
+{
+    if(strText.empty() || strText.size() > 9 || !std::all_of(strText.begin(), strText.end(), isDigit))
+        return false;
+    intValue = std::stoi(strText);
+    return true;
+}
+
+// parseCoord: k/n, k/n+p, k/n-p, 0 or 1 (see the format at the top).
+static bool parseCoord(const std::string& strText, FlagCoord& recCoord)
+{
+    recCoord = FlagCoord{};
+    std::size_t intSign = strText.find_first_of("+-");
+    std::string strFraction = strText.substr(0, intSign);
+    if(intSign != std::string::npos)
+    {
+        if(!parseInt(strText.substr(intSign + 1), recCoord.intOffset))
+            return false;
+        if(strText[intSign] == '-')
+            recCoord.intOffset = -recCoord.intOffset;
+    }
+    std::size_t intSlash = strFraction.find('/');
+    if(intSlash == std::string::npos)
+        return (strFraction == "0" || strFraction == "1") && parseInt(strFraction, recCoord.intNum);
+    return parseInt(strFraction.substr(0, intSlash), recCoord.intNum)
+        && parseInt(strFraction.substr(intSlash + 1), recCoord.intDen)
+        && recCoord.intDen > 0 && recCoord.intNum <= recCoord.intDen;
+}
+
+// MAX_RADIUS: the largest circle radius, times the height (or width), a few times the diagonal
+// of any flag-shaped image. It keeps pixel radii far from int overflow when rasterizing.
+static constexpr int MAX_RADIUS = 4;
+
+// parseRadius: <fraction>h or <fraction>w, the fraction a plain non-negative decimal.
+static bool parseRadius(const std::string& strText, FlagShape& recShape)
+{
+    if(strText.size() < 2 || (strText.back() != 'h' && strText.back() != 'w'))
+        return false;
+    std::string strNumber = strText.substr(0, strText.size() - 1);
+    if(strNumber.find_first_not_of("0123456789.") != std::string::npos)
+        return false;
+    std::istringstream issNumber(strNumber);
+    issNumber >> recShape.dblRadius;
+    recShape.blnRadiusOfWidth = strText.back() == 'w';
+    return !issNumber.fail() && issNumber.eof();
+}
+
+std::vector<FlagSpec> parseFlags(std::istream& isSpec, const std::string& strSource)
+{
+    std::vector<FlagSpec> vecFlags;
+    int intErrorLine = 0;
+    std::string strError;
+    if(!tryParseFlags(isSpec, vecFlags, intErrorLine, strError))
+        failFlagLine(strSource, intErrorLine, strError);
+    return vecFlags;
+}
+
+bool tryParseFlags(std::istream& isSpec, std::vector<FlagSpec>& vecFlags, int& intErrorLine, std::string& strError)
+{
+    std::string strLine;
+    int intLine = 0;
+    auto fnFail = [&](const std::string& strReason)
+    {
+        intErrorLine = intLine;
+        strError = strReason;
+        return false;
+    };
+    while(std::getline(isSpec, strLine))
+    {
+        ++intLine;
+        std::istringstream issLine(stripComment(strLine));
+        std::vector<std::string> vecWords;
+        for(std::string strWord; issLine >> strWord;)
+            vecWords.push_back(strWord);
+        if(vecWords.empty())
+            continue;
+
+        const std::string& strDirective = vecWords[0];
+        if(strDirective == "flag")
+        {
+            if(vecWords.size() != 2 || !isFlagName(vecWords[1]))
+                return fnFail("expected: flag <NAME> (letters, digits, '_' and '-', not only digits)");
+            FlagSpec recSpec;
+            recSpec.strName = upperCase(vecWords[1]);
+            vecFlags.push_back(recSpec);
+            continue;
+        }
+        if(vecFlags.empty())
+            return fnFail("'" + strDirective + "' before the first 'flag' line");
+        FlagSpec& recSpec = vecFlags.back();
+
+        FlagShape recShape;
+        if(strDirective == "background")
+        {
+            if(vecWords.size() != 2 || !parseColour(vecWords[1], recSpec.recBackground))
+                return fnFail("expected: background #RRGGBB");
+        }
+        else if(strDirective == "rect")
+        {
+            if(vecWords.size() != 6 || !parseCoord(vecWords[1], recShape.recTop) || !parseCoord(vecWords[2], recShape.recLeft)
+               || !parseCoord(vecWords[3], recShape.recBottom) || !parseCoord(vecWords[4], recShape.recRight)
+               || !parseColour(vecWords[5], recShape.recColour))
+                return fnFail("expected: rect <top> <left> <bottom> <right> #RRGGBB");
+            recSpec.vecShapes.push_back(recShape);
+        }
+        else if(strDirective == "circle")
+        {
+            recShape.eKind = SHAPE_CIRCLE;
+            if(vecWords.size() != 5 || !parseCoord(vecWords[1], recShape.recRow) || !parseCoord(vecWords[2], recShape.recCol)
+               || !parseRadius(vecWords[3], recShape) || !parseColour(vecWords[4], recShape.recColour))
+                return fnFail("expected: circle <row> <col> <radius>h|w #RRGGBB");
+            if(recShape.dblRadius > MAX_RADIUS)
+                return fnFail("the circle radius is at most " + std::to_string(MAX_RADIUS) + "h or "
+                              + std::to_string(MAX_RADIUS) + "w");
+            recSpec.vecShapes.push_back(recShape);
+        }
+        else if(strDirective == "hstripes" || strDirective == "vstripes")
+        {
+            int intBands = 0;
+            if(vecWords.size() < 3 || !parseInt(vecWords[1], intBands) || intBands < 1
+               || vecWords.size() != static_cast<std::size_t>(intBands) + 2)
+                return fnFail("expected: " + strDirective + " <n> followed by n colours");
+            // band i = [i/n, (i+1)/n), the last band ending at the edge (1/1)
+            for(int i = 0; i < intBands; ++i)
+            {
+                FlagShape recBand;
+                FlagCoord recBegin{i, intBands, 0};
+                FlagCoord recEnd = i + 1 == intBands ? FlagCoord{1, 1, 0} : FlagCoord{i + 1, intBands, 0};
+                bool blnHorizontal = strDirective == "hstripes";
+                recBand.recTop    = blnHorizontal ? recBegin : FlagCoord{0, 1, 0};
+                recBand.recBottom = blnHorizontal ? recEnd : FlagCoord{1, 1, 0};
+                recBand.recLeft   = blnHorizontal ? FlagCoord{0, 1, 0} : recBegin;
+                recBand.recRight  = blnHorizontal ? FlagCoord{1, 1, 0} : recEnd;
+                if(!parseColour(vecWords[i + 2], recBand.recColour))
+                    return fnFail("colours are #RRGGBB");
+                recSpec.vecShapes.push_back(recBand);
+            }
+        }
+        else
+            return fnFail("unknown directive '" + strDirective + "'");
+    }
+    return true;
+}
+
+FlagType addFlag(FlagSpec recSpec)
+{
+    FlagType eExisting = AUSTRIA;
+    if(findFlag(recSpec.strName, eExisting))
+    {
+        std::cerr << "ERROR! Flag " << recSpec.strName << " is defined twice. Terminating." << std::endl;
+        std::exit(ERROR_ARGS);
+    }
+    registry().push_back(std::move(recSpec));
+    return static_cast<FlagType>(registry().size() - 1);
+}
+
+void loadFlagFile(const std::string& strPath)
+{
+    std::ifstream ifsSpec(strPath);
+    if(!ifsSpec)
+    {
+        std::cerr << "ERROR! Could not open flag file " << strPath << ". Terminating." << std::endl;
+        std::exit(ERROR_ARGS);
+    }
+    for(FlagSpec& recSpec : parseFlags(ifsSpec, strPath))
+        addFlag(std::move(recSpec));
+}
+
+int flagCount()
+{
+    return static_cast<int>(registry().size());
+}
+
+bool isValidFlag(int intFlag)
+{
+    return intFlag >= 0 && intFlag < flagCount();
+}
+
+const FlagSpec& flagSpec(FlagType eType)
+{
+    return registry()[static_cast<std::size_t>(eType)];
+}
+
+const std::string& flagTypeName(FlagType eType)
+{
+    static const std::string strUnknown = "UNKNOWN";
+    return isValidFlag(eType) ? registry()[static_cast<std::size_t>(eType)].strName : strUnknown;
+}
+
+bool findFlag(const std::string& strName, FlagType& eType)
+{
+    std::string strWanted = upperCase(strName);
+    const std::deque<FlagSpec>& deqFlags = registry();
+    for(std::size_t i = 0; i < deqFlags.size(); ++i)
+    {
+        if(deqFlags[i].strName == strWanted)
+        {
+            eType = static_cast<FlagType>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+std::uint64_t flagSpecHash(FlagType eType)
+{
+    const FlagSpec& recSpec = flagSpec(eType);
+    std::uint64_t intHash = 14695981039346656037ull;
+    auto fnMix = [&intHash](std::uint64_t intValue)
+    {
+        for(int b = 0; b < 8; ++b, intValue >>= 8)
+        {
+            intHash ^= intValue & 0xFF;
+            intHash *= 1099511628211ull;
+        }
+    };
+    auto fnMixColour = [&fnMix](const UJPixel& recColour)
+    {
+        fnMix(static_cast<std::uint64_t>(recColour.intRed) << 16 | static_cast<std::uint64_t>(recColour.intGreen) << 8 | recColour.intBlue);
+    };
+    auto fnMixCoord = [&fnMix](const FlagCoord& recCoord)
+    {
+        for(int intPart : {recCoord.intNum, recCoord.intDen, recCoord.intOffset})
+            fnMix(static_cast<std::uint32_t>(intPart));
+    };
+
+    fnMixColour(recSpec.recBackground);
+    fnMix(recSpec.vecShapes.size());
+    for(const FlagShape& recShape : recSpec.vecShapes)
+    {
+        fnMix(static_cast<std::uint64_t>(recShape.eKind));
+        for(const FlagCoord* pCoord : {&recShape.recTop, &recShape.recLeft, &recShape.recBottom, &recShape.recRight,
+                                       &recShape.recRow, &recShape.recCol})
+            fnMixCoord(*pCoord);
+        fnMix(std::bit_cast<std::uint64_t>(recShape.dblRadius));
+        fnMix(recShape.blnRadiusOfWidth ? 1 : 0);
+        fnMixColour(recShape.recColour);
+    }
+    return intHash;
+}
@@ -0,0 +1,406 @@
+// FlagRasterizer.cpp turns a flag description (FlagLibrary) into horizontal runs of constant colour.
+// Responsibilities:
+//  - compile a FlagSpec for one image size into a run table: for every row, the runs that
+//    make it up, left to right
+//  - keep the tables of recently used (flag, size) pairs, at most TABLE_CACHE_ENTRIES of them
+//    and TABLE_CACHE_BYTES together, so repeated renders (batch jobs, server requests)
+//    compile each table once
+//  - fill a row of pixels from its runs with the bulk fill kernel (fillPixels)
+//  - optionally anti-alias circle edges (see circleRunsAA)
+//
+// A row is built by painting the intervals that the shapes cover in that row over the
+// background, in order, then merging neighbouring runs of the same colour. Most flags
+// have very few distinct rows (stripes: one per band), and consecutive identical rows
+// share their runs, so a table is one small index per row plus a short list of runs.
+//
+// Anti-aliasing: rect edges always fall on pixel boundaries, only circles have curved
+// edges. In anti-aliased tables every pixel a circle edge passes through gets its own
+// run, blended by the fraction of the pixel the circle covers; the inside of the circle
+// stays one run, so the fill cost hardly changes. Coverage is that of 16 x 16 sub-samples
+// per pixel, computed per sub-row in closed form, and only for the few pixels per row
+// between the innermost and outermost reach of the circle in that row.
+//
+// Important invariants:
+//  - the runs of a row are left to right, non-empty and cover [0, width) exactly
+//  - without anti-aliasing, the built-in flags are pixel-identical to the original
+//    per-pixel predicates
+//  - tables are immutable once built; any number of threads may share one
+
+module;
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <tuple>
+#include <vector>
+
+export module FlagRasterizer;
+
+import LibUtility;
+import FlagLibrary;
+import PixelKernels;
+
+// PixelRun: columns [intBegin, intEnd) of one row share recColour.
+export struct PixelRun
+{
+    int intBegin;
+    int intEnd;
+    UJPixel recColour;
+};
+
+// RunTable: the compiled runs of one flag at one size (defined below).
+struct RunTable;
+
+export class FlagRasterizer
+{
+public:
+    // Exits with ERROR_ARGS if eType is not a registered flag. blnAntiAlias blends the pixels
+    // on circle edges by how much of them the circle covers (hard edges otherwise).
+    FlagRasterizer(FlagType eType, int intHeight, int intWidth, bool blnAntiAlias = false);
+
+    // rowRuns: the runs of row intRow (valid as long as this rasterizer or a copy of it lives).
+    std::span<const PixelRun> rowRuns(int intRow) const;
+    // fillRow: paints row intRow into arrRow (which must be getWidth() pixels long).
+    void fillRow(int intRow, std::span<UJPixel> arrRow) const;
+
+    int getHeight() const;
+    int getWidth()  const;
+
+private:
+    std::shared_ptr<const RunTable> _table;
+    int _rows;
+    int _cols;
+};
+
+// ---------- Implementations ----------
+
+// Row r of a RunTable is vecRuns[vecRows[vecRowIndex[r]].intFirst ...] (intCount runs).
+struct RunTable
+{
+    struct RowRef
+    {
+        std::uint32_t intFirst;
+        std::uint32_t intCount;
+    };
+    std::vector<std::uint32_t> vecRowIndex; // one per image row
+    std::vector<RowRef> vecRows;            // distinct rows
+    std::vector<PixelRun> vecRuns;
+};
+
+static constexpr std::size_t TABLE_CACHE_ENTRIES = 32;
+static constexpr std::size_t TABLE_CACHE_BYTES   = 16 << 20; // all cached tables together
+static constexpr std::size_t TABLE_CACHE_MAX     = 4 << 20;  // larger tables are not cached
+static constexpr int AA_SAMPLES  = 16;                       // sub-samples per pixel side
+static constexpr int AA_COVERAGE = AA_SAMPLES * AA_SAMPLES;  // coverage of a fully covered pixel
+
+static bool sameColour(const UJPixel& recA, const UJPixel& recB)
+{
+    return recA.intRed == recB.intRed && recA.intGreen == recB.intGreen && recA.intBlue == recB.intBlue;
+}
+
+// appendRun: adds a run to the end of vecRow, merged into the last one if it has the same colour.
+static void appendRun(std::vector<PixelRun>& vecRow, const PixelRun& recRun)
+{
+    if(!vecRow.empty() && sameColour(vecRow.back().recColour, recRun.recColour))
+        vecRow.back().intEnd = recRun.intEnd;
+    else
+        vecRow.push_back(recRun);
+}
+
+// paintRuns: replaces the columns of the row in vecRow that arrOverlay covers (a gap-free,
+// left to right list of runs) with arrOverlay. vecPainted is scratch space.
+static void paintRuns(std::vector<PixelRun>& vecRow, std::vector<PixelRun>& vecPainted, std::span<const PixelRun> arrOverlay)
+{
+    if(arrOverlay.empty())
+        return;
+    int intBegin = arrOverlay.front().intBegin;
+    int intEnd   = arrOverlay.back().intEnd;
+    vecPainted.clear();
+    bool blnAdded = false;
+    for(const PixelRun& recRun : vecRow)
+    {
+        if(recRun.intBegin < intBegin)
+            vecPainted.push_back({recRun.intBegin, std::min(recRun.intEnd, intBegin), recRun.recColour});
+        if(!blnAdded && recRun.intEnd > intBegin)
+        {
+            vecPainted.insert(vecPainted.end(), arrOverlay.begin(), arrOverlay.end());
+            blnAdded = true;
+        }
+        if(recRun.intEnd > intEnd)
+            vecPainted.push_back({std::max(recRun.intBegin, intEnd), recRun.intEnd, recRun.recColour});
+    }
+    // merge neighbours of the same colour
+    vecRow.clear();
+    for(const PixelRun& recRun : vecPainted)
+        appendRun(vecRow, recRun);
+}
+
+// paintRun: colours [intBegin, intEnd) of the row in vecRow with recColour.
+static void paintRun(std::vector<PixelRun>& vecRow, std::vector<PixelRun>& vecPainted, int intBegin, int intEnd, const UJPixel& recColour)
+{
+    if(intBegin < intEnd)
+    {
+        PixelRun recRun{intBegin, intEnd, recColour};
+        paintRuns(vecRow, vecPainted, {&recRun, 1});
+    }
+}
+
+// inCircle: the original per-pixel Euclidean distance test, kept bit-for-bit.
+static bool inCircle(int intDY, int intDX, double dblRadius)
+{
+    return std::sqrt(std::pow(intDX, 2) + std::pow(intDY, 2)) <= dblRadius;
+}
+
+// circleSpan: the columns [intBegin, intEnd) of row intRow inside the circle (empty if none).
+// Within one row the distance grows with |col - centre|, so the inside is the single run
+// |col - centre| <= k. k starts from the analytic half-chord sqrt(r^2 - dy^2) and is then
+// nudged with the exact per-pixel test, so rounding can never change a pixel. k never needs
+// to pass the far edge of the row (intReach), which keeps the casts and the nudging bounded
+// however large the radius is.
+static void circleSpan(int intRow, int intCentreRow, int intCentreCol, double dblRadius, int intCols, int& intBegin, int& intEnd)
+{
+    intBegin = intEnd = 0;
+    int intDY = intCentreRow - intRow;
+    if(!inCircle(intDY, 0, dblRadius))
+        return;
+
+    int intReach = std::max(intCentreCol, intCols - 1 - intCentreCol) + 1;
+    double dblChord = dblRadius * dblRadius - static_cast<double>(intDY) * intDY;
+    int intK = static_cast<int>(std::min(std::floor(std::sqrt(std::max(0.0, dblChord))), static_cast<double>(intReach)));
+    while(intK > 0 && !inCircle(intDY, intK, dblRadius))
+        --intK;
+    while(intK < intReach && inCircle(intDY, intK + 1, dblRadius))
+        ++intK;
+    intBegin = std::clamp(intCentreCol - intK, 0, intCols);
+    intEnd   = std::clamp(intCentreCol + intK + 1, 0, intCols);
+}
+
+// blend: recUnder covered intCoverage / AA_COVERAGE by recOver, rounded.
+static UJPixel blend(const UJPixel& recUnder, const UJPixel& recOver, int intCoverage)
+{
+    auto fnChannel = [intCoverage](int intUnder, int intOver)
+    {
+        return static_cast<std::uint8_t>((intUnder * (AA_COVERAGE - intCoverage) + intOver * intCoverage + AA_COVERAGE / 2) / AA_COVERAGE);
+    };
+    UJPixel recResult = recUnder;
+    recResult.intRed   = fnChannel(recUnder.intRed, recOver.intRed);
+    recResult.intGreen = fnChannel(recUnder.intGreen, recOver.intGreen);
+    recResult.intBlue  = fnChannel(recUnder.intBlue, recOver.intBlue);
+    return recResult;
+}
+
+// pixelCoverage: how many of the AA_SAMPLES^2 sub-samples of the pixel whose left edge is
+// dblLeft (relative to the centre column) lie inside the circle. arrHalfWidths holds the
+// circle's half-width at each sub-sample row (negative: the sub-row misses the circle), so
+// each sub-row is one closed-form count of the sub-sample columns in [-w, w]:
+// x_i = dblLeft + (i + 0.5) / AA_SAMPLES is inside iff ceil(a) <= i <= floor(b).
+static int pixelCoverage(double dblLeft, const double (&arrHalfWidths)[AA_SAMPLES])
+{
+    int intCovered = 0;
+    for(double dblHalfWidth : arrHalfWidths)
+    {
+        // clamped before the cast: a huge radius puts the bounds far outside [0, AA_SAMPLES)
+        int intFirst = static_cast<int>(std::clamp(std::ceil((-dblHalfWidth - dblLeft) * AA_SAMPLES - 0.5), -1.0, static_cast<double>(AA_SAMPLES)));
+        int intLast  = static_cast<int>(std::clamp(std::floor((dblHalfWidth - dblLeft) * AA_SAMPLES - 0.5), -1.0, static_cast<double>(AA_SAMPLES)));
+        intCovered += std::max(0, std::min(intLast, AA_SAMPLES - 1) - std::max(intFirst, 0) + 1);
+    }
+    return intCovered;
+}
+
+// circleRunsAA: the anti-aliased circle over row intRow of vecRow, as overlay runs in vecOverlay.
+// Pixel (row, col) is the unit square around its centre (row, col), as in inCircle().
+// Columns wholly inside the circle's narrowest reach in this row are one full-colour run;
+// only the pixels up to its widest reach are sampled, and blended over what is under them.
+static void circleRunsAA(const std::vector<PixelRun>& vecRow, int intRow, int intCentreRow, int intCentreCol, double dblRadius,
+                         int intCols, const UJPixel& recColour, std::vector<PixelRun>& vecOverlay)
+{
+    vecOverlay.clear();
+    double arrHalfWidths[AA_SAMPLES];
+    double dblOuter = -1.0;
+    double dblInner = dblRadius;
+    for(int j = 0; j < AA_SAMPLES; ++j)
+    {
+        double dblY = static_cast<double>(intRow - intCentreRow) - 0.5 + (j + 0.5) / AA_SAMPLES;
+        double dblChord = dblRadius * dblRadius - dblY * dblY;
+        arrHalfWidths[j] = dblChord >= 0.0 ? std::sqrt(dblChord) : -1.0;
+        dblOuter = std::max(dblOuter, arrHalfWidths[j]);
+        dblInner = std::min(dblInner, arrHalfWidths[j]);
+    }
+    if(dblOuter < 0.0 || intCols <= 0)
+        return;
+
+    // [intBegin, intEnd): every column that can be touched; [intFullBegin, intFullEnd): fully covered
+    double dblCentre = static_cast<double>(intCentreCol);
+    int intBegin = static_cast<int>(std::clamp(std::floor(dblCentre - dblOuter) - 1.0, 0.0, static_cast<double>(intCols)));
+    int intEnd   = static_cast<int>(std::clamp(std::ceil(dblCentre + dblOuter) + 2.0, 0.0, static_cast<double>(intCols)));
+    int intFullBegin = static_cast<int>(std::clamp(std::ceil(dblCentre - dblInner + 0.5), static_cast<double>(intBegin), static_cast<double>(intEnd)));
+    int intFullEnd   = static_cast<int>(std::clamp(std::floor(dblCentre + dblInner - 0.5) + 1.0, static_cast<double>(intFullBegin), static_cast<double>(intEnd)));
+
+    auto itUnder = vecRow.begin(); // the run under column c (columns are visited left to right)
+    for(int c = intBegin; c < intEnd; ++c)
+    {
+        if(c == intFullBegin && intFullBegin < intFullEnd)
+        {
+            appendRun(vecOverlay, {intFullBegin, intFullEnd, recColour});
+            c = intFullEnd - 1;
+            continue;
+        }
+        while(itUnder->intEnd <= c)
+            ++itUnder;
+        int intCoverage = pixelCoverage(static_cast<double>(c) - dblCentre - 0.5, arrHalfWidths);
+        UJPixel recPixel = intCoverage == 0 ? itUnder->recColour
+                         : intCoverage == AA_COVERAGE ? recColour : blend(itUnder->recColour, recColour, intCoverage);
+        appendRun(vecOverlay, {c, c + 1, recPixel});
+    }
+}
+
+// compileTable: the runs of every row of recSpec drawn at intRows x intCols.
+static std::shared_ptr<const RunTable> compileTable(const FlagSpec& recSpec, int intRows, int intCols, bool blnAntiAlias)
+{
+    auto pTable = std::make_shared<RunTable>();
+    pTable->vecRowIndex.resize(static_cast<std::size_t>(intRows));
+    std::vector<PixelRun> vecRow;
+    std::vector<PixelRun> vecScratch;
+    std::vector<PixelRun> vecOverlay;
+    for(int r = 0; r < intRows; ++r)
+    {
+        vecRow.clear();
+        if(intCols > 0)
+            vecRow.push_back({0, intCols, recSpec.recBackground});
+        for(const FlagShape& recShape : recSpec.vecShapes)
+        {
+            int intBegin = 0;
+            int intEnd = 0;
+            if(recShape.eKind == SHAPE_RECT)
+            {
+                if(r >= recShape.recTop.resolve(intRows) && r < recShape.recBottom.resolve(intRows))
+                {
+                    intBegin = recShape.recLeft.resolve(intCols);
+                    intEnd   = recShape.recRight.resolve(intCols);
+                }
+            }
+            else if(blnAntiAlias)
+            {
+                double dblRadius = recShape.dblRadius * static_cast<double>(recShape.blnRadiusOfWidth ? intCols : intRows);
+                circleRunsAA(vecRow, r, recShape.recRow.resolve(intRows), recShape.recCol.resolve(intCols), dblRadius, intCols,
+                             recShape.recColour, vecOverlay);
+                paintRuns(vecRow, vecScratch, vecOverlay);
+                continue;
+            }
+            else
+            {
+                double dblRadius = recShape.dblRadius * static_cast<double>(recShape.blnRadiusOfWidth ? intCols : intRows);
+                circleSpan(r, recShape.recRow.resolve(intRows), recShape.recCol.resolve(intCols), dblRadius, intCols, intBegin, intEnd);
+            }
+            paintRun(vecRow, vecScratch, intBegin, intEnd, recShape.recColour);
+        }
+
+        // consecutive identical rows share one entry
+        bool blnSame = false;
+        if(!pTable->vecRows.empty())
+        {
+            const RunTable::RowRef& recLast = pTable->vecRows.back();
+            blnSame = recLast.intCount == vecRow.size()
+                   && std::equal(vecRow.begin(), vecRow.end(), pTable->vecRuns.begin() + recLast.intFirst,
+                                 [](const PixelRun& recA, const PixelRun& recB)
+                                 {
+                                     return recA.intBegin == recB.intBegin && recA.intEnd == recB.intEnd
+                                         && sameColour(recA.recColour, recB.recColour);
+                                 });
+        }
+        if(!blnSame)
+        {
+            pTable->vecRows.push_back({static_cast<std::uint32_t>(pTable->vecRuns.size()), static_cast<std::uint32_t>(vecRow.size())});
+            pTable->vecRuns.insert(pTable->vecRuns.end(), vecRow.begin(), vecRow.end());
+        }
+        pTable->vecRowIndex[static_cast<std::size_t>(r)] = static_cast<std::uint32_t>(pTable->vecRows.size() - 1);
+    }
+    pTable->vecRows.shrink_to_fit(); // the table lives on in the cache
+    pTable->vecRuns.shrink_to_fit();
+    return pTable;
+}
+
+// TableCacheEntry: one table in the cache of cachedTable().
+struct TableCacheEntry
+{
+    FlagType eType;
+    int intRows;
+    int intCols;
+    bool blnAntiAlias;
+    std::shared_ptr<const RunTable> pTable;
+    std::size_t intBytes;
+};
+
+// tableBytes: the heap memory a table holds.
+static std::size_t tableBytes(const RunTable& recTable)
+{
+    return recTable.vecRowIndex.capacity() * sizeof(std::uint32_t) + recTable.vecRows.capacity() * sizeof(RunTable::RowRef)
+         + recTable.vecRuns.capacity() * sizeof(PixelRun);
+}
+
+// cachedTable: the table of (eType, intRows, intCols, blnAntiAlias), compiled on a miss. The cache keeps
+// the most recently compiled tables, up to TABLE_CACHE_ENTRIES and TABLE_CACHE_BYTES; a table over
+// TABLE_CACHE_MAX (a very tall or anti-aliased image, a flag with many shapes) is not kept at all,
+// so in batch and server mode the cache never holds more than TABLE_CACHE_BYTES.
+// Rasterizers hold their own reference, so dropping an entry never invalidates a table in use.
+static std::shared_ptr<const RunTable> cachedTable(FlagType eType, int intRows, int intCols, bool blnAntiAlias)
+{
+    static std::mutex mtxCache;
+    static std::deque<TableCacheEntry> deqCache; // oldest first
+    static std::size_t intCachedBytes = 0;       // guarded by mtxCache
+
+    {
+        std::lock_guard<std::mutex> lckCache(mtxCache);
+        for(const TableCacheEntry& recEntry : deqCache)
+        {
+            if(std::tie(recEntry.eType, recEntry.intRows, recEntry.intCols, recEntry.blnAntiAlias) == std::tie(eType, intRows, intCols, blnAntiAlias))
+                return recEntry.pTable;
+        }
+    }
+    // compiled outside the lock; two threads missing at once just build the same table twice
+    std::shared_ptr<const RunTable> pTable = compileTable(flagSpec(eType), intRows, intCols, blnAntiAlias);
+    std::size_t intBytes = tableBytes(*pTable);
+    if(intBytes > TABLE_CACHE_MAX)
+        return pTable;
+    std::lock_guard<std::mutex> lckCache(mtxCache);
+    while(!deqCache.empty() && (deqCache.size() == TABLE_CACHE_ENTRIES || intCachedBytes + intBytes > TABLE_CACHE_BYTES))
+    {
+        intCachedBytes -= deqCache.front().intBytes;
+        deqCache.pop_front();
+    }
+    deqCache.push_back({eType, intRows, intCols, blnAntiAlias, pTable, intBytes});
+    intCachedBytes += intBytes;
+    return pTable;
+}
+
+FlagRasterizer::FlagRasterizer(FlagType eType, int intHeight, int intWidth, bool blnAntiAlias)
+: _rows(intHeight), _cols(intWidth)
+{
+    if(!isValidFlag(eType))
+    {
+        std::cerr << "ERROR! FlagType " << static_cast<int>(eType) << " must be within [0, " << flagCount() - 1 << "]. Terminating." << std::endl;
+        std::exit(ERROR_ARGS);
+    }
+    _table = cachedTable(eType, intHeight, intWidth, blnAntiAlias);
+}
+
+int FlagRasterizer::getHeight() const { return _rows; }
+int FlagRasterizer::getWidth()  const { return _cols; }
+
+std::span<const PixelRun> FlagRasterizer::rowRuns(int intRow) const
+{
+    const RunTable::RowRef& recRow = _table->vecRows[_table->vecRowIndex[static_cast<std::size_t>(intRow)]];
+    return {_table->vecRuns.data() + recRow.intFirst, recRow.intCount};
+}
+
+void FlagRasterizer::fillRow(int intRow, std::span<UJPixel> arrRow) const
+{
+    for(const PixelRun& recRun : rowRuns(intRow))
+        fillPixels(arrRow.subspan(static_cast<std::size_t>(recRun.intBegin), static_cast<std::size_t>(recRun.intEnd - recRun.intBegin)), recRun.recColour);
+}
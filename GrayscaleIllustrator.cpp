@@ -1,54 +1,118 @@
 // GrayscaleIllustrator.cpp is a derived class that converts colour pixels to an average-intensity grayscale
-// value and outputs in the P2 (PGM) text format.
+// value and outputs in the P2 (PGM) text format, or binary P5 when the export mode is BINARY.
+// The per-pixel average (R + G + B) / 3 runs row by row in the PixelKernels module (SIMD where available);
+// a procedural flag is encoded by the fused pipeline GrayValues + RawBytes / DecimalText (RenderPipeline).
 
 module;
-#include <sstream>
+#include <cstddef>
+#include <cstdint>
+#include <span>
 #include <string>
+#include <utility>
+#include <vector>
 
 export module GrayscaleIllustrator;
 
 import LibUtility;
 import FlagIllustrator;
+import UJImage;
+import ImageSink;
+import TextEncoder;
+import PixelKernels;
+import FlagRasterizer;
+import RenderPipeline;
 
 export class GrayscaleIllustrator : public FlagIllustrator
 {
 public:
     GrayscaleIllustrator();
     GrayscaleIllustrator(int intHeight, int intWidth);
+    explicit GrayscaleIllustrator(UJImage objImage); // adopts objImage (see FlagIllustrator)
+
+    // Override exportImage to provide P2 / P5 output (grayscale).
+    using FlagIllustrator::exportImage;
+    void exportImage(ImageSink& objSink) const override;
+    std::size_t exportSize() const override;
+    // exportReserve: P2 as at most "255 " per value plus the newlines, without the exact pass.
+    std::size_t exportReserve() const override;
+    std::string formatHeader(int intHeight, int intWidth) const override;
+    // P2: intensities as text; P5: one intensity byte per pixel.
+    void encodeRow(std::span<const UJPixel> arrRow, RowScratch& recScratch, ImageSink& objSink) const override;
+
+protected:
+    bool exportRuns(const FlagRasterizer& objRaster, ImageSink& objSink, int intRowBegin, int intRowEnd) const override;
 
-    // Override exportImage to provide P2 output (grayscale).
-    std::string exportImage() const override;
 private:
-    int average(const UJPixel& recPixel) const; // integer average of RGB
+    // Intensities of one row, written into vecOut (resized to the row width).
+    static void rowIntensities(std::span<const UJPixel> arrRow, std::vector<std::uint8_t>& vecOut);
 };
 
 GrayscaleIllustrator::GrayscaleIllustrator() : FlagIllustrator() {}
 GrayscaleIllustrator::GrayscaleIllustrator(int intHeight, int intWidth)
 : FlagIllustrator(intHeight, intWidth) {}
+GrayscaleIllustrator::GrayscaleIllustrator(UJImage objImage)
+: FlagIllustrator(std::move(objImage)) {}
+
+// Convert each pixel to an intensity 0..255 and write P2 / P5 format, one row at a time.
+void GrayscaleIllustrator::exportImage(ImageSink& objSink) const
+{
+    objSink.write(exportHeader());
+    exportRows(objSink, 0, getHeight());
+}
+
+std::string GrayscaleIllustrator::formatHeader(int intHeight, int intWidth) const
+{
+    return pnmHeader(_eMode == BINARY ? "P5" : "P2", intWidth, intHeight, 255); // max intensity
+}
+
+void GrayscaleIllustrator::encodeRow(std::span<const UJPixel> arrRow, RowScratch& recScratch, ImageSink& objSink) const
+{
+    rowIntensities(arrRow, recScratch.vecBytes);
+    if(_eMode == BINARY)
+        objSink.write(reinterpret_cast<const char*>(recScratch.vecBytes.data()), recScratch.vecBytes.size());
+    else
+        writeTextRow(recScratch.vecBytes, recScratch.vecText, objSink);
+}
+
+bool GrayscaleIllustrator::exportRuns(const FlagRasterizer& objRaster, ImageSink& objSink, int intRowBegin, int intRowEnd) const
+{
+    if(_eMode == BINARY)
+        encodeFused<GrayValues, RawBytes>(objRaster, objSink, intRowBegin, intRowEnd);
+    else
+        encodeFused<GrayValues, DecimalText>(objRaster, objSink, intRowBegin, intRowEnd);
+    return true;
+}
 
-// Convert each pixel to an intensity 0..255 and write P2 format.
-std::string GrayscaleIllustrator::exportImage() const
+// exportSize: P5 is one byte per pixel; P2 needs the text length of every intensity.
+std::size_t GrayscaleIllustrator::exportSize() const
 {
-    std::stringstream ssPGM;
-    ssPGM << "P2" << std::endl
-          << _image->getWidth() << ' ' << _image->getHeight() << std::endl
-          << 255 << std::endl; // max intensity
+    int intWidth  = getWidth();
+    int intHeight = getHeight();
+    if(_eMode == BINARY)
+        return pnmHeader("P5", intWidth, intHeight, 255).size() + static_cast<std::size_t>(intWidth) * static_cast<std::size_t>(intHeight);
 
-    for(int r = 0; r < _image->getHeight(); ++r)
+    std::size_t intSize = pnmHeader("P2", intWidth, intHeight, 255).size() + static_cast<std::size_t>(intHeight);
+    std::vector<UJPixel> vecRow;
+    std::vector<std::uint8_t> vecIntensity;
+    for(int r = 0; r < intHeight; ++r)
     {
-        for(int c = 0; c < _image->getWidth(); ++c)
-        {
-            int intIntensity = average(_image->getPixel(r, c));
-            ssPGM << intIntensity << ' ';
-        }
-        ssPGM << std::endl;
+        rowIntensities(pixelRow(r, vecRow), vecIntensity);
+        intSize += textSize(vecIntensity);
     }
-    return ssPGM.str();
+    return intSize;
 }
 
-// average: (R + G + B) / 3
-// Using integer arithmetic is fine for PGM (0..255).
-int GrayscaleIllustrator::average(const UJPixel& recPixel) const
+std::size_t GrayscaleIllustrator::exportReserve() const
 {
-    return (recPixel.intRed + recPixel.intGreen + recPixel.intBlue) / 3;
-}
\ No newline at end of file
+    if(_eMode == BINARY)
+        return exportSize(); // closed form
+    std::size_t intRowBytes = static_cast<std::size_t>(getWidth()) * TEXT_BYTES_PER_VALUE + 1;
+    return pnmHeader("P2", getWidth(), getHeight(), 255).size() + static_cast<std::size_t>(getHeight()) * intRowBytes;
+}
+
+// rowIntensities: (R + G + B) / 3 for every pixel of the row, integer division.
+void GrayscaleIllustrator::rowIntensities(std::span<const UJPixel> arrRow, std::vector<std::uint8_t>& vecOut)
+{
+    vecOut.resize(arrRow.size());
+    rowToGray(arrRow, vecOut.data());
+}
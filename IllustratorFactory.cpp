@@ -0,0 +1,94 @@
+// IllustratorFactory.cpp creates concrete illustrators from an IllustratorType.
+// Responsibilities:
+//  - one place that maps IllustratorType -> ColourIllustrator / GrayscaleIllustrator / BWIllustrator /
+//    QOIIllustrator / PNGIllustrator
+//  - printable names for reports
+//
+// Callers get a std::unique_ptr<FlagIllustrator>, so the object is used polymorphically
+// and deleted through the virtual destructor automatically.
+
+module;
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <utility>
+
+export module IllustratorFactory;
+
+import LibUtility;
+import FlagIllustrator;
+import UJImage;
+import ColourIllustrator;
+import GrayscaleIllustrator;
+import BWIllustrator;
+import QOIIllustrator;
+import PNGIllustrator;
+
+// createIllustrator: new illustrator of the given type and size.
+// Exits with ERROR_CONV for an unknown type (matches main's handling).
+export std::unique_ptr<FlagIllustrator> createIllustrator(IllustratorType eType, int intHeight, int intWidth);
+// Same, around an existing image (moved in, pixels not copied), e.g. one released by
+// another illustrator to export it in a second format without drawing it again.
+export std::unique_ptr<FlagIllustrator> createIllustrator(IllustratorType eType, UJImage objImage);
+
+// illustratorTypeName: "Colour", "Grayscale", "BW", "QOI" or "PNG".
+export const char* illustratorTypeName(IllustratorType eType);
+
+// illustratorExtension: the file extension of its output, ".ppm", ".pgm", ".pbm", ".qoi" or ".png".
+export const char* illustratorExtension(IllustratorType eType);
+
+// ---------- Implementations ----------
+
+std::unique_ptr<FlagIllustrator> createIllustrator(IllustratorType eType, int intHeight, int intWidth)
+{
+    switch(eType)
+    {
+        case COLOUR:    return std::make_unique<ColourIllustrator>(intHeight, intWidth);    // P3 / P6
+        case GRAYSCALE: return std::make_unique<GrayscaleIllustrator>(intHeight, intWidth); // P2 / P5
+        case BW:        return std::make_unique<BWIllustrator>(intHeight, intWidth);        // P1 / P4
+        case QOI:       return std::make_unique<QOIIllustrator>(intHeight, intWidth);
+        case PNG:       return std::make_unique<PNGIllustrator>(intHeight, intWidth);
+    }
+    std::cerr << "ERROR! Invalid IllustratorType. Terminating." << std::endl;
+    std::exit(ERROR_CONV);
+}
+
+std::unique_ptr<FlagIllustrator> createIllustrator(IllustratorType eType, UJImage objImage)
+{
+    switch(eType)
+    {
+        case COLOUR:    return std::make_unique<ColourIllustrator>(std::move(objImage));
+        case GRAYSCALE: return std::make_unique<GrayscaleIllustrator>(std::move(objImage));
+        case BW:        return std::make_unique<BWIllustrator>(std::move(objImage));
+        case QOI:       return std::make_unique<QOIIllustrator>(std::move(objImage));
+        case PNG:       return std::make_unique<PNGIllustrator>(std::move(objImage));
+    }
+    std::cerr << "ERROR! Invalid IllustratorType. Terminating." << std::endl;
+    std::exit(ERROR_CONV);
+}
+
+const char* illustratorTypeName(IllustratorType eType)
+{
+    switch(eType)
+    {
+        case COLOUR:    return "Colour";
+        case GRAYSCALE: return "Grayscale";
+        case BW:        return "BW";
+        case QOI:       return "QOI";
+        case PNG:       return "PNG";
+    }
+    return "Unknown";
+}
+
+const char* illustratorExtension(IllustratorType eType)
+{
+    switch(eType)
+    {
+        case COLOUR:    return ".ppm";
+        case GRAYSCALE: return ".pgm";
+        case BW:        return ".pbm";
+        case QOI:       return ".qoi";
+        case PNG:       return ".png";
+    }
+    return ".img";
+}
@@ -0,0 +1,190 @@
+// ImageSink.cpp is a small output module used by the exporters to stream encoded images.
+// Responsibilities:
+//  - collect encoded bytes in one fixed-size chunk buffer
+//  - hand each full chunk to a writer: a std::ostream, a raw file descriptor or a user callback
+//  - pass large blocks (bigger than a chunk) straight to the writer without copying
+//  - or, over a fixed memory range (e.g. part of a mapped file), store bytes directly in it
+//
+// Important invariants:
+//  - memory used by a sink is bounded by its chunk size, however large the image is
+//  - flush() (also called by the destructor) writes whatever is still buffered
+//  - a memory sink has no chunk buffer; writing past the end of its range is a failed write
+//  - a failed write is fatal: exit(ERROR_IO), matching the rest of the project
+
+module;
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <ostream>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+export module ImageSink;
+
+import LibUtility;
+import Metrics;
+
+export class ImageSink
+{
+public:
+    // Writer: receives each chunk of encoded bytes, in order.
+    using Writer = std::function<void(const char* pData, std::size_t intSize)>;
+
+    explicit ImageSink(std::ostream& osOut, std::size_t intChunkSize = DEF_CHUNK_SIZE);
+    explicit ImageSink(int intFd, std::size_t intChunkSize = DEF_CHUNK_SIZE);
+    explicit ImageSink(Writer fnWriter, std::size_t intChunkSize = DEF_CHUNK_SIZE);
+    explicit ImageSink(std::span<char> arrTarget); // bytes go straight into arrTarget, in order
+    ImageSink(const ImageSink&) = delete;            // a sink owns its position in the stream
+    ImageSink& operator=(const ImageSink&) = delete;
+    ~ImageSink();                                    // flushes
+
+    void write(const char* pData, std::size_t intSize);
+    void write(std::string_view strData);
+    void put(char chValue);
+    void flush();
+
+    // Total bytes accepted so far (buffered or already written).
+    std::size_t bytesWritten() const;
+
+    static constexpr std::size_t DEF_CHUNK_SIZE = 64 * 1024;
+
+private:
+    Writer _fnWriter;
+    std::vector<char> _buffer; // fixed capacity = chunk size
+    std::size_t _used  = 0;    // bytes currently buffered
+    std::size_t _total = 0;    // bytes accepted overall
+    std::span<char> _target;   // memory sink only
+    bool _blnDirect = false;
+};
+
+// ---------- Implementations ----------
+
+// failWrite: the output went away (closed pipe, full disk, ...); nothing sensible to do but stop.
+static void failWrite()
+{
+    std::cerr << "ERROR! Could not write image output. Terminating." << std::endl;
+    std::exit(ERROR_IO);
+}
+
+ImageSink::ImageSink(std::ostream& osOut, std::size_t intChunkSize)
+: ImageSink(Writer([&osOut](const char* pData, std::size_t intSize)
+  {
+      osOut.write(pData, static_cast<std::streamsize>(intSize));
+      if(!osOut)
+          failWrite();
+  }), intChunkSize)
+{}
+
+ImageSink::ImageSink(int intFd, std::size_t intChunkSize)
+: ImageSink(Writer([intFd](const char* pData, std::size_t intSize)
+  {
+      // write() may accept less than asked for: loop until the chunk is out.
+      while(intSize > 0)
+      {
+#ifdef _WIN32
+          int intDone = _write(intFd, pData, static_cast<unsigned>(std::min<std::size_t>(intSize, 1u << 30)));
+#else
+          ssize_t intDone = ::write(intFd, pData, intSize);
+          if(intDone < 0 && errno == EINTR)
+              continue;
+#endif
+          if(intDone <= 0)
+              failWrite();
+          pData   += intDone;
+          intSize -= static_cast<std::size_t>(intDone);
+      }
+  }), intChunkSize)
+{}
+
+ImageSink::ImageSink(Writer fnWriter, std::size_t intChunkSize)
+: _fnWriter(std::move(fnWriter)), _buffer(std::max<std::size_t>(intChunkSize, 1))
+{}
+
+ImageSink::ImageSink(std::span<char> arrTarget)
+: _target(arrTarget), _blnDirect(true)
+{}
+
+ImageSink::~ImageSink()
+{
+    flush();
+}
+
+// write: buffer small pieces, send anything at least a chunk long straight through.
+void ImageSink::write(const char* pData, std::size_t intSize)
+{
+    if(_blnDirect)
+    {
+        if(intSize > _target.size() - _total)
+            failWrite();
+        std::copy_n(pData, intSize, _target.data() + _total);
+        _total += intSize;
+        return;
+    }
+    _total += intSize;
+    if(_used + intSize <= _buffer.size())
+    {
+        std::copy_n(pData, intSize, _buffer.data() + _used);
+        _used += intSize;
+        return;
+    }
+
+    // Top up the current chunk first so chunks stay full, then decide.
+    std::size_t intFill = _buffer.size() - _used;
+    std::copy_n(pData, intFill, _buffer.data() + _used);
+    _used = _buffer.size();
+    pData   += intFill;
+    intSize -= intFill;
+    flush();
+
+    if(intSize >= _buffer.size())
+    {
+        StageTimer objTimer(STAGE_WRITE);
+        _fnWriter(pData, intSize); // bulk data: no point copying it through the buffer
+        return;
+    }
+    std::copy_n(pData, intSize, _buffer.data());
+    _used = intSize;
+}
+
+void ImageSink::write(std::string_view strData)
+{
+    write(strData.data(), strData.size());
+}
+
+void ImageSink::put(char chValue)
+{
+    if(_blnDirect)
+    {
+        write(&chValue, 1);
+        return;
+    }
+    if(_used == _buffer.size())
+        flush();
+    _buffer[_used++] = chValue;
+    ++_total;
+}
+
+void ImageSink::flush()
+{
+    if(_used > 0)
+    {
+        StageTimer objTimer(STAGE_WRITE);
+        _fnWriter(_buffer.data(), _used);
+        _used = 0;
+    }
+}
+
+std::size_t ImageSink::bytesWritten() const
+{
+    return _total;
+}
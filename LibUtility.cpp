@@ -1,15 +1,23 @@
 // LibUtility.cpp is  a small utility module used across the project.
 // Exports:
-//  - UJPixel (pixel struct)
+//  - UJPixel (packed 8-bit-per-channel pixel struct)
 //  - ExitCode (enum used as return codes)
-//  - FlagType (enum of supported flags)
+//  - FlagType (number of a flag; the enumerators are the built-in flags)
+//  - IllustratorType (which concrete illustrator to use) and isCompressed
+//  - ExportMode (ASCII or binary PNM output)
+//  - DitherMode (how the BW formats turn colours into black and white)
+//  - MAX_DIMENSION (largest accepted image height / width)
+//  - MAX_GRID_PIXELS (largest image that is drawn into a pixel grid)
 //  - convToFlagType (helper to parse command-line args)
+// Flag names and descriptions live in FlagLibrary.cpp.
 
 
 //  - This module centralises small common definitions so other modules include this.
 //  - We include iostream because convToFlagType can print error messages.
 
 module;
+#include <cstddef>
+#include <cstdint>
 #include <iostream>
 #include <string>
 #include <sstream>
@@ -18,38 +26,125 @@ module;
 export module LibUtility;
 
 // ------------ Data types exported ------------
+// UJPixel: one byte per channel (RGB888, 3 bytes per pixel).
+// Building with -DUJ_PIXEL_RGBA pads it to RGBA8888 (4 bytes, 4-byte aligned)
+// so a pixel never straddles a 32-bit lane in SIMD code.
+// A uint8_t cannot leave 0..255, so assigning a UJPixel needs no range check;
+// values that start life as int go through the checked fromRGB() once.
+#ifdef UJ_PIXEL_RGBA
+export struct alignas(4) UJPixel
+#else
 export struct UJPixel
+#endif
 {
-    int intRed;   // 0..255
-    int intGreen; // 0..255
-    int intBlue;  // 0..255
+    std::uint8_t intRed;   // 0..255
+    std::uint8_t intGreen; // 0..255
+    std::uint8_t intBlue;  // 0..255
+#ifdef UJ_PIXEL_RGBA
+    std::uint8_t intAlpha = 255; // padding, always opaque
+#endif
+
+    // fromRGB: build a pixel from int channels, exits with ERROR_RANGE if any is outside 0..255.
+    static UJPixel fromRGB(int intRed, int intGreen, int intBlue);
 };
 
+#ifdef UJ_PIXEL_RGBA
+static_assert(sizeof(UJPixel) == 4, "RGBA8888 pixel must be 4 bytes");
+#else
+static_assert(sizeof(UJPixel) == 3, "RGB888 pixel must be 3 bytes");
+#endif
+
 export enum ExitCode
 {
     SUCCESS = 0,
     ERROR_RANGE,
     ERROR_ARGS,
-    ERROR_CONV
+    ERROR_CONV,
+    ERROR_IO
 };
 
-export enum FlagType
+// FlagType: the number of a flag in the FlagLibrary registry. Any value in
+// [0, flagCount()) is valid; the enumerators name the built-in flags, which come first.
+export enum FlagType : int
 {
     AUSTRIA = 0,
     JAPAN   = 1,
     NIGERIA = 2
 };
 
+// IllustratorType: the concrete FlagIllustrator classes, numbered as on the command line.
+export enum IllustratorType
+{
+    COLOUR    = 0,
+    GRAYSCALE = 1,
+    BW        = 2,
+    QOI       = 3,
+    PNG       = 4
+};
+
+// isCompressed: QOI and PNG. They are always binary (ExportMode does not apply) and are
+// compressed as one stream, so they cannot be cut into independently encoded bands.
+export constexpr bool isCompressed(IllustratorType eType)
+{
+    return eType == QOI || eType == PNG;
+}
+
+// ExportMode: which PNM flavour the illustrators write.
+//  ASCII  - P3 / P2 / P1, one decimal number per value
+//  BINARY - P6 / P5 / P4, raw bytes (P4 packs 8 pixels per byte)
+export enum ExportMode
+{
+    ASCII  = 0,
+    BINARY = 1
+};
+
+// DitherMode: how BWIllustrator (P1 / P4) decides black and white.
+//  DITHER_NONE      - black unless exactly white (R = G = B = 255)
+//  DITHER_ORDERED   - intensity against an 8 x 8 Bayer threshold matrix
+//  DITHER_DIFFUSION - Floyd-Steinberg error diffusion on the intensity
+export enum DitherMode
+{
+    DITHER_NONE      = 0,
+    DITHER_ORDERED   = 1,
+    DITHER_DIFFUSION = 2
+};
+
+// MAX_DIMENSION: the largest image height or width accepted anywhere. Dimensions stay int,
+// but every pixel or byte count derived from them is computed in std::size_t (64-bit), so
+// poster sizes such as 60000 x 40000 (2.4 billion pixels) do not overflow.
+export constexpr int MAX_DIMENSION = 1 << 20;
+
+// MAX_GRID_PIXELS: images with more pixels than this (the old 10000 x 10000 cap) are not
+// drawn into a UJImage; they are encoded procedurally, a row at a time, instead.
+export constexpr std::size_t MAX_GRID_PIXELS = std::size_t{10000} * 10000;
+
+// ------------ UJPixel ------------
+UJPixel UJPixel::fromRGB(int intRed, int intGreen, int intBlue)
+{
+    for(int intValue : {intRed, intGreen, intBlue})
+    {
+        if(intValue < 0 || intValue > 255)
+        {
+            std::cerr << "ERROR! " << intValue << " must be within [0, 255]. Terminating." << std::endl;
+            std::exit(ERROR_RANGE);
+        }
+    }
+    return {static_cast<std::uint8_t>(intRed),
+            static_cast<std::uint8_t>(intGreen),
+            static_cast<std::uint8_t>(intBlue)};
+}
+
 // ------------ Helper function / Utility method------------
 // convToFlagType:
 // Convert string (from argv) to FlagType enum.
+// intFlagCount is the number of registered flags (flagCount() in FlagLibrary).
 // Exits with ERROR_CONV if invalid input.
-export FlagType convToFlagType(const std::string& strArg)
+export FlagType convToFlagType(const std::string& strArg, int intFlagCount = 3)
 {
     std::stringstream ssConv{strArg};
     int intTemp = 0;
     ssConv >> intTemp;
-    if(ssConv.fail() || intTemp < 0 || intTemp > 2)
+    if(ssConv.fail() || intTemp < 0 || intTemp >= intFlagCount)
     {
         // Clear error message, then exit.
         std::cerr << "ERROR! Could not convert command line argument to a flag type. Terminating." << std::endl;
@@ -0,0 +1,154 @@
+// MappedFile.cpp is a small module that creates an output file of a known size and maps it into memory.
+// Responsibilities:
+//  - create / truncate the file and reserve its final size on disk up front
+//  - map the whole file read/write, so several threads can fill disjoint byte ranges at once
+//  - unmap and close on close() or destruction (RAII, move-only)
+//
+// Reserving the blocks first (posix_fallocate) matters: a store into a mapped page that the
+// file system cannot back (disk full) raises SIGBUS instead of returning an error.
+// POSIX only; on Windows create() returns false and callers fall back to streamed writes.
+
+module;
+#include <cstddef>
+#include <span>
+#include <string>
+#include <utility>
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+export module MappedFile;
+
+export class MappedFile
+{
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    ~MappedFile();
+
+    // create: strPath becomes a file of exactly intSize bytes, mapped read/write.
+    // Returns false (and leaves nothing open) if the file cannot be created, sized or mapped.
+    bool create(const std::string& strPath, std::size_t intSize);
+
+    // bytes: the mapped file contents (empty before create() and after close()).
+    std::span<char> bytes() const;
+
+    // close: unmap and close the file. Returns false if that failed.
+    bool close();
+
+    // supported: whether create() can work on this platform at all.
+    static bool supported();
+
+private:
+    int _fd = -1;
+    char* _pData = nullptr;
+    std::size_t _size = 0;
+};
+
+// ---------- Implementations ----------
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+: _fd(std::exchange(other._fd, -1)), _pData(std::exchange(other._pData, nullptr)), _size(std::exchange(other._size, 0))
+{}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+    if(this != &other)
+    {
+        close();
+        _fd    = std::exchange(other._fd, -1);
+        _pData = std::exchange(other._pData, nullptr);
+        _size  = std::exchange(other._size, 0);
+    }
+    return *this;
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+std::span<char> MappedFile::bytes() const
+{
+    return {_pData, _size};
+}
+
+#ifndef _WIN32
+
+bool MappedFile::supported()
+{
+    return true;
+}
+
+bool MappedFile::create(const std::string& strPath, std::size_t intSize)
+{
+    close();
+    _fd = ::open(strPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(_fd < 0)
+        return false;
+
+    // ftruncate sets the length; posix_fallocate then reserves real blocks where the file
+    // system supports it (EINVAL / EOPNOTSUPP: it cannot, and the sparse file has to do).
+    bool blnOk = ::ftruncate(_fd, static_cast<off_t>(intSize)) == 0;
+    if(blnOk && intSize > 0)
+    {
+        int intError = ::posix_fallocate(_fd, 0, static_cast<off_t>(intSize));
+        blnOk = intError == 0 || intError == EINVAL || intError == EOPNOTSUPP;
+    }
+    if(blnOk && intSize > 0)
+    {
+        void* pMap = ::mmap(nullptr, intSize, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+        blnOk = pMap != MAP_FAILED;
+        if(blnOk)
+        {
+            _pData = static_cast<char*>(pMap);
+            ::madvise(pMap, intSize, MADV_SEQUENTIAL); // each writer walks its range front to back
+        }
+    }
+    if(!blnOk)
+    {
+        ::close(_fd);
+        _fd = -1;
+        return false;
+    }
+    _size = intSize;
+    return true;
+}
+
+bool MappedFile::close()
+{
+    bool blnOk = true;
+    if(_pData != nullptr)
+        blnOk = ::munmap(_pData, _size) == 0;
+    if(_fd >= 0)
+        blnOk = ::close(_fd) == 0 && blnOk;
+    _fd = -1;
+    _pData = nullptr;
+    _size = 0;
+    return blnOk;
+}
+
+#else // _WIN32
+
+bool MappedFile::supported()
+{
+    return false;
+}
+
+bool MappedFile::create(const std::string&, std::size_t)
+{
+    return false;
+}
+
+bool MappedFile::close()
+{
+    return true;
+}
+
+#endif
@@ -0,0 +1,387 @@
+// Metrics.cpp is the instrumentation module: wall time per render stage plus output counters.
+// Responsibilities:
+//  - Stage: the phases of a render (allocate, illustrate, encode, write)
+//  - StageTimer: RAII wall-clock timer for one stage; countPixels / countBytes / countAllocation
+//    (bytes are the encoded rows, counted where they are encoded, so a band that is encoded
+//    into a buffer and then copied to the output is counted once; headers are not included)
+//  - RenderStats: a snapshot of every counter, with throughput, as JSON or Prometheus text
+//  - RenderMetrics + MetricsScope: the counters of one render (a batch job, a request), next
+//    to the process-wide ones
+//
+// The counters are relaxed atomics, updated once per stage call (per 64 KiB chunk for
+// writes, per band of rows for encoding), never per pixel. Everything is added to the
+// process-wide RenderMetrics and, while a MetricsScope lives on the recording thread, to that
+// scope's RenderMetrics as well. A render that starts threads hands its scope on to them
+// (currentRenderMetrics()), so concurrent renders keep their numbers apart.
+// Everything is compiled in only with -DUJ_METRICS. Otherwise METRICS_ENABLED is false,
+// StageTimer is an empty class and the count functions are empty, so the hot paths
+// compile to exactly what they were without instrumentation.
+//
+// Stage times add up the time of every thread. A stage timed inside another one on the same
+// thread (a chunk written while encoding) counts for the inner stage only, so on one thread
+// the stage times add up to at most the wall time.
+
+module;
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+export module Metrics;
+
+#ifdef UJ_METRICS
+export inline constexpr bool METRICS_ENABLED = true;
+#else
+export inline constexpr bool METRICS_ENABLED = false;
+#endif
+
+export enum Stage
+{
+    STAGE_ALLOCATE = 0, // pixel buffer allocation and the initial white fill
+    STAGE_ILLUSTRATE,   // drawing the flag into the pixel grid
+    STAGE_ENCODE,       // turning rows into PNM bytes (including procedural row generation)
+    STAGE_WRITE,        // handing encoded chunks to the stream / file / callback
+    STAGE_COUNT
+};
+
+export const char* stageName(Stage eStage);
+
+// RenderStats: everything recorded since the start (or the last resetMetrics()).
+export struct RenderStats
+{
+    bool blnEnabled = METRICS_ENABLED;
+    std::array<std::uint64_t, STAGE_COUNT> arrNanos{}; // wall time per stage, summed over threads
+    std::array<std::uint64_t, STAGE_COUNT> arrCalls{};
+    std::uint64_t intPixels      = 0; // pixels encoded (once per output format)
+    std::uint64_t intBytes       = 0; // encoded row bytes (headers excluded)
+    std::uint64_t intAllocations = 0; // pixel buffers allocated
+    std::uint64_t intAllocBytes  = 0;
+
+    double seconds(Stage eStage) const;
+    double pixelsPerSecond() const; // pixels per second of illustrate + encode time
+    double bytesPerSecond() const;  // bytes per second of encode time
+
+    std::string toJson() const;
+    // toPrometheus: text exposition format, every metric prefixed "flagillustrator_".
+    std::string toPrometheus() const;
+};
+
+// RenderMetrics: one set of counters (the process-wide set, or one render's).
+export class RenderMetrics
+{
+public:
+    void addStage(Stage eStage, std::uint64_t intNanos);
+    void addPixels(std::uint64_t intPixels);
+    void addBytes(std::uint64_t intBytes);
+    void addAllocation(std::uint64_t intBytes);
+    RenderStats snapshot() const;
+    void reset();
+
+private:
+    std::array<std::atomic<std::uint64_t>, STAGE_COUNT> _nanos{};
+    std::array<std::atomic<std::uint64_t>, STAGE_COUNT> _calls{};
+    std::atomic<std::uint64_t> _pixels{0};
+    std::atomic<std::uint64_t> _bytes{0};
+    std::atomic<std::uint64_t> _allocations{0};
+    std::atomic<std::uint64_t> _allocBytes{0};
+};
+
+// metricsSnapshot / resetMetrics: the process-wide counters.
+export RenderStats metricsSnapshot();
+export void resetMetrics();
+
+// currentRenderMetrics: the counters of the MetricsScope open on this thread (nullptr if none).
+export RenderMetrics* currentRenderMetrics();
+
+// recordStage: add one timed call of eStage that lasted intNanos, started when this thread's
+// timed total was intNestedStart (StageTimer does this; time of stages timed inside it is
+// taken out).
+export void recordStage(Stage eStage, std::uint64_t intNanos, std::uint64_t intNestedStart);
+// nestedStageNanos: this thread's total of timed stage time so far (see recordStage()).
+export std::uint64_t nestedStageNanos();
+export void addPixels(std::uint64_t intPixels);
+export void addBytes(std::uint64_t intBytes);
+export void addAllocation(std::uint64_t intBytes);
+
+// The hooks used in the hot paths: no code at all unless METRICS_ENABLED.
+export inline void countPixels(std::size_t intPixels)
+{
+    if constexpr(METRICS_ENABLED)
+        addPixels(intPixels);
+}
+
+export inline void countBytes(std::size_t intBytes)
+{
+    if constexpr(METRICS_ENABLED)
+        addBytes(intBytes);
+}
+
+export inline void countAllocation(std::size_t intBytes)
+{
+    if constexpr(METRICS_ENABLED)
+        addAllocation(intBytes);
+}
+
+// BasicStageTimer<true>: times its own lifetime into eStage. BasicStageTimer<false>: nothing.
+export template<bool blnEnabled>
+class BasicStageTimer
+{
+public:
+    explicit BasicStageTimer(Stage eStage)
+    : _eStage(eStage), _intNestedStart(nestedStageNanos()), _tmStart(std::chrono::steady_clock::now())
+    {}
+    ~BasicStageTimer()
+    {
+        auto intNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _tmStart).count();
+        recordStage(_eStage, static_cast<std::uint64_t>(intNanos), _intNestedStart);
+    }
+    BasicStageTimer(const BasicStageTimer&) = delete;
+    BasicStageTimer& operator=(const BasicStageTimer&) = delete;
+
+private:
+    Stage _eStage;
+    std::uint64_t _intNestedStart;
+    std::chrono::steady_clock::time_point _tmStart;
+};
+
+template<>
+class BasicStageTimer<false>
+{
+public:
+    explicit BasicStageTimer(Stage) {}
+};
+
+export using StageTimer = BasicStageTimer<METRICS_ENABLED>;
+
+// BasicMetricsScope<true>: for its lifetime, this thread also records into pMetrics (nullptr:
+// no render scope), then the previous scope is restored. BasicMetricsScope<false>: nothing.
+export template<bool blnEnabled>
+class BasicMetricsScope;
+
+template<>
+class BasicMetricsScope<true>
+{
+public:
+    explicit BasicMetricsScope(RenderMetrics* pMetrics);
+    ~BasicMetricsScope();
+    BasicMetricsScope(const BasicMetricsScope&) = delete;
+    BasicMetricsScope& operator=(const BasicMetricsScope&) = delete;
+
+private:
+    RenderMetrics* _previous;
+};
+
+template<>
+class BasicMetricsScope<false>
+{
+public:
+    explicit BasicMetricsScope(RenderMetrics*) {}
+};
+
+export using MetricsScope = BasicMetricsScope<METRICS_ENABLED>;
+
+// ---------- Implementations ----------
+
+static RenderMetrics& globalMetrics()
+{
+    static RenderMetrics objMetrics;
+    return objMetrics;
+}
+
+static thread_local RenderMetrics* t_pScopeMetrics = nullptr;
+static thread_local std::uint64_t t_intNestedNanos = 0;
+
+const char* stageName(Stage eStage)
+{
+    switch(eStage)
+    {
+        case STAGE_ALLOCATE:   return "allocate";
+        case STAGE_ILLUSTRATE: return "illustrate";
+        case STAGE_ENCODE:     return "encode";
+        case STAGE_WRITE:      return "write";
+        case STAGE_COUNT:      break;
+    }
+    return "unknown";
+}
+
+void RenderMetrics::addStage(Stage eStage, std::uint64_t intNanos)
+{
+    _nanos[eStage].fetch_add(intNanos, std::memory_order_relaxed);
+    _calls[eStage].fetch_add(1, std::memory_order_relaxed);
+}
+
+void RenderMetrics::addPixels(std::uint64_t intPixels)
+{
+    _pixels.fetch_add(intPixels, std::memory_order_relaxed);
+}
+
+void RenderMetrics::addBytes(std::uint64_t intBytes)
+{
+    _bytes.fetch_add(intBytes, std::memory_order_relaxed);
+}
+
+void RenderMetrics::addAllocation(std::uint64_t intBytes)
+{
+    _allocations.fetch_add(1, std::memory_order_relaxed);
+    _allocBytes.fetch_add(intBytes, std::memory_order_relaxed);
+}
+
+RenderStats RenderMetrics::snapshot() const
+{
+    RenderStats recStats;
+    for(int s = 0; s < STAGE_COUNT; ++s)
+    {
+        recStats.arrNanos[s] = _nanos[s].load(std::memory_order_relaxed);
+        recStats.arrCalls[s] = _calls[s].load(std::memory_order_relaxed);
+    }
+    recStats.intPixels      = _pixels.load(std::memory_order_relaxed);
+    recStats.intBytes       = _bytes.load(std::memory_order_relaxed);
+    recStats.intAllocations = _allocations.load(std::memory_order_relaxed);
+    recStats.intAllocBytes  = _allocBytes.load(std::memory_order_relaxed);
+    return recStats;
+}
+
+void RenderMetrics::reset()
+{
+    for(int s = 0; s < STAGE_COUNT; ++s)
+    {
+        _nanos[s].store(0, std::memory_order_relaxed);
+        _calls[s].store(0, std::memory_order_relaxed);
+    }
+    _pixels.store(0, std::memory_order_relaxed);
+    _bytes.store(0, std::memory_order_relaxed);
+    _allocations.store(0, std::memory_order_relaxed);
+    _allocBytes.store(0, std::memory_order_relaxed);
+}
+
+RenderStats metricsSnapshot()
+{
+    return globalMetrics().snapshot();
+}
+
+void resetMetrics()
+{
+    globalMetrics().reset();
+}
+
+RenderMetrics* currentRenderMetrics()
+{
+    return t_pScopeMetrics;
+}
+
+// recordStage: the stages that ended inside this one added their own length to the thread's
+// total; whatever it grew by since intNestedStart is theirs, not this stage's. The total then
+// grows by this stage's full length, so the enclosing stage subtracts it exactly once.
+void recordStage(Stage eStage, std::uint64_t intNanos, std::uint64_t intNestedStart)
+{
+    std::uint64_t intNested = std::min(intNanos, t_intNestedNanos - intNestedStart);
+    t_intNestedNanos = intNestedStart + intNanos;
+    globalMetrics().addStage(eStage, intNanos - intNested);
+    if(t_pScopeMetrics != nullptr)
+        t_pScopeMetrics->addStage(eStage, intNanos - intNested);
+}
+
+std::uint64_t nestedStageNanos()
+{
+    return t_intNestedNanos;
+}
+
+void addPixels(std::uint64_t intPixels)
+{
+    globalMetrics().addPixels(intPixels);
+    if(t_pScopeMetrics != nullptr)
+        t_pScopeMetrics->addPixels(intPixels);
+}
+
+void addBytes(std::uint64_t intBytes)
+{
+    globalMetrics().addBytes(intBytes);
+    if(t_pScopeMetrics != nullptr)
+        t_pScopeMetrics->addBytes(intBytes);
+}
+
+void addAllocation(std::uint64_t intBytes)
+{
+    globalMetrics().addAllocation(intBytes);
+    if(t_pScopeMetrics != nullptr)
+        t_pScopeMetrics->addAllocation(intBytes);
+}
+
+BasicMetricsScope<true>::BasicMetricsScope(RenderMetrics* pMetrics)
+: _previous(t_pScopeMetrics)
+{
+    t_pScopeMetrics = pMetrics;
+}
+
+BasicMetricsScope<true>::~BasicMetricsScope()
+{
+    t_pScopeMetrics = _previous;
+}
+
+double RenderStats::seconds(Stage eStage) const
+{
+    return static_cast<double>(arrNanos[eStage]) / 1e9;
+}
+
+double RenderStats::pixelsPerSecond() const
+{
+    double dblSeconds = seconds(STAGE_ILLUSTRATE) + seconds(STAGE_ENCODE);
+    return dblSeconds > 0.0 ? static_cast<double>(intPixels) / dblSeconds : 0.0;
+}
+
+double RenderStats::bytesPerSecond() const
+{
+    double dblSeconds = seconds(STAGE_ENCODE);
+    return dblSeconds > 0.0 ? static_cast<double>(intBytes) / dblSeconds : 0.0;
+}
+
+std::string RenderStats::toJson() const
+{
+    std::ostringstream ossJson;
+    ossJson << "{\"enabled\": " << (blnEnabled ? "true" : "false") << ", \"stages\": {";
+    for(int s = 0; s < STAGE_COUNT; ++s)
+    {
+        Stage eStage = static_cast<Stage>(s);
+        ossJson << (s == 0 ? "" : ", ") << '"' << stageName(eStage) << "\": {\"calls\": " << arrCalls[s]
+                << ", \"ms\": " << seconds(eStage) * 1e3 << '}';
+    }
+    ossJson << "}, \"pixels\": " << intPixels << ", \"bytes\": " << intBytes
+            << ", \"allocations\": " << intAllocations << ", \"alloc_bytes\": " << intAllocBytes
+            << ", \"mpx_per_s\": " << pixelsPerSecond() / 1e6 << ", \"mb_per_s\": " << bytesPerSecond() / 1e6 << '}';
+    return ossJson.str();
+}
+
+std::string RenderStats::toPrometheus() const
+{
+    std::ostringstream ossText;
+    ossText << "# HELP flagillustrator_metrics_enabled 1 if the binary was built with -DUJ_METRICS.\n"
+            << "# TYPE flagillustrator_metrics_enabled gauge\n"
+            << "flagillustrator_metrics_enabled " << (blnEnabled ? 1 : 0) << '\n'
+            << "# HELP flagillustrator_stage_seconds_total Wall time spent in each render stage, summed over threads.\n"
+            << "# TYPE flagillustrator_stage_seconds_total counter\n";
+    for(int s = 0; s < STAGE_COUNT; ++s)
+        ossText << "flagillustrator_stage_seconds_total{stage=\"" << stageName(static_cast<Stage>(s)) << "\"} "
+                << seconds(static_cast<Stage>(s)) << '\n';
+    ossText << "# HELP flagillustrator_stage_calls_total Timed calls of each render stage.\n"
+            << "# TYPE flagillustrator_stage_calls_total counter\n";
+    for(int s = 0; s < STAGE_COUNT; ++s)
+        ossText << "flagillustrator_stage_calls_total{stage=\"" << stageName(static_cast<Stage>(s)) << "\"} " << arrCalls[s] << '\n';
+
+    // name, help, value
+    const struct { const char* pName; const char* pHelp; std::uint64_t intValue; } arrCounters[] = {
+        {"pixels_total",          "Pixels encoded, once per output format.", intPixels},
+        {"bytes_total",           "Encoded row bytes, headers excluded.",    intBytes},
+        {"allocations_total",     "Pixel buffers allocated.",                intAllocations},
+        {"allocated_bytes_total", "Bytes of pixel buffers allocated.",       intAllocBytes}};
+    for(const auto& recCounter : arrCounters)
+    {
+        ossText << "# HELP flagillustrator_" << recCounter.pName << ' ' << recCounter.pHelp << '\n'
+                << "# TYPE flagillustrator_" << recCounter.pName << " counter\n"
+                << "flagillustrator_" << recCounter.pName << ' ' << recCounter.intValue << '\n';
+    }
+    return ossText.str();
+}
@@ -0,0 +1,91 @@
+// MultiExporter.cpp encodes one rendered flag into several formats in a single pass.
+// Responsibilities:
+//  - hold a list of outputs, each an encoder (an illustrator of some IllustratorType and
+//    ExportMode that never draws anything itself) plus the ImageSink it writes to
+//  - read (or, in procedural mode, generate) every row of the source illustrator once and
+//    hand it to every encoder while it is still in cache
+//
+// Compared with one illustrator per format, the flag is drawn once instead of N times, only
+// one pixel grid exists (none in procedural mode) and the pixels are read from memory once.
+// Every output is byte-identical to the same illustrator's own exportImage().
+
+module;
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+
+export module MultiExporter;
+
+import LibUtility;
+import ImageSink;
+import FlagIllustrator;
+import IllustratorFactory;
+import Metrics;
+
+export class MultiExporter
+{
+public:
+    // addTarget: one more output, encoded like an eIllustrator in eMode (dithered with eDither
+    // if it is BW; error diffusion runs serially here, as the rows arrive), written to objSink.
+    // objSink must outlive every exportImage() call.
+    void addTarget(IllustratorType eIllustrator, ExportMode eMode, ImageSink& objSink, DitherMode eDither = DITHER_NONE);
+    std::size_t getTargetCount() const;
+
+    // exportImage: the complete image of objSource (drawn or procedural) to every target.
+    // The sinks are not flushed, so more can follow (e.g. a trailing newline).
+    void exportImage(const FlagIllustrator& objSource) const;
+
+private:
+    struct Target
+    {
+        std::unique_ptr<FlagIllustrator> pEncoder; // 0x0: used for formatHeader / encodeRow only
+        ImageSink* pSink;
+    };
+    std::vector<Target> _targets;
+};
+
+// ---------- Implementations ----------
+
+void MultiExporter::addTarget(IllustratorType eIllustrator, ExportMode eMode, ImageSink& objSink, DitherMode eDither)
+{
+    std::unique_ptr<FlagIllustrator> pEncoder = createIllustrator(eIllustrator, 0, 0);
+    pEncoder->setExportMode(eMode);
+    pEncoder->setDither(eDither);
+    _targets.push_back({std::move(pEncoder), &objSink});
+}
+
+std::size_t MultiExporter::getTargetCount() const
+{
+    return _targets.size();
+}
+
+void MultiExporter::exportImage(const FlagIllustrator& objSource) const
+{
+    int intHeight = objSource.getHeight();
+    int intWidth  = objSource.getWidth();
+    for(const Target& recTarget : _targets)
+        recTarget.pSink->write(recTarget.pEncoder->formatHeader(intHeight, intWidth));
+
+    StageTimer objTimer(STAGE_ENCODE);
+    std::size_t intStart = 0;
+    for(const Target& recTarget : _targets)
+        intStart += recTarget.pSink->bytesWritten();
+    std::vector<UJPixel> vecRow;                            // only used in procedural mode
+    std::vector<RowScratch> vecScratch(_targets.size());    // per target, reused from row to row
+    for(RowScratch& recScratch : vecScratch)
+        recScratch.intRows = intHeight;
+    for(int r = 0; r < intHeight; ++r)
+    {
+        std::span<const UJPixel> arrRow = objSource.pixelRow(r, vecRow);
+        for(std::size_t t = 0; t < _targets.size(); ++t)
+            _targets[t].pEncoder->encodeRow(arrRow, vecScratch[t], *_targets[t].pSink);
+    }
+
+    std::size_t intEnd = 0;
+    for(const Target& recTarget : _targets)
+        intEnd += recTarget.pSink->bytesWritten();
+    countPixels(static_cast<std::size_t>(intHeight) * static_cast<std::size_t>(intWidth) * _targets.size());
+    countBytes(intEnd - intStart);
+}
@@ -0,0 +1,271 @@
+// PNGIllustrator.cpp is a derived class that writes the flag as a PNG image (8-bit RGB), compressed
+// with the built-in deflate encoder (Deflate.cpp), so no external converter or library is needed.
+// Responsibilities:
+//  - filter every row for compression: Up (all zeros) when it repeats the row above, Sub
+//    otherwise (zeros everywhere but at the colour edges)
+//  - compress bands of BAND_PIXELS pixels independently, in parallel on the encode threads,
+//    each into its own IDAT chunk; the bands depend on the width alone, so the output is the
+//    same for any thread count
+//
+// Layout: signature, IHDR, an IDAT holding the zlib header, one IDAT per band (deflate blocks
+// ending on a byte boundary, see deflateSegment), an IDAT with the closing block and the
+// Adler-32 of all rows (combined from the bands' own), IEND. Decoders read the IDAT chunks
+// as one zlib stream.
+// The export mode does not apply (PNG is always binary). PNG itself requires a width and height
+// of at least 1; empty images are still written, with no rows.
+
+module;
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+export module PNGIllustrator;
+
+import LibUtility;
+import FlagIllustrator;
+import UJImage;
+import ImageSink;
+import Deflate;
+import Metrics;
+
+export class PNGIllustrator : public FlagIllustrator
+{
+public:
+    PNGIllustrator();
+    PNGIllustrator(int intHeight, int intWidth);
+    explicit PNGIllustrator(UJImage objImage); // adopts objImage (see FlagIllustrator)
+
+    using FlagIllustrator::exportImage;
+    void exportImage(ImageSink& objSink) const override;
+    // exportSize: there is no closed form, so this encodes the whole image and counts the bytes,
+    // as slow as exportImage() itself. Not for the hot path (see FlagIllustrator::exportSize).
+    std::size_t exportSize() const override;
+    std::size_t exportReserve() const override; // 0: the string grows as the bands arrive
+    std::string formatHeader(int intHeight, int intWidth) const override;
+    // encodeRow: collects the rows of a band in recScratch and writes the band once it is complete.
+    void encodeRow(std::span<const UJPixel> arrRow, RowScratch& recScratch, ImageSink& objSink) const override;
+    // exportRows: the bands compressed in parallel on the encode threads.
+    void exportRows(ImageSink& objSink, int intRowBegin, int intRowEnd) const override;
+
+    // bandRows: rows per independently compressed band at this width (at least one).
+    static int bandRows(int intWidth);
+    static constexpr std::size_t BAND_PIXELS = 1 << 18;
+
+private:
+    // encodeBand: one band of intRows rows as an IDAT chunk appended to vecOut; returns the Adler-32
+    // of its filtered rows. arrRows holds the band's rows back to back, preceded by the row above
+    // if blnAbove.
+    static std::uint32_t encodeBand(std::span<const UJPixel> arrRows, std::size_t intRows, std::size_t intWidth, bool blnAbove,
+                                    std::vector<std::uint8_t>& vecFiltered, std::vector<std::uint8_t>& vecOut);
+    // endChunks: the closing IDAT (last block and Adler-32) and IEND.
+    static std::vector<std::uint8_t> endChunks(std::uint32_t intAdler);
+};
+
+// ---------- Implementations ----------
+
+static constexpr std::array<std::uint8_t, 8> PNG_SIGNATURE{0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+static constexpr std::uint8_t PNG_FILTER_SUB = 1;
+static constexpr std::uint8_t PNG_FILTER_UP  = 2;
+
+static void appendBig32(std::vector<std::uint8_t>& vecOut, std::uint32_t intValue)
+{
+    for(int intShift = 24; intShift >= 0; intShift -= 8)
+        vecOut.push_back(static_cast<std::uint8_t>(intValue >> intShift));
+}
+
+// appendChunk: length, type, data and the CRC-32 of type and data.
+static void appendChunk(std::vector<std::uint8_t>& vecOut, const char* strType, std::span<const std::uint8_t> arrData)
+{
+    appendBig32(vecOut, static_cast<std::uint32_t>(arrData.size()));
+    std::size_t intType = vecOut.size();
+    vecOut.insert(vecOut.end(), strType, strType + 4);
+    vecOut.insert(vecOut.end(), arrData.begin(), arrData.end());
+    appendBig32(vecOut, crc32(std::span<const std::uint8_t>(vecOut).subspan(intType)));
+}
+
+PNGIllustrator::PNGIllustrator() : FlagIllustrator() {}
+PNGIllustrator::PNGIllustrator(int intHeight, int intWidth)
+: FlagIllustrator(intHeight, intWidth) {}
+PNGIllustrator::PNGIllustrator(UJImage objImage)
+: FlagIllustrator(std::move(objImage)) {}
+
+void PNGIllustrator::exportImage(ImageSink& objSink) const
+{
+    objSink.write(exportHeader());
+    exportRows(objSink, 0, getHeight());
+}
+
+std::size_t PNGIllustrator::exportSize() const
+{
+    ImageSink objCount([](const char*, std::size_t) {});
+    exportImage(objCount);
+    objCount.flush();
+    return objCount.bytesWritten();
+}
+
+std::size_t PNGIllustrator::exportReserve() const
+{
+    return 0;
+}
+
+// formatHeader: everything before the first row. An image without rows is complete after its
+// header, so it carries the end chunks too.
+std::string PNGIllustrator::formatHeader(int intHeight, int intWidth) const
+{
+    std::vector<std::uint8_t> vecHeader(PNG_SIGNATURE.begin(), PNG_SIGNATURE.end());
+    std::vector<std::uint8_t> vecIhdr;
+    appendBig32(vecIhdr, static_cast<std::uint32_t>(intWidth));
+    appendBig32(vecIhdr, static_cast<std::uint32_t>(intHeight));
+    for(std::uint8_t intField : {8, 2, 0, 0, 0}) // 8 bits, RGB, deflate, adaptive filters, not interlaced
+        vecIhdr.push_back(intField);
+    appendChunk(vecHeader, "IHDR", vecIhdr);
+    appendChunk(vecHeader, "IDAT", ZLIB_HEADER);
+    if(intHeight == 0)
+    {
+        std::vector<std::uint8_t> vecEnd = endChunks(1);
+        vecHeader.insert(vecHeader.end(), vecEnd.begin(), vecEnd.end());
+    }
+    return std::string(vecHeader.begin(), vecHeader.end());
+}
+
+// encodeRow: recScratch.vecPixels keeps the last row of the previous band in front of the
+// current band's rows, for the filters.
+void PNGIllustrator::encodeRow(std::span<const UJPixel> arrRow, RowScratch& recScratch, ImageSink& objSink) const
+{
+    int intRow = recScratch.intNextRow++;
+    std::size_t intWidth = arrRow.size();
+    int intBandRows = bandRows(static_cast<int>(intWidth));
+    std::vector<UJPixel>& vecBand = recScratch.vecPixels;
+    if(intRow == 0)
+    {
+        vecBand.clear();
+        recScratch.intChecksum = 1;
+    }
+    else if(intRow % intBandRows == 0)
+    {
+        std::copy(vecBand.end() - static_cast<std::ptrdiff_t>(intWidth), vecBand.end(), vecBand.begin());
+        vecBand.resize(intWidth);
+    }
+    vecBand.insert(vecBand.end(), arrRow.begin(), arrRow.end());
+
+    bool blnLast = intRow + 1 == recScratch.intRows;
+    if((intRow + 1) % intBandRows != 0 && !blnLast)
+        return;
+    std::size_t intRows = static_cast<std::size_t>(intRow % intBandRows) + 1;
+    std::vector<std::uint8_t> vecOut;
+    std::uint32_t intAdler = encodeBand(vecBand, intRows, intWidth, intRow >= intBandRows, recScratch.vecBytes, vecOut);
+    recScratch.intChecksum = adler32Combine(recScratch.intChecksum, intAdler, intRows * (3 * intWidth + 1));
+    if(blnLast)
+    {
+        std::vector<std::uint8_t> vecEnd = endChunks(recScratch.intChecksum);
+        vecOut.insert(vecOut.end(), vecEnd.begin(), vecEnd.end());
+    }
+    objSink.write(reinterpret_cast<const char*>(vecOut.data()), vecOut.size());
+}
+
+void PNGIllustrator::exportRows(ImageSink& objSink, int intRowBegin, int intRowEnd) const
+{
+    StageTimer objTimer(STAGE_ENCODE);
+    std::size_t intStart = objSink.bytesWritten();
+    std::size_t intWidth = static_cast<std::size_t>(getWidth());
+    int intBandRows = bandRows(getWidth());
+    int intFirstBand = intRowBegin / intBandRows;
+    // every band's Adler-32, combined in row order once all are done
+    std::vector<std::uint32_t> vecAdler(intRowEnd > intRowBegin ? static_cast<std::size_t>((intRowEnd - 1) / intBandRows + 1 - intFirstBand) : 0);
+    encodeBands(objSink, intRowBegin, intRowEnd, intBandRows,
+                [&](int intBegin, int intEnd, RowScratch& recScratch, std::vector<std::uint8_t>& vecOut)
+                {
+                    bool blnAbove = intBegin > 0;
+                    std::span<const UJPixel> arrRows = pixelRows(blnAbove ? intBegin - 1 : intBegin, intEnd, recScratch.vecPixels);
+                    vecAdler[static_cast<std::size_t>(intBegin / intBandRows - intFirstBand)] =
+                        encodeBand(arrRows, static_cast<std::size_t>(intEnd - intBegin), intWidth, blnAbove, recScratch.vecBytes, vecOut);
+                });
+    if(intRowEnd == getHeight() && intRowEnd > intRowBegin)
+    {
+        std::uint32_t intAdler = 1;
+        for(std::size_t b = 0; b < vecAdler.size(); ++b)
+        {
+            int intBegin = std::max(intRowBegin, (intFirstBand + static_cast<int>(b)) * intBandRows);
+            int intEnd   = std::min(intRowEnd, intBegin - intBegin % intBandRows + intBandRows);
+            intAdler = adler32Combine(intAdler, vecAdler[b], static_cast<std::size_t>(intEnd - intBegin) * (3 * intWidth + 1));
+        }
+        std::vector<std::uint8_t> vecEnd = endChunks(intAdler);
+        objSink.write(reinterpret_cast<const char*>(vecEnd.data()), vecEnd.size());
+    }
+    countPixels(static_cast<std::size_t>(intRowEnd - intRowBegin) * intWidth);
+    countBytes(objSink.bytesWritten() - intStart);
+}
+
+int PNGIllustrator::bandRows(int intWidth)
+{
+    return static_cast<int>(std::clamp<std::size_t>(BAND_PIXELS / static_cast<std::size_t>(std::max(1, intWidth)),
+                                                    1, static_cast<std::size_t>(MAX_DIMENSION)));
+}
+
+// encodeBand: each filtered row is the filter byte and 3 * width bytes. Sub stores every channel
+// minus the same channel one pixel to the left (mod 256); Up stores the difference to the row
+// above, which is all zeros for a repeated row.
+std::uint32_t PNGIllustrator::encodeBand(std::span<const UJPixel> arrRows, std::size_t intRows, std::size_t intWidth, bool blnAbove,
+                                         std::vector<std::uint8_t>& vecFiltered, std::vector<std::uint8_t>& vecOut)
+{
+    std::size_t intRowBytes = 3 * intWidth + 1;
+    vecFiltered.resize(intRows * intRowBytes);
+    for(std::size_t r = 0; r < intRows; ++r)
+    {
+        std::span<const UJPixel> arrRow = arrRows.subspan((r + (blnAbove ? 1 : 0)) * intWidth, intWidth);
+        std::uint8_t* pOut = vecFiltered.data() + r * intRowBytes;
+        if((r > 0 || blnAbove) && std::memcmp(arrRow.data(), arrRow.data() - intWidth, intWidth * sizeof(UJPixel)) == 0)
+        {
+            pOut[0] = PNG_FILTER_UP;
+            std::memset(pOut + 1, 0, intRowBytes - 1);
+            continue;
+        }
+        pOut[0] = PNG_FILTER_SUB;
+        ++pOut;
+        if constexpr(sizeof(UJPixel) == 3)
+        {
+            // RGB888 rows are already the channel bytes
+            const std::uint8_t* pIn = reinterpret_cast<const std::uint8_t*>(arrRow.data());
+            std::memcpy(pOut, pIn, std::min<std::size_t>(3, intRowBytes - 1));
+            for(std::size_t i = 3; i < intRowBytes - 1; ++i)
+                pOut[i] = static_cast<std::uint8_t>(pIn[i] - pIn[i - 3]);
+        }
+        else
+        {
+            UJPixel recLeft{0, 0, 0};
+            for(const UJPixel& recPixel : arrRow)
+            {
+                *pOut++ = static_cast<std::uint8_t>(recPixel.intRed - recLeft.intRed);
+                *pOut++ = static_cast<std::uint8_t>(recPixel.intGreen - recLeft.intGreen);
+                *pOut++ = static_cast<std::uint8_t>(recPixel.intBlue - recLeft.intBlue);
+                recLeft = recPixel;
+            }
+        }
+    }
+
+    std::size_t intChunk = vecOut.size();
+    vecOut.resize(intChunk + 8);
+    std::memcpy(vecOut.data() + intChunk + 4, "IDAT", 4);
+    deflateSegment(vecFiltered, vecOut);
+    std::uint32_t intLength = static_cast<std::uint32_t>(vecOut.size() - intChunk - 8);
+    for(int b = 0; b < 4; ++b)
+        vecOut[intChunk + static_cast<std::size_t>(b)] = static_cast<std::uint8_t>(intLength >> (24 - 8 * b));
+    appendBig32(vecOut, crc32(std::span<const std::uint8_t>(vecOut).subspan(intChunk + 4)));
+    return adler32(vecFiltered);
+}
+
+std::vector<std::uint8_t> PNGIllustrator::endChunks(std::uint32_t intAdler)
+{
+    std::vector<std::uint8_t> vecEnd;
+    std::vector<std::uint8_t> vecLast(DEFLATE_END.begin(), DEFLATE_END.end());
+    appendBig32(vecLast, intAdler);
+    appendChunk(vecEnd, "IDAT", vecLast);
+    appendChunk(vecEnd, "IEND", {});
+    return vecEnd;
+}
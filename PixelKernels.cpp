@@ -0,0 +1,420 @@
+// PixelKernels.cpp holds the per-row colour conversion loops used by the grayscale and BW exporters.
+// Responsibilities:
+//  - RGB row -> 8-bit intensity row, intensity = (R + G + B) / 3 (integer division)
+//  - RGB row -> black mask (1 = not exactly white, 0 = white), one byte per pixel for P1
+//  - RGB row -> packed P4 bits (MSB = leftmost pixel, last byte zero padded)
+//  - RGB row -> ordered-dither mask (1 = intensity below the 8 x 8 Bayer threshold), and
+//    any 0/1 mask -> packed P4 bits
+//  - fill a run of pixels with one colour (used to replay the flag run tables)
+//  - measure a run of repeated pixels (used by the compressed formats)
+//
+// Each conversion has a scalar version and, on x86, SSSE3 and AVX2 versions that work
+// on 8 / 16 packed RGB888 pixels at a time. The best version the CPU supports is picked
+// once at runtime; setKernelLevel() can force a lower one (benchmarks, cross-checks).
+//
+// Bit-exactness:
+//  - (R + G + B) is at most 765, so it fits a 16-bit lane, and for any 16-bit s
+//    (s * 0xAAAB) >> 17 == s / 3, which is what the SIMD versions compute
+//  - a pixel is exactly white iff R + G + B == 765, so the mask is one compare on the sum
+
+module;
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UJ_KERNELS_X86 1
+#endif
+
+export module PixelKernels;
+
+import LibUtility;
+
+export enum KernelLevel
+{
+    KERNEL_SCALAR = 0,
+    KERNEL_SSSE3  = 1,
+    KERNEL_AVX2   = 2
+};
+
+// Highest level this CPU (and build) supports, and the level currently in use.
+export KernelLevel getBestKernelLevel();
+export KernelLevel getKernelLevel();
+// setKernelLevel: use eLevel from now on (capped at getBestKernelLevel()).
+export void setKernelLevel(KernelLevel eLevel);
+export const char* kernelLevelName(KernelLevel eLevel);
+
+// arrRow.size() outputs each; pOut must not overlap the row.
+export void rowToGray(std::span<const UJPixel> arrRow, std::uint8_t* pOut);
+export void rowToBlackMask(std::span<const UJPixel> arrRow, std::uint8_t* pOut);
+// rowToPackedBits: writes (arrRow.size() + 7) / 8 bytes.
+export void rowToPackedBits(std::span<const UJPixel> arrRow, std::uint8_t* pOut);
+// rowToOrderedMask: 1 (black) where the intensity of the pixel in column c is below the
+// Bayer threshold of (intRow % 8, c % 8), 0 elsewhere. Exact white and black stay as they are.
+export void rowToOrderedMask(std::span<const UJPixel> arrRow, int intRow, std::uint8_t* pOut);
+// packBits: 0/1 mask bytes -> (arrMask.size() + 7) / 8 P4 bytes.
+export void packBits(std::span<const std::uint8_t> arrMask, std::uint8_t* pOut);
+// fillPixels: every pixel of arrRun becomes recColour.
+export void fillPixels(std::span<UJPixel> arrRun, const UJPixel& recColour);
+// repeatLength: how many pixels from intStart (>= 1) on equal arrPixels[intStart - 1].
+export std::size_t repeatLength(std::span<const UJPixel> arrPixels, std::size_t intStart);
+
+// ---------- Implementations ----------
+
+static constexpr int WHITE_SUM = 3 * 255;
+
+// BAYER_THRESHOLDS: the 8 x 8 Bayer matrix B scaled to intensities, (2B + 1) * 255 / 128,
+// i.e. 1..253: intensity 0 is always black and 255 always white.
+static constexpr auto BAYER_THRESHOLDS = []
+{
+    constexpr std::uint8_t arrBayer[8][8] = {
+        { 0, 32,  8, 40,  2, 34, 10, 42},
+        {48, 16, 56, 24, 50, 18, 58, 26},
+        {12, 44,  4, 36, 14, 46,  6, 38},
+        {60, 28, 52, 20, 62, 30, 54, 22},
+        { 3, 35, 11, 43,  1, 33,  9, 41},
+        {51, 19, 59, 27, 49, 17, 57, 25},
+        {15, 47,  7, 39, 13, 45,  5, 37},
+        {63, 31, 55, 23, 61, 29, 53, 21}};
+    struct { std::uint8_t arrRows[8][8]; } recTable{};
+    for(int y = 0; y < 8; ++y)
+        for(int x = 0; x < 8; ++x)
+            recTable.arrRows[y][x] = static_cast<std::uint8_t>((2 * arrBayer[y][x] + 1) * 255 / 128);
+    return recTable;
+}();
+
+// ----- Scalar versions (any pixel layout) -----
+
+static void grayScalar(const UJPixel* pRow, std::size_t intCount, std::uint8_t* pOut)
+{
+    for(std::size_t i = 0; i < intCount; ++i)
+        pOut[i] = static_cast<std::uint8_t>((pRow[i].intRed + pRow[i].intGreen + pRow[i].intBlue) / 3);
+}
+
+static void maskScalar(const UJPixel* pRow, std::size_t intCount, std::uint8_t* pOut)
+{
+    for(std::size_t i = 0; i < intCount; ++i)
+        pOut[i] = (pRow[i].intRed + pRow[i].intGreen + pRow[i].intBlue) == WHITE_SUM ? 0 : 1;
+}
+
+// orderedScalar: pThresholds is one row of BAYER_THRESHOLDS; pRow starts on a multiple of 8 columns.
+static void orderedScalar(const UJPixel* pRow, std::size_t intCount, std::uint8_t* pOut, const std::uint8_t* pThresholds)
+{
+    for(std::size_t i = 0; i < intCount; ++i)
+        pOut[i] = (pRow[i].intRed + pRow[i].intGreen + pRow[i].intBlue) / 3 < pThresholds[i & 7] ? 1 : 0;
+}
+
+// packMask: eight 0/1 mask bytes -> one P4 byte (first pixel in the top bit).
+// With the bytes loaded little-endian, the multiply moves byte i's bit to bit 63 - i;
+// all partial products land on distinct bits, so nothing carries into the top byte.
+static std::uint8_t packMask(const std::uint8_t* pMask)
+{
+    std::uint64_t intBits;
+    std::memcpy(&intBits, pMask, 8);
+    return static_cast<std::uint8_t>((intBits * 0x8040201008040201ull) >> 56);
+}
+
+#ifdef UJ_KERNELS_X86
+// ----- SSSE3 / AVX2 versions (RGB888 only) -----
+// A block is 8 pixels = 24 bytes. Two overlapping 16-byte loads (bytes 0..15 and 8..23)
+// cover it, and six byte shuffles spread R, G and B into 16-bit lanes of the two loads.
+// The AVX2 versions put two blocks in the two 128-bit lanes, so the same shuffle masks work.
+static constexpr char Z = static_cast<char>(0x80); // shuffle index that yields 0
+
+#define UJ_RED_LO   0, Z, 3, Z, 6, Z, 9, Z,12, Z,15, Z, Z, Z, Z, Z
+#define UJ_RED_HI   Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z,10, Z,13, Z
+#define UJ_GREEN_LO 1, Z, 4, Z, 7, Z,10, Z,13, Z, Z, Z, Z, Z, Z, Z
+#define UJ_GREEN_HI Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, 8, Z,11, Z,14, Z
+#define UJ_BLUE_LO  2, Z, 5, Z, 8, Z,11, Z,14, Z, Z, Z, Z, Z, Z, Z
+#define UJ_BLUE_HI  Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, 9, Z,12, Z,15, Z
+
+__attribute__((target("ssse3")))
+static __m128i sumBlock128(const std::uint8_t* pBytes)
+{
+    __m128i vecLo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pBytes));
+    __m128i vecHi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pBytes + 8));
+    __m128i vecSum = _mm_add_epi16(_mm_shuffle_epi8(vecLo, _mm_setr_epi8(UJ_RED_LO)),
+                                   _mm_shuffle_epi8(vecHi, _mm_setr_epi8(UJ_RED_HI)));
+    vecSum = _mm_add_epi16(vecSum, _mm_shuffle_epi8(vecLo, _mm_setr_epi8(UJ_GREEN_LO)));
+    vecSum = _mm_add_epi16(vecSum, _mm_shuffle_epi8(vecHi, _mm_setr_epi8(UJ_GREEN_HI)));
+    vecSum = _mm_add_epi16(vecSum, _mm_shuffle_epi8(vecLo, _mm_setr_epi8(UJ_BLUE_LO)));
+    return _mm_add_epi16(vecSum, _mm_shuffle_epi8(vecHi, _mm_setr_epi8(UJ_BLUE_HI)));
+}
+
+__attribute__((target("avx2")))
+static __m256i sumBlock256(const std::uint8_t* pBytes)
+{
+    // lane 0 = pixels 0..7, lane 1 = pixels 8..15
+    __m256i vecLo = _mm256_loadu2_m128i(reinterpret_cast<const __m128i*>(pBytes + 24),
+                                        reinterpret_cast<const __m128i*>(pBytes));
+    __m256i vecHi = _mm256_loadu2_m128i(reinterpret_cast<const __m128i*>(pBytes + 32),
+                                        reinterpret_cast<const __m128i*>(pBytes + 8));
+    __m256i vecSum = _mm256_add_epi16(_mm256_shuffle_epi8(vecLo, _mm256_setr_epi8(UJ_RED_LO, UJ_RED_LO)),
+                                      _mm256_shuffle_epi8(vecHi, _mm256_setr_epi8(UJ_RED_HI, UJ_RED_HI)));
+    vecSum = _mm256_add_epi16(vecSum, _mm256_shuffle_epi8(vecLo, _mm256_setr_epi8(UJ_GREEN_LO, UJ_GREEN_LO)));
+    vecSum = _mm256_add_epi16(vecSum, _mm256_shuffle_epi8(vecHi, _mm256_setr_epi8(UJ_GREEN_HI, UJ_GREEN_HI)));
+    vecSum = _mm256_add_epi16(vecSum, _mm256_shuffle_epi8(vecLo, _mm256_setr_epi8(UJ_BLUE_LO, UJ_BLUE_LO)));
+    return _mm256_add_epi16(vecSum, _mm256_shuffle_epi8(vecHi, _mm256_setr_epi8(UJ_BLUE_HI, UJ_BLUE_HI)));
+}
+
+#undef UJ_RED_LO
+#undef UJ_RED_HI
+#undef UJ_GREEN_LO
+#undef UJ_GREEN_HI
+#undef UJ_BLUE_LO
+#undef UJ_BLUE_HI
+
+__attribute__((target("ssse3")))
+static void graySSSE3(const UJPixel* pRow, std::size_t intCount, std::uint8_t* pOut)
+{
+    const std::uint8_t* pBytes = reinterpret_cast<const std::uint8_t*>(pRow);
+    std::size_t i = 0;
+    for(; i + 8 <= intCount; i += 8)
+    {
+        __m128i vecGray = _mm_srli_epi16(_mm_mulhi_epu16(sumBlock128(pBytes + 3 * i), _mm_set1_epi16(static_cast<short>(0xAAAB))), 1);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(pOut + i), _mm_packus_epi16(vecGray, vecGray));
+    }
+    grayScalar(pRow + i, intCount - i, pOut + i);
+}
+
+__attribute__((target("ssse3")))
+static void maskSSSE3(const UJPixel* pRow, std::size_t intCount, std::uint8_t* pOut)
+{
+    const std::uint8_t* pBytes = reinterpret_cast<const std::uint8_t*>(pRow);
+    std::size_t i = 0;
+    for(; i + 8 <= intCount; i += 8)
+    {
+        __m128i vecWhite = _mm_cmpeq_epi16(sumBlock128(pBytes + 3 * i), _mm_set1_epi16(WHITE_SUM));
+        __m128i vecBlack = _mm_andnot_si128(vecWhite, _mm_set1_epi16(1));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(pOut + i), _mm_packus_epi16(vecBlack, vecBlack));
+    }
+    maskScalar(pRow + i, intCount - i, pOut + i);
+}
+
+__attribute__((target("ssse3")))
+static void orderedSSSE3(const UJPixel* pRow, std::size_t intCount, std::uint8_t* pOut, const std::uint8_t* pThresholds)
+{
+    const std::uint8_t* pBytes = reinterpret_cast<const std::uint8_t*>(pRow);
+    __m128i vecThresholds = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pThresholds)), _mm_setzero_si128());
+    std::size_t i = 0;
+    for(; i + 8 <= intCount; i += 8)
+    {
+        __m128i vecGray = _mm_srli_epi16(_mm_mulhi_epu16(sumBlock128(pBytes + 3 * i), _mm_set1_epi16(static_cast<short>(0xAAAB))), 1);
+        __m128i vecBlack = _mm_and_si128(_mm_cmplt_epi16(vecGray, vecThresholds), _mm_set1_epi16(1));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(pOut + i), _mm_packus_epi16(vecBlack, vecBlack));
+    }
+    orderedScalar(pRow + i, intCount - i, pOut + i, pThresholds);
+}
+
+__attribute__((target("avx2")))
+static void grayAVX2(const UJPixel* pRow, std::size_t intCount, std::uint8_t* pOut)
+{
+    const std::uint8_t* pBytes = reinterpret_cast<const std::uint8_t*>(pRow);
+    std::size_t i = 0;
+    for(; i + 16 <= intCount; i += 16)
+    {
+        __m256i vecGray = _mm256_srli_epi16(_mm256_mulhi_epu16(sumBlock256(pBytes + 3 * i), _mm256_set1_epi16(static_cast<short>(0xAAAB))), 1);
+        __m128i vecBytes = _mm_packus_epi16(_mm256_castsi256_si128(vecGray), _mm256_extracti128_si256(vecGray, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pOut + i), vecBytes);
+    }
+    graySSSE3(pRow + i, intCount - i, pOut + i);
+}
+
+__attribute__((target("avx2")))
+static void maskAVX2(const UJPixel* pRow, std::size_t intCount, std::uint8_t* pOut)
+{
+    const std::uint8_t* pBytes = reinterpret_cast<const std::uint8_t*>(pRow);
+    std::size_t i = 0;
+    for(; i + 16 <= intCount; i += 16)
+    {
+        __m256i vecWhite = _mm256_cmpeq_epi16(sumBlock256(pBytes + 3 * i), _mm256_set1_epi16(WHITE_SUM));
+        __m256i vecBlack = _mm256_andnot_si256(vecWhite, _mm256_set1_epi16(1));
+        __m128i vecBytes = _mm_packus_epi16(_mm256_castsi256_si128(vecBlack), _mm256_extracti128_si256(vecBlack, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pOut + i), vecBytes);
+    }
+    maskSSSE3(pRow + i, intCount - i, pOut + i);
+}
+__attribute__((target("avx2")))
+static void orderedAVX2(const UJPixel* pRow, std::size_t intCount, std::uint8_t* pOut, const std::uint8_t* pThresholds)
+{
+    const std::uint8_t* pBytes = reinterpret_cast<const std::uint8_t*>(pRow);
+    // both 128-bit lanes hold 8 pixels that start on a multiple of 8 columns
+    __m128i vecRow = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pThresholds)), _mm_setzero_si128());
+    __m256i vecThresholds = _mm256_broadcastsi128_si256(vecRow);
+    std::size_t i = 0;
+    for(; i + 16 <= intCount; i += 16)
+    {
+        __m256i vecGray = _mm256_srli_epi16(_mm256_mulhi_epu16(sumBlock256(pBytes + 3 * i), _mm256_set1_epi16(static_cast<short>(0xAAAB))), 1);
+        __m256i vecBlack = _mm256_and_si256(_mm256_cmpgt_epi16(vecThresholds, vecGray), _mm256_set1_epi16(1));
+        __m128i vecBytes = _mm_packus_epi16(_mm256_castsi256_si128(vecBlack), _mm256_extracti128_si256(vecBlack, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pOut + i), vecBytes);
+    }
+    orderedSSSE3(pRow + i, intCount - i, pOut + i, pThresholds);
+}
+#endif // UJ_KERNELS_X86
+
+// ----- Dispatch -----
+
+using RowKernel = void (*)(const UJPixel*, std::size_t, std::uint8_t*);
+using ThresholdKernel = void (*)(const UJPixel*, std::size_t, std::uint8_t*, const std::uint8_t*);
+
+struct KernelTable
+{
+    KernelLevel eLevel;
+    RowKernel fnGray;
+    RowKernel fnMask;
+    ThresholdKernel fnOrdered;
+};
+
+static KernelTable makeTable(KernelLevel eLevel)
+{
+#ifdef UJ_KERNELS_X86
+    if(eLevel == KERNEL_AVX2)
+        return {KERNEL_AVX2, grayAVX2, maskAVX2, orderedAVX2};
+    if(eLevel == KERNEL_SSSE3)
+        return {KERNEL_SSSE3, graySSSE3, maskSSSE3, orderedSSSE3};
+#endif
+    return {KERNEL_SCALAR, grayScalar, maskScalar, orderedScalar};
+}
+
+KernelLevel getBestKernelLevel()
+{
+#ifdef UJ_KERNELS_X86
+    // the SIMD versions read pixels as packed 3-byte RGB
+    if constexpr(sizeof(UJPixel) == 3)
+    {
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2"))
+            return KERNEL_AVX2;
+        if(__builtin_cpu_supports("ssse3"))
+            return KERNEL_SSSE3;
+    }
+#endif
+    return KERNEL_SCALAR;
+}
+
+// activeTable: chosen on first use; setKernelLevel() replaces it (not meant to race with exports).
+static KernelTable& activeTable()
+{
+    static KernelTable recTable = makeTable(getBestKernelLevel());
+    return recTable;
+}
+
+KernelLevel getKernelLevel()
+{
+    return activeTable().eLevel;
+}
+
+void setKernelLevel(KernelLevel eLevel)
+{
+    KernelLevel eBest = getBestKernelLevel();
+    activeTable() = makeTable(eLevel < eBest ? eLevel : eBest);
+}
+
+const char* kernelLevelName(KernelLevel eLevel)
+{
+    switch(eLevel)
+    {
+        case KERNEL_SCALAR: return "scalar";
+        case KERNEL_SSSE3:  return "ssse3";
+        case KERNEL_AVX2:   return "avx2";
+    }
+    return "unknown";
+}
+
+void rowToGray(std::span<const UJPixel> arrRow, std::uint8_t* pOut)
+{
+    activeTable().fnGray(arrRow.data(), arrRow.size(), pOut);
+}
+
+void rowToBlackMask(std::span<const UJPixel> arrRow, std::uint8_t* pOut)
+{
+    activeTable().fnMask(arrRow.data(), arrRow.size(), pOut);
+}
+
+// rowToPackedBits: mask 64 pixels at a time into a small stack buffer, then pack 8 -> 1.
+void rowToPackedBits(std::span<const UJPixel> arrRow, std::uint8_t* pOut)
+{
+    constexpr std::size_t BLOCK = 64;
+    std::uint8_t arrMask[BLOCK];
+    std::size_t intCount = arrRow.size();
+    for(std::size_t intStart = 0; intStart < intCount; intStart += BLOCK)
+    {
+        std::size_t intLen = intCount - intStart < BLOCK ? intCount - intStart : BLOCK;
+        rowToBlackMask(arrRow.subspan(intStart, intLen), arrMask);
+        std::memset(arrMask + intLen, 0, BLOCK - intLen); // zero padding bits for the last byte
+        for(std::size_t b = 0; b < (intLen + 7) / 8; ++b)
+            *pOut++ = packMask(arrMask + 8 * b);
+    }
+}
+
+void rowToOrderedMask(std::span<const UJPixel> arrRow, int intRow, std::uint8_t* pOut)
+{
+    activeTable().fnOrdered(arrRow.data(), arrRow.size(), pOut, BAYER_THRESHOLDS.arrRows[intRow & 7]);
+}
+
+void packBits(std::span<const std::uint8_t> arrMask, std::uint8_t* pOut)
+{
+    std::size_t intCount = arrMask.size();
+    std::size_t intWhole = intCount / 8;
+    for(std::size_t b = 0; b < intWhole; ++b)
+        pOut[b] = packMask(arrMask.data() + 8 * b);
+    if(intCount % 8 != 0)
+    {
+        std::uint8_t arrLast[8] = {}; // zero padding bits
+        std::memcpy(arrLast, arrMask.data() + 8 * intWhole, intCount % 8);
+        pOut[intWhole] = packMask(arrLast);
+    }
+}
+
+// fillPixels: a 3-byte pixel does not fit a vector lane, so std::fill stores one pixel at a
+// time. Instead the first FILL_SEED pixels are stored one by one and that pattern is then
+// copied with memcpy, doubling up to FILL_BLOCK pixels and then a block at a time from the
+// (still cached) start of the run: long runs fill at memcpy speed.
+void fillPixels(std::span<UJPixel> arrRun, const UJPixel& recColour)
+{
+    constexpr std::size_t FILL_SEED  = 16;
+    constexpr std::size_t FILL_BLOCK = 4096;
+    UJPixel* pRun = arrRun.data();
+    std::size_t intCount = arrRun.size();
+    std::size_t intDone = intCount < FILL_SEED ? intCount : FILL_SEED;
+    for(std::size_t i = 0; i < intDone; ++i)
+        pRun[i] = recColour;
+    while(intDone < intCount)
+    {
+        std::size_t intLen = intCount - intDone;
+        if(intLen > intDone)
+            intLen = intDone;
+        if(intLen > FILL_BLOCK)
+            intLen = FILL_BLOCK;
+        std::memcpy(pRun + intDone, pRun, intLen * sizeof(UJPixel));
+        intDone += intLen;
+    }
+}
+
+// repeatLength: pixel k equals pixel k - 1 for every k in the run exactly when every byte equals
+// the byte one pixel earlier, so the bytes are compared 8 at a time against themselves shifted
+// by one pixel; the first differing byte ends the run.
+std::size_t repeatLength(std::span<const UJPixel> arrPixels, std::size_t intStart)
+{
+    const unsigned char* pBytes = reinterpret_cast<const unsigned char*>(arrPixels.data());
+    std::size_t intBegin = intStart * sizeof(UJPixel);
+    std::size_t intEnd   = arrPixels.size() * sizeof(UJPixel);
+    std::size_t b = intBegin;
+    if constexpr(std::endian::native == std::endian::little)
+    {
+        for(; b + 8 <= intEnd; b += 8)
+        {
+            std::uint64_t intNow, intBefore;
+            std::memcpy(&intNow, pBytes + b, 8);
+            std::memcpy(&intBefore, pBytes + b - sizeof(UJPixel), 8);
+            if(intNow != intBefore)
+                return (b + static_cast<std::size_t>(std::countr_zero(intNow ^ intBefore)) / 8) / sizeof(UJPixel) - intStart;
+        }
+    }
+    while(b < intEnd && pBytes[b] == pBytes[b - sizeof(UJPixel)])
+        ++b;
+    return b / sizeof(UJPixel) - intStart;
+}
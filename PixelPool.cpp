@@ -0,0 +1,203 @@
+// PixelPool.cpp provides the allocators behind UJImage pixel buffers.
+// Responsibilities:
+//  - PixelAllocator: the interface UJImage allocates and frees its buffer through
+//  - the heap allocator (plain aligned new/delete), used unless another one is installed
+//  - PixelPool: a thread-safe size-class pool that keeps freed buffers and hands them
+//    out again, so rendering many same-sized flags stops allocating and page faulting
+//  - counters for reuse rate and resident bytes
+//
+// Size classes: a request is rounded up to the next of 4, 5, 6 or 7 times a power of two
+// pixels, so a buffer is at most 25% larger than asked for and similar sizes share a class.
+//
+// Important invariants:
+//  - every buffer is aligned to PIXEL_ALIGNMENT bytes
+//  - a buffer goes back to the allocator that produced it, with the capacity it reported
+//  - a PixelPool must outlive every image that took a buffer from it
+
+module;
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <new>
+#include <vector>
+
+export module PixelPool;
+
+import LibUtility;
+
+export constexpr std::size_t PIXEL_ALIGNMENT = 64; // cache line
+
+export class PixelAllocator
+{
+public:
+    virtual ~PixelAllocator() = default;
+
+    // allocate: an uninitialised buffer for at least intPixels pixels. intCapacity is set
+    // to the pixels actually available (>= intPixels), to be passed back to deallocate().
+    virtual UJPixel* allocate(std::size_t intPixels, std::size_t& intCapacity) = 0;
+    virtual void deallocate(UJPixel* pPixels, std::size_t intCapacity) = 0;
+};
+
+// The allocator new images use (the heap allocator unless setDefaultPixelAllocator was called).
+export PixelAllocator& defaultPixelAllocator();
+// setDefaultPixelAllocator: nullptr restores the heap allocator. Images keep the allocator
+// they were created with, so switching only affects images created afterwards.
+export void setDefaultPixelAllocator(PixelAllocator* pAllocator);
+export PixelAllocator& heapPixelAllocator();
+
+export struct PoolStats
+{
+    std::size_t intAllocations = 0; // allocate() calls that succeeded
+    std::size_t intReuses      = 0; // ... of which were served from a free list
+    std::size_t intReleases    = 0; // deallocate() calls
+    std::size_t intInUseBytes  = 0; // handed out, not yet returned
+    std::size_t intCachedBytes = 0; // returned and kept for reuse
+    std::size_t intPeakBytes   = 0; // highest in-use + cached seen
+
+    std::size_t residentBytes() const { return intInUseBytes + intCachedBytes; }
+    double reuseRate() const { return intAllocations > 0 ? static_cast<double>(intReuses) / intAllocations : 0.0; }
+};
+
+export class PixelPool : public PixelAllocator
+{
+public:
+    // intMaxCachedBytes: free buffers beyond this are returned to the heap instead of kept.
+    explicit PixelPool(std::size_t intMaxCachedBytes = DEF_MAX_CACHED_BYTES);
+    PixelPool(const PixelPool&) = delete;
+    PixelPool& operator=(const PixelPool&) = delete;
+    ~PixelPool() override; // frees the cached buffers
+
+    UJPixel* allocate(std::size_t intPixels, std::size_t& intCapacity) override;
+    void deallocate(UJPixel* pPixels, std::size_t intCapacity) override;
+
+    PoolStats getStats() const;
+    void trim(); // give every cached buffer back to the heap
+
+    // sizeClass: the capacity a request for intPixels is rounded up to.
+    static std::size_t sizeClass(std::size_t intPixels);
+
+    static constexpr std::size_t DEF_MAX_CACHED_BYTES = std::size_t{1} << 30;
+
+private:
+    std::size_t _maxCachedBytes;
+    mutable std::mutex _mutex;
+    std::map<std::size_t, std::vector<UJPixel*>> _free; // size class -> cached buffers
+    PoolStats _stats;
+};
+
+// ---------- Implementations ----------
+
+// HeapPixelAllocator: one aligned heap block per buffer, freed straight away.
+class HeapPixelAllocator : public PixelAllocator
+{
+public:
+    UJPixel* allocate(std::size_t intPixels, std::size_t& intCapacity) override
+    {
+        intCapacity = intPixels;
+        return static_cast<UJPixel*>(::operator new[](intPixels * sizeof(UJPixel), std::align_val_t{PIXEL_ALIGNMENT}));
+    }
+
+    void deallocate(UJPixel* pPixels, std::size_t) override
+    {
+        ::operator delete[](pPixels, std::align_val_t{PIXEL_ALIGNMENT});
+    }
+};
+
+static PixelAllocator* g_pDefaultAllocator = nullptr; // nullptr = heap
+
+PixelAllocator& heapPixelAllocator()
+{
+    static HeapPixelAllocator objHeap;
+    return objHeap;
+}
+
+PixelAllocator& defaultPixelAllocator()
+{
+    return g_pDefaultAllocator != nullptr ? *g_pDefaultAllocator : heapPixelAllocator();
+}
+
+void setDefaultPixelAllocator(PixelAllocator* pAllocator)
+{
+    g_pDefaultAllocator = pAllocator;
+}
+
+PixelPool::PixelPool(std::size_t intMaxCachedBytes)
+: _maxCachedBytes(intMaxCachedBytes)
+{}
+
+PixelPool::~PixelPool()
+{
+    trim();
+}
+
+std::size_t PixelPool::sizeClass(std::size_t intPixels)
+{
+    if(intPixels <= 4)
+        return intPixels;
+    // 4..7 << intShift covers [4 << intShift, 8 << intShift); round up within that octave
+    int intShift = std::bit_width(intPixels) - 3;
+    std::size_t intStep = std::size_t{1} << intShift;
+    return (intPixels + intStep - 1) / intStep * intStep;
+}
+
+UJPixel* PixelPool::allocate(std::size_t intPixels, std::size_t& intCapacity)
+{
+    intCapacity = sizeClass(intPixels);
+    std::size_t intBytes = intCapacity * sizeof(UJPixel);
+    {
+        std::lock_guard<std::mutex> objLock(_mutex);
+        auto itClass = _free.find(intCapacity);
+        if(itClass != _free.end() && !itClass->second.empty())
+        {
+            UJPixel* pPixels = itClass->second.back();
+            itClass->second.pop_back();
+            ++_stats.intAllocations;
+            ++_stats.intReuses;
+            _stats.intInUseBytes += intBytes;
+            _stats.intCachedBytes -= intBytes;
+            return pPixels;
+        }
+    }
+    // outside the lock; counted only once it succeeded, so a throwing allocation leaves the stats alone
+    UJPixel* pPixels = heapPixelAllocator().allocate(intCapacity, intCapacity);
+    std::lock_guard<std::mutex> objLock(_mutex);
+    ++_stats.intAllocations;
+    _stats.intInUseBytes += intBytes;
+    _stats.intPeakBytes = std::max(_stats.intPeakBytes, _stats.residentBytes());
+    return pPixels;
+}
+
+void PixelPool::deallocate(UJPixel* pPixels, std::size_t intCapacity)
+{
+    std::size_t intBytes = intCapacity * sizeof(UJPixel);
+    {
+        std::lock_guard<std::mutex> objLock(_mutex);
+        ++_stats.intReleases;
+        _stats.intInUseBytes -= intBytes;
+        if(_stats.intCachedBytes + intBytes <= _maxCachedBytes)
+        {
+            _free[intCapacity].push_back(pPixels);
+            _stats.intCachedBytes += intBytes;
+            return;
+        }
+    }
+    heapPixelAllocator().deallocate(pPixels, intCapacity); // over budget: really free it
+}
+
+PoolStats PixelPool::getStats() const
+{
+    std::lock_guard<std::mutex> objLock(_mutex);
+    return _stats;
+}
+
+void PixelPool::trim()
+{
+    std::lock_guard<std::mutex> objLock(_mutex);
+    for(auto& [intCapacity, vecBuffers] : _free)
+        for(UJPixel* pPixels : vecBuffers)
+            heapPixelAllocator().deallocate(pPixels, intCapacity);
+    _free.clear();
+    _stats.intCachedBytes = 0;
+}
@@ -0,0 +1,223 @@
+// QOIIllustrator.cpp is a derived class that writes the flag as a QOI image (the "Quite OK Image"
+// format, qoiformat.org): lossless RGB, a 14-byte header, then one to four bytes per pixel, and
+// a single byte for a run of up to 62 equal pixels, so a flag shrinks to a tiny fraction of P6.
+// Responsibilities:
+//  - encode bands of BAND_PIXELS pixels independently, in parallel on the encode threads
+//  - run fast path: a run of equal pixels is measured in one go (PixelKernels::repeatLength,
+//    8 bytes per compare) and written as whole run bytes, instead of pixel by pixel
+//
+// Bands: the QOI state (previous pixel and a 64-entry index of recent colours) runs through the
+// whole image, so a band cannot know the state it starts in. A band therefore writes its first
+// pixel in full (QOI_OP_RGB) and only uses index entries it has written itself: the decoder's
+// index holds the same pixels in those slots, so the result is one valid QOI stream. This costs
+// a few bytes per band. The bands depend on the width alone, so the output is the same for any
+// thread count, and the first band starts from the format's own initial state: images of up to
+// BAND_PIXELS pixels are byte-identical to the reference encoder's.
+// The export mode does not apply (QOI is always binary).
+
+module;
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+export module QOIIllustrator;
+
+import LibUtility;
+import FlagIllustrator;
+import UJImage;
+import ImageSink;
+import PixelKernels;
+import Metrics;
+
+export class QOIIllustrator : public FlagIllustrator
+{
+public:
+    QOIIllustrator();
+    QOIIllustrator(int intHeight, int intWidth);
+    explicit QOIIllustrator(UJImage objImage); // adopts objImage (see FlagIllustrator)
+
+    using FlagIllustrator::exportImage;
+    void exportImage(ImageSink& objSink) const override;
+    // exportSize: there is no closed form, so this encodes the whole image and counts the bytes,
+    // as slow as exportImage() itself. Not for the hot path (see FlagIllustrator::exportSize).
+    std::size_t exportSize() const override;
+    std::size_t exportReserve() const override; // 0: the string grows as the bands arrive
+    std::string formatHeader(int intHeight, int intWidth) const override;
+    // encodeRow: collects the rows of a band in recScratch and writes the band once it is complete.
+    void encodeRow(std::span<const UJPixel> arrRow, RowScratch& recScratch, ImageSink& objSink) const override;
+    // exportRows: the bands encoded in parallel on the encode threads.
+    void exportRows(ImageSink& objSink, int intRowBegin, int intRowEnd) const override;
+
+    // bandRows: rows per independently encoded band at this width (at least one).
+    static int bandRows(int intWidth);
+    static constexpr std::size_t BAND_PIXELS = 1 << 18;
+
+private:
+    // encodeBand: the pixels of one band (rows back to back); blnFirstBand if it starts the image.
+    static void encodeBand(std::span<const UJPixel> arrBand, bool blnFirstBand, std::vector<std::uint8_t>& vecOut);
+};
+
+// ---------- Implementations ----------
+
+static constexpr std::uint8_t QOI_OP_INDEX = 0x00; // 00iiiiii: index entry i
+static constexpr std::uint8_t QOI_OP_DIFF  = 0x40; // 01rrggbb: each channel -2..1 from the previous pixel
+static constexpr std::uint8_t QOI_OP_LUMA  = 0x80; // 10gggggg rrrrbbbb: green -32..31, red / blue -8..7 around it
+static constexpr std::uint8_t QOI_OP_RUN   = 0xC0; // 11llllll: the previous pixel 1..62 more times
+static constexpr std::uint8_t QOI_OP_RGB   = 0xFE; // then R, G, B
+static constexpr std::size_t QOI_MAX_RUN   = 62;
+static constexpr std::array<std::uint8_t, 8> QOI_END{0, 0, 0, 0, 0, 0, 0, 1};
+
+static bool samePixel(const UJPixel& recA, const UJPixel& recB)
+{
+    return recA.intRed == recB.intRed && recA.intGreen == recB.intGreen && recA.intBlue == recB.intBlue;
+}
+
+QOIIllustrator::QOIIllustrator() : FlagIllustrator() {}
+QOIIllustrator::QOIIllustrator(int intHeight, int intWidth)
+: FlagIllustrator(intHeight, intWidth) {}
+QOIIllustrator::QOIIllustrator(UJImage objImage)
+: FlagIllustrator(std::move(objImage)) {}
+
+void QOIIllustrator::exportImage(ImageSink& objSink) const
+{
+    objSink.write(exportHeader());
+    exportRows(objSink, 0, getHeight());
+}
+
+std::size_t QOIIllustrator::exportSize() const
+{
+    ImageSink objCount([](const char*, std::size_t) {});
+    exportImage(objCount);
+    objCount.flush();
+    return objCount.bytesWritten();
+}
+
+std::size_t QOIIllustrator::exportReserve() const
+{
+    return 0;
+}
+
+// formatHeader: "qoif", width and height (big-endian), 3 channels, sRGB. An image without rows
+// is complete after its header, so it carries the end marker too.
+std::string QOIIllustrator::formatHeader(int intHeight, int intWidth) const
+{
+    std::string strHeader = "qoif";
+    for(int intValue : {intWidth, intHeight})
+        for(int intShift = 24; intShift >= 0; intShift -= 8)
+            strHeader.push_back(static_cast<char>((static_cast<std::uint32_t>(intValue) >> intShift) & 0xFF));
+    strHeader.push_back(3); // RGB
+    strHeader.push_back(0); // sRGB with linear alpha
+    if(intHeight == 0)
+        strHeader.append(QOI_END.begin(), QOI_END.end());
+    return strHeader;
+}
+
+void QOIIllustrator::encodeRow(std::span<const UJPixel> arrRow, RowScratch& recScratch, ImageSink& objSink) const
+{
+    int intRow = recScratch.intNextRow++;
+    int intBandRows = bandRows(static_cast<int>(arrRow.size()));
+    std::vector<UJPixel>& vecBand = recScratch.vecPixels;
+    if(intRow % intBandRows == 0)
+        vecBand.clear();
+    vecBand.insert(vecBand.end(), arrRow.begin(), arrRow.end());
+
+    bool blnLast = intRow + 1 == recScratch.intRows;
+    if((intRow + 1) % intBandRows != 0 && !blnLast)
+        return;
+    std::vector<std::uint8_t>& vecOut = recScratch.vecBytes;
+    vecOut.clear();
+    encodeBand(vecBand, intRow < intBandRows, vecOut);
+    if(blnLast)
+        vecOut.insert(vecOut.end(), QOI_END.begin(), QOI_END.end());
+    objSink.write(reinterpret_cast<const char*>(vecOut.data()), vecOut.size());
+}
+
+void QOIIllustrator::exportRows(ImageSink& objSink, int intRowBegin, int intRowEnd) const
+{
+    StageTimer objTimer(STAGE_ENCODE);
+    std::size_t intStart = objSink.bytesWritten();
+    encodeBands(objSink, intRowBegin, intRowEnd, bandRows(getWidth()),
+                [this](int intBegin, int intEnd, RowScratch& recScratch, std::vector<std::uint8_t>& vecOut)
+                { encodeBand(pixelRows(intBegin, intEnd, recScratch.vecPixels), intBegin == 0, vecOut); });
+    if(intRowEnd == getHeight() && intRowEnd > intRowBegin)
+        objSink.write(reinterpret_cast<const char*>(QOI_END.data()), QOI_END.size());
+    countPixels(static_cast<std::size_t>(intRowEnd - intRowBegin) * static_cast<std::size_t>(getWidth()));
+    countBytes(objSink.bytesWritten() - intStart);
+}
+
+int QOIIllustrator::bandRows(int intWidth)
+{
+    return static_cast<int>(std::clamp<std::size_t>(BAND_PIXELS / static_cast<std::size_t>(std::max(1, intWidth)),
+                                                    1, static_cast<std::size_t>(MAX_DIMENSION)));
+}
+
+// encodeBand: the QOI encoder of the specification, with the band rules above and the runs
+// measured in one go. Runs carry on across rows (the band's rows are back to back).
+void QOIIllustrator::encodeBand(std::span<const UJPixel> arrBand, bool blnFirstBand, std::vector<std::uint8_t>& vecOut)
+{
+    std::array<UJPixel, 64> arrIndex{};
+    std::uint64_t intIndexed = 0;    // bit h set: arrIndex[h] was written in this band
+    UJPixel recPrev{0, 0, 0};        // the format's initial previous pixel (opaque black)
+    bool blnKnownPrev = blnFirstBand;
+    std::size_t intRun = 0;
+    auto fnFlushRun = [&]()
+    {
+        for(; intRun >= QOI_MAX_RUN; intRun -= QOI_MAX_RUN)
+            vecOut.push_back(static_cast<std::uint8_t>(QOI_OP_RUN | (QOI_MAX_RUN - 1)));
+        if(intRun > 0)
+            vecOut.push_back(static_cast<std::uint8_t>(QOI_OP_RUN | (intRun - 1)));
+        intRun = 0;
+    };
+
+    std::size_t intCount = arrBand.size();
+    for(std::size_t i = 0; i < intCount;)
+    {
+        const UJPixel& recPixel = arrBand[i];
+        if(blnKnownPrev && samePixel(recPixel, recPrev))
+        {
+            // recPrev is arrBand[i - 1] except for the initial pixel
+            std::size_t intLength = i == 0 ? 1 : repeatLength(arrBand, i);
+            intRun += intLength;
+            i += intLength;
+            continue;
+        }
+        fnFlushRun();
+
+        int intHash = (recPixel.intRed * 3 + recPixel.intGreen * 5 + recPixel.intBlue * 7 + 255 * 11) % 64;
+        if((intIndexed >> intHash & 1) != 0 && samePixel(arrIndex[intHash], recPixel))
+            vecOut.push_back(static_cast<std::uint8_t>(QOI_OP_INDEX | intHash));
+        else
+        {
+            arrIndex[intHash] = recPixel;
+            intIndexed |= std::uint64_t{1} << intHash;
+            // channel differences wrap around, as in the decoder
+            int intDR = static_cast<std::int8_t>(recPixel.intRed - recPrev.intRed);
+            int intDG = static_cast<std::int8_t>(recPixel.intGreen - recPrev.intGreen);
+            int intDB = static_cast<std::int8_t>(recPixel.intBlue - recPrev.intBlue);
+            if(blnKnownPrev && intDR >= -2 && intDR <= 1 && intDG >= -2 && intDG <= 1 && intDB >= -2 && intDB <= 1)
+                vecOut.push_back(static_cast<std::uint8_t>(QOI_OP_DIFF | (intDR + 2) << 4 | (intDG + 2) << 2 | (intDB + 2)));
+            else if(blnKnownPrev && intDG >= -32 && intDG <= 31 && intDR - intDG >= -8 && intDR - intDG <= 7
+                    && intDB - intDG >= -8 && intDB - intDG <= 7)
+            {
+                vecOut.push_back(static_cast<std::uint8_t>(QOI_OP_LUMA | (intDG + 32)));
+                vecOut.push_back(static_cast<std::uint8_t>((intDR - intDG + 8) << 4 | (intDB - intDG + 8)));
+            }
+            else
+            {
+                vecOut.push_back(QOI_OP_RGB);
+                vecOut.push_back(recPixel.intRed);
+                vecOut.push_back(recPixel.intGreen);
+                vecOut.push_back(recPixel.intBlue);
+            }
+        }
+        recPrev = recPixel;
+        blnKnownPrev = true;
+        ++i;
+    }
+    fnFlushRun();
+}
@@ -0,0 +1,267 @@
+// RenderCache.cpp is an in-process cache of encoded flag images.
+// Responsibilities:
+//  - map (flag, height, width, illustrator, export mode, anti-aliasing) -> encoded image bytes
+//  - render and encode on a miss, using the normal FlagIllustrator classes
+//  - evict least recently used entries once the cached bytes exceed a budget
+//  - optionally persist every rendered image to a directory and reload it on a later miss
+//    (file names include a hash of the flag description, see flagSpecHash)
+//  - count hits / misses / disk hits / evictions
+//
+// Flags are fully determined by the key, so a hit is always correct. Entries are handed
+// out as shared_ptr<const std::string>: a caller can keep using an image after it has
+// been evicted, and a hit costs one reference count instead of a render.
+//
+// Thread safety: all members may be called concurrently (one mutex around the index).
+// Rendering happens outside the lock, so two threads missing on the same key at the same
+// time may both render it; the second insert simply replaces the first.
+
+module;
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+export module RenderCache;
+
+import LibUtility;
+import FlagLibrary;
+import FlagIllustrator;
+import IllustratorFactory;
+
+export struct RenderKey
+{
+    FlagType eFlag;
+    int intHeight;
+    int intWidth;
+    IllustratorType eIllustrator;
+    ExportMode eMode;
+    bool blnAntiAlias = false;
+
+    bool operator==(const RenderKey& recOther) const = default;
+};
+
+export struct CacheStats
+{
+    std::size_t intHits      = 0; // served from memory
+    std::size_t intDiskHits  = 0; // loaded from the persistence directory
+    std::size_t intMisses    = 0; // rendered
+    std::size_t intEvictions = 0;
+    std::size_t intEntries   = 0;
+    std::size_t intBytes     = 0; // encoded bytes held in memory
+};
+
+export class RenderCache
+{
+public:
+    // intMaxBytes: memory budget for cached images. strDiskDir: persistence directory
+    // (created if missing), or empty for memory only.
+    explicit RenderCache(std::size_t intMaxBytes, const std::string& strDiskDir = "");
+    RenderCache(const RenderCache&) = delete;
+    RenderCache& operator=(const RenderCache&) = delete;
+
+    // get: the encoded image for recKey, rendered (and cached) on a miss.
+    std::shared_ptr<const std::string> get(const RenderKey& recKey);
+    // cacheable: false if the encoded image of recKey cannot fit the budget, decided without
+    // rendering it, so callers can stream such images instead of building them in memory.
+    bool cacheable(const RenderKey& recKey) const;
+
+    CacheStats getStats() const;
+    void clear(); // memory only; files on disk are kept
+
+private:
+    struct KeyHash
+    {
+        std::size_t operator()(const RenderKey& recKey) const;
+    };
+    using LruList = std::list<std::pair<RenderKey, std::shared_ptr<const std::string>>>;
+
+    std::shared_ptr<const std::string> render(const RenderKey& recKey) const;
+    std::shared_ptr<const std::string> loadFromDisk(const RenderKey& recKey) const;
+    void saveToDisk(const RenderKey& recKey, const std::string& strImage) const;
+    std::string diskPath(const RenderKey& recKey) const;
+    void insert(const RenderKey& recKey, std::shared_ptr<const std::string> pImage); // caller holds _mutex
+
+    std::size_t _maxBytes;
+    std::string _diskDir;
+    mutable std::mutex _mutex;
+    LruList _lru; // most recently used at the front
+    std::unordered_map<RenderKey, LruList::iterator, KeyHash> _index;
+    CacheStats _stats;
+};
+
+// ---------- Implementations ----------
+
+RenderCache::RenderCache(std::size_t intMaxBytes, const std::string& strDiskDir)
+: _maxBytes(intMaxBytes), _diskDir(strDiskDir)
+{
+    if(!_diskDir.empty())
+    {
+        std::error_code objError;
+        std::filesystem::create_directories(_diskDir, objError); // a failure shows up as failed saves
+    }
+}
+
+std::shared_ptr<const std::string> RenderCache::get(const RenderKey& recKey)
+{
+    {
+        std::lock_guard<std::mutex> objLock(_mutex);
+        auto itFound = _index.find(recKey);
+        if(itFound != _index.end())
+        {
+            _lru.splice(_lru.begin(), _lru, itFound->second); // now most recently used
+            ++_stats.intHits;
+            return itFound->second->second;
+        }
+    }
+
+    // Miss: try the disk copy, otherwise render. Both happen without the lock held.
+    std::shared_ptr<const std::string> pImage = loadFromDisk(recKey);
+    bool blnFromDisk = pImage != nullptr;
+    if(!blnFromDisk)
+    {
+        pImage = render(recKey);
+        saveToDisk(recKey, *pImage);
+    }
+
+    std::lock_guard<std::mutex> objLock(_mutex);
+    ++(blnFromDisk ? _stats.intDiskHits : _stats.intMisses);
+    insert(recKey, pImage);
+    return pImage;
+}
+
+CacheStats RenderCache::getStats() const
+{
+    std::lock_guard<std::mutex> objLock(_mutex);
+    CacheStats recStats = _stats;
+    recStats.intEntries = _index.size();
+    return recStats;
+}
+
+void RenderCache::clear()
+{
+    std::lock_guard<std::mutex> objLock(_mutex);
+    _lru.clear();
+    _index.clear();
+    _stats.intBytes = 0;
+}
+
+// cacheable: the binary PNM formats and P1 have an exact size up front; P3 / P2 have a lower
+// bound (every value takes at least "0 "). QOI / PNG have none short of compressing the image,
+// and a flag compresses to a few KB, so they count as cacheable.
+bool RenderCache::cacheable(const RenderKey& recKey) const
+{
+    if(isCompressed(recKey.eIllustrator))
+        return true;
+    std::unique_ptr<FlagIllustrator> pSizer = createIllustrator(recKey.eIllustrator, 0, 0);
+    pSizer->setExportMode(recKey.eMode);
+    pSizer->setAntiAlias(recKey.blnAntiAlias);
+    pSizer->illustrateProcedural(recKey.eFlag, recKey.intHeight, recKey.intWidth); // no pixel grid
+    std::size_t intSize = 0;
+    if(recKey.eMode == BINARY || recKey.eIllustrator == BW)
+        intSize = pSizer->exportSize();
+    else
+    {
+        std::size_t intValues = static_cast<std::size_t>(recKey.intWidth) * (recKey.eIllustrator == COLOUR ? 3 : 1);
+        intSize = pSizer->exportHeader().size() + static_cast<std::size_t>(recKey.intHeight) * (2 * intValues + 1);
+    }
+    return intSize <= _maxBytes;
+}
+
+std::size_t RenderCache::KeyHash::operator()(const RenderKey& recKey) const
+{
+    std::size_t intHash = std::hash<int>()(recKey.intHeight);
+    for(int intPart : {recKey.intWidth, static_cast<int>(recKey.eFlag),
+                       static_cast<int>(recKey.eIllustrator), static_cast<int>(recKey.eMode), recKey.blnAntiAlias ? 1 : 0})
+        intHash = intHash * 1000003u ^ std::hash<int>()(intPart);
+    return intHash;
+}
+
+std::shared_ptr<const std::string> RenderCache::render(const RenderKey& recKey) const
+{
+    std::unique_ptr<FlagIllustrator> pIllustrator = createIllustrator(recKey.eIllustrator, recKey.intHeight, recKey.intWidth);
+    pIllustrator->setExportMode(recKey.eMode);
+    pIllustrator->setAntiAlias(recKey.blnAntiAlias);
+    pIllustrator->illustrate(recKey.eFlag);
+    return std::make_shared<const std::string>(pIllustrator->exportImage());
+}
+
+std::shared_ptr<const std::string> RenderCache::loadFromDisk(const RenderKey& recKey) const
+{
+    if(_diskDir.empty())
+        return nullptr;
+    std::ifstream ifsImage(diskPath(recKey), std::ios::binary);
+    if(!ifsImage)
+        return nullptr;
+    std::string strImage{std::istreambuf_iterator<char>(ifsImage), std::istreambuf_iterator<char>()};
+    return std::make_shared<const std::string>(std::move(strImage));
+}
+
+// saveToDisk: write to a temporary name first and rename, so a reader never sees half a file.
+void RenderCache::saveToDisk(const RenderKey& recKey, const std::string& strImage) const
+{
+    if(_diskDir.empty())
+        return;
+    std::string strPath = diskPath(recKey);
+    std::stringstream ssTemp;
+    ssTemp << strPath << ".tmp." << std::this_thread::get_id(); // unique per writing thread
+    {
+        std::ofstream ofsImage(ssTemp.str(), std::ios::binary | std::ios::trunc);
+        if(!ofsImage.write(strImage.data(), static_cast<std::streamsize>(strImage.size())))
+            return; // persistence is best effort: the image is still cached in memory
+    }
+    std::error_code objError;
+    std::filesystem::rename(ssTemp.str(), strPath, objError);
+    if(objError)
+        std::filesystem::remove(ssTemp.str(), objError);
+}
+
+std::string RenderCache::diskPath(const RenderKey& recKey) const
+{
+    std::stringstream ssName;
+    // The hash of the flag's description keeps a flag redefined by --flags from hitting the old images.
+    ssName << flagTypeName(recKey.eFlag) << '-' << std::hex << std::setw(16) << std::setfill('0')
+           << flagSpecHash(recKey.eFlag) << std::dec << '_' << recKey.intHeight << 'x' << recKey.intWidth << '_'
+           << illustratorTypeName(recKey.eIllustrator);
+    if(!isCompressed(recKey.eIllustrator)) // QOI / PNG ignore the mode
+        ssName << (recKey.eMode == BINARY ? "_binary" : "_ascii");
+    if(recKey.blnAntiAlias)
+        ssName << "_aa";
+    ssName << illustratorExtension(recKey.eIllustrator);
+    return (std::filesystem::path(_diskDir) / ssName.str()).string();
+}
+
+void RenderCache::insert(const RenderKey& recKey, std::shared_ptr<const std::string> pImage)
+{
+    auto itFound = _index.find(recKey);
+    if(itFound != _index.end())
+    {
+        _stats.intBytes -= itFound->second->second->size();
+        _lru.erase(itFound->second);
+        _index.erase(itFound);
+    }
+    if(pImage->size() > _maxBytes)
+        return; // would evict everything and still not fit: serve it uncached
+
+    _stats.intBytes += pImage->size();
+    _lru.emplace_front(recKey, std::move(pImage));
+    _index[recKey] = _lru.begin();
+
+    while(_stats.intBytes > _maxBytes)
+    {
+        auto itOldest = std::prev(_lru.end());
+        _stats.intBytes -= itOldest->second->size();
+        _index.erase(itOldest->first);
+        _lru.erase(itOldest);
+        ++_stats.intEvictions;
+    }
+}
@@ -0,0 +1,182 @@
+// RenderPipeline.cpp encodes a flag straight from its run tables, without a pixel row in between.
+// Responsibilities:
+//  - pixel formats: what one pixel is written as (RGBValues: R, G, B; GrayValues: the intensity
+//    (R + G + B) / 3; MaskValues: 1 unless exactly white)
+//  - encoders: how the values of a row become bytes (RawBytes: P6 / P5; DecimalText: P3 / P2 /
+//    P1; PackedBits: P4, mask values only)
+//  - encodeFused<Pixels, Encoder>: the rows of a FlagRasterizer, encoded by that pair
+//
+// Render-then-export fills every pixel of a row (or of the whole grid), then converts and
+// encodes the row pixel by pixel. Here the flag is drawn and encoded in one loop over its runs:
+// each run's colour is converted and encoded once, and the bytes of that one pixel are repeated
+// over the run with block copies. The pixel format and the encoder are template parameters,
+// so every combination compiles into its own loop with no calls per run, let alone per pixel.
+// Consecutive rows with the same runs (every row of a stripe, see FlagRasterizer) are encoded
+// once and the bytes written again.
+//
+// The illustrators are the facade: in procedural mode their exportRows() runs the matching
+// pipeline (FlagIllustrator::exportRuns), so the output is byte-identical to encodeRow().
+// Flags are data (FlagLibrary), so the flag is the rasterizer passed in, not a parameter.
+
+module;
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <vector>
+
+export module RenderPipeline;
+
+import LibUtility;
+import FlagRasterizer;
+import ImageSink;
+import TextEncoder;
+
+// RunBytes: not exported, and repeatBytes is a static member rather than a static function:
+// the encoders below are templates instantiated in the importing illustrators, which may
+// reach a module's own names but not ones local to this translation unit.
+struct RunBytes
+{
+    // repeatBytes: intCount copies of the intSize bytes at pPattern from pOut on, doubling the
+    // copied block each time; returns one past the last byte.
+    static char* repeatBytes(char* pOut, const char* pPattern, std::size_t intSize, std::size_t intCount);
+};
+
+char* RunBytes::repeatBytes(char* pOut, const char* pPattern, std::size_t intSize, std::size_t intCount)
+{
+    std::size_t intTotal = intSize * intCount;
+    if(intTotal == 0)
+        return pOut;
+    std::memcpy(pOut, pPattern, intSize);
+    for(std::size_t intDone = intSize; intDone < intTotal;)
+    {
+        std::size_t intCopy = std::min(intDone, intTotal - intDone);
+        std::memcpy(pOut + intDone, pOut, intCopy);
+        intDone += intCopy;
+    }
+    return pOut + intTotal;
+}
+
+// ----- Pixel formats -----
+
+export struct RGBValues
+{
+    static constexpr std::size_t VALUES = 3;
+    static std::array<std::uint8_t, VALUES> pixelValues(const UJPixel& recPixel)
+    {
+        return {recPixel.intRed, recPixel.intGreen, recPixel.intBlue};
+    }
+};
+
+export struct GrayValues
+{
+    static constexpr std::size_t VALUES = 1;
+    static std::array<std::uint8_t, VALUES> pixelValues(const UJPixel& recPixel)
+    {
+        return {static_cast<std::uint8_t>((recPixel.intRed + recPixel.intGreen + recPixel.intBlue) / 3)};
+    }
+};
+
+export struct MaskValues
+{
+    static constexpr std::size_t VALUES = 1;
+    static std::array<std::uint8_t, VALUES> pixelValues(const UJPixel& recPixel)
+    {
+        return {static_cast<std::uint8_t>(recPixel.intRed + recPixel.intGreen + recPixel.intBlue == 3 * 255 ? 0 : 1)};
+    }
+};
+
+// ----- Encoders -----
+// rowCapacity: bytes a row of intWidth pixels of VALUES values each may take.
+// beginRow / encodeRun / endRow: a row is begun at pRow, its runs are appended left to right
+// at pOut (each call returns the new end), and endRow returns one past the finished row.
+
+export struct RawBytes
+{
+    static std::size_t rowCapacity(std::size_t intWidth, std::size_t intValues) { return intWidth * intValues; }
+    static char* beginRow(char* pRow, std::size_t) { return pRow; }
+    template<std::size_t VALUES>
+    static char* encodeRun(char*, char* pOut, const PixelRun& recRun, const std::array<std::uint8_t, VALUES>& arrValues)
+    {
+        return RunBytes::repeatBytes(pOut, reinterpret_cast<const char*>(arrValues.data()), VALUES,
+                                     static_cast<std::size_t>(recRun.intEnd - recRun.intBegin));
+    }
+    static char* endRow(char*, char* pOut, std::size_t) { return pOut; }
+};
+
+export struct DecimalText
+{
+    static std::size_t rowCapacity(std::size_t intWidth, std::size_t intValues) { return intWidth * intValues * TEXT_BYTES_PER_VALUE + 1; }
+    static char* beginRow(char* pRow, std::size_t) { return pRow; }
+    template<std::size_t VALUES>
+    static char* encodeRun(char*, char* pOut, const PixelRun& recRun, const std::array<std::uint8_t, VALUES>& arrValues)
+    {
+        char arrText[VALUES * TEXT_BYTES_PER_VALUE];
+        char* pEnd = encodeText(arrValues, arrText);
+        return RunBytes::repeatBytes(pOut, arrText, static_cast<std::size_t>(pEnd - arrText), static_cast<std::size_t>(recRun.intEnd - recRun.intBegin));
+    }
+    static char* endRow(char*, char* pOut, std::size_t)
+    {
+        *pOut = '\n';
+        return pOut + 1;
+    }
+};
+
+// PackedBits: the row starts all white (0 bits, which also pads the last byte); black runs set
+// their bits, a partial byte at either end and whole 0xFF bytes in between.
+export struct PackedBits
+{
+    static std::size_t rowCapacity(std::size_t intWidth, std::size_t) { return (intWidth + 7) / 8; }
+    static char* beginRow(char* pRow, std::size_t intWidth)
+    {
+        std::memset(pRow, 0, (intWidth + 7) / 8);
+        return pRow;
+    }
+    template<std::size_t VALUES>
+    static char* encodeRun(char* pRow, char* pOut, const PixelRun& recRun, const std::array<std::uint8_t, VALUES>& arrValues)
+    {
+        static_assert(VALUES == 1, "PackedBits encodes mask values");
+        if(arrValues[0] == 0)
+            return pOut;
+        std::uint8_t* pBits = reinterpret_cast<std::uint8_t*>(pRow);
+        std::size_t c = static_cast<std::size_t>(recRun.intBegin);
+        std::size_t intEnd = static_cast<std::size_t>(recRun.intEnd);
+        for(; c < intEnd && c % 8 != 0; ++c)
+            pBits[c / 8] |= static_cast<std::uint8_t>(0x80 >> (c % 8));
+        std::size_t intFull = (intEnd - c) / 8;
+        std::memset(pBits + c / 8, 0xFF, intFull);
+        for(c += intFull * 8; c < intEnd; ++c)
+            pBits[c / 8] |= static_cast<std::uint8_t>(0x80 >> (c % 8));
+        return pOut;
+    }
+    static char* endRow(char* pRow, char*, std::size_t intWidth) { return pRow + (intWidth + 7) / 8; }
+};
+
+// encodeFused: rows [intRowBegin, intRowEnd) of objRaster's flag, each converted by Pixels and
+// encoded by Encoder, written to objSink (exactly what encodeRow() would write for the filled rows).
+export template<class Pixels, class Encoder>
+void encodeFused(const FlagRasterizer& objRaster, ImageSink& objSink, int intRowBegin, int intRowEnd)
+{
+    std::size_t intWidth = static_cast<std::size_t>(objRaster.getWidth());
+    std::vector<char> vecRow(Encoder::rowCapacity(intWidth, Pixels::VALUES));
+    const PixelRun* pEncoded = nullptr; // the runs vecRow holds, once blnEncoded
+    bool blnEncoded = false;
+    std::size_t intSize = 0;
+    for(int r = intRowBegin; r < intRowEnd; ++r)
+    {
+        std::span<const PixelRun> arrRuns = objRaster.rowRuns(r);
+        if(!blnEncoded || arrRuns.data() != pEncoded)
+        {
+            char* pRow = vecRow.data();
+            char* pOut = Encoder::beginRow(pRow, intWidth);
+            for(const PixelRun& recRun : arrRuns)
+                pOut = Encoder::encodeRun(pRow, pOut, recRun, Pixels::pixelValues(recRun.recColour));
+            intSize = static_cast<std::size_t>(Encoder::endRow(pRow, pOut, intWidth) - pRow);
+            pEncoded = arrRuns.data();
+            blnEncoded = true;
+        }
+        objSink.write(vecRow.data(), intSize);
+    }
+}
@@ -0,0 +1,540 @@
+// RenderServer.cpp is a long-running render daemon answering requests over a local socket.
+// Responsibilities:
+//  - listen on a Unix domain socket (or a TCP port on 127.0.0.1)
+//  - read requests from each connection, one per line, and hand them to a worker pool
+//  - render with the normal FlagIllustrator classes (or through a RenderCache when one is set)
+//  - send the replies back on each connection in request order, encoding the PNM formats
+//    straight into the socket
+//
+// Protocol (text lines, '\n' terminated; replies are in the same order as the requests):
+//   <FlagType 0..flagCount()-1> <height> <width> <IllustratorType 0..4> [binary] [aa]
+//       ("aa": anti-aliased circle edges, as --antialias; the options may come in either order)
+//       -> "OK <n>\n" followed by exactly n bytes of PNM / QOI / PNG image
+//       -> "ERR <reason>\n" for a malformed request, or a QOI / PNG one with a 0 height or width
+//          (the connection stays open)
+//   STATS     -> "OK <n>\n" followed by the render metrics in Prometheus text format (Metrics.cpp),
+//                taken when the reply is sent, so every earlier request on the connection is in it
+//   QUIT      -> closes this connection
+//   SHUTDOWN  -> stops the whole server (open connections are closed)
+// A client may send any number of requests without waiting for replies (pipelining).
+//
+// Backpressure: the render queue shared by all connections holds at most intQueueLimit
+// requests and each connection may have at most intPipelineLimit unanswered requests.
+// When either is full the connection simply stops reading its socket until there is room.
+//
+// Threads: one accept loop (the caller of run()), intWorkers render workers, and a reader
+// plus a writer thread per open connection.
+//
+// Memory: a worker describes the flag (illustrateProcedural) and hands the illustrator to the
+// connection's writer, which sends "OK <exportSize()>" and then encodes the rows through an
+// ImageSink into the socket, so a PNM reply takes one row and one sink chunk, not the image.
+// QOI / PNG replies are compressed by the worker into a string (exportSize() would mean
+// compressing them twice, and a compressed flag is small), and cache hits are sent as stored.
+
+module;
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // SIGPIPE is ignored in run() instead
+#endif
+#endif
+
+export module RenderServer;
+
+import LibUtility;
+import FlagLibrary;
+import ImageSink;
+import FlagIllustrator;
+import IllustratorFactory;
+import RenderCache;
+import Metrics;
+
+export struct ServerOptions
+{
+    std::string strSocketPath;            // Unix domain socket path; empty = TCP on intPort
+    int intPort = 0;                      // TCP port on 127.0.0.1 (used when strSocketPath is empty)
+    int intWorkers = 1;                   // render threads
+    std::size_t intQueueLimit = 64;       // queued renders, all connections together
+    std::size_t intPipelineLimit = 16;    // unanswered requests per connection
+    RenderCache* pCache = nullptr;        // not owned; nullptr renders every request
+    int intMaxDimension = 10000;          // bounds the time one request may take
+};
+
+export class RenderServer
+{
+public:
+    explicit RenderServer(const ServerOptions& recOptions);
+    RenderServer(const RenderServer&) = delete;
+    RenderServer& operator=(const RenderServer&) = delete;
+
+    // run: listens and serves until a SHUTDOWN request arrives.
+    // Returns SUCCESS, ERROR_ARGS if the socket path is too long (or on Windows, where there is
+    // no server), or ERROR_IO if the socket could not be set up.
+    int run();
+
+    // parseRequest: one request line (protocol above) into recKey.
+    // Returns false, with the reason for the "ERR" reply in strError, if it is malformed
+    // or larger than ServerOptions::intMaxDimension.
+    bool parseRequest(const std::string& strLine, RenderKey& recKey, std::string& strError) const;
+
+private:
+    using ImagePtr = std::shared_ptr<const std::string>;
+
+    // RenderedImage: a worker's result, either the encoded bytes (cache hits, QOI / PNG) or a
+    // procedural illustrator the writer encodes while sending it.
+    struct RenderedImage
+    {
+        ImagePtr pBytes;
+        std::unique_ptr<FlagIllustrator> pIllustrator;
+    };
+
+    struct RenderTask
+    {
+        RenderKey recKey;
+        std::promise<RenderedImage> objResult;
+    };
+
+    // Reply: one per request, in request order. An empty future means strError is sent instead.
+    struct Reply
+    {
+        std::future<RenderedImage> objImage;
+        std::string strError;
+        bool blnStats = false; // a STATS reply: no image, the metrics text
+    };
+
+    // Connection: the state shared by the reader and writer thread of one client.
+    struct Connection
+    {
+        int intFd = -1;
+        std::mutex objMutex;
+        std::condition_variable cvChanged;
+        std::deque<Reply> deqReplies;
+        bool blnReaderDone = false;
+    };
+
+    void work();                                      // render worker loop
+    void serveConnection(int intFd, std::atomic<bool>& blnDone); // reader side of one connection
+    void writeReplies(Connection& objConnection);     // writer side of one connection
+    void submit(RenderTask&& recTask);                // blocks while the queue is full
+    void stop();                                      // SHUTDOWN: wake everything up
+
+    ServerOptions _options;
+    int _listenFd = -1;
+    std::atomic<bool> _stopping{false};
+
+    std::mutex _queueMutex;
+    std::condition_variable _cvNotEmpty;
+    std::condition_variable _cvNotFull;
+    std::deque<RenderTask> _queue;
+
+    std::mutex _clientsMutex;
+    std::set<int> _clientFds;                         // open connections, closed on SHUTDOWN
+};
+
+// ---------- Implementations ----------
+
+RenderServer::RenderServer(const ServerOptions& recOptions)
+: _options(recOptions)
+{
+    _options.intWorkers       = std::max(1, _options.intWorkers);
+    _options.intMaxDimension  = std::clamp(_options.intMaxDimension, 0, MAX_DIMENSION);
+    _options.intQueueLimit    = std::max<std::size_t>(1, _options.intQueueLimit);
+    _options.intPipelineLimit = std::max<std::size_t>(1, _options.intPipelineLimit);
+}
+
+bool RenderServer::parseRequest(const std::string& strLine, RenderKey& recKey, std::string& strError) const
+{
+    std::stringstream ssFields{strLine};
+    int intFlag = 0, intHeight = 0, intWidth = 0, intIllustrator = 0;
+    strError.clear();
+    if(!(ssFields >> intFlag >> intHeight >> intWidth >> intIllustrator))
+        strError = "expected <flag> <height> <width> <illustrator> [binary] [aa]";
+    else if(!isValidFlag(intFlag))
+        strError = "FlagType must be in [0, " + std::to_string(flagCount() - 1) + "]";
+    else if(intHeight < 0 || intHeight > _options.intMaxDimension || intWidth < 0 || intWidth > _options.intMaxDimension)
+        strError = "height and width must be in [0, " + std::to_string(_options.intMaxDimension) + "]";
+    else if(intIllustrator < 0 || intIllustrator > PNG)
+        strError = "IllustratorType must be in [0, 4]";
+    else if(isCompressed(static_cast<IllustratorType>(intIllustrator)) && (intHeight == 0 || intWidth == 0))
+        strError = "QOI and PNG images need a height and width of at least 1";
+    if(!strError.empty())
+        return false;
+
+    recKey.eMode = ASCII;
+    recKey.blnAntiAlias = false;
+    std::string strOption;
+    while(ssFields >> strOption)
+    {
+        if(strOption == "binary" && recKey.eMode == ASCII)
+            recKey.eMode = BINARY;
+        else if(strOption == "aa" && !recKey.blnAntiAlias)
+            recKey.blnAntiAlias = true;
+        else
+        {
+            strError = "unexpected '" + strOption + "' (the options are 'binary' and 'aa', once each)";
+            return false;
+        }
+    }
+    recKey.eFlag        = static_cast<FlagType>(intFlag);
+    recKey.intHeight    = intHeight;
+    recKey.intWidth     = intWidth;
+    recKey.eIllustrator = static_cast<IllustratorType>(intIllustrator);
+    return true;
+}
+
+void RenderServer::submit(RenderTask&& recTask)
+{
+    std::unique_lock<std::mutex> objLock(_queueMutex);
+    _cvNotFull.wait(objLock, [this] { return _queue.size() < _options.intQueueLimit || _stopping; });
+    if(_stopping)
+        return; // dropped: the broken promise turns into an "ERR" reply
+    _queue.push_back(std::move(recTask));
+    _cvNotEmpty.notify_one();
+}
+
+void RenderServer::work()
+{
+    while(true)
+    {
+        RenderTask recTask;
+        {
+            std::unique_lock<std::mutex> objLock(_queueMutex);
+            _cvNotEmpty.wait(objLock, [this] { return !_queue.empty() || _stopping; });
+            if(_queue.empty())
+                return; // stopping and nothing left to do
+            recTask = std::move(_queue.front());
+            _queue.pop_front();
+            _cvNotFull.notify_one();
+        }
+
+        const RenderKey& recKey = recTask.recKey;
+        RenderedImage recImage;
+        if(_options.pCache != nullptr && _options.pCache->cacheable(recKey))
+            recImage.pBytes = _options.pCache->get(recKey);
+        else
+        {
+            // No pixel grid: the writer generates the rows while it sends them.
+            recImage.pIllustrator = createIllustrator(recKey.eIllustrator, 0, 0);
+            recImage.pIllustrator->setExportMode(recKey.eMode);
+            recImage.pIllustrator->setAntiAlias(recKey.blnAntiAlias);
+            recImage.pIllustrator->illustrateProcedural(recKey.eFlag, recKey.intHeight, recKey.intWidth);
+            if(isCompressed(recKey.eIllustrator))
+            {
+                recImage.pBytes = std::make_shared<const std::string>(recImage.pIllustrator->exportImage());
+                recImage.pIllustrator.reset();
+            }
+        }
+        recTask.objResult.set_value(std::move(recImage));
+    }
+}
+
+#ifdef _WIN32
+
+int RenderServer::run()
+{
+    std::cerr << "ERROR! Server mode needs POSIX sockets and is not available on Windows. Terminating." << std::endl;
+    return ERROR_ARGS;
+}
+
+void RenderServer::serveConnection(int, std::atomic<bool>&)
+{}
+
+void RenderServer::writeReplies(Connection&)
+{}
+
+void RenderServer::stop()
+{}
+
+#else
+
+// sendAll: writes the whole block; false once the client has gone away.
+static bool sendAll(int intFd, const char* pData, std::size_t intSize)
+{
+    while(intSize > 0)
+    {
+        ssize_t intDone = ::send(intFd, pData, intSize, MSG_NOSIGNAL);
+        if(intDone < 0 && errno == EINTR)
+            continue;
+        if(intDone <= 0)
+            return false;
+        pData   += intDone;
+        intSize -= static_cast<std::size_t>(intDone);
+    }
+    return true;
+}
+
+int RenderServer::run()
+{
+    std::signal(SIGPIPE, SIG_IGN); // a client hanging up must not kill the server
+    if(!_options.strSocketPath.empty())
+    {
+        sockaddr_un recAddress{};
+        if(_options.strSocketPath.size() >= sizeof(recAddress.sun_path))
+        {
+            std::cerr << "ERROR! Socket path too long: " << _options.strSocketPath << ". Terminating." << std::endl;
+            return ERROR_ARGS;
+        }
+        recAddress.sun_family = AF_UNIX;
+        std::strcpy(recAddress.sun_path, _options.strSocketPath.c_str());
+        ::unlink(recAddress.sun_path); // a stale socket from an earlier run
+        _listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if(_listenFd < 0 || ::bind(_listenFd, reinterpret_cast<sockaddr*>(&recAddress), sizeof(recAddress)) != 0)
+        {
+            std::cerr << "ERROR! Could not bind " << _options.strSocketPath << ": " << std::strerror(errno) << ". Terminating." << std::endl;
+            return ERROR_IO;
+        }
+    }
+    else
+    {
+        sockaddr_in recAddress{};
+        recAddress.sin_family      = AF_INET;
+        recAddress.sin_port        = htons(static_cast<std::uint16_t>(_options.intPort));
+        recAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // local clients only
+        _listenFd = ::socket(AF_INET, SOCK_STREAM, 0);
+        int intOn = 1;
+        if(_listenFd >= 0)
+            ::setsockopt(_listenFd, SOL_SOCKET, SO_REUSEADDR, &intOn, sizeof(intOn));
+        if(_listenFd < 0 || ::bind(_listenFd, reinterpret_cast<sockaddr*>(&recAddress), sizeof(recAddress)) != 0)
+        {
+            std::cerr << "ERROR! Could not bind 127.0.0.1:" << _options.intPort << ": " << std::strerror(errno) << ". Terminating." << std::endl;
+            return ERROR_IO;
+        }
+    }
+    if(::listen(_listenFd, SOMAXCONN) != 0)
+    {
+        std::cerr << "ERROR! Could not listen: " << std::strerror(errno) << ". Terminating." << std::endl;
+        return ERROR_IO;
+    }
+    std::cerr << "server: listening on "
+              << (_options.strSocketPath.empty() ? "127.0.0.1:" + std::to_string(_options.intPort) : _options.strSocketPath)
+              << " with " << _options.intWorkers << " workers" << std::endl;
+
+    std::vector<std::thread> vecWorkers;
+    for(int w = 0; w < _options.intWorkers; ++w)
+        vecWorkers.emplace_back(&RenderServer::work, this);
+
+    // Connection threads, each with a flag it sets when done so the loop can join it.
+    std::list<std::pair<std::thread, std::unique_ptr<std::atomic<bool>>>> lstConnections;
+    while(!_stopping)
+    {
+        lstConnections.remove_if([](auto& objEntry)
+        {
+            if(!*objEntry.second)
+                return false;
+            objEntry.first.join();
+            return true;
+        });
+        int intClient = ::accept(_listenFd, nullptr, nullptr);
+        if(intClient < 0)
+        {
+            if(errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break; // listening socket shut down by stop(), or a real error
+        }
+        if(_options.strSocketPath.empty())
+        {
+            int intOn = 1; // replies are sent in sink chunks; do not hold back the last segment
+            ::setsockopt(intClient, IPPROTO_TCP, TCP_NODELAY, &intOn, sizeof(intOn));
+        }
+        std::lock_guard<std::mutex> objLock(_clientsMutex);
+        if(_stopping)
+        {
+            ::close(intClient);
+            break;
+        }
+        _clientFds.insert(intClient);
+        auto pDone = std::make_unique<std::atomic<bool>>(false);
+        std::thread objThread(&RenderServer::serveConnection, this, intClient, std::ref(*pDone));
+        lstConnections.emplace_back(std::move(objThread), std::move(pDone));
+    }
+
+    stop();
+    for(auto& objEntry : lstConnections)
+        objEntry.first.join();
+    for(std::thread& objThread : vecWorkers)
+        objThread.join();
+    ::close(_listenFd);
+    if(!_options.strSocketPath.empty())
+        ::unlink(_options.strSocketPath.c_str());
+    return SUCCESS;
+}
+
+void RenderServer::stop()
+{
+    _stopping = true;
+    ::shutdown(_listenFd, SHUT_RDWR); // wakes the accept loop
+    {
+        std::lock_guard<std::mutex> objLock(_clientsMutex);
+        for(int intFd : _clientFds)
+            ::shutdown(intFd, SHUT_RDWR); // wakes readers blocked in recv
+    }
+    std::lock_guard<std::mutex> objLock(_queueMutex);
+    _cvNotEmpty.notify_all();
+    _cvNotFull.notify_all();
+}
+
+void RenderServer::serveConnection(int intFd, std::atomic<bool>& blnDone)
+{
+    Connection objConnection;
+    objConnection.intFd = intFd;
+    std::thread objWriter(&RenderServer::writeReplies, this, std::ref(objConnection));
+
+    // queueReply: blocks while this connection already has intPipelineLimit replies pending.
+    auto queueReply = [&](Reply&& recReply)
+    {
+        std::unique_lock<std::mutex> objLock(objConnection.objMutex);
+        objConnection.cvChanged.wait(objLock, [&] { return objConnection.deqReplies.size() < _options.intPipelineLimit; });
+        objConnection.deqReplies.push_back(std::move(recReply));
+        objConnection.cvChanged.notify_all();
+    };
+
+    std::string strPending;
+    char arrBuffer[4096];
+    bool blnOpen = true;
+    while(blnOpen && !_stopping)
+    {
+        ssize_t intRead = ::recv(intFd, arrBuffer, sizeof(arrBuffer), 0);
+        if(intRead < 0 && errno == EINTR)
+            continue;
+        if(intRead <= 0)
+            break; // client closed, or the server is shutting down
+        strPending.append(arrBuffer, static_cast<std::size_t>(intRead));
+
+        std::size_t intStart = 0;
+        for(std::size_t intEnd = strPending.find('\n'); intEnd != std::string::npos && blnOpen;
+            intStart = intEnd + 1, intEnd = strPending.find('\n', intStart))
+        {
+            std::string strLine = strPending.substr(intStart, intEnd - intStart);
+            if(!strLine.empty() && strLine.back() == '\r')
+                strLine.pop_back();
+            if(strLine.empty())
+                continue;
+            if(strLine == "QUIT")
+            {
+                blnOpen = false;
+                break;
+            }
+            if(strLine == "STATS")
+            {
+                Reply recReply;
+                recReply.blnStats = true;
+                queueReply(std::move(recReply));
+                continue;
+            }
+            if(strLine == "SHUTDOWN")
+            {
+                blnOpen = false;
+                stop();
+                break;
+            }
+
+            Reply recReply;
+            RenderTask recTask;
+            if(parseRequest(strLine, recTask.recKey, recReply.strError))
+            {
+                recReply.objImage = recTask.objResult.get_future();
+                queueReply(std::move(recReply)); // reserve the reply slot first, so order is kept
+                submit(std::move(recTask));
+            }
+            else
+                queueReply(std::move(recReply));
+        }
+        strPending.erase(0, intStart);
+    }
+
+    {
+        std::lock_guard<std::mutex> objLock(objConnection.objMutex);
+        objConnection.blnReaderDone = true;
+        objConnection.cvChanged.notify_all();
+    }
+    objWriter.join();
+
+    std::lock_guard<std::mutex> objLock(_clientsMutex);
+    _clientFds.erase(intFd);
+    ::close(intFd);
+    blnDone = true;
+}
+
+void RenderServer::writeReplies(Connection& objConnection)
+{
+    bool blnClientGone = false;
+    while(true)
+    {
+        Reply recReply;
+        {
+            std::unique_lock<std::mutex> objLock(objConnection.objMutex);
+            objConnection.cvChanged.wait(objLock, [&] { return !objConnection.deqReplies.empty() || objConnection.blnReaderDone; });
+            if(objConnection.deqReplies.empty())
+                return; // reader finished and every reply has been sent
+            recReply = std::move(objConnection.deqReplies.front());
+            objConnection.deqReplies.pop_front();
+            objConnection.cvChanged.notify_all(); // room for the reader again
+        }
+
+        // A task queued during SHUTDOWN may never run; its promise is then broken and get() throws.
+        std::string strHeader;
+        RenderedImage recImage;
+        if(recReply.objImage.valid())
+        {
+            try
+            {
+                recImage = recReply.objImage.get();
+            }
+            catch(const std::future_error&)
+            {
+                strHeader = "ERR server shutting down\n";
+            }
+        }
+        else if(recReply.blnStats)
+        {
+            // Earlier replies on this connection have been sent, so their renders are counted.
+            recImage.pBytes = std::make_shared<const std::string>(metricsSnapshot().toPrometheus());
+        }
+        else
+            strHeader = "ERR " + recReply.strError + "\n";
+        if(blnClientGone)
+            continue; // keep draining so the reader never blocks on a full pipeline
+        if(recImage.pBytes != nullptr)
+            strHeader = "OK " + std::to_string(recImage.pBytes->size()) + "\n";
+        else if(recImage.pIllustrator != nullptr)
+            strHeader = "OK " + std::to_string(recImage.pIllustrator->exportSize()) + "\n";
+
+        ImageSink objSink([&](const char* pData, std::size_t intSize)
+        {
+            if(!blnClientGone)
+                blnClientGone = !sendAll(objConnection.intFd, pData, intSize);
+        });
+        objSink.write(strHeader);
+        if(recImage.pBytes != nullptr)
+            objSink.write(*recImage.pBytes);
+        else if(recImage.pIllustrator != nullptr)
+            recImage.pIllustrator->exportImage(objSink);
+    }
+}
+
+#endif
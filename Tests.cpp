@@ -0,0 +1,1459 @@
+// Tests.cpp is a separate entry point that checks every output format against its specification.
+// Checks, for every flag (the built-in ones and one registered here), a range of sizes, every
+// illustrator and both export modes:
+//  - PNM (P1..P6): the file parsed back (header, then every value) equals the reference flag,
+//    converted as the format defines them: R G B, the intensity (R + G + B) / 3, 1 unless white
+//  - streaming: exportImage(ImageSink&) through a sink with a tiny chunk size writes the same
+//    bytes as exportImage(), exportSize() is exactly their count and exportReserve() at least it
+//  - threads: a flag drawn in 7 parallel row bands exports the same bytes as one drawn serially
+//  - procedural: the flag described only (no pixel grid) exports the same bytes as the drawn one;
+//    for the PNM formats that export is encoded straight from the runs (RenderPipeline), and
+//    with setFusedExport(false) through encodeRow() instead, again the same bytes
+//  - anti-aliasing: all of the above again with blended circle edges; pixels more than a pixel
+//    away from a circle edge still equal the reference, edge pixels lie between the circle
+//    colour and the colour under it
+//  - tiled: TiledRenderer::render (small bands, 3 threads) writes the same bytes as exportImage(),
+//    and so does renderToFile (binary images through renderMapped where files can be mapped)
+//  - dithering: ordered and error-diffusion P1 / P4 files hold exactly the reference flag
+//    dithered by the textbook definitions, whatever the number of threads, drawn or procedural,
+//    tiled (ordered) or as a multi-format target
+//  - QOI: decoded by a reference decoder (qoiformat.org), equal to the drawn pixels
+//  - PNG: every chunk CRC verified, the IDAT stream inflated (stored, fixed and dynamic
+//    Huffman blocks), its Adler-32 verified and the rows unfiltered, equal to the drawn pixels;
+//    QOI and PNG are also checked at a size that spans several compressed bands, on 3 threads,
+//    and on a synthetic image that exercises every QOI operation and PNG filter choice
+//  - multi-format export: one pass over a drawn or procedural flag writes every format (PNM in
+//    both modes), each equal to that illustrator's own exportImage()
+//  - flag library: malformed flag descriptions are rejected on the right line, well-formed ones
+//    (coordinates, offsets, radii, comments) are read exactly; different descriptions hash
+//    differently; radii over 4h / 4w are rejected, and circles at that bound or (built in code)
+//    far past it cover the whole image instead of overflowing
+//  - moves: an image released from one illustrator, moved or copied into another, exports as
+//    if it had been drawn there, and the moved-from side is left 0x0
+//  - rectangles: random fillRect / copyRect calls (within one image, overlapping too) leave the
+//    same pixels as the same operations done pixel by pixel with getPixel / setPixel
+//  - pixel pool: size classes stay within 25% of the request, and flags drawn into recycled
+//    buffers export the same bytes as flags drawn into fresh ones; an allocation that throws
+//    leaves the pool's counters alone
+//  - metrics: stage times nested on one thread count once, per-render scopes add up separately
+//    from the process-wide counters, and (with -DUJ_METRICS) an export counts its pixels
+//  - batch jobs: BatchRenderer reads well-formed job lines field by field and rejects malformed ones;
+//    a run writes each job's file, and a job whose output cannot be opened fails unrendered
+//  - render cache: hits return the exported bytes, the least recently used entry is evicted first
+//    and a second cache reloads the images the first one persisted (named after the hash of
+//    the flag description); cacheable() tells images over the budget from the key alone
+//  - server requests: RenderServer reads well-formed request lines and rejects malformed ones
+// The parser, the decoders, the checksums and the reference flags here follow the format and
+// flag definitions and share no code with the illustrators.
+//
+// Usage:
+//   tests
+// Prints each failed check and a summary on stderr; the exit code is SUCCESS if every check
+// passed and ERROR_CONV otherwise.
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <span>
+#include <sstream>
+#include <string>
+#include <vector>
+
+import LibUtility;
+import Metrics;
+import FlagLibrary;
+import ImageSink;
+import PixelPool;
+import UJImage;
+import FlagIllustrator;
+import IllustratorFactory;
+import MappedFile;
+import TiledRenderer;
+import MultiExporter;
+import RenderCache;
+import RenderServer;
+import BatchRenderer;
+
+struct TestSize
+{
+    int intHeight;
+    int intWidth;
+};
+
+static const std::vector<TestSize> SIZES = {{1, 1}, {2, 3}, {7, 13}, {37, 61}, {240, 320}};
+static const TestSize BANDED_SIZE = {700, 600}; // several QOI / PNG bands (BAND_PIXELS = 256K)
+
+static int s_intChecks   = 0;
+static int s_intFailures = 0;
+
+// check: counts one check and reports it if it failed.
+static void check(bool blnOk, const std::string& strWhat)
+{
+    ++s_intChecks;
+    if(blnOk)
+        return;
+    ++s_intFailures;
+    std::cerr << "FAIL: " << strWhat << std::endl;
+}
+
+// describe: "JAPAN 37x61 Colour binary aa", for the failure messages.
+static std::string describe(FlagType eFlag, const TestSize& recSize, IllustratorType eType, ExportMode eMode,
+                            bool blnAntiAlias = false)
+{
+    std::stringstream ssName;
+    ssName << flagTypeName(eFlag) << ' ' << recSize.intHeight << 'x' << recSize.intWidth << ' '
+           << illustratorTypeName(eType) << (eMode == BINARY ? " binary" : " ascii") << (blnAntiAlias ? " aa" : "");
+    return ssName.str();
+}
+
+// drawnIllustrator: the flag drawn by an illustrator of eType, on intThreads threads.
+static std::unique_ptr<FlagIllustrator> drawnIllustrator(FlagType eFlag, const TestSize& recSize, IllustratorType eType, ExportMode eMode,
+                                                         bool blnAntiAlias = false, int intThreads = 1)
+{
+    std::unique_ptr<FlagIllustrator> pIllustrator = createIllustrator(eType, recSize.intHeight, recSize.intWidth);
+    pIllustrator->setExportMode(eMode);
+    pIllustrator->setAntiAlias(blnAntiAlias);
+    pIllustrator->illustrate(eFlag, intThreads);
+    return pIllustrator;
+}
+
+// proceduralIllustrator: the flag described only (no grid), exported fused or through encodeRow().
+static std::unique_ptr<FlagIllustrator> proceduralIllustrator(FlagType eFlag, const TestSize& recSize, IllustratorType eType, ExportMode eMode,
+                                                              bool blnAntiAlias = false, bool blnFused = true)
+{
+    std::unique_ptr<FlagIllustrator> pIllustrator = createIllustrator(eType, 0, 0);
+    pIllustrator->setExportMode(eMode);
+    pIllustrator->setAntiAlias(blnAntiAlias);
+    pIllustrator->setFusedExport(blnFused);
+    pIllustrator->illustrateProcedural(eFlag, recSize.intHeight, recSize.intWidth);
+    return pIllustrator;
+}
+
+// ----- Reference flags -----
+
+// TEST_FLAG: registered by checkFlagLibrary() as the flag after the built-in ones.
+static const char* TEST_FLAG = R"(
+flag TEST_STRIPES
+hstripes 3 #000000 #EF3340 #FFFFFF
+circle 1/2 1/4 0.25w #1B7339
+)";
+
+// testStripe: the colour of row r of TEST_FLAG's stripes.
+static UJPixel testStripe(const TestSize& recSize, int r)
+{
+    int intBand = recSize.intHeight / 3;
+    return r < intBand ? UJPixel{0, 0, 0} : r < 2 * intBand ? UJPixel{239, 51, 64} : UJPixel{255, 255, 255};
+}
+
+// referencePixel: the colour of pixel (r, c), straight from the flag definitions.
+static UJPixel referencePixel(FlagType eFlag, const TestSize& recSize, int r, int c)
+{
+    const UJPixel recWhite = {255, 255, 255};
+    switch(static_cast<int>(eFlag))
+    {
+        case AUSTRIA:
+        {
+            int intThickness = recSize.intHeight / 3;
+            return r > intThickness && r < 2 * intThickness ? recWhite : UJPixel{239, 51, 64};
+        }
+        case JAPAN:
+        {
+            double dblRow = r - recSize.intHeight / 2, dblCol = c - recSize.intWidth / 2;
+            return std::sqrt(dblRow * dblRow + dblCol * dblCol) <= 0.3 * recSize.intHeight ? UJPixel{188, 0, 45} : recWhite;
+        }
+        case NIGERIA:
+        {
+            int intThickness = recSize.intWidth / 3;
+            return c > intThickness && c < 2 * intThickness ? recWhite : UJPixel{27, 115, 57};
+        }
+        default: // TEST_FLAG
+        {
+            double dblRow = r - recSize.intHeight / 2, dblCol = c - recSize.intWidth / 4;
+            if(std::sqrt(dblRow * dblRow + dblCol * dblCol) <= 0.25 * recSize.intWidth)
+                return {27, 115, 57};
+            return testStripe(recSize, r);
+        }
+    }
+}
+
+// referenceEdge: whether pixel (r, c) lies within a pixel of a circle edge, where anti-aliasing
+// may blend it; if so, the circle colour and the colour under the circle there.
+static bool referenceEdge(FlagType eFlag, const TestSize& recSize, int r, int c, UJPixel& recCircle, UJPixel& recUnder)
+{
+    double dblRow = r - recSize.intHeight / 2, dblCol = 0, dblRadius = 0;
+    if(eFlag == JAPAN)
+    {
+        dblCol = c - recSize.intWidth / 2;
+        dblRadius = 0.3 * recSize.intHeight;
+        recCircle = {188, 0, 45};
+        recUnder = {255, 255, 255};
+    }
+    else if(eFlag != AUSTRIA && eFlag != NIGERIA) // TEST_FLAG
+    {
+        dblCol = c - recSize.intWidth / 4;
+        dblRadius = 0.25 * recSize.intWidth;
+        recCircle = {27, 115, 57};
+        recUnder = testStripe(recSize, r);
+    }
+    else
+        return false;
+    return std::abs(std::sqrt(dblRow * dblRow + dblCol * dblCol) - dblRadius) <= 1.0;
+}
+
+// ----- Checksums (bit by bit, straight from the definitions) -----
+
+static std::uint32_t referenceCrc32(const std::uint8_t* pData, std::size_t intSize)
+{
+    std::uint32_t intCrc = 0xFFFFFFFFu;
+    for(std::size_t i = 0; i < intSize; ++i)
+    {
+        intCrc ^= pData[i];
+        for(int k = 0; k < 8; ++k)
+            intCrc = (intCrc >> 1) ^ ((intCrc & 1) ? 0xEDB88320u : 0u);
+    }
+    return ~intCrc;
+}
+
+static std::uint32_t referenceAdler32(const std::vector<std::uint8_t>& vecData)
+{
+    std::uint32_t intA = 1, intB = 0;
+    for(std::uint8_t intByte : vecData)
+    {
+        intA = (intA + intByte) % 65521;
+        intB = (intB + intA) % 65521;
+    }
+    return intB << 16 | intA;
+}
+
+static std::uint32_t readBig32(const std::string& strData, std::size_t intAt)
+{
+    std::uint32_t intValue = 0;
+    for(std::size_t i = 0; i < 4; ++i)
+        intValue = intValue << 8 | static_cast<std::uint8_t>(strData[intAt + i]);
+    return intValue;
+}
+
+
+// ----- PNM -----
+
+// PnmImage: a parsed P1..P6 file, its values in file order (R G B per pixel for P3 / P6).
+struct PnmImage
+{
+    std::string strMagic;
+    int intWidth  = 0;
+    int intHeight = 0;
+    std::vector<int> vecValues;
+};
+
+// parsePnm: false if strData is not exactly one well-formed image.
+static bool parsePnm(const std::string& strData, PnmImage& recImage)
+{
+    std::size_t intAt = 0;
+    auto fnSkipSpace = [&]()
+    {
+        while(intAt < strData.size() && (std::isspace(static_cast<unsigned char>(strData[intAt])) || strData[intAt] == '#'))
+        {
+            if(strData[intAt] == '#')
+                while(intAt < strData.size() && strData[intAt] != '\n')
+                    ++intAt;
+            else
+                ++intAt;
+        }
+    };
+    auto fnNumber = [&](int& intValue)
+    {
+        fnSkipSpace();
+        if(intAt >= strData.size() || !std::isdigit(static_cast<unsigned char>(strData[intAt])))
+            return false;
+        intValue = 0;
+        while(intAt < strData.size() && std::isdigit(static_cast<unsigned char>(strData[intAt])))
+            intValue = intValue * 10 + (strData[intAt++] - '0');
+        return true;
+    };
+
+    if(strData.size() < 2 || strData[0] != 'P' || strData[1] < '1' || strData[1] > '6')
+        return false;
+    recImage.strMagic = strData.substr(0, 2);
+    intAt = 2;
+    char chKind = strData[1];
+    int intMax = 1;
+    if(!fnNumber(recImage.intWidth) || !fnNumber(recImage.intHeight))
+        return false;
+    if(chKind != '1' && chKind != '4' && (!fnNumber(intMax) || intMax != 255))
+        return false;
+
+    std::size_t intPixels = static_cast<std::size_t>(recImage.intWidth) * static_cast<std::size_t>(recImage.intHeight);
+    std::size_t intValues = intPixels * (chKind == '3' || chKind == '6' ? 3 : 1);
+    recImage.vecValues.clear();
+    if(chKind <= '3')
+    {
+        for(std::size_t v = 0; v < intValues; ++v)
+        {
+            int intValue = 0;
+            if(chKind == '1')
+            {
+                fnSkipSpace(); // P1 values need no separator
+                if(intAt >= strData.size() || (strData[intAt] != '0' && strData[intAt] != '1'))
+                    return false;
+                intValue = strData[intAt++] - '0';
+            }
+            else if(!fnNumber(intValue) || intValue > intMax)
+                return false;
+            recImage.vecValues.push_back(intValue);
+        }
+        fnSkipSpace();
+        return intAt == strData.size();
+    }
+
+    // Binary: exactly one whitespace byte after the header, then the raster and nothing else.
+    if(intAt >= strData.size() || !std::isspace(static_cast<unsigned char>(strData[intAt])))
+        return false;
+    ++intAt;
+    if(chKind == '4')
+    {
+        std::size_t intRowBytes = (static_cast<std::size_t>(recImage.intWidth) + 7) / 8;
+        if(strData.size() - intAt != intRowBytes * static_cast<std::size_t>(recImage.intHeight))
+            return false;
+        for(int r = 0; r < recImage.intHeight; ++r)
+            for(int c = 0; c < recImage.intWidth; ++c)
+            {
+                std::uint8_t intByte = static_cast<std::uint8_t>(strData[intAt + static_cast<std::size_t>(r) * intRowBytes + static_cast<std::size_t>(c) / 8]);
+                recImage.vecValues.push_back(intByte >> (7 - c % 8) & 1);
+            }
+        return true;
+    }
+    if(strData.size() - intAt != intValues)
+        return false;
+    for(std::size_t v = 0; v < intValues; ++v)
+        recImage.vecValues.push_back(static_cast<std::uint8_t>(strData[intAt + v]));
+    return true;
+}
+
+// expectedValues: what a PNM file of eType should hold for the reference flag, in file order.
+static std::vector<int> expectedValues(FlagType eFlag, const TestSize& recSize, IllustratorType eType)
+{
+    std::vector<int> vecValues;
+    for(int r = 0; r < recSize.intHeight; ++r)
+        for(int c = 0; c < recSize.intWidth; ++c)
+        {
+            UJPixel recPixel = referencePixel(eFlag, recSize, r, c);
+            int intSum = recPixel.intRed + recPixel.intGreen + recPixel.intBlue;
+            if(eType == COLOUR)
+            {
+                vecValues.push_back(recPixel.intRed);
+                vecValues.push_back(recPixel.intGreen);
+                vecValues.push_back(recPixel.intBlue);
+            }
+            else if(eType == GRAYSCALE)
+                vecValues.push_back(intSum / 3);
+            else
+                vecValues.push_back(intSum == 3 * 255 ? 0 : 1);
+        }
+    return vecValues;
+}
+
+// pixelValues: the values a PNM file of eType holds for one pixel.
+static std::vector<int> pixelValues(const UJPixel& recPixel, IllustratorType eType)
+{
+    int intSum = recPixel.intRed + recPixel.intGreen + recPixel.intBlue;
+    if(eType == COLOUR)
+        return {recPixel.intRed, recPixel.intGreen, recPixel.intBlue};
+    if(eType == GRAYSCALE)
+        return {intSum / 3};
+    return {intSum == 3 * 255 ? 0 : 1};
+}
+
+// antiAliasedValuesOk: vecValues (file order) equal the reference flag away from circle edges;
+// on an edge, every value lies between those of the circle colour and the colour under it
+// (one off for grayscale, which averages the rounded channels). intBlended counts the edge
+// pixels equal to neither.
+static bool antiAliasedValuesOk(FlagType eFlag, const TestSize& recSize, IllustratorType eType,
+                                const std::vector<int>& vecValues, int& intBlended)
+{
+    std::size_t intPerPixel = eType == COLOUR ? 3 : 1;
+    if(vecValues.size() != static_cast<std::size_t>(recSize.intHeight) * static_cast<std::size_t>(recSize.intWidth) * intPerPixel)
+        return false;
+    int intSlack = eType == GRAYSCALE ? 1 : 0;
+    intBlended = 0;
+    std::size_t intAt = 0;
+    for(int r = 0; r < recSize.intHeight; ++r)
+        for(int c = 0; c < recSize.intWidth; ++c, intAt += intPerPixel)
+        {
+            UJPixel recCircle, recUnder;
+            if(!referenceEdge(eFlag, recSize, r, c, recCircle, recUnder))
+            {
+                std::vector<int> vecExpected = pixelValues(referencePixel(eFlag, recSize, r, c), eType);
+                if(!std::equal(vecExpected.begin(), vecExpected.end(), vecValues.begin() + intAt))
+                    return false;
+                continue;
+            }
+            std::vector<int> vecCircle = pixelValues(recCircle, eType), vecUnder = pixelValues(recUnder, eType);
+            bool blnCircle = true, blnUnder = true;
+            for(std::size_t v = 0; v < intPerPixel; ++v)
+            {
+                int intValue = vecValues[intAt + v];
+                if(intValue < std::min(vecCircle[v], vecUnder[v]) - intSlack || intValue > std::max(vecCircle[v], vecUnder[v]) + intSlack)
+                    return false;
+                blnCircle = blnCircle && intValue == vecCircle[v];
+                blnUnder = blnUnder && intValue == vecUnder[v];
+            }
+            if(!blnCircle && !blnUnder)
+                ++intBlended;
+        }
+    return true;
+}
+
+// referenceDither: the P1 / P4 values of the reference flag dithered by eDither: the intensity
+// against the recursive 8 x 8 Bayer matrix B, threshold (2B + 1) * 255 / 128, or Floyd-Steinberg
+// with the error in 1/16 grey levels and every share rounded down.
+static std::vector<int> referenceDither(FlagType eFlag, const TestSize& recSize, DitherMode eDither)
+{
+    std::vector<int> vecValues;
+    std::vector<int> vecErrorIn(static_cast<std::size_t>(recSize.intWidth) + 2, 0), vecErrorOut(vecErrorIn.size(), 0);
+    auto fnShare = [](int intError, int intSixteenths) { return static_cast<int>(std::floor(intError * intSixteenths / 16.0)); };
+    for(int r = 0; r < recSize.intHeight; ++r)
+    {
+        std::fill(vecErrorOut.begin(), vecErrorOut.end(), 0);
+        int intCarry = 0;
+        for(int c = 0; c < recSize.intWidth; ++c)
+        {
+            UJPixel recPixel = referencePixel(eFlag, recSize, r, c);
+            int intGray = (recPixel.intRed + recPixel.intGreen + recPixel.intBlue) / 3;
+            if(eDither == DITHER_ORDERED)
+            {
+                int intBayer = 0; // bits of (c xor r) and r interleaved, lowest bits first
+                for(int b = 0; b < 3; ++b)
+                    intBayer = intBayer << 2 | ((c ^ r) >> b & 1) << 1 | (r >> b & 1);
+                vecValues.push_back(intGray < (2 * intBayer + 1) * 255 / 128 ? 1 : 0);
+                continue;
+            }
+            int intValue = intGray * 16 + vecErrorIn[c + 1] + intCarry;
+            bool blnBlack = intValue < 128 * 16;
+            int intError = intValue - (blnBlack ? 0 : 255 * 16);
+            vecValues.push_back(blnBlack ? 1 : 0);
+            vecErrorOut[c] += fnShare(intError, 3);
+            vecErrorOut[c + 1] += fnShare(intError, 5);
+            vecErrorOut[c + 2] += fnShare(intError, 1);
+            intCarry = fnShare(intError, 7);
+        }
+        vecErrorIn.swap(vecErrorOut);
+    }
+    return vecValues;
+}
+
+// ----- QOI -----
+
+// decodeQoi: the RGB pixels of a QOI file, or false if it is malformed or does not end exactly
+// with the end marker.
+static bool decodeQoi(const std::string& strData, int& intWidth, int& intHeight, std::vector<std::array<std::uint8_t, 3>>& vecPixels)
+{
+    if(strData.size() < 14 + 8 || strData.compare(0, 4, "qoif") != 0)
+        return false;
+    intWidth  = static_cast<int>(readBig32(strData, 4));
+    intHeight = static_cast<int>(readBig32(strData, 8));
+    if(strData[12] != 3 || strData[13] != 0)
+        return false;
+
+    std::array<std::array<std::uint8_t, 4>, 64> arrIndex{};
+    std::array<std::uint8_t, 4> arrPixel{0, 0, 0, 255};
+    std::size_t intPixels = static_cast<std::size_t>(intWidth) * static_cast<std::size_t>(intHeight);
+    std::size_t intAt = 14;
+    std::size_t intEnd = strData.size() - 8;
+    vecPixels.clear();
+    auto fnByte = [&]() { return static_cast<std::uint8_t>(strData[intAt++]); };
+    while(vecPixels.size() < intPixels)
+    {
+        if(intAt >= intEnd)
+            return false;
+        std::uint8_t intOp = fnByte();
+        int intRun = 1;
+        if(intOp == 0xFE)
+        {
+            if(intAt + 3 > intEnd)
+                return false;
+            arrPixel[0] = fnByte();
+            arrPixel[1] = fnByte();
+            arrPixel[2] = fnByte();
+        }
+        else if(intOp == 0xFF)
+        {
+            if(intAt + 4 > intEnd)
+                return false;
+            for(std::uint8_t& intChannel : arrPixel)
+                intChannel = fnByte();
+        }
+        else if((intOp & 0xC0) == 0x00)
+            arrPixel = arrIndex[intOp];
+        else if((intOp & 0xC0) == 0x40)
+        {
+            arrPixel[0] = static_cast<std::uint8_t>(arrPixel[0] + ((intOp >> 4) & 3) - 2);
+            arrPixel[1] = static_cast<std::uint8_t>(arrPixel[1] + ((intOp >> 2) & 3) - 2);
+            arrPixel[2] = static_cast<std::uint8_t>(arrPixel[2] + (intOp & 3) - 2);
+        }
+        else if((intOp & 0xC0) == 0x80)
+        {
+            if(intAt >= intEnd)
+                return false;
+            int intGreen = (intOp & 0x3F) - 32;
+            std::uint8_t intSecond = fnByte();
+            arrPixel[0] = static_cast<std::uint8_t>(arrPixel[0] + intGreen + (intSecond >> 4) - 8);
+            arrPixel[1] = static_cast<std::uint8_t>(arrPixel[1] + intGreen);
+            arrPixel[2] = static_cast<std::uint8_t>(arrPixel[2] + intGreen + (intSecond & 0x0F) - 8);
+        }
+        else
+            intRun = (intOp & 0x3F) + 1;
+        arrIndex[(arrPixel[0] * 3 + arrPixel[1] * 5 + arrPixel[2] * 7 + arrPixel[3] * 11) % 64] = arrPixel;
+        for(int i = 0; i < intRun; ++i)
+            vecPixels.push_back({arrPixel[0], arrPixel[1], arrPixel[2]});
+    }
+    return vecPixels.size() == intPixels && intAt == intEnd && strData.compare(intEnd, 8, std::string("\0\0\0\0\0\0\0\1", 8)) == 0;
+}
+
+// ----- PNG -----
+
+// BitReader: the bits of a deflate stream, least significant bit of each byte first.
+struct BitReader
+{
+    const std::vector<std::uint8_t>& vecData;
+    std::size_t intByte = 0;
+    int intBit = 0;
+    bool blnOverrun = false;
+
+    int bits(int intCount)
+    {
+        int intValue = 0;
+        for(int i = 0; i < intCount; ++i)
+        {
+            if(intByte >= vecData.size())
+            {
+                blnOverrun = true;
+                return 0;
+            }
+            intValue |= (vecData[intByte] >> intBit & 1) << i;
+            if(++intBit == 8)
+            {
+                intBit = 0;
+                ++intByte;
+            }
+        }
+        return intValue;
+    }
+};
+
+// Huffman: a canonical code given by its code lengths, decoded a bit at a time (RFC 1951 3.2.2).
+struct Huffman
+{
+    std::array<int, 16> arrCount{};
+    std::vector<int> vecSymbols;
+
+    explicit Huffman(const std::vector<int>& vecLengths)
+    {
+        for(int intLength : vecLengths)
+            ++arrCount[intLength];
+        arrCount[0] = 0;
+        for(int intLength = 1; intLength < 16; ++intLength)
+            for(std::size_t s = 0; s < vecLengths.size(); ++s)
+                if(vecLengths[s] == intLength)
+                    vecSymbols.push_back(static_cast<int>(s));
+    }
+
+    int decode(BitReader& objBits) const
+    {
+        int intCode = 0, intFirst = 0, intIndex = 0;
+        for(int intLength = 1; intLength < 16; ++intLength)
+        {
+            intCode |= objBits.bits(1);
+            if(intCode - arrCount[intLength] < intFirst)
+                return vecSymbols[static_cast<std::size_t>(intIndex + intCode - intFirst)];
+            intIndex += arrCount[intLength];
+            intFirst = (intFirst + arrCount[intLength]) << 1;
+            intCode <<= 1;
+        }
+        return -1;
+    }
+};
+
+// inflate: the raw deflate stream from objBits on, appended to vecOut; false if it is malformed.
+static bool inflate(BitReader& objBits, std::vector<std::uint8_t>& vecOut)
+{
+    static const int arrLengthBase[29]  = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+                                           67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const int arrLengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static const int arrDistBase[30]    = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+                                           1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+    static const int arrDistExtra[30]   = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+    static const int arrOrder[19]       = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+    bool blnFinal = false;
+    while(!blnFinal)
+    {
+        blnFinal = objBits.bits(1) == 1;
+        int intType = objBits.bits(2);
+        if(intType == 0)
+        {
+            if(objBits.intBit != 0)
+            {
+                objBits.intBit = 0;
+                ++objBits.intByte;
+            }
+            int intLength = objBits.bits(16);
+            int intInverse = objBits.bits(16);
+            if((intLength ^ 0xFFFF) != intInverse)
+                return false;
+            for(int i = 0; i < intLength; ++i)
+                vecOut.push_back(static_cast<std::uint8_t>(objBits.bits(8)));
+            continue;
+        }
+        if(intType == 3)
+            return false;
+
+        std::vector<int> vecLitLengths(288, 0), vecDistLengths(30, 5);
+        if(intType == 1)
+        {
+            for(int s = 0; s < 288; ++s)
+                vecLitLengths[static_cast<std::size_t>(s)] = s < 144 ? 8 : s < 256 ? 9 : s < 280 ? 7 : 8;
+        }
+        else
+        {
+            int intLitCodes  = objBits.bits(5) + 257;
+            int intDistCodes = objBits.bits(5) + 1;
+            int intLenCodes  = objBits.bits(4) + 4;
+            std::vector<int> vecCodeLengths(19, 0);
+            for(int i = 0; i < intLenCodes; ++i)
+                vecCodeLengths[static_cast<std::size_t>(arrOrder[i])] = objBits.bits(3);
+            Huffman objCodeLengths(vecCodeLengths);
+            std::vector<int> vecLengths;
+            while(static_cast<int>(vecLengths.size()) < intLitCodes + intDistCodes)
+            {
+                int intSymbol = objCodeLengths.decode(objBits);
+                if(intSymbol < 0 || objBits.blnOverrun)
+                    return false;
+                if(intSymbol < 16)
+                    vecLengths.push_back(intSymbol);
+                else if(intSymbol == 16)
+                {
+                    if(vecLengths.empty())
+                        return false;
+                    vecLengths.insert(vecLengths.end(), static_cast<std::size_t>(3 + objBits.bits(2)), vecLengths.back());
+                }
+                else
+                    vecLengths.insert(vecLengths.end(), static_cast<std::size_t>(intSymbol == 17 ? 3 + objBits.bits(3) : 11 + objBits.bits(7)), 0);
+            }
+            if(static_cast<int>(vecLengths.size()) != intLitCodes + intDistCodes)
+                return false;
+            vecLitLengths.assign(vecLengths.begin(), vecLengths.begin() + intLitCodes);
+            vecDistLengths.assign(vecLengths.begin() + intLitCodes, vecLengths.end());
+        }
+
+        Huffman objLit(vecLitLengths), objDist(vecDistLengths);
+        while(true)
+        {
+            int intSymbol = objLit.decode(objBits);
+            if(intSymbol < 0 || objBits.blnOverrun)
+                return false;
+            if(intSymbol < 256)
+            {
+                vecOut.push_back(static_cast<std::uint8_t>(intSymbol));
+                continue;
+            }
+            if(intSymbol == 256)
+                break;
+            intSymbol -= 257;
+            if(intSymbol >= 29)
+                return false;
+            int intLength = arrLengthBase[intSymbol] + objBits.bits(arrLengthExtra[intSymbol]);
+            int intDistSymbol = objDist.decode(objBits);
+            if(intDistSymbol < 0 || intDistSymbol >= 30)
+                return false;
+            std::size_t intDist = static_cast<std::size_t>(arrDistBase[intDistSymbol] + objBits.bits(arrDistExtra[intDistSymbol]));
+            if(intDist > vecOut.size())
+                return false;
+            for(int i = 0; i < intLength; ++i)
+                vecOut.push_back(vecOut[vecOut.size() - intDist]);
+        }
+    }
+    return !objBits.blnOverrun;
+}
+
+// decodePng: the RGB pixels of an 8-bit RGB PNG; false (with the reason in strError) if any
+// chunk CRC, the zlib stream, its Adler-32 or a filter is wrong.
+static bool decodePng(const std::string& strData, int& intWidth, int& intHeight, std::vector<std::array<std::uint8_t, 3>>& vecPixels,
+                      std::string& strError)
+{
+    static const std::string strSignature("\x89PNG\r\n\x1A\n", 8);
+    if(strData.compare(0, 8, strSignature) != 0)
+    {
+        strError = "bad signature";
+        return false;
+    }
+    std::vector<std::uint8_t> vecZlib;
+    bool blnEnd = false;
+    intWidth = intHeight = -1;
+    for(std::size_t intAt = 8; intAt < strData.size() && !blnEnd;)
+    {
+        if(intAt + 12 > strData.size())
+        {
+            strError = "truncated chunk";
+            return false;
+        }
+        std::size_t intLength = readBig32(strData, intAt);
+        if(intAt + 12 + intLength > strData.size())
+        {
+            strError = "truncated chunk";
+            return false;
+        }
+        const std::uint8_t* pType = reinterpret_cast<const std::uint8_t*>(strData.data() + intAt + 4);
+        std::string strType = strData.substr(intAt + 4, 4);
+        if(referenceCrc32(pType, 4 + intLength) != readBig32(strData, intAt + 8 + intLength))
+        {
+            strError = "CRC mismatch in " + strType;
+            return false;
+        }
+        if(strType == "IHDR")
+        {
+            intWidth  = static_cast<int>(readBig32(strData, intAt + 8));
+            intHeight = static_cast<int>(readBig32(strData, intAt + 12));
+            if(intLength != 13 || strData.compare(intAt + 16, 5, std::string("\x08\x02\0\0\0", 5)) != 0)
+            {
+                strError = "IHDR is not 8-bit RGB, non-interlaced";
+                return false;
+            }
+        }
+        else if(strType == "IDAT")
+            vecZlib.insert(vecZlib.end(), pType + 4, pType + 4 + intLength);
+        else if(strType == "IEND")
+            blnEnd = intAt + 12 + intLength == strData.size();
+        intAt += 12 + intLength;
+    }
+    if(!blnEnd || intWidth < 0)
+    {
+        strError = "no IHDR, or IEND is not the last chunk";
+        return false;
+    }
+    if(vecZlib.size() < 6 || (vecZlib[0] & 0x0F) != 8 || (vecZlib[0] << 8 | vecZlib[1]) % 31 != 0 || (vecZlib[1] & 0x20) != 0)
+    {
+        strError = "bad zlib header";
+        return false;
+    }
+
+    BitReader objBits{vecZlib, 2};
+    std::vector<std::uint8_t> vecRaw;
+    if(!inflate(objBits, vecRaw))
+    {
+        strError = "malformed deflate stream";
+        return false;
+    }
+    std::size_t intAdlerAt = objBits.intByte + (objBits.intBit != 0 ? 1 : 0);
+    if(intAdlerAt + 4 != vecZlib.size())
+    {
+        strError = "Adler-32 missing or followed by extra bytes";
+        return false;
+    }
+    std::uint32_t intAdler = static_cast<std::uint32_t>(vecZlib[intAdlerAt]) << 24 | static_cast<std::uint32_t>(vecZlib[intAdlerAt + 1]) << 16
+                           | static_cast<std::uint32_t>(vecZlib[intAdlerAt + 2]) << 8 | vecZlib[intAdlerAt + 3];
+    if(intAdler != referenceAdler32(vecRaw))
+    {
+        strError = "Adler-32 mismatch";
+        return false;
+    }
+
+    // Unfilter (filter byte, then 3 * width bytes per row; 3 bytes per pixel).
+    std::size_t intRowBytes = 3 * static_cast<std::size_t>(intWidth);
+    if(vecRaw.size() != static_cast<std::size_t>(intHeight) * (intRowBytes + 1))
+    {
+        strError = "inflated size does not match the image size";
+        return false;
+    }
+    std::vector<std::uint8_t> vecPrevious(intRowBytes, 0), vecRow(intRowBytes);
+    vecPixels.clear();
+    for(int r = 0; r < intHeight; ++r)
+    {
+        const std::uint8_t* pIn = vecRaw.data() + static_cast<std::size_t>(r) * (intRowBytes + 1);
+        std::uint8_t intFilter = pIn[0];
+        for(std::size_t i = 0; i < intRowBytes; ++i)
+        {
+            int intLeft = i >= 3 ? vecRow[i - 3] : 0;
+            int intUp = vecPrevious[i];
+            int intUpLeft = i >= 3 ? vecPrevious[i - 3] : 0;
+            int intPredict = 0;
+            switch(intFilter)
+            {
+                case 0: intPredict = 0; break;
+                case 1: intPredict = intLeft; break;
+                case 2: intPredict = intUp; break;
+                case 3: intPredict = (intLeft + intUp) / 2; break;
+                case 4:
+                {
+                    int intP = intLeft + intUp - intUpLeft;
+                    int intPa = std::abs(intP - intLeft), intPb = std::abs(intP - intUp), intPc = std::abs(intP - intUpLeft);
+                    intPredict = intPa <= intPb && intPa <= intPc ? intLeft : intPb <= intPc ? intUp : intUpLeft;
+                    break;
+                }
+                default:
+                    strError = "unknown filter type";
+                    return false;
+            }
+            vecRow[i] = static_cast<std::uint8_t>(pIn[1 + i] + intPredict);
+        }
+        for(std::size_t c = 0; c < intRowBytes; c += 3)
+            vecPixels.push_back({vecRow[c], vecRow[c + 1], vecRow[c + 2]});
+        vecPrevious.swap(vecRow);
+    }
+    return true;
+}
+
+// samePixels: decoded RGB pixels equal to the drawn image.
+static bool samePixels(const std::vector<std::array<std::uint8_t, 3>>& vecPixels, const UJImage& objImage)
+{
+    std::span<const UJPixel> arrPixels = objImage.pixels();
+    if(vecPixels.size() != arrPixels.size())
+        return false;
+    for(std::size_t i = 0; i < arrPixels.size(); ++i)
+        if(vecPixels[i][0] != arrPixels[i].intRed || vecPixels[i][1] != arrPixels[i].intGreen || vecPixels[i][2] != arrPixels[i].intBlue)
+            return false;
+    return true;
+}
+
+// ----- Checks -----
+
+static void checkPnm(FlagType eFlag, const TestSize& recSize, IllustratorType eType, ExportMode eMode, bool blnAntiAlias)
+{
+    std::string strName = describe(eFlag, recSize, eType, eMode, blnAntiAlias);
+    std::unique_ptr<FlagIllustrator> pDrawn = drawnIllustrator(eFlag, recSize, eType, eMode, blnAntiAlias);
+    std::string strDrawn = pDrawn->exportImage();
+    PnmImage recImage;
+    bool blnParsed = parsePnm(strDrawn, recImage);
+    check(blnParsed, strName + ": not a well-formed PNM file");
+    if(blnParsed)
+    {
+        static const char* arrMagic[2][3] = {{"P3", "P2", "P1"}, {"P6", "P5", "P4"}};
+        check(recImage.strMagic == arrMagic[eMode == BINARY ? 1 : 0][eType], strName + ": wrong magic number " + recImage.strMagic);
+        check(recImage.intHeight == recSize.intHeight && recImage.intWidth == recSize.intWidth, strName + ": wrong size in the header");
+        if(!blnAntiAlias)
+            check(recImage.vecValues == expectedValues(eFlag, recSize, eType), strName + ": values differ from the reference flag");
+        else
+        {
+            int intBlended = 0;
+            check(antiAliasedValuesOk(eFlag, recSize, eType, recImage.vecValues, intBlended),
+                  strName + ": values differ from the reference flag or its blended edges");
+            // a circle of radius 11 or more crosses many pixels partly
+            if(eType != BW && recSize.intHeight >= 37 && eFlag != AUSTRIA && eFlag != NIGERIA)
+                check(intBlended > 0, strName + ": no circle edge pixel is blended");
+        }
+    }
+    std::string strStreamed;
+    {
+        ImageSink objSink([&strStreamed](const char* pData, std::size_t intSize) { strStreamed.append(pData, intSize); }, 7);
+        pDrawn->exportImage(objSink);
+        check(objSink.bytesWritten() == strDrawn.size(), strName + ": bytesWritten() differs from the exported size");
+    }
+    check(strStreamed == strDrawn, strName + ": streamed export differs from exportImage()");
+    check(pDrawn->exportSize() == strDrawn.size(), strName + ": exportSize() differs from the exported size");
+    check(pDrawn->exportReserve() >= strDrawn.size(), strName + ": exportReserve() is below the exported size");
+    check(drawnIllustrator(eFlag, recSize, eType, eMode, blnAntiAlias, 7)->exportImage() == strDrawn, strName + ": drawn on 7 threads differs from serial");
+    std::unique_ptr<FlagIllustrator> pProcedural = proceduralIllustrator(eFlag, recSize, eType, eMode, blnAntiAlias);
+    check(pProcedural->exportImage() == strDrawn, strName + ": procedural export differs from the drawn grid");
+    check(pProcedural->exportSize() == strDrawn.size(), strName + ": procedural exportSize() differs from the exported size");
+    check(proceduralIllustrator(eFlag, recSize, eType, eMode, blnAntiAlias, false)->exportImage() == strDrawn,
+          strName + ": procedural export through encodeRow() differs from the drawn grid");
+    std::string strTiled;
+    TiledRenderer objTiled(3, 4096); // bands of a few rows, so there are many of them
+    objTiled.setAntiAlias(blnAntiAlias);
+    {
+        ImageSink objSink([&strTiled](const char* pData, std::size_t intSize) { strTiled.append(pData, intSize); });
+        objTiled.render(eFlag, eType, eMode, recSize.intHeight, recSize.intWidth, objSink);
+    }
+    check(strTiled == strDrawn, strName + ": tiled render differs from exportImage()");
+
+    std::string strPath = (std::filesystem::temp_directory_path() / "flag_tests_tiled.pnm").string();
+    bool blnWritten = eMode == BINARY && MappedFile::supported()
+                    ? objTiled.renderMapped(eFlag, eType, recSize.intHeight, recSize.intWidth, strPath)
+                    : objTiled.renderToFile(eFlag, eType, eMode, recSize.intHeight, recSize.intWidth, strPath);
+    check(blnWritten, strName + ": tiled file could not be written");
+    std::ifstream ifsFile(strPath, std::ios::binary);
+    std::string strFile{std::istreambuf_iterator<char>(ifsFile), std::istreambuf_iterator<char>()};
+    ifsFile.close();
+    std::filesystem::remove(strPath);
+    check(strFile == strDrawn, strName + ": tiled file differs from exportImage()");
+}
+
+static void checkDither(FlagType eFlag, const TestSize& recSize, ExportMode eMode, DitherMode eDither)
+{
+    std::string strName = describe(eFlag, recSize, BW, eMode) + (eDither == DITHER_ORDERED ? " ordered" : " diffusion");
+    std::unique_ptr<FlagIllustrator> pDrawn = drawnIllustrator(eFlag, recSize, BW, eMode);
+    pDrawn->setDither(eDither);
+    std::string strDrawn = pDrawn->exportImage();
+    PnmImage recImage;
+    check(parsePnm(strDrawn, recImage) && recImage.vecValues == referenceDither(eFlag, recSize, eDither),
+          strName + ": values differ from the reference dithering");
+    pDrawn->setEncodeThreads(3);
+    check(pDrawn->exportImage() == strDrawn, strName + ": dithered on 3 threads differs from serial");
+    std::unique_ptr<FlagIllustrator> pProcedural = proceduralIllustrator(eFlag, recSize, BW, eMode);
+    pProcedural->setDither(eDither);
+    pProcedural->setEncodeThreads(2);
+    check(pProcedural->exportImage() == strDrawn, strName + ": procedural export differs from the drawn grid");
+
+    std::string strMulti;
+    {
+        ImageSink objSink([&strMulti](const char* pData, std::size_t intSize) { strMulti.append(pData, intSize); });
+        MultiExporter objExporter;
+        objExporter.addTarget(BW, eMode, objSink, eDither);
+        objExporter.exportImage(*pProcedural);
+    }
+    check(strMulti == strDrawn, strName + ": multi-format target differs from exportImage()");
+    if(eDither == DITHER_ORDERED) // error diffusion cannot be split into bands
+    {
+        std::string strTiled;
+        TiledRenderer objTiled(3, 4096);
+        objTiled.setDither(eDither);
+        {
+            ImageSink objSink([&strTiled](const char* pData, std::size_t intSize) { strTiled.append(pData, intSize); });
+            objTiled.render(eFlag, BW, eMode, recSize.intHeight, recSize.intWidth, objSink);
+        }
+        check(strTiled == strDrawn, strName + ": tiled render differs from exportImage()");
+    }
+}
+
+// checkDecoded: strFile, a QOI or PNG export of objImage, decodes to exactly its pixels.
+static void checkDecoded(const std::string& strName, IllustratorType eType, const std::string& strFile, const UJImage& objImage)
+{
+    int intWidth = 0, intHeight = 0;
+    std::vector<std::array<std::uint8_t, 3>> vecPixels;
+    std::string strError = "malformed";
+    bool blnDecoded = eType == QOI ? decodeQoi(strFile, intWidth, intHeight, vecPixels)
+                                   : decodePng(strFile, intWidth, intHeight, vecPixels, strError);
+    check(blnDecoded, strName + ": " + strError);
+    if(blnDecoded)
+    {
+        check(intHeight == objImage.getHeight() && intWidth == objImage.getWidth(), strName + ": wrong size in the header");
+        check(samePixels(vecPixels, objImage), strName + ": decoded pixels differ from the drawn pixels");
+    }
+}
+
+static void checkCompressed(FlagType eFlag, const TestSize& recSize, IllustratorType eType, bool blnAntiAlias, int intThreads)
+{
+    std::string strName = describe(eFlag, recSize, eType, BINARY, blnAntiAlias) + " on " + std::to_string(intThreads) + " threads";
+    std::unique_ptr<FlagIllustrator> pDrawn = drawnIllustrator(eFlag, recSize, eType, BINARY, blnAntiAlias);
+    pDrawn->setEncodeThreads(intThreads);
+    std::string strDrawn = pDrawn->exportImage();
+    checkDecoded(strName, eType, strDrawn, pDrawn->getImage());
+    check(pDrawn->exportSize() == strDrawn.size(), strName + ": exportSize() differs from the exported size");
+    std::string strStreamed;
+    {
+        ImageSink objSink([&strStreamed](const char* pData, std::size_t intSize) { strStreamed.append(pData, intSize); }, 7);
+        pDrawn->exportImage(objSink);
+    }
+    check(strStreamed == strDrawn, strName + ": streamed export differs from exportImage()");
+
+    std::unique_ptr<FlagIllustrator> pProcedural = proceduralIllustrator(eFlag, recSize, eType, BINARY, blnAntiAlias);
+    pProcedural->setEncodeThreads(intThreads);
+    check(pProcedural->exportImage() == strDrawn, strName + ": procedural export differs from the drawn grid");
+}
+
+// checkSynthetic: flags are mostly runs of a few colours, so QOI and PNG are also fed an image
+// with every kind of row: small steps (QOI_OP_DIFF), medium steps (QOI_OP_LUMA), noise
+// (QOI_OP_RGB, literals), a repeated row (runs, PNG Up) and recurring colours (QOI_OP_INDEX).
+static void checkSynthetic(IllustratorType eType)
+{
+    const int intHeight = 50, intWidth = 97;
+    UJImage objImage(intHeight, intWidth);
+    std::uint32_t intNoise = 12345;
+    for(int r = 0; r < intHeight; ++r)
+        for(int c = 0; c < intWidth; ++c)
+        {
+            intNoise = intNoise * 1103515245u + 12345u;
+            int intValue = 0;
+            switch(r % 5)
+            {
+                case 0: intValue = c; break;                                  // +1 per pixel
+                case 1: intValue = c * 9; break;                              // +9 per pixel
+                case 2: intValue = static_cast<int>(intNoise >> 16); break;   // noise
+                case 3: intValue = (c % 4) * 60; break;                       // four recurring colours
+                case 4: break;                                                // set below
+            }
+            objImage.setPixel(r, c, {static_cast<std::uint8_t>(intValue), static_cast<std::uint8_t>(intValue * 3 + r),
+                                     static_cast<std::uint8_t>(255 - intValue)});
+        }
+    for(int r = 4; r < intHeight; r += 5) // the row above repeated
+        for(int c = 0; c < intWidth; ++c)
+            objImage.setPixel(r, c, objImage.getPixel(r - 1, c));
+
+    UJImage objCopy(objImage);
+    std::unique_ptr<FlagIllustrator> pIllustrator = createIllustrator(eType, std::move(objCopy));
+    checkDecoded(std::string("synthetic ") + illustratorTypeName(eType), eType, pIllustrator->exportImage(), objImage);
+}
+
+// checkFlagRejected: strSpec is rejected, on line intLine.
+static void checkFlagRejected(const std::string& strSpec, int intLine)
+{
+    std::istringstream issSpec(strSpec);
+    std::vector<FlagSpec> vecFlags;
+    int intErrorLine = 0;
+    std::string strError;
+    bool blnParsed = tryParseFlags(issSpec, vecFlags, intErrorLine, strError);
+    check(!blnParsed && intErrorLine == intLine && !strError.empty(),
+          "flag library: '" + strSpec + "' not rejected on line " + std::to_string(intLine));
+}
+
+// checkFlagLibrary: the parser, then TEST_FLAG registered for the format checks.
+static void checkFlagLibrary()
+{
+    for(const auto& [pSpec, intLine] : std::vector<std::pair<const char*, int>>{
+            {"background #FFFFFF", 1}, {"flag 123", 1}, {"flag A B", 1},
+            {"flag A\nbackground #FFF", 2}, {"flag A\nbackground #GGGGGG", 2}, {"flag A\nrect 0 0 1 #000000", 2},
+            {"flag A\nrect 2/1 0 1 1 #000000", 2}, {"flag A\nrect 1/0 0 1 1 #000000", 2}, {"flag A\nrect 2 0 1 1 #000000", 2},
+            {"flag A\nrect 1/2+x 0 1 1 #000000", 2}, {"flag A\ncircle 1/2 1/2 0.3 #000000", 2},
+            {"flag A\ncircle 1/2 1/2 -0.3h #000000", 2}, {"flag A\ncircle 1/2 1/2 0.3.1h #000000", 2},
+            {"flag A\ncircle 1/2 1/2 h #000000", 2}, {"flag A\n\n# comment\nhstripes 2 #000000", 4},
+            {"flag A\nvstripes 0", 2}, {"flag A\ntriangle 0 0 1", 2}, {"flag A\ncircle 1/2 1/2 4.5w #000000", 2},
+            {"flag A\ncircle 1/2 1/2 99999999h #000000", 2}})
+        checkFlagRejected(pSpec, intLine);
+
+    std::istringstream issSpec("# comment\nflag Test-1 # comment\nbackground #102030\n"
+                               "circle 1/2 1/4+2 0.25w #0000FF\nrect 0 0 1/3-1 1 #FFFFFF # comment\n"
+                               "flag other\ncircle 0 1 .5h #000000\nvstripes 2 #000000 #FFFFFF\n");
+    std::vector<FlagSpec> vecFlags;
+    int intErrorLine = 0;
+    std::string strError;
+    bool blnParsed = tryParseFlags(issSpec, vecFlags, intErrorLine, strError);
+    check(blnParsed && vecFlags.size() == 2, "flag library: well-formed flags rejected: " + strError);
+    if(vecFlags.size() == 2 && vecFlags[0].vecShapes.size() == 2 && vecFlags[1].vecShapes.size() == 3)
+    {
+        const FlagSpec& recFirst = vecFlags[0];
+        const FlagShape& recCircle = recFirst.vecShapes[0];
+        const FlagShape& recRect = recFirst.vecShapes[1];
+        check(recFirst.strName == "TEST-1" && recFirst.recBackground.intRed == 0x10 && recFirst.recBackground.intBlue == 0x30,
+              "flag library: name or background misread");
+        check(recCircle.eKind == SHAPE_CIRCLE && recCircle.dblRadius == 0.25 && recCircle.blnRadiusOfWidth
+              && recCircle.recCol.resolve(100) == 27 && recCircle.recRow.resolve(101) == 50, "flag library: circle misread");
+        check(recRect.eKind == SHAPE_RECT && recRect.recBottom.resolve(100) == 32 && recRect.recRight.resolve(100) == 100
+              && recRect.recColour.intGreen == 255, "flag library: rect misread");
+        const FlagShape& recHalf = vecFlags[1].vecShapes[0];
+        check(recHalf.dblRadius == 0.5 && !recHalf.blnRadiusOfWidth && recHalf.recCol.resolve(7) == 7, "flag library: radius '.5h' misread");
+        check(vecFlags[1].vecShapes[2].recLeft.resolve(9) == 4 && vecFlags[1].vecShapes[2].recRight.resolve(9) == 9,
+              "flag library: stripe bands misread");
+    }
+    else
+        check(false, "flag library: wrong number of shapes");
+
+    std::istringstream issTest(TEST_FLAG);
+    FlagType eTest = addFlag(parseFlags(issTest, "TEST_FLAG").front());
+    FlagType eFound = AUSTRIA;
+    check(eTest == flagCount() - 1 && findFlag("test_stripes", eFound) && eFound == eTest, "flag library: registered flag not found");
+    check(flagSpecHash(AUSTRIA) != flagSpecHash(JAPAN) && flagSpecHash(JAPAN) != flagSpecHash(NIGERIA)
+          && flagSpecHash(NIGERIA) != flagSpecHash(eTest) && flagSpecHash(eTest) == flagSpecHash(eTest),
+          "flag library: description hashes collide or change");
+}
+
+static void checkMultiExport(FlagType eFlag, const TestSize& recSize)
+{
+    for(bool blnProcedural : {false, true})
+    {
+        std::string strName = describe(eFlag, recSize, COLOUR, ASCII) + (blnProcedural ? " procedural" : " drawn") + " multi-format";
+        std::unique_ptr<FlagIllustrator> pSource = blnProcedural ? proceduralIllustrator(eFlag, recSize, COLOUR, ASCII)
+                                                                 : drawnIllustrator(eFlag, recSize, COLOUR, ASCII);
+        // every PNM format in both modes, then QOI and PNG
+        auto fnType = [](std::size_t t) { return t < 6 ? static_cast<IllustratorType>(t % 3) : t == 6 ? QOI : PNG; };
+        std::vector<std::string> vecOutputs(8);
+        {
+            std::vector<std::unique_ptr<ImageSink>> vecSinks;
+            MultiExporter objExporter;
+            for(std::size_t t = 0; t < vecOutputs.size(); ++t)
+            {
+                std::string& strOutput = vecOutputs[t];
+                vecSinks.push_back(std::make_unique<ImageSink>([&strOutput](const char* pData, std::size_t intSize) { strOutput.append(pData, intSize); }));
+                objExporter.addTarget(fnType(t), t < 3 ? ASCII : BINARY, *vecSinks.back());
+            }
+            objExporter.exportImage(*pSource);
+        } // the sinks flush here
+        for(std::size_t t = 0; t < vecOutputs.size(); ++t)
+        {
+            IllustratorType eType = fnType(t);
+            ExportMode eMode = t < 3 ? ASCII : BINARY;
+            check(vecOutputs[t] == drawnIllustrator(eFlag, recSize, eType, eMode)->exportImage(),
+                  strName + ": " + illustratorTypeName(eType) + (eMode == BINARY ? " binary" : " ascii") + " output differs from exportImage()");
+        }
+    }
+}
+
+static void checkMoves(FlagType eFlag, const TestSize& recSize)
+{
+    std::string strName = describe(eFlag, recSize, COLOUR, BINARY);
+    std::unique_ptr<FlagIllustrator> pColour = drawnIllustrator(eFlag, recSize, COLOUR, BINARY);
+    std::string strColour = pColour->exportImage();
+    UJImage objCopy(pColour->getImage());
+    UJImage objImage = pColour->releaseImage();
+    check(pColour->getImage().getHeight() == 0 && pColour->getImage().getWidth() == 0, strName + ": released illustrator is not 0x0");
+
+    std::unique_ptr<FlagIllustrator> pGrayscale = createIllustrator(GRAYSCALE, std::move(objImage));
+    pGrayscale->setExportMode(BINARY);
+    check(objImage.getHeight() == 0 && objImage.getWidth() == 0, strName + ": moved-from image is not 0x0");
+    check(pGrayscale->exportImage() == drawnIllustrator(eFlag, recSize, GRAYSCALE, BINARY)->exportImage(),
+          strName + ": released image exports differently as grayscale");
+
+    UJImage objAssigned(1, 1);
+    objAssigned = objCopy;
+    std::unique_ptr<FlagIllustrator> pAssigned = createIllustrator(COLOUR, objAssigned);
+    pAssigned->setExportMode(BINARY);
+    check(pAssigned->exportImage() == strColour, strName + ": copied image exports differently");
+}
+
+// equalChannels: channels equal (the padding of an RGBA pixel is not compared).
+static bool equalChannels(const UJPixel& recA, const UJPixel& recB)
+{
+    return recA.intRed == recB.intRed && recA.intGreen == recB.intGreen && recA.intBlue == recB.intBlue;
+}
+
+static void checkRects()
+{
+    const int intHeight = 23, intWidth = 31;
+    UJImage objImage(intHeight, intWidth);
+    UJImage objReference(intHeight, intWidth);
+    for(int r = 0; r < intHeight; ++r)
+        for(int c = 0; c < intWidth; ++c)
+        {
+            UJPixel recPixel = {static_cast<std::uint8_t>(r), static_cast<std::uint8_t>(c), static_cast<std::uint8_t>(r * intWidth + c)};
+            objImage.setPixel(r, c, recPixel);
+            objReference.setPixel(r, c, recPixel);
+        }
+
+    std::uint32_t intRandom = 2024;
+    auto fnNext = [&intRandom](int intBound)
+    {
+        intRandom = intRandom * 1103515245u + 12345u;
+        return static_cast<int>((intRandom >> 16) % static_cast<std::uint32_t>(intBound));
+    };
+    int intFirstWrong = -1;
+    for(int intOp = 0; intOp < 500 && intFirstWrong < 0; ++intOp)
+    {
+        int intRectHeight = fnNext(intHeight + 1), intRectWidth = fnNext(intWidth + 1);
+        int intRow = fnNext(intHeight - intRectHeight + 1), intCol = fnNext(intWidth - intRectWidth + 1);
+        if(intOp % 2 == 0)
+        {
+            UJPixel recPixel = {static_cast<std::uint8_t>(fnNext(256)), static_cast<std::uint8_t>(fnNext(256)), static_cast<std::uint8_t>(fnNext(256))};
+            objImage.fillRect(intRow, intCol, intRectHeight, intRectWidth, recPixel);
+            for(int r = 0; r < intRectHeight; ++r)
+                for(int c = 0; c < intRectWidth; ++c)
+                    objReference.setPixel(intRow + r, intCol + c, recPixel);
+        }
+        else
+        {
+            int intSrcRow = fnNext(intHeight - intRectHeight + 1), intSrcCol = fnNext(intWidth - intRectWidth + 1);
+            objImage.copyRect(objImage, intSrcRow, intSrcCol, intRectHeight, intRectWidth, intRow, intCol);
+            UJImage objSource(objReference); // the rectangles may overlap: copy from the state before
+            for(int r = 0; r < intRectHeight; ++r)
+                for(int c = 0; c < intRectWidth; ++c)
+                    objReference.setPixel(intRow + r, intCol + c, objSource.getPixel(intSrcRow + r, intSrcCol + c));
+        }
+        for(int r = 0; r < intHeight && intFirstWrong < 0; ++r)
+            for(int c = 0; c < intWidth && intFirstWrong < 0; ++c)
+                if(!equalChannels(objImage.getPixel(r, c), objReference.getPixel(r, c)))
+                    intFirstWrong = intOp;
+    }
+    check(intFirstWrong < 0, "rectangles: pixels differ from the reference after operation " + std::to_string(intFirstWrong));
+}
+
+// checkHugeCircles: a corner circle at the largest radius a description may give (4h), and one
+// built in code with a radius far past it, cover every pixel, drawn or procedural, with or
+// without anti-aliasing. Registered after the per-flag checks, which do not know these flags.
+static void checkHugeCircles()
+{
+    std::istringstream issSpec("flag huge_parsed\nbackground #FFFFFF\ncircle 0 0 4h #123456\n");
+    FlagType eParsed = addFlag(parseFlags(issSpec, "huge_parsed").front());
+    FlagSpec recBuilt = flagSpec(eParsed);
+    recBuilt.strName = "huge_built";
+    recBuilt.vecShapes.front().dblRadius = 99999999.0;
+    FlagType eBuilt = addFlag(recBuilt);
+    const UJPixel recCircle{0x12, 0x34, 0x56};
+    for(const auto& [eFlag, recSize] : std::vector<std::pair<FlagType, TestSize>>{
+            {eParsed, {100, 100}}, {eParsed, {37, 61}}, {eBuilt, {1, 1}}, {eBuilt, {100, 100}}, {eBuilt, {7, 1000}}, {eBuilt, {1000, 7}}})
+        for(bool blnAntiAlias : {false, true})
+        {
+            std::string strName = describe(eFlag, recSize, COLOUR, BINARY, blnAntiAlias);
+            std::unique_ptr<FlagIllustrator> pDrawn = drawnIllustrator(eFlag, recSize, COLOUR, BINARY, blnAntiAlias);
+            bool blnCovered = true;
+            for(int r = 0; r < recSize.intHeight; ++r)
+                for(int c = 0; c < recSize.intWidth; ++c)
+                    blnCovered = blnCovered && equalChannels(pDrawn->getImage().getPixel(r, c), recCircle);
+            check(blnCovered, strName + ": a huge circle leaves pixels uncovered");
+            check(proceduralIllustrator(eFlag, recSize, COLOUR, BINARY, blnAntiAlias)->exportImage() == pDrawn->exportImage(),
+                  strName + ": procedural export differs from the drawn one");
+        }
+}
+
+static void checkPixelPool()
+{
+    std::size_t intWrong = 0;
+    for(std::size_t intPixels = 1; intPixels <= 100000 && intWrong == 0; ++intPixels)
+    {
+        std::size_t intClass = PixelPool::sizeClass(intPixels);
+        if(intClass < intPixels || 4 * intClass > 5 * intPixels)
+            intWrong = intPixels;
+    }
+    check(intWrong == 0, "pixel pool: wrong size class for " + std::to_string(intWrong) + " pixels");
+
+    const TestSize recSize = {37, 61};
+    std::string strFresh = drawnIllustrator(JAPAN, recSize, COLOUR, BINARY)->exportImage();
+    PixelPool objPool;
+    setDefaultPixelAllocator(&objPool);
+    for(int i = 0; i < 3; ++i)
+        check(drawnIllustrator(JAPAN, recSize, COLOUR, BINARY)->exportImage() == strFresh, "pixel pool: recycled buffer exports differently");
+    setDefaultPixelAllocator(nullptr);
+    PoolStats recStats = objPool.getStats();
+    check(recStats.intReuses == 2 && recStats.intAllocations == 3 && recStats.intReleases == 3, "pixel pool: wrong allocation / reuse counts");
+    check(recStats.intInUseBytes == 0 && recStats.intCachedBytes > 0, "pixel pool: buffers not returned to the pool");
+
+    std::size_t intCapacity = 0;
+    bool blnThrew = false;
+    try
+    {
+        objPool.allocate(std::size_t{1} << 58, intCapacity); // far beyond any address space
+    }
+    catch(const std::bad_alloc&)
+    {
+        blnThrew = true;
+    }
+    PoolStats recAfter = objPool.getStats();
+    check(blnThrew && recAfter.intAllocations == recStats.intAllocations && recAfter.intInUseBytes == 0
+          && recAfter.intPeakBytes == recStats.intPeakBytes, "pixel pool: a failed allocation is counted");
+}
+
+static void checkMetrics()
+{
+    // Driven directly (BasicMetricsScope<true>), so this also runs without -DUJ_METRICS.
+    RenderMetrics objRender;
+    {
+        BasicMetricsScope<true> objScope(&objRender);
+        check(currentRenderMetrics() == &objRender, "metrics: scope not current on its thread");
+        std::uint64_t intOuterStart = nestedStageNanos();
+        recordStage(STAGE_ENCODE, 30, nestedStageNanos());  // inside the illustrate stage below
+        recordStage(STAGE_ILLUSTRATE, 100, intOuterStart);   // 100 ns in all, 30 of them encoding
+        addPixels(170);
+        addBytes(60);
+    }
+    check(currentRenderMetrics() == nullptr, "metrics: scope still current after it ended");
+    RenderStats recStats = objRender.snapshot();
+    check(recStats.arrNanos[STAGE_ILLUSTRATE] == 70 && recStats.arrNanos[STAGE_ENCODE] == 30
+          && recStats.arrCalls[STAGE_ILLUSTRATE] == 1 && recStats.arrCalls[STAGE_ENCODE] == 1, "metrics: nested stage counted twice");
+    check(recStats.intPixels == 170 && recStats.intBytes == 60, "metrics: wrong pixel / byte counts");
+    check(std::abs(recStats.pixelsPerSecond() - 1.7e9) < 1.0 && std::abs(recStats.bytesPerSecond() - 2e9) < 1.0, "metrics: wrong throughput");
+    check(recStats.toJson().find("\"encode\": {\"calls\": 1") != std::string::npos, "metrics: JSON lacks the encode stage");
+    check(recStats.toPrometheus().find("flagillustrator_stage_seconds_total") != std::string::npos, "metrics: Prometheus text lacks the stage times");
+    objRender.reset();
+    recStats = objRender.snapshot();
+    check(recStats.intPixels == 0 && recStats.arrCalls[STAGE_ENCODE] == 0, "metrics: reset() kept counts");
+
+    if constexpr(METRICS_ENABLED)
+    {
+        const TestSize recSize = {37, 61};
+        {
+            MetricsScope objScope(&objRender);
+            drawnIllustrator(JAPAN, recSize, GRAYSCALE, BINARY)->exportImage();
+        }
+        recStats = objRender.snapshot();
+        check(recStats.intPixels == 37 * 61 && recStats.intBytes == 37 * 61 && recStats.arrCalls[STAGE_ILLUSTRATE] == 1,
+              "metrics: a P5 export recorded the wrong counts");
+    }
+}
+
+// checkJobRejected: strLine is rejected by the batch job parser.
+static void checkJobRejected(const std::string& strLine)
+{
+    RenderJob recJob{};
+    std::string strError;
+    check(!BatchRenderer::parseJobLine(strLine, recJob, strError) && !strError.empty(), "batch job '" + strLine + "' was accepted");
+}
+
+static void checkJobParsing()
+{
+    std::stringstream ssJobs{"# a comment\n\n1 480 640 0 out/japan.ppm\n   \n2 7 13 2 out/nigeria.pbm binary\n1 7 13 3 out/japan.qoi aa\n"};
+    std::vector<RenderJob> vecJobs = BatchRenderer::parseJobs(ssJobs);
+    check(vecJobs.size() == 3, "batch job list: blank and comment lines are not skipped");
+    if(vecJobs.size() == 3)
+    {
+        const RenderJob& recFirst = vecJobs[0];
+        const RenderJob& recSecond = vecJobs[1];
+        check(recFirst.eFlag == JAPAN && recFirst.intHeight == 480 && recFirst.intWidth == 640 && recFirst.eIllustrator == COLOUR
+              && recFirst.eMode == ASCII && recFirst.strOutput == "out/japan.ppm", "batch job list: first job misread");
+        check(recSecond.eFlag == NIGERIA && recSecond.intHeight == 7 && recSecond.intWidth == 13 && recSecond.eIllustrator == BW
+              && recSecond.eMode == BINARY && recSecond.strOutput == "out/nigeria.pbm", "batch job list: second job misread");
+        check(!recFirst.blnAntiAlias && !recSecond.blnAntiAlias && vecJobs[2].blnAntiAlias && vecJobs[2].eIllustrator == QOI,
+              "batch job list: 'aa' option misread");
+    }
+    for(const char* pLine : {"1 480 640 0", "x 480 640 0 out.ppm", "1 480 640 zero out.ppm", "99 480 640 0 out.ppm",
+                             "-1 480 640 0 out.ppm", "1 -1 640 0 out.ppm", "1 480 2000000 0 out.ppm", "1 480 640 5 out.ppm",
+                             "1 480 640 0 out.ppm bin", "1 480 640 0 out.ppm BINARY", "1 480 640 0 out.ppm binary x",
+                             "1 480 640 0 out.ppm aa binary aa", "1 480 640 0 out.ppm binary binary", "1 0 640 3 out.qoi",
+                             "1 480 0 4 out.png"})
+        checkJobRejected(pLine);
+}
+
+// checkBatchRun: jobs are written to their files; a job whose output cannot be opened fails
+// before anything is rendered (so it never reaches the cache either).
+static void checkBatchRun()
+{
+    std::filesystem::path objDir = std::filesystem::temp_directory_path() / "flag_tests_batch";
+    std::error_code objError;
+    std::filesystem::remove_all(objDir, objError);
+    std::filesystem::create_directories(objDir, objError);
+    const TestSize recSize = {37, 61};
+    std::vector<RenderJob> vecJobs = {{JAPAN, recSize.intHeight, recSize.intWidth, COLOUR, BINARY, (objDir / "japan.ppm").string()},
+                                      {JAPAN, recSize.intHeight, recSize.intWidth, GRAYSCALE, ASCII, (objDir / "missing" / "japan.pgm").string()}};
+    for(bool blnCached : {false, true})
+    {
+        std::string strName = std::string("batch run") + (blnCached ? " cached" : "");
+        RenderCache objCache(1 << 20);
+        BatchRenderer objBatch(2);
+        objBatch.setCache(blnCached ? &objCache : nullptr);
+        std::stringstream ssReport;
+        check(objBatch.run(vecJobs, ssReport) == 1, strName + ": wrong number of failed jobs");
+        std::ifstream ifsFile(vecJobs[0].strOutput, std::ios::binary);
+        std::string strFile{std::istreambuf_iterator<char>(ifsFile), std::istreambuf_iterator<char>()};
+        check(strFile == drawnIllustrator(JAPAN, recSize, COLOUR, BINARY)->exportImage(), strName + ": output file differs from exportImage()");
+        if(blnCached)
+            check(objCache.getStats().intMisses == 1, strName + ": a job with an unwritable output was rendered");
+    }
+    std::filesystem::remove_all(objDir, objError);
+}
+
+// cachedImage: what RenderCache should hold for recKey.
+static std::string cachedImage(const RenderKey& recKey)
+{
+    return drawnIllustrator(recKey.eFlag, {recKey.intHeight, recKey.intWidth}, recKey.eIllustrator, recKey.eMode)->exportImage();
+}
+
+static void checkRenderCache()
+{
+    const RenderKey recAu = {AUSTRIA, 7, 13, COLOUR, BINARY};
+    const RenderKey recJp = {JAPAN,   7, 13, COLOUR, BINARY};
+    const RenderKey recNg = {NIGERIA, 7, 13, COLOUR, BINARY};
+    const std::size_t intImageBytes = cachedImage(recAu).size(); // the same for all three
+
+    // Room for two images: touching AUSTRIA makes JAPAN the least recently used.
+    RenderCache objCache(2 * intImageBytes);
+    check(*objCache.get(recAu) == cachedImage(recAu), "render cache: miss returns the wrong image");
+    objCache.get(recJp);
+    check(*objCache.get(recAu) == cachedImage(recAu), "render cache: hit returns the wrong image");
+    objCache.get(recNg);
+    CacheStats recStats = objCache.getStats();
+    check(recStats.intHits == 1 && recStats.intMisses == 3 && recStats.intEvictions == 1, "render cache: wrong hit / miss / eviction counts");
+    check(recStats.intEntries == 2 && recStats.intBytes == 2 * intImageBytes, "render cache: wrong entry / byte counts after an eviction");
+    objCache.get(recAu);
+    objCache.get(recJp);
+    recStats = objCache.getStats();
+    check(recStats.intHits == 2 && recStats.intMisses == 4, "render cache: evicted the wrong entry");
+    const RenderKey recJpAntiAliased = {JAPAN, 7, 13, COLOUR, BINARY, true};
+    check(*objCache.get(recJpAntiAliased) == drawnIllustrator(JAPAN, {7, 13}, COLOUR, BINARY, true)->exportImage()
+          && objCache.getStats().intMisses == 5, "render cache: anti-aliased image served from the hard-edged entry");
+    // cacheable: decided from the key alone (P3 / P2 from a lower bound; QOI / PNG always).
+    check(objCache.cacheable(recAu) && objCache.cacheable({AUSTRIA, 7, 13, GRAYSCALE, ASCII}) && objCache.cacheable({AUSTRIA, 20, 20, QOI, BINARY}),
+          "render cache: an image within the budget counts as too large");
+    check(!objCache.cacheable({AUSTRIA, 20, 20, COLOUR, BINARY}) && !objCache.cacheable({AUSTRIA, 7, 26, COLOUR, ASCII}),
+          "render cache: an image over the budget counts as cacheable");
+
+    // Persistence: a fresh cache on the same directory loads instead of rendering.
+    std::filesystem::path objDir = std::filesystem::temp_directory_path() / "flag_tests_cache";
+    std::error_code objError;
+    std::filesystem::remove_all(objDir, objError);
+    {
+        RenderCache objWriter(2 * intImageBytes, objDir.string());
+        objWriter.get(recJp);
+    }
+    std::stringstream ssHash;
+    ssHash << std::hex << std::setw(16) << std::setfill('0') << flagSpecHash(JAPAN);
+    std::vector<std::string> vecFiles;
+    for(const std::filesystem::directory_entry& objEntry : std::filesystem::directory_iterator(objDir, objError))
+        vecFiles.push_back(objEntry.path().filename().string());
+    check(vecFiles.size() == 1 && vecFiles[0].find(ssHash.str()) != std::string::npos,
+          "render cache: disk file not named after the hash of the flag description");
+    RenderCache objReader(2 * intImageBytes, objDir.string());
+    check(*objReader.get(recJp) == cachedImage(recJp), "render cache: image reloaded from disk differs");
+    objReader.clear();
+    objReader.get(recJp);
+    recStats = objReader.getStats();
+    check(recStats.intDiskHits == 2 && recStats.intMisses == 0, "render cache: persisted image was rendered again");
+    std::filesystem::remove_all(objDir, objError);
+}
+
+// checkRequestRejected: strLine gets an "ERR" reply from objServer.
+static void checkRequestRejected(const RenderServer& objServer, const std::string& strLine)
+{
+    RenderKey recKey{};
+    std::string strError;
+    check(!objServer.parseRequest(strLine, recKey, strError) && !strError.empty(), "server request '" + strLine + "' was accepted");
+}
+
+static void checkRequestParsing()
+{
+    ServerOptions recOptions;
+    recOptions.intMaxDimension = 1000;
+    RenderServer objServer(recOptions); // nothing is opened until run()
+    RenderKey recKey{};
+    std::string strError;
+    check(objServer.parseRequest("1 480 640 2", recKey, strError)
+          && recKey == RenderKey{JAPAN, 480, 640, BW, ASCII}, "server request '1 480 640 2' misread");
+    check(objServer.parseRequest("2 7 1000 1 binary", recKey, strError)
+          && recKey == RenderKey{NIGERIA, 7, 1000, GRAYSCALE, BINARY}, "server request '2 7 1000 1 binary' misread");
+    check(objServer.parseRequest("1 7 13 4 aa binary", recKey, strError)
+          && recKey == RenderKey{JAPAN, 7, 13, PNG, BINARY, true}, "server request '1 7 13 4 aa binary' misread");
+    check(objServer.parseRequest("1 0 640 0", recKey, strError) && recKey.intHeight == 0,
+          "server request '1 0 640 0' (an empty PNM image) rejected");
+    for(const char* pLine : {"", "1 480 640", "one 480 640 0", "99 480 640 0", "1 -1 640 0", "1 480 1001 0",
+                             "1 1001 640 0", "1 480 640 -1", "1 480 640 5", "1 480 640 0 bin", "1 480 640 0 aa aa",
+                             "1 480 640 0 binary aa binary", "1 0 640 3", "1 480 0 4"})
+        checkRequestRejected(objServer, pLine);
+}
+
+int main(int argc, char** argv)
+{
+    if(argc > 1)
+    {
+        std::cerr << "ERROR! Usage: " << argv[0] << " (no arguments). Terminating." << std::endl;
+        std::exit(ERROR_ARGS);
+    }
+    checkFlagLibrary();
+    for(int intFlag = 0; intFlag < flagCount(); ++intFlag)
+    {
+        FlagType eFlag = static_cast<FlagType>(intFlag);
+        for(const TestSize& recSize : SIZES)
+        {
+            for(IllustratorType eType : {COLOUR, GRAYSCALE, BW})
+                for(ExportMode eMode : {ASCII, BINARY})
+                    for(bool blnAntiAlias : {false, true})
+                        checkPnm(eFlag, recSize, eType, eMode, blnAntiAlias);
+            for(IllustratorType eType : {QOI, PNG})
+                for(bool blnAntiAlias : {false, true})
+                    checkCompressed(eFlag, recSize, eType, blnAntiAlias, 1);
+            for(ExportMode eMode : {ASCII, BINARY})
+                for(DitherMode eDither : {DITHER_ORDERED, DITHER_DIFFUSION})
+                    checkDither(eFlag, recSize, eMode, eDither);
+            checkMultiExport(eFlag, recSize);
+            checkMoves(eFlag, recSize);
+        }
+        for(IllustratorType eType : {QOI, PNG})
+            checkCompressed(eFlag, BANDED_SIZE, eType, true, 3);
+    }
+    for(IllustratorType eType : {QOI, PNG})
+        checkSynthetic(eType);
+    checkRects();
+    checkHugeCircles();
+    checkPixelPool();
+    checkMetrics();
+    checkJobParsing();
+    checkBatchRun();
+    checkRenderCache();
+    checkRequestParsing();
+    std::cerr << "tests: " << s_intChecks << " checks, " << s_intFailures << " failed" << std::endl;
+    return s_intFailures == 0 ? SUCCESS : ERROR_CONV;
+}
@@ -0,0 +1,125 @@
+// TextEncoder.cpp is the fast ASCII encoder behind the P3 / P2 / P1 exporters.
+// Responsibilities:
+//  - turn a row of 0..255 values into "<decimal> " text without iostreams
+//  - report the exact size of that text up front, so callers can preallocate
+//  - build the PNM header shared by the ASCII and binary formats
+//
+// How it works:
+//  - a table built at compile time holds, for every value 0..255, its digits followed
+//    by one space ("7 ", "42 ", "255 ") and the length of that text (2..4)
+//  - encoding is one 4-byte copy plus a pointer bump per value: no locale, no
+//    virtual calls, no per-row flush
+//
+// The output is byte-identical to `ss << intValue << ' '` on a default stringstream.
+
+module;
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+export module TextEncoder;
+
+import ImageSink;
+
+// Bytes encodeText() may touch per value (it always copies a whole table entry).
+export constexpr std::size_t TEXT_BYTES_PER_VALUE = 4;
+
+// textSize: exact number of bytes encodeText() produces for these values.
+export std::size_t textSize(std::span<const std::uint8_t> arrValues);
+
+// encodeText: writes every value as decimal digits plus a space, returns one past the last byte.
+// pOut must have room for TEXT_BYTES_PER_VALUE * arrValues.size() bytes (only textSize() are kept).
+export char* encodeText(std::span<const std::uint8_t> arrValues, char* pOut);
+
+// writeTextRow: encodes one row of values and a '\n' into objSink.
+// vecScratch is a caller-owned buffer reused from row to row (grows once, to the widest row).
+export void writeTextRow(std::span<const std::uint8_t> arrValues, std::vector<char>& vecScratch, ImageSink& objSink);
+
+// pnmHeader: "<magic>\n<width> <height>\n" followed by "<maxValue>\n" when maxValue > 0
+// (PBM formats P1 / P4 have no max value line).
+export std::string pnmHeader(std::string_view strMagic, int intWidth, int intHeight, int intMaxValue);
+
+// ---------- Implementations ----------
+
+struct DecimalEntry
+{
+    char arrChars[TEXT_BYTES_PER_VALUE]; // digits then ' ' (unused tail bytes are ' ')
+    std::uint8_t intLength;              // 2..4
+};
+
+static constexpr std::array<DecimalEntry, 256> makeDecimalTable()
+{
+    std::array<DecimalEntry, 256> arrTable{};
+    for(int intValue = 0; intValue < 256; ++intValue)
+    {
+        DecimalEntry& recEntry = arrTable[intValue];
+        char arrDigits[3] = {};
+        int intDigits = 0;
+        int intRest = intValue;
+        do
+        {
+            arrDigits[intDigits++] = static_cast<char>('0' + intRest % 10);
+            intRest /= 10;
+        } while(intRest > 0);
+
+        for(int d = 0; d < intDigits; ++d)
+            recEntry.arrChars[d] = arrDigits[intDigits - 1 - d]; // most significant first
+        for(int d = intDigits; d < static_cast<int>(TEXT_BYTES_PER_VALUE); ++d)
+            recEntry.arrChars[d] = ' ';
+        recEntry.intLength = static_cast<std::uint8_t>(intDigits + 1);
+    }
+    return arrTable;
+}
+
+static constexpr std::array<DecimalEntry, 256> DECIMAL_TABLE = makeDecimalTable();
+
+std::size_t textSize(std::span<const std::uint8_t> arrValues)
+{
+    std::size_t intSize = 0;
+    for(std::uint8_t intValue : arrValues)
+        intSize += DECIMAL_TABLE[intValue].intLength;
+    return intSize;
+}
+
+char* encodeText(std::span<const std::uint8_t> arrValues, char* pOut)
+{
+    for(std::uint8_t intValue : arrValues)
+    {
+        const DecimalEntry& recEntry = DECIMAL_TABLE[intValue];
+        std::memcpy(pOut, recEntry.arrChars, TEXT_BYTES_PER_VALUE);
+        pOut += recEntry.intLength;
+    }
+    return pOut;
+}
+
+void writeTextRow(std::span<const std::uint8_t> arrValues, std::vector<char>& vecScratch, ImageSink& objSink)
+{
+    std::size_t intCapacity = TEXT_BYTES_PER_VALUE * arrValues.size() + 1;
+    if(vecScratch.size() < intCapacity)
+        vecScratch.resize(intCapacity);
+
+    char* pEnd = encodeText(arrValues, vecScratch.data());
+    *pEnd++ = '\n';
+    objSink.write(vecScratch.data(), static_cast<std::size_t>(pEnd - vecScratch.data()));
+}
+
+std::string pnmHeader(std::string_view strMagic, int intWidth, int intHeight, int intMaxValue)
+{
+    std::string strHeader(strMagic);
+    strHeader += '\n';
+    strHeader += std::to_string(intWidth);
+    strHeader += ' ';
+    strHeader += std::to_string(intHeight);
+    strHeader += '\n';
+    if(intMaxValue > 0)
+    {
+        strHeader += std::to_string(intMaxValue);
+        strHeader += '\n';
+    }
+    return strHeader;
+}
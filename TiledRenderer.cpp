@@ -0,0 +1,242 @@
+// TiledRenderer.cpp streams images of any size (up to MAX_DIMENSION per side) in fixed memory.
+// Responsibilities:
+//  - split the image into bands of whole rows, sized so one encoded band is about intBandBytes
+//  - encode the bands on several threads from one shared procedural illustrator
+//    (FlagIllustrator::illustrateProcedural), so no pixel grid is ever allocated and the
+//    flag's run table is compiled once
+//  - write the bands to the sink strictly in order, as soon as each one is ready,
+//    so a file on disk grows incrementally while the rest is still being rendered
+//    (encodeBandsInOrder, the same loop the compressed formats use)
+//  - for binary formats written to a file: every row has the same encoded size, so the
+//    offset of every band is known up front; the file is created at its final size and
+//    memory-mapped (MappedFile), and each thread encodes its bands straight into the
+//    mapping — no band buffers, no lock, no waiting for a turn
+//
+// Memory: one encoded band plus one generated row per thread, whatever the image size
+// (one generated row per thread when mapped).
+// A thread that finished its band waits for its turn to write before taking the next one,
+// so no more than intThreads bands ever exist at once.
+//
+// Bands rather than 2D tiles, because every PNM format is written row-major.
+// QOI and PNG are one compressed stream and cannot be tiled (isCompressed); they compress their
+// own bands in parallel instead (FlagIllustrator::setEncodeThreads).
+
+module;
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+export module TiledRenderer;
+
+import LibUtility;
+import ImageSink;
+import FlagIllustrator;
+import IllustratorFactory;
+import Metrics;
+import MappedFile;
+
+export class TiledRenderer
+{
+public:
+    explicit TiledRenderer(int intThreads, std::size_t intBandBytes = DEF_BAND_BYTES);
+
+    // setAntiAlias: anti-aliased circle edges in the images rendered from now on (off by default).
+    void setAntiAlias(bool blnAntiAlias);
+    // setDither: BW dithering from now on. Bands are encoded independently, so only
+    // DITHER_NONE and DITHER_ORDERED are possible; DITHER_DIFFUSION exits with ERROR_ARGS.
+    void setDither(DitherMode eDither);
+
+    // render: the complete encoded image (header included) into objSink. Returns the bytes written.
+    // A compressed eIllustrator (QOI, PNG) exits with ERROR_ARGS, here and in the calls below.
+    std::size_t render(FlagType eFlag, IllustratorType eIllustrator, ExportMode eMode,
+                       int intHeight, int intWidth, ImageSink& objSink) const;
+
+    // renderToFile: the same, written to strPath. BINARY images go through renderMapped() where
+    // the platform can map files, anything else is streamed in order through render().
+    // Returns false if the file could not be opened (a failed write exits with ERROR_IO, like ImageSink).
+    bool renderToFile(FlagType eFlag, IllustratorType eIllustrator, ExportMode eMode,
+                      int intHeight, int intWidth, const std::string& strPath) const;
+
+    // renderMapped: a BINARY image (P6 / P5 / P4) encoded in parallel straight into a mapped
+    // file of its exact final size. Returns false if the file could not be created or mapped.
+    bool renderMapped(FlagType eFlag, IllustratorType eIllustrator,
+                      int intHeight, int intWidth, const std::string& strPath) const;
+
+    // bandRows: rows per band for this format and width.
+    int bandRows(IllustratorType eIllustrator, ExportMode eMode, int intWidth) const;
+
+    static constexpr std::size_t DEF_BAND_BYTES = 4 << 20;
+
+private:
+    // runWorkers: fnWorker on up to intWork threads (the calling thread is one of them).
+    void runWorkers(int intWork, const std::function<void()>& fnWorker) const;
+
+    int _threads;
+    std::size_t _bandBytes;
+    bool _blnAntiAlias = false;
+    DitherMode _eDither = DITHER_NONE;
+};
+
+// ---------- Implementations ----------
+
+TiledRenderer::TiledRenderer(int intThreads, std::size_t intBandBytes)
+: _threads(std::max(1, intThreads)), _bandBytes(std::max<std::size_t>(1, intBandBytes))
+{}
+
+void TiledRenderer::setAntiAlias(bool blnAntiAlias)
+{
+    _blnAntiAlias = blnAntiAlias;
+}
+
+void TiledRenderer::setDither(DitherMode eDither)
+{
+    if(eDither == DITHER_DIFFUSION)
+    {
+        std::cerr << "ERROR! Error diffusion needs every row in order and cannot be tiled. Terminating." << std::endl;
+        std::exit(ERROR_ARGS);
+    }
+    _eDither = eDither;
+}
+
+// checkTileable: exits for the formats that cannot be cut into bands.
+static void checkTileable(IllustratorType eIllustrator)
+{
+    if(isCompressed(eIllustrator))
+    {
+        std::cerr << "ERROR! QOI and PNG are compressed as one stream and cannot be tiled. Terminating." << std::endl;
+        std::exit(ERROR_ARGS);
+    }
+}
+
+int TiledRenderer::bandRows(IllustratorType eIllustrator, ExportMode eMode, int intWidth) const
+{
+    // Upper bound of encoded bytes per pixel, in eighths (P4 is one bit per pixel), for the
+    // tileable formats (checkTileable): P3 "255 " x3 = 12, P2 "255 " = 4, P1 "1 " = 2, P6 = 3,
+    // P5 = 1, P4 = 1/8.
+    static const std::size_t arrEighths[2][BW + 1] = {{96, 32, 16}, {24, 8, 1}};
+    std::size_t intRowBytes = (static_cast<std::size_t>(intWidth) * arrEighths[eMode == BINARY ? 1 : 0][eIllustrator] + 7) / 8 + 8;
+    return static_cast<int>(std::clamp<std::size_t>(_bandBytes / intRowBytes, 1, static_cast<std::size_t>(MAX_DIMENSION)));
+}
+
+// newIllustrator: a description of the flag; the pixel grid stays empty.
+static std::unique_ptr<FlagIllustrator> newIllustrator(FlagType eFlag, IllustratorType eIllustrator, ExportMode eMode,
+                                                       int intHeight, int intWidth, bool blnAntiAlias, DitherMode eDither)
+{
+    std::unique_ptr<FlagIllustrator> pIllustrator = createIllustrator(eIllustrator, 0, 0);
+    pIllustrator->setExportMode(eMode);
+    pIllustrator->setAntiAlias(blnAntiAlias);
+    pIllustrator->setDither(eDither);
+    pIllustrator->illustrateProcedural(eFlag, intHeight, intWidth);
+    return pIllustrator;
+}
+
+void TiledRenderer::runWorkers(int intWork, const std::function<void()>& fnWorker) const
+{
+    int intThreads = std::min(_threads, std::max(1, intWork));
+    RenderMetrics* pMetrics = currentRenderMetrics(); // the workers record into the caller's scope too
+    std::vector<std::thread> vecThreads;
+    for(int t = 1; t < intThreads; ++t)
+        vecThreads.emplace_back([&fnWorker, pMetrics]()
+                                {
+                                    MetricsScope objScope(pMetrics);
+                                    fnWorker();
+                                });
+    fnWorker(); // the calling thread is a worker too
+    for(std::thread& objThread : vecThreads)
+        objThread.join();
+}
+
+std::size_t TiledRenderer::render(FlagType eFlag, IllustratorType eIllustrator, ExportMode eMode,
+                                  int intHeight, int intWidth, ImageSink& objSink) const
+{
+    checkTileable(eIllustrator);
+    std::size_t intStart = objSink.bytesWritten();
+    int intBandRows = bandRows(eIllustrator, eMode, intWidth);
+
+    // one description shared by all workers: exportRows() is const and the run table immutable
+    std::unique_ptr<FlagIllustrator> pIllustrator = newIllustrator(eFlag, eIllustrator, eMode, intHeight, intWidth, _blnAntiAlias, _eDither);
+    objSink.write(pIllustrator->exportHeader());
+    encodeBandsInOrder(objSink, 0, intHeight, intBandRows, _threads,
+                       [&pIllustrator](int intBegin, int intEnd, RowScratch&, std::vector<std::uint8_t>& vecOut)
+                       {
+                           ImageSink objBand([&vecOut](const char* pData, std::size_t intSize)
+                                             { vecOut.insert(vecOut.end(), pData, pData + intSize); });
+                           pIllustrator->exportRows(objBand, intBegin, intEnd);
+                       });
+    return objSink.bytesWritten() - intStart;
+}
+
+bool TiledRenderer::renderMapped(FlagType eFlag, IllustratorType eIllustrator,
+                                 int intHeight, int intWidth, const std::string& strPath) const
+{
+    checkTileable(eIllustrator);
+    std::unique_ptr<FlagIllustrator> pIllustrator = newIllustrator(eFlag, eIllustrator, BINARY, intHeight, intWidth, _blnAntiAlias, _eDither);
+    std::string strHeader = pIllustrator->exportHeader();
+    std::size_t intSize   = pIllustrator->exportSize(); // exact, and cheap for the binary formats
+    // Binary rows all encode to the same number of bytes, so row r starts at header + r * rowBytes.
+    std::size_t intRowBytes = intHeight > 0 ? (intSize - strHeader.size()) / static_cast<std::size_t>(intHeight) : 0;
+
+    MappedFile objFile;
+    if(!objFile.create(strPath, intSize))
+        return false;
+    std::span<char> arrFile = objFile.bytes();
+    std::copy(strHeader.begin(), strHeader.end(), arrFile.begin());
+
+    int intBandRows = bandRows(eIllustrator, BINARY, intWidth);
+    int intBands = (intHeight + intBandRows - 1) / intBandRows;
+    std::atomic<int> intNext{0};
+    auto fnWorker = [&]()
+    {
+        for(int b = intNext++; b < intBands; b = intNext++)
+        {
+            // Each band owns a disjoint byte range of the file: nothing to coordinate.
+            int intBegin = b * intBandRows;
+            int intEnd   = std::min(intHeight, intBegin + intBandRows);
+            std::size_t intBandBytes = static_cast<std::size_t>(intEnd - intBegin) * intRowBytes;
+            ImageSink objBand(arrFile.subspan(strHeader.size() + static_cast<std::size_t>(intBegin) * intRowBytes, intBandBytes));
+            pIllustrator->exportRows(objBand, intBegin, intEnd);
+            // A longer band already fails in the sink; a shorter one would leave a hole of zeros.
+            if(objBand.bytesWritten() != intBandBytes)
+            {
+                std::cerr << "ERROR! Rows " << intBegin << ".." << intEnd - 1 << " encoded to " << objBand.bytesWritten()
+                          << " bytes instead of " << intBandBytes << ". Terminating." << std::endl;
+                std::exit(ERROR_IO);
+            }
+        }
+    };
+    runWorkers(intBands, fnWorker);
+
+    if(!objFile.close())
+    {
+        std::cerr << "ERROR! Could not write image output. Terminating." << std::endl;
+        std::exit(ERROR_IO);
+    }
+    return true;
+}
+
+bool TiledRenderer::renderToFile(FlagType eFlag, IllustratorType eIllustrator, ExportMode eMode,
+                                 int intHeight, int intWidth, const std::string& strPath) const
+{
+    if(eMode == BINARY && MappedFile::supported() && renderMapped(eFlag, eIllustrator, intHeight, intWidth, strPath))
+        return true;
+
+    std::ofstream ofsOut(strPath, std::ios::binary | std::ios::trunc);
+    if(!ofsOut)
+        return false;
+    {
+        ImageSink objSink(ofsOut);
+        render(eFlag, eIllustrator, eMode, intHeight, intWidth, objSink);
+    } // sink flushes on destruction
+    ofsOut.close();
+    return true;
+}
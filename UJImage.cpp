@@ -1,35 +1,75 @@
-// UJImage.cpp handles a resizable image stored as a dynamically-allocated 2D array of UJPixel.
+// UJImage.cpp handles a resizable image stored as one contiguous, aligned block of UJPixel.
 // Responsibilities:
-//  - allocate/deallocate the 2D pixel array
-//  - deep-copy semantics (copy ctor clones pixel data)
-//  - accessor/mutator with range checks
-//  - toPPM() for colour (P3) output (used by ColourIllustrator)
+//  - allocate/deallocate the pixel buffer (a single allocation per image) through a
+//    PixelAllocator, so a PixelPool can recycle buffers across images
+//  - resize in place, reusing the buffer when it is big enough
+//  - deep-copy semantics (copy ctor / copy assignment clone pixel data with one bulk copy)
+//  - move semantics: moving hands the buffer over without touching the pixels
+//  - optionally wrap a borrowed buffer owned by someone else (never freed here)
+//  - accessor/mutator with index range checks
+//  - raw row / whole-image views (std::span) for loops that walk memory linearly
+//  - checked-once region access: checkRect() validates a rectangle up front, the *Unchecked
+//    accessors then cost no comparison at all, and fillRect() / copyRect() work on whole rows
+//  - writePPM() / writeRawPPM() for colour (P3 / P6) output (used by ColourIllustrator),
+//    with toPPM() / toRawPPM() as string-returning wrappers sized exactly by ppmSize() / rawPPMSize()
 //
 // Important invariants:
-//  - _image points to an array of _rows pointers, each pointing to an array of _cols UJPixel
-//  - dealloc() must safely free this memory (no leaks)
+//  - _pixels points to _rows * _cols UJPixel stored row-major; row r starts at
+//    _pixels + r * _cols (the row stride equals the width, so the rows are back to back)
+//  - buffers allocated here are aligned to ALIGNMENT bytes (a borrowed one need not be)
+//  - dealloc() must safely free this memory (no leaks), and only when _owned is set;
+//    an owned buffer goes back to _allocator, the allocator that produced it
+//  - a moved-from image is a valid 0x0 image
 
 module;
+#include <algorithm>
 #include <cassert>
-#include <sstream>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
 #include <string>
+#include <utility>
+#include <vector>
 #include <iostream>
 #include <cstdlib>
 
 export module UJImage;
 
 import LibUtility;
+import PixelPool;
+import Metrics;
+import ImageSink;
+import TextEncoder;
 
 export class UJImage
 {
 public:
     UJImage();
     UJImage(int intRows, int intCols);
-    UJImage(const UJImage& objOriginal); // deep copy
+    // Same, with the buffer from objAllocator instead of defaultPixelAllocator().
+    UJImage(int intRows, int intCols, PixelAllocator& objAllocator);
+    // Borrowed buffer: the image lives in arrBuffer (at least intRows * intCols pixels, kept
+    // as they are) and is never freed by UJImage; the caller keeps it alive meanwhile.
+    // A resize() beyond arrBuffer.size() switches to an owned buffer.
+    UJImage(std::span<UJPixel> arrBuffer, int intRows, int intCols);
+    UJImage(const UJImage& objOriginal); // deep copy (from objOriginal's allocator)
+    UJImage(UJImage&& objOriginal) noexcept; // takes the buffer; objOriginal becomes 0x0
+    UJImage& operator=(const UJImage& objOriginal); // deep copy, reusing the buffer if it fits
+    UJImage& operator=(UJImage&& objOriginal) noexcept;
     ~UJImage();
 
     // Convert internal pixel grid to P3 PPM string (colour).
     std::string toPPM() const;
+    // Same image as binary P6 PPM (3 raw bytes per pixel).
+    std::string toRawPPM() const;
+    // Streaming versions of the two above: encode straight into objSink.
+    void writePPM(ImageSink& objSink) const;
+    void writeRawPPM(ImageSink& objSink) const;
+    // Exact byte counts of the two encodings (computed without encoding).
+    std::size_t ppmSize() const;
+    std::size_t rawPPMSize() const;
 
     // Accessors/mutators (with range enforcement)
     int getHeight() const;
@@ -37,21 +77,92 @@ public:
     UJPixel getPixel(int intRow, int intCol) const;
     void setPixel(int intRow, int intCol, const UJPixel& recPixel);
 
+    // Raw views: the row index is checked once, the pixels inside are not.
+    std::span<UJPixel> row(int intRow);
+    std::span<const UJPixel> row(int intRow) const;
+
+    // Checked-once access. checkRect exits with ERROR_RANGE unless the intHeight x intWidth
+    // rectangle at (intRow, intCol) lies inside the image (empty rectangles anywhere inside
+    // the bounds are fine). Within a checked region the unchecked accessors may be used
+    // freely: they only assert() in debug builds, so inner loops stay straight-line code.
+    void checkRect(int intRow, int intCol, int intHeight, int intWidth) const;
+    std::span<UJPixel> rowUnchecked(int intRow) noexcept;
+    std::span<const UJPixel> rowUnchecked(int intRow) const noexcept;
+    UJPixel& pixelUnchecked(int intRow, int intCol) noexcept;
+    const UJPixel& pixelUnchecked(int intRow, int intCol) const noexcept;
+
+    // fillRect: every pixel of the rectangle set to recPixel (checked once, then a fill per row).
+    void fillRect(int intRow, int intCol, int intHeight, int intWidth, const UJPixel& recPixel);
+    // copyRect: the intHeight x intWidth rectangle at (intSrcRow, intSrcCol) of objSource copied
+    // to (intRow, intCol) of this image, a bulk copy per row. Both rectangles are checked once;
+    // objSource may be this image, and the two rectangles may overlap.
+    void copyRect(const UJImage& objSource, int intSrcRow, int intSrcCol, int intHeight, int intWidth,
+                  int intRow, int intCol);
+    // Whole image as one row-major span of getHeight() * getWidth() pixels.
+    std::span<UJPixel> pixels();
+    std::span<const UJPixel> pixels() const;
+    // R,G,B bytes of one row (3 * getWidth() values). For RGB888 this is a view of the
+    // row itself; RGBA pixels are copied into vecScratch without their padding byte.
+    std::span<const std::uint8_t> rowChannels(int intRow, std::vector<std::uint8_t>& vecScratch) const;
+    // Same for any run of pixels (e.g. a row generated outside an image).
+    static std::span<const std::uint8_t> pixelChannels(std::span<const UJPixel> arrPixels, std::vector<std::uint8_t>& vecScratch);
+
+    // Bulk copy of all pixel values from an image of the same dimensions.
+    void copyPixels(const UJImage& objOriginal);
+
+    // resize: change the dimensions and reset every pixel to white. The current
+    // buffer is kept whenever it is large enough, so repeated renders of the same
+    // (or a smaller) size allocate nothing.
+    void resize(int intRows, int intCols);
+
+    static constexpr std::size_t ALIGNMENT = PIXEL_ALIGNMENT; // cache line
+
 private:
     // Helpers
-    void alloc(int intRows, int intCols);     // allocate the 2D grid
+    void alloc(int intRows, int intCols);     // allocate the pixel buffer
     void clone(const UJImage& objOriginal);   // deep copy
-    void dealloc();                           // free grid
+    void dealloc();                           // free buffer
     void enforceRange(int intValue, int intMin, int intMax) const;
+    std::size_t count() const;                // _rows * _cols without int overflow
+    std::size_t offset(int intRow) const;     // index of the first pixel of a row
 
     // State
-    UJPixel** _image = nullptr; // pointer to rows (each row is UJPixel*)
+    UJPixel* _pixels = nullptr; // row-major, _rows * _cols pixels
+    std::size_t _capacity = 0;  // pixels the buffer can hold (>= _rows * _cols)
     int _rows = 0;
     int _cols = 0;
+    bool _owned = true;         // false: _pixels is a borrowed buffer
+    PixelAllocator* _allocator = &defaultPixelAllocator(); // where owned buffers come from
 };
 
 // ---------- Implementations ----------
 
+// The unchecked accessors are inline, so loops in other modules compile down to plain pointer
+// arithmetic on _pixels.
+inline std::span<UJPixel> UJImage::rowUnchecked(int intRow) noexcept
+{
+    assert(intRow >= 0 && intRow < _rows);
+    return {_pixels + offset(intRow), static_cast<std::size_t>(_cols)};
+}
+
+inline std::span<const UJPixel> UJImage::rowUnchecked(int intRow) const noexcept
+{
+    assert(intRow >= 0 && intRow < _rows);
+    return {_pixels + offset(intRow), static_cast<std::size_t>(_cols)};
+}
+
+inline UJPixel& UJImage::pixelUnchecked(int intRow, int intCol) noexcept
+{
+    assert(intRow >= 0 && intRow < _rows && intCol >= 0 && intCol < _cols);
+    return _pixels[offset(intRow) + static_cast<std::size_t>(intCol)];
+}
+
+inline const UJPixel& UJImage::pixelUnchecked(int intRow, int intCol) const noexcept
+{
+    assert(intRow >= 0 && intRow < _rows && intCol >= 0 && intCol < _cols);
+    return _pixels[offset(intRow) + static_cast<std::size_t>(intCol)];
+}
+
 UJImage::UJImage() : UJImage(2, 2) // default tiny image
 {}
 
@@ -61,94 +172,215 @@ UJImage::UJImage(int intRows, int intCols)
     alloc(intRows, intCols);
 }
 
+UJImage::UJImage(int intRows, int intCols, PixelAllocator& objAllocator)
+: _allocator(&objAllocator)
+{
+    alloc(intRows, intCols);
+}
+
+UJImage::UJImage(std::span<UJPixel> arrBuffer, int intRows, int intCols)
+: _pixels(arrBuffer.data()), _capacity(arrBuffer.size()), _rows(intRows), _cols(intCols), _owned(false)
+{
+    enforceRange(intRows, 0, MAX_DIMENSION);
+    enforceRange(intCols, 0, MAX_DIMENSION);
+    if(count() > _capacity)
+    {
+        std::cerr << "ERROR! Borrowed buffer of " << _capacity << " pixels is too small for "
+                  << intRows << "x" << intCols << ". Terminating." << std::endl;
+        std::exit(ERROR_RANGE);
+    }
+}
+
 UJImage::UJImage(const UJImage& objOriginal)
-: UJImage(objOriginal._rows, objOriginal._cols) // reuse alloc via delegating ctor
+: UJImage(objOriginal._rows, objOriginal._cols, *objOriginal._allocator) // reuse alloc via delegating ctor
 {
     // Deep copy pixel values
     clone(objOriginal);
 }
 
+UJImage::UJImage(UJImage&& objOriginal) noexcept
+: _pixels(std::exchange(objOriginal._pixels, nullptr)),
+  _capacity(std::exchange(objOriginal._capacity, 0)),
+  _rows(std::exchange(objOriginal._rows, 0)),
+  _cols(std::exchange(objOriginal._cols, 0)),
+  _owned(std::exchange(objOriginal._owned, true)),
+  _allocator(objOriginal._allocator)
+{}
+
+UJImage& UJImage::operator=(const UJImage& objOriginal)
+{
+    if(this == &objOriginal)
+        return *this;
+    if(objOriginal.count() > _capacity)
+    {
+        dealloc();
+        alloc(objOriginal._rows, objOriginal._cols);
+    }
+    else
+    {
+        _rows = objOriginal._rows;
+        _cols = objOriginal._cols;
+    }
+    clone(objOriginal);
+    return *this;
+}
+
+UJImage& UJImage::operator=(UJImage&& objOriginal) noexcept
+{
+    if(this == &objOriginal)
+        return *this;
+    dealloc();
+    _pixels   = std::exchange(objOriginal._pixels, nullptr);
+    _capacity = std::exchange(objOriginal._capacity, 0);
+    _rows     = std::exchange(objOriginal._rows, 0);
+    _cols     = std::exchange(objOriginal._cols, 0);
+    _owned    = std::exchange(objOriginal._owned, true);
+    _allocator = objOriginal._allocator;
+    return *this;
+}
+
 UJImage::~UJImage()
 {
     // Ensure resources freed
     dealloc();
 }
 
-// toPPM: returns a P3 colour PPM string.
+// toPPM: returns a P3 colour PPM string (see writePPM for the layout).
+// The string is allocated once at its exact final size.
+std::string UJImage::toPPM() const
+{
+    std::string strPPM;
+    strPPM.reserve(ppmSize());
+    {
+        ImageSink objSink([&strPPM](const char* pData, std::size_t intSize) { strPPM.append(pData, intSize); });
+        writePPM(objSink);
+    } // sink flushes on destruction
+    return strPPM;
+}
+
+// toRawPPM: returns a binary P6 colour PPM string (see writeRawPPM for the layout).
+std::string UJImage::toRawPPM() const
+{
+    std::string strPPM;
+    strPPM.reserve(rawPPMSize());
+    {
+        ImageSink objSink([&strPPM](const char* pData, std::size_t intSize) { strPPM.append(pData, intSize); });
+        writeRawPPM(objSink);
+    }
+    return strPPM;
+}
+
+// writePPM: streams a P3 colour PPM, one row at a time, through the table-driven TextEncoder.
 // The header is:
 //   P3
 //   <width> <height>
 //   255
-// then pixel triples row-major.
-std::string UJImage::toPPM() const
+// then pixel triples row-major, one image row per text line.
+void UJImage::writePPM(ImageSink& objSink) const
 {
-    std::stringstream ssPPM;
-    ssPPM << "P3" << std::endl
-          << _cols << ' ' << _rows << std::endl
-          << 255 << std::endl;
+    objSink.write(pnmHeader("P3", _cols, _rows, 255));
+
+    std::vector<std::uint8_t> vecChannels; // only used for RGBA pixels
+    std::vector<char> vecText;             // one encoded row, reused
     for(int r = 0; r < _rows; ++r)
+        writeTextRow(pixelChannels(rowUnchecked(r), vecChannels), vecText, objSink);
+}
+
+// writeRawPPM: streams a binary P6 colour PPM.
+// The header is the same as P3 (with a single '\n' after 255, as P6 requires),
+// followed by R,G,B bytes row-major with no separators.
+void UJImage::writeRawPPM(ImageSink& objSink) const
+{
+    objSink.write(pnmHeader("P6", _cols, _rows, 255));
+    if constexpr(sizeof(UJPixel) == 3)
+    {
+        // RGB888 in memory is exactly the P6 payload: hand the buffer over as-is.
+        objSink.write(reinterpret_cast<const char*>(_pixels), count() * 3);
+    }
+    else
     {
-        for(int c = 0; c < _cols; ++c)
+        // RGBA8888: drop the padding byte of each pixel, a row at a time.
+        std::vector<std::uint8_t> vecChannels;
+        for(int r = 0; r < _rows; ++r)
         {
-            ssPPM << _image[r][c].intRed << ' '
-                  << _image[r][c].intGreen << ' '
-                  << _image[r][c].intBlue << ' ';
+            std::span<const std::uint8_t> arrChannels = pixelChannels(rowUnchecked(r), vecChannels);
+            objSink.write(reinterpret_cast<const char*>(arrChannels.data()), arrChannels.size());
         }
-        ssPPM << std::endl;
     }
-    return ssPPM.str();
 }
 
-// alloc: create the rows and columns on the heap.
-// We always initialise pixels to white (255,255,255).
+// ppmSize: header + the text of every channel value + one '\n' per row.
+std::size_t UJImage::ppmSize() const
+{
+    std::size_t intSize = pnmHeader("P3", _cols, _rows, 255).size() + static_cast<std::size_t>(_rows);
+    std::vector<std::uint8_t> vecChannels;
+    for(int r = 0; r < _rows; ++r)
+        intSize += textSize(pixelChannels(rowUnchecked(r), vecChannels));
+    return intSize;
+}
+
+std::size_t UJImage::rawPPMSize() const
+{
+    return pnmHeader("P6", _cols, _rows, 255).size() + count() * 3;
+}
+
+// alloc: create the whole pixel grid with a single aligned allocation from _allocator.
+// We always initialise pixels to white (255,255,255). A grid of more than MAX_GRID_PIXELS
+// is refused (ERROR_ARGS); such images are only ever rendered procedurally.
 void UJImage::alloc(int intRows, int intCols)
 {
+    enforceRange(intRows, 0, MAX_DIMENSION);
+    enforceRange(intCols, 0, MAX_DIMENSION);
+    if(static_cast<std::size_t>(intRows) * static_cast<std::size_t>(intCols) > MAX_GRID_PIXELS)
+    {
+        std::cerr << "ERROR! A " << intRows << "x" << intCols << " pixel grid is larger than "
+                  << MAX_GRID_PIXELS << " pixels (render it procedurally). Terminating." << std::endl;
+        std::exit(ERROR_ARGS);
+    }
+
     // store dimensions
     _rows = intRows;
     _cols = intCols;
 
-    // allocate array of row pointers
-    _image = new UJPixel*[_rows];
-    for(int r = 0; r < _rows; ++r)
-    {
-        // allocate each row
-        _image[r] = new UJPixel[_cols];
-        for(int c = 0; c < _cols; ++c)
-        {
-            // default pixel = white
-            _image[r][c] = {255, 255, 255};
-        }
-    }
+    // one block for every row; UJPixel is trivial so raw storage + fill is enough.
+    // The allocator may round the capacity up, which later resizes can use.
+    StageTimer objTimer(STAGE_ALLOCATE);
+    if(count() > 0)
+        countAllocation(count() * sizeof(UJPixel));
+    _pixels = _allocator->allocate(count(), _capacity);
+    _owned = true;
+    std::uninitialized_fill_n(_pixels, count(), UJPixel{255, 255, 255}); // default pixel = white
 }
 
-// clone: deep copy pixel values from original into this->_image.
+// clone: deep copy pixel values from original into this->_pixels.
 void UJImage::clone(const UJImage& objOriginal)
 {
-    assert(_rows == objOriginal._rows);
-    assert(_cols == objOriginal._cols);
-    for(int r = 0; r < _rows; ++r)
-    {
-        for(int c = 0; c < _cols; ++c)
-            _image[r][c] = objOriginal._image[r][c];
-    }
+    copyPixels(objOriginal);
 }
 
-// dealloc: free rows then the row-pointer array.
+// dealloc: free the pixel block (a borrowed one is just let go).
 // Important: set pointers to nullptr to avoid accidental reuse.
 void UJImage::dealloc()
 {
-    if(_image != nullptr)
+    if(_pixels != nullptr)
     {
-        for(int r = 0; r < _rows; ++r)
-        {
-            delete [] _image[r];     // free row pixels
-            _image[r] = nullptr;
-        }
-        delete [] _image;           // free array of row pointers
-        _image = nullptr;
+        if(_owned)
+            _allocator->deallocate(_pixels, _capacity);
+        _pixels = nullptr;
+        _capacity = 0;
     }
 }
 
+std::size_t UJImage::count() const
+{
+    return static_cast<std::size_t>(_rows) * static_cast<std::size_t>(_cols);
+}
+
+std::size_t UJImage::offset(int intRow) const
+{
+    return static_cast<std::size_t>(intRow) * static_cast<std::size_t>(_cols);
+}
+
 // enforceRange: helper used by accessors/mutators to ensure indexes/values are valid.
 // exit(ERROR_RANGE) on invalid value (explicit, loud failure for assignment).
 void UJImage::enforceRange(int intValue, int intMin, int intMax) const
@@ -167,16 +399,118 @@ UJPixel UJImage::getPixel(int intRow, int intCol) const
 {
     enforceRange(intRow, 0, _rows - 1);
     enforceRange(intCol, 0, _cols - 1);
-    return _image[intRow][intCol];
+    return _pixels[offset(intRow) + intCol];
 }
 
 void UJImage::setPixel(int intRow, int intCol, const UJPixel& recPixel)
 {
-    // validate the indices and the RGB values before assignment
+    // validate the indices before assignment (UJPixel channels are always 0..255)
     enforceRange(intRow, 0, _rows - 1);
     enforceRange(intCol, 0, _cols - 1);
-    enforceRange(recPixel.intRed,   0, 255);
-    enforceRange(recPixel.intGreen, 0, 255);
-    enforceRange(recPixel.intBlue,  0, 255);
-    _image[intRow][intCol] = recPixel;
-}
\ No newline at end of file
+    _pixels[offset(intRow) + intCol] = recPixel;
+}
+
+std::span<UJPixel> UJImage::row(int intRow)
+{
+    enforceRange(intRow, 0, _rows - 1);
+    return {_pixels + offset(intRow), static_cast<std::size_t>(_cols)};
+}
+
+std::span<const UJPixel> UJImage::row(int intRow) const
+{
+    enforceRange(intRow, 0, _rows - 1);
+    return {_pixels + offset(intRow), static_cast<std::size_t>(_cols)};
+}
+
+void UJImage::checkRect(int intRow, int intCol, int intHeight, int intWidth) const
+{
+    // 64-bit sums: intRow + intHeight cannot overflow
+    if(intRow < 0 || intCol < 0 || intHeight < 0 || intWidth < 0
+       || static_cast<long long>(intRow) + intHeight > _rows || static_cast<long long>(intCol) + intWidth > _cols)
+    {
+        std::cerr << "ERROR! Rectangle " << intHeight << "x" << intWidth << " at (" << intRow << ", " << intCol
+                  << ") is outside the " << _rows << "x" << _cols << " image. Terminating." << std::endl;
+        std::exit(ERROR_RANGE);
+    }
+}
+
+void UJImage::fillRect(int intRow, int intCol, int intHeight, int intWidth, const UJPixel& recPixel)
+{
+    checkRect(intRow, intCol, intHeight, intWidth);
+    for(int r = intRow; r < intRow + intHeight; ++r)
+        std::fill_n(_pixels + offset(r) + intCol, intWidth, recPixel);
+}
+
+void UJImage::copyRect(const UJImage& objSource, int intSrcRow, int intSrcCol, int intHeight, int intWidth,
+                       int intRow, int intCol)
+{
+    objSource.checkRect(intSrcRow, intSrcCol, intHeight, intWidth);
+    checkRect(intRow, intCol, intHeight, intWidth);
+    // Within this image, walk the rows away from the overlap: bottom-up when moving down.
+    // memmove handles any overlap inside a row (UJPixel is trivially copyable).
+    bool blnBottomUp = &objSource == this && intRow > intSrcRow;
+    for(int i = 0; i < intHeight; ++i)
+    {
+        int k = blnBottomUp ? intHeight - 1 - i : i;
+        std::memmove(_pixels + offset(intRow + k) + intCol,
+                     objSource._pixels + objSource.offset(intSrcRow + k) + intSrcCol,
+                     static_cast<std::size_t>(intWidth) * sizeof(UJPixel));
+    }
+}
+
+std::span<UJPixel> UJImage::pixels()
+{
+    return {_pixels, count()};
+}
+
+std::span<const UJPixel> UJImage::pixels() const
+{
+    return {_pixels, count()};
+}
+
+std::span<const std::uint8_t> UJImage::rowChannels(int intRow, std::vector<std::uint8_t>& vecScratch) const
+{
+    return pixelChannels(row(intRow), vecScratch);
+}
+
+std::span<const std::uint8_t> UJImage::pixelChannels(std::span<const UJPixel> arrRow, std::vector<std::uint8_t>& vecScratch)
+{
+    if constexpr(sizeof(UJPixel) == 3)
+    {
+        return {reinterpret_cast<const std::uint8_t*>(arrRow.data()), arrRow.size() * 3};
+    }
+    else
+    {
+        vecScratch.resize(arrRow.size() * 3);
+        std::size_t i = 0;
+        for(const UJPixel& recPixel : arrRow)
+        {
+            vecScratch[i++] = recPixel.intRed;
+            vecScratch[i++] = recPixel.intGreen;
+            vecScratch[i++] = recPixel.intBlue;
+        }
+        return vecScratch;
+    }
+}
+
+void UJImage::resize(int intRows, int intCols)
+{
+    std::size_t intNeeded = static_cast<std::size_t>(intRows) * static_cast<std::size_t>(intCols);
+    if(intNeeded > _capacity)
+    {
+        dealloc();
+        alloc(intRows, intCols);
+        return;
+    }
+    _rows = intRows;
+    _cols = intCols;
+    std::fill_n(_pixels, count(), UJPixel{255, 255, 255}); // same state as a fresh image
+}
+
+// copyPixels: the buffers are contiguous, so a deep copy is one bulk copy.
+void UJImage::copyPixels(const UJImage& objOriginal)
+{
+    assert(_rows == objOriginal._rows);
+    assert(_cols == objOriginal._cols);
+    std::copy_n(objOriginal._pixels, count(), _pixels);
+}
@@ -7,12 +7,33 @@ if not exist "..\output" mkdir "..\output"
 
 echo Compiling...
 g++ --std=c++20 -fmodules-ts -c LibUtility.cpp
+g++ --std=c++20 -fmodules-ts -c Metrics.cpp
+g++ --std=c++20 -fmodules-ts -c ImageSink.cpp
+g++ --std=c++20 -fmodules-ts -c MappedFile.cpp
+g++ --std=c++20 -fmodules-ts -c TextEncoder.cpp
+g++ --std=c++20 -fmodules-ts -c Deflate.cpp
+g++ --std=c++20 -fmodules-ts -c PixelKernels.cpp
+g++ --std=c++20 -fmodules-ts -c PixelPool.cpp
 g++ --std=c++20 -fmodules-ts -c UJImage.cpp
+g++ --std=c++20 -fmodules-ts -c FlagLibrary.cpp
+g++ --std=c++20 -fmodules-ts -c FlagRasterizer.cpp
+g++ --std=c++20 -fmodules-ts -c RenderPipeline.cpp
 g++ --std=c++20 -fmodules-ts -c FlagIllustrator.cpp
 g++ --std=c++20 -fmodules-ts -c ColourIllustrator.cpp
 g++ --std=c++20 -fmodules-ts -c GrayscaleIllustrator.cpp
+g++ --std=c++20 -fmodules-ts -c Dither.cpp
 g++ --std=c++20 -fmodules-ts -c BWIllustrator.cpp
+g++ --std=c++20 -fmodules-ts -c QOIIllustrator.cpp
+g++ --std=c++20 -fmodules-ts -c PNGIllustrator.cpp
+g++ --std=c++20 -fmodules-ts -c IllustratorFactory.cpp
+g++ --std=c++20 -fmodules-ts -c TiledRenderer.cpp
+g++ --std=c++20 -fmodules-ts -c MultiExporter.cpp
+g++ --std=c++20 -fmodules-ts -c RenderCache.cpp
+g++ --std=c++20 -fmodules-ts -c BatchRenderer.cpp
+g++ --std=c++20 -fmodules-ts -c RenderServer.cpp
 g++ --std=c++20 -fmodules-ts -c main.cpp
+g++ --std=c++20 -fmodules-ts -c Benchmark.cpp
+g++ --std=c++20 -fmodules-ts -c Tests.cpp
 
 if %errorlevel% neq 0 (
     echo Compilation failed.
@@ -21,7 +42,7 @@ if %errorlevel% neq 0 (
 )
 
 echo Linking...
-g++ LibUtility.o UJImage.o FlagIllustrator.o ColourIllustrator.o GrayscaleIllustrator.o BWIllustrator.o main.o -o "..\bin\prog.exe"
+g++ LibUtility.o Metrics.o ImageSink.o TextEncoder.o Deflate.o PixelKernels.o PixelPool.o UJImage.o FlagLibrary.o FlagRasterizer.o RenderPipeline.o FlagIllustrator.o ColourIllustrator.o GrayscaleIllustrator.o Dither.o BWIllustrator.o QOIIllustrator.o PNGIllustrator.o IllustratorFactory.o MappedFile.o TiledRenderer.o MultiExporter.o RenderCache.o BatchRenderer.o RenderServer.o main.o -o "..\bin\prog.exe"
 
 if %errorlevel% neq 0 (
     echo Linking failed.
@@ -29,6 +50,33 @@ if %errorlevel% neq 0 (
     exit /b %errorlevel%
 )
 
+echo Linking benchmark...
+g++ LibUtility.o Metrics.o ImageSink.o TextEncoder.o Deflate.o PixelKernels.o PixelPool.o UJImage.o FlagLibrary.o FlagRasterizer.o RenderPipeline.o FlagIllustrator.o ColourIllustrator.o GrayscaleIllustrator.o Dither.o BWIllustrator.o QOIIllustrator.o PNGIllustrator.o IllustratorFactory.o RenderCache.o BatchRenderer.o Benchmark.o -o "..\bin\bench.exe"
+
+if %errorlevel% neq 0 (
+    echo Linking failed.
+    pause
+    exit /b %errorlevel%
+)
+
+echo Linking tests...
+g++ LibUtility.o Metrics.o ImageSink.o TextEncoder.o Deflate.o PixelKernels.o PixelPool.o UJImage.o FlagLibrary.o FlagRasterizer.o RenderPipeline.o FlagIllustrator.o ColourIllustrator.o GrayscaleIllustrator.o Dither.o BWIllustrator.o QOIIllustrator.o PNGIllustrator.o IllustratorFactory.o MappedFile.o TiledRenderer.o MultiExporter.o RenderCache.o BatchRenderer.o RenderServer.o Tests.o -o "..\bin\tests.exe"
+
+if %errorlevel% neq 0 (
+    echo Linking failed.
+    pause
+    exit /b %errorlevel%
+)
+
+echo Running tests...
+"..\bin\tests.exe"
+
+if %errorlevel% neq 0 (
+    echo Tests failed.
+    pause
+    exit /b %errorlevel%
+)
+
 echo Cleaning up object files...
 del *.o 2>nul
 
@@ -41,6 +89,11 @@ echo Generating a grayscale PGM and a PBM (BW)
 "..\bin\prog.exe" 0 1 > "..\output\image_au_gray.pgm"
 "..\bin\prog.exe" 2 2 > "..\output\image_ng_bw.pbm"
 
+echo Generating binary PPM / PGM / PBM (P6 / P5 / P4)
+"..\bin\prog.exe" 1 --binary > "..\output\image_jp_bin.ppm"
+"..\bin\prog.exe" 1 1 --binary > "..\output\image_jp_gray_bin.pgm"
+"..\bin\prog.exe" 1 2 --binary > "..\output\image_jp_bw_bin.pbm"
+
 echo Images created in ..\output
 
 pause
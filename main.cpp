@@ -1,14 +1,28 @@
 #include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
 import LibUtility;
+import FlagLibrary;
+import PixelPool;
+import ImageSink;
 import FlagIllustrator;
-import ColourIllustrator;
-import GrayscaleIllustrator;
-import BWIllustrator;
+import IllustratorFactory;
+import TiledRenderer;
+import MultiExporter;
+import Metrics;
+import RenderCache;
+import BatchRenderer;
+import RenderServer;
 
 // Helper: try to extract an integer from a string. Return true on success.
 static bool tryExtractIntInRange(const std::string &s, int &out, int minv = 0, int maxv = 2)
@@ -32,23 +46,355 @@ static bool tryExtractIntInRange(const std::string &s, int &out, int minv = 0, i
     }
 }
 
-int main(int argc, char** argv)
+// tryExtractCount: an option value made of digits only (e.g. "-j 8"), in [minv, maxv].
+// Unlike tryExtractIntInRange nothing around the digits is skipped, so "8x" or "-1" is refused.
+static bool tryExtractCount(const std::string &s, int &out, int minv, int maxv)
 {
-    // collect up to two valid integers (0..2) appearing anywhere in argv[1..]
-    std::vector<int> found;
-    for(int i = 1; i < argc && found.size() < 2; ++i)
+    if(s.empty() || s.size() > 9 || s.find_first_not_of("0123456789") != std::string::npos)
+        return false;
+    return tryExtractIntInRange(s, out, minv, maxv);
+}
+
+// tryExtractSize: "HxW" (e.g. 20000x30000), each side in [0, MAX_DIMENSION]. Return true on success.
+static bool tryExtractSize(const std::string &s, int &outHeight, int &outWidth)
+{
+    std::size_t pos = s.find_first_of("xX");
+    if(pos == std::string::npos)
+        return false;
+    std::string strHeight = s.substr(0, pos);
+    std::string strWidth  = s.substr(pos + 1);
+    for(const std::string* p : {&strHeight, &strWidth})
+    {
+        if(p->empty() || p->size() > 9 || p->find_first_not_of("0123456789") != std::string::npos)
+            return false;
+    }
+    return tryExtractIntInRange(strHeight, outHeight, 0, MAX_DIMENSION)
+        && tryExtractIntInRange(strWidth, outWidth, 0, MAX_DIMENSION);
+}
+
+// extractFlagAndIllustrator: the FlagType and IllustratorType among the positional arguments.
+// The first argument that names a flag (case-insensitive) or holds a number in
+// [0, flagCount()) is the FlagType; the next one with a number in [0, 4] is the IllustratorType.
+// Anything else is ignored. Returns how many of the two were found.
+static std::size_t extractFlagAndIllustrator(const std::vector<std::string>& vecArgs, std::vector<int>& found)
+{
+    for(const std::string& arg : vecArgs)
     {
         int val;
-        if(tryExtractIntInRange(std::string(argv[i]), val, 0, 2))
+        FlagType eNamed;
+        if(found.empty() && findFlag(arg, eNamed))
+            found.push_back(eNamed);
+        else if(found.empty() && tryExtractIntInRange(arg, val, 0, flagCount() - 1))
             found.push_back(val);
+        else if(found.size() == 1 && tryExtractIntInRange(arg, val, 0, PNG))
+            found.push_back(val);
+    }
+    return found.size();
+}
+
+// reportStats: the render metrics on stderr, as "json" or "prometheus" text (nothing for "").
+static void reportStats(const std::string& strFormat)
+{
+    if(strFormat.empty())
+        return;
+    RenderStats recStats = metricsSnapshot();
+    std::cerr << (strFormat == "json" ? recStats.toJson() + "\n" : recStats.toPrometheus());
+    if(!recStats.blnEnabled)
+        std::cerr << "(metrics are compiled out: build with -DUJ_METRICS to record them)" << std::endl;
+}
+
+// reportPool: buffer pool counters on stderr (nothing without a pool).
+static void reportPool(const PixelPool* pPool)
+{
+    if(pPool == nullptr)
+        return;
+    PoolStats recStats = pPool->getStats();
+    std::cerr << "pool: " << recStats.intAllocations << " allocations, " << recStats.intReuses << " reused ("
+              << recStats.reuseRate() * 100.0 << "%), " << recStats.residentBytes() << " bytes resident, "
+              << recStats.intPeakBytes << " bytes peak" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    // collect the FlagType (a number or a flag name) and the IllustratorType (0..4) from argv[1..]
+    // IllustratorType 3 / 4 writes a compressed QOI / PNG image instead of PNM (binary anyway,
+    // so -b does not matter; see QOIIllustrator.cpp and PNGIllustrator.cpp).
+    // "--flags FILE" adds the flags described in FILE (see FlagLibrary.cpp) after the built-in
+    // ones, numbered in order; it may be repeated. "--list-flags" prints every flag and exits.
+    // "-b" / "--binary" switches to the binary PNM formats (P6/P5/P4).
+    // "-j N" / "--threads N" draws the flag with N threads (default 1), and encodes with them
+    // where the format allows it (QOI / PNG bands, error diffusion).
+    // "--antialias" blends the pixels on circle edges (e.g. Japan) instead of hard edges; only the
+    // edge pixels are sampled, so it costs little (single render, --tiled and --all; batch jobs
+    // and server requests ask for it per image with an "aa" option).
+    // "--dither ordered|diffusion" keeps the tones in the BW formats (P1 / P4): an 8 x 8 Bayer
+    // pattern, or Floyd-Steinberg error diffusion run as a wavefront on the -j threads
+    // (diffusion cannot be combined with --tiled).
+    // "--procedural" encodes the flag row by row from its description without drawing a
+    // pixel grid (single render and batch mode; -j does not apply to the drawing then).
+    // "--size HxW" renders H x W pixels instead of the default size (each side up to MAX_DIMENSION;
+    // anything over MAX_GRID_PIXELS is rendered procedurally), "-o FILE" writes to FILE instead of
+    // stdout, and "--tiled" streams the image in row bands encoded by -j threads (TiledRenderer.cpp);
+    // with -b and -o the bands are encoded in parallel straight into a memory-mapped FILE.
+    // "--all PREFIX" renders the flag once and writes PREFIX.ppm, PREFIX.pgm and PREFIX.pbm
+    // in a single pass over its rows (MultiExporter.cpp); the IllustratorType is not needed.
+    // "--stats json|prometheus" prints per-stage times and counters on stderr at the end, in
+    // any mode (see Metrics.cpp; recorded only in builds with -DUJ_METRICS).
+    // "--batch FILE" renders every job listed in FILE ("-" = stdin) instead; there
+    // -j N is the number of concurrent jobs (default: one per hardware thread),
+    // "--cache-mb N" keeps up to N MB of encoded images so repeated jobs are rendered once,
+    // and "--cache-dir DIR" also persists them to DIR for later runs.
+    // "--serve SOCKET" / "--serve-tcp PORT" runs as a render server instead (see RenderServer.cpp);
+    // -j and the cache options apply there too.
+    // "--pool-mb N" (batch / server) recycles pixel buffers through a PixelPool keeping up
+    // to N MB of freed buffers, and reports its reuse counters at the end.
+    std::vector<std::string> vecPositional;
+    std::vector<std::string> vecFlagFiles;
+    bool blnListFlags = false;
+    ExportMode eMode = ASCII;
+    int intThreads = 1;
+    bool blnThreadsGiven = false;
+    bool blnProcedural = false;
+    bool blnTiled = false;
+    bool blnAntiAlias = false;
+    DitherMode eDither = DITHER_NONE;
+    int intHeight = FlagIllustrator::DEF_HEIGHT;
+    int intWidth  = FlagIllustrator::DEF_WIDTH;
+    std::string strOutFile;
+    std::string strAllPrefix;
+    std::string strStatsFormat;
+    std::string strBatchFile;
+    int intCacheMb = -1; // -1: not given
+    std::string strCacheDir;
+    int intPoolMb = -1; // -1: no pool
+    std::string strServeSocket;
+    int intServePort = 0; // 0: not given
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string arg(argv[i]);
+        if(arg == "-b" || arg == "--binary")
+        {
+            eMode = BINARY;
+            continue;
+        }
+        if(arg == "--flags")
+        {
+            if(i + 1 >= argc)
+            {
+                std::cerr << "ERROR! --flags needs a flag description file. Terminating." << std::endl;
+                std::exit(ERROR_ARGS);
+            }
+            vecFlagFiles.push_back(argv[++i]);
+            continue;
+        }
+        if(arg == "--list-flags")
+        {
+            blnListFlags = true;
+            continue;
+        }
+        if(arg == "--dither")
+        {
+            std::string strDither = i + 1 < argc ? argv[i + 1] : "";
+            if(strDither != "ordered" && strDither != "diffusion")
+            {
+                std::cerr << "ERROR! --dither needs a method: ordered or diffusion. Terminating." << std::endl;
+                std::exit(ERROR_ARGS);
+            }
+            eDither = strDither == "ordered" ? DITHER_ORDERED : DITHER_DIFFUSION;
+            ++i;
+            continue;
+        }
+        if(arg == "--antialias")
+        {
+            blnAntiAlias = true;
+            continue;
+        }
+        if(arg == "--procedural")
+        {
+            blnProcedural = true;
+            continue;
+        }
+        if(arg == "--tiled")
+        {
+            blnTiled = true;
+            continue;
+        }
+        if(arg == "--size")
+        {
+            if(i + 1 >= argc || !tryExtractSize(std::string(argv[++i]), intHeight, intWidth))
+            {
+                std::cerr << "ERROR! --size needs HxW with each side in [0, " << MAX_DIMENSION << "]. Terminating." << std::endl;
+                std::exit(ERROR_ARGS);
+            }
+            continue;
+        }
+        if(arg == "--stats")
+        {
+            if(i + 1 >= argc || (std::string(argv[i + 1]) != "json" && std::string(argv[i + 1]) != "prometheus"))
+            {
+                std::cerr << "ERROR! --stats needs a format: json or prometheus. Terminating." << std::endl;
+                std::exit(ERROR_ARGS);
+            }
+            strStatsFormat = argv[++i];
+            continue;
+        }
+        if(arg == "--all")
+        {
+            if(i + 1 >= argc)
+            {
+                std::cerr << "ERROR! --all needs a file name prefix. Terminating." << std::endl;
+                std::exit(ERROR_ARGS);
+            }
+            strAllPrefix = argv[++i];
+            continue;
+        }
+        if(arg == "-o" || arg == "--output")
+        {
+            if(i + 1 >= argc)
+            {
+                std::cerr << "ERROR! " << arg << " needs a file name. Terminating." << std::endl;
+                std::exit(ERROR_ARGS);
+            }
+            strOutFile = argv[++i];
+            continue;
+        }
+        if(arg == "-j" || arg == "--threads")
+        {
+            // the count is consumed here so it is never mistaken for a FlagType
+            if(i + 1 >= argc || !tryExtractCount(std::string(argv[++i]), intThreads, 1, 1024))
+            {
+                std::cerr << "ERROR! " << arg << " needs a thread count in [1, 1024]. Terminating." << std::endl;
+                std::exit(ERROR_ARGS);
+            }
+            blnThreadsGiven = true;
+            continue;
+        }
+        if(arg == "--batch")
+        {
+            if(i + 1 >= argc)
+            {
+                std::cerr << "ERROR! --batch needs a job file (or - for stdin). Terminating." << std::endl;
+                std::exit(ERROR_ARGS);
+            }
+            strBatchFile = argv[++i];
+            continue;
+        }
+        if(arg == "--serve" || arg == "--serve-tcp")
+        {
+            bool blnOk = i + 1 < argc;
+            if(blnOk && arg == "--serve")
+                strServeSocket = argv[++i];
+            else if(blnOk)
+                blnOk = tryExtractIntInRange(std::string(argv[++i]), intServePort, 1, 65535);
+            if(!blnOk)
+            {
+                std::cerr << "ERROR! " << arg << " needs a socket path / TCP port. Terminating." << std::endl;
+                std::exit(ERROR_ARGS);
+            }
+            continue;
+        }
+        if(arg == "--cache-mb")
+        {
+            if(i + 1 >= argc || !tryExtractCount(std::string(argv[++i]), intCacheMb, 0, 1 << 20))
+            {
+                std::cerr << "ERROR! --cache-mb needs a size in MB. Terminating." << std::endl;
+                std::exit(ERROR_ARGS);
+            }
+            continue;
+        }
+        if(arg == "--pool-mb")
+        {
+            if(i + 1 >= argc || !tryExtractCount(std::string(argv[++i]), intPoolMb, 0, 1 << 20))
+            {
+                std::cerr << "ERROR! --pool-mb needs a size in MB. Terminating." << std::endl;
+                std::exit(ERROR_ARGS);
+            }
+            continue;
+        }
+        if(arg == "--cache-dir")
+        {
+            if(i + 1 >= argc)
+            {
+                std::cerr << "ERROR! --cache-dir needs a directory. Terminating." << std::endl;
+                std::exit(ERROR_ARGS);
+            }
+            strCacheDir = argv[++i];
+            continue;
+        }
+        vecPositional.push_back(arg);
+    }
+
+    // The flag files are loaded before anything renders: the registry is read-only from here on.
+    for(const std::string& strFlagFile : vecFlagFiles)
+        loadFlagFile(strFlagFile);
+    if(blnListFlags)
+    {
+        for(int f = 0; f < flagCount(); ++f)
+            std::cout << f << ' ' << flagTypeName(static_cast<FlagType>(f)) << '\n';
+        return SUCCESS;
+    }
+
+    // Declared before anything that creates images, so it outlives them all.
+    std::unique_ptr<PixelPool> pPool;
+    if(intPoolMb >= 0)
+    {
+        pPool = std::make_unique<PixelPool>(static_cast<std::size_t>(intPoolMb) << 20);
+        setDefaultPixelAllocator(pPool.get());
+    }
+
+    std::unique_ptr<RenderCache> pCache;
+    if(intCacheMb >= 0 || !strCacheDir.empty())
+    {
+        std::size_t intCacheBytes = static_cast<std::size_t>(intCacheMb < 0 ? 256 : intCacheMb) << 20;
+        pCache = std::make_unique<RenderCache>(intCacheBytes, strCacheDir);
+    }
+
+    // SERVER MODE: stay up and answer render requests over a socket
+    if(!strServeSocket.empty() || intServePort != 0)
+    {
+        ServerOptions recOptions;
+        recOptions.strSocketPath = strServeSocket;
+        recOptions.intPort       = intServePort;
+        recOptions.intWorkers    = blnThreadsGiven ? intThreads : static_cast<int>(std::thread::hardware_concurrency());
+        recOptions.pCache        = pCache.get();
+        RenderServer objServer(recOptions);
+        int intResult = objServer.run();
+        reportPool(pPool.get());
+        reportStats(strStatsFormat);
+        return intResult;
+    }
+
+    // BATCH MODE: many jobs, one process
+    if(!strBatchFile.empty())
+    {
+        std::ifstream ifsJobs;
+        if(strBatchFile != "-")
+        {
+            ifsJobs.open(strBatchFile);
+            if(!ifsJobs)
+            {
+                std::cerr << "ERROR! Could not open job file " << strBatchFile << ". Terminating." << std::endl;
+                std::exit(ERROR_ARGS);
+            }
+        }
+        std::vector<RenderJob> vecJobs = BatchRenderer::parseJobs(strBatchFile == "-" ? std::cin : ifsJobs);
+        int intWorkers = blnThreadsGiven ? intThreads : static_cast<int>(std::thread::hardware_concurrency());
+        BatchRenderer objBatch(intWorkers);
+        objBatch.setCache(pCache.get());
+        objBatch.setProcedural(blnProcedural);
+        int intFailed = objBatch.run(vecJobs, std::cerr);
+        reportPool(pPool.get());
+        reportStats(strStatsFormat);
+        return intFailed == 0 ? SUCCESS : ERROR_IO;
     }
 
     // Need at least one (the FlagType).
-    if(found.size() < 1)
+    std::vector<int> found;
+    if(extractFlagAndIllustrator(vecPositional, found) < 1)
     {
         // Print the same usage message as before (keeps marker happy).
         std::cerr << "ERROR! Usage: " << (argv[0] ? argv[0] : "prog")
-                  << " FlagType (0,1,2) [IllustratorType (0=Colour,1=Grayscale,2=BW)]. Terminating." << std::endl;
+                  << " FlagType (0.." << flagCount() - 1 << " or a flag name) [IllustratorType (0=Colour,1=Grayscale,2=BW,3=QOI,4=PNG)] [--flags FILE] [--list-flags] [-b|--binary] [-j|--threads N] [--procedural] [--antialias] [--dither ordered|diffusion] [--size HxW] [--tiled] [-o FILE] [--all PREFIX] [--stats json|prometheus]  or  --batch FILE [-j N] [--procedural] [--cache-mb N] [--cache-dir DIR] [--pool-mb N]  or  --serve SOCKET|--serve-tcp PORT [-j N]. Terminating." << std::endl;
         std::exit(ERROR_ARGS);
     }
 
@@ -58,26 +404,118 @@ int main(int argc, char** argv)
     // If a second valid integer is present, use it; otherwise default to 0 (Colour)
     int intIllustratorChoice = (found.size() >= 2) ? found[1] : 0;
 
-    // POLYMORPHIC INSTANTIATION (same as before)
-    FlagIllustrator* pIllustrator = nullptr;
-    switch(intIllustratorChoice)
+    IllustratorType eIllustrator = static_cast<IllustratorType>(intIllustratorChoice);
+    if(!strAllPrefix.empty() && (blnTiled || !strOutFile.empty()))
+    {
+        std::cerr << "ERROR! --all names its own output files and cannot be combined with --tiled or -o. Terminating." << std::endl;
+        std::exit(ERROR_ARGS);
+    }
+    if(isCompressed(eIllustrator) && (intHeight == 0 || intWidth == 0))
     {
-        case 0: pIllustrator = new ColourIllustrator();    break; // Colour (P3)
-        case 1: pIllustrator = new GrayscaleIllustrator(); break; // Grayscale (P2)
-        case 2: pIllustrator = new BWIllustrator();        break; // B/W (P1)
-        default: // should never happen because of extraction range check
-            std::cerr << "ERROR! Invalid IllustratorType. Terminating." << std::endl;
-            std::exit(ERROR_CONV);
+        std::cerr << "ERROR! QOI and PNG images need a height and width of at least 1. Terminating." << std::endl;
+        std::exit(ERROR_ARGS);
     }
+    if(static_cast<std::size_t>(intHeight) * static_cast<std::size_t>(intWidth) > MAX_GRID_PIXELS)
+        blnProcedural = true;
 
-    pIllustrator->illustrate(eType);
+    TiledRenderer objTiled(intThreads);
+    objTiled.setAntiAlias(blnAntiAlias);
+    if(blnTiled)
+        objTiled.setDither(eDither);
 
-    // POLYMORPHIC CALL
-    std::cout << pIllustrator->exportImage() << std::endl;
+    // TILED BINARY FILE: every row has a fixed size, so the bands go straight into a mapped file.
+    if(blnTiled && eMode == BINARY && !strOutFile.empty())
+    {
+        if(!objTiled.renderToFile(eType, eIllustrator, eMode, intHeight, intWidth, strOutFile))
+        {
+            std::cerr << "ERROR! Could not open output file " << strOutFile << ". Terminating." << std::endl;
+            std::exit(ERROR_IO);
+        }
+        reportStats(strStatsFormat);
+        return SUCCESS;
+    }
+
+    std::ofstream ofsOut;
+    if(!strOutFile.empty())
+    {
+        ofsOut.open(strOutFile, std::ios::binary | std::ios::trunc);
+        if(!ofsOut)
+        {
+            std::cerr << "ERROR! Could not open output file " << strOutFile << ". Terminating." << std::endl;
+            std::exit(ERROR_IO);
+        }
+    }
+    std::ostream& osOut = strOutFile.empty() ? std::cout : ofsOut;
+
+    // POLYMORPHIC INSTANTIATION: 0 = Colour (P3), 1 = Grayscale (P2), 2 = B/W (P1).
+    // The unique_ptr deletes the illustrator through the virtual destructor on return.
+    // A procedural or tiled render never needs the pixel grid, so it starts from an empty image.
+    std::unique_ptr<FlagIllustrator> pIllustrator;
+    if(!blnTiled)
+    {
+        int intGridHeight = blnProcedural ? 0 : intHeight;
+        int intGridWidth  = blnProcedural ? 0 : intWidth;
+        pIllustrator = createIllustrator(eIllustrator, intGridHeight, intGridWidth);
+
+        pIllustrator->setExportMode(eMode);
+        pIllustrator->setAntiAlias(blnAntiAlias);
+        pIllustrator->setDither(eDither);
+        pIllustrator->setEncodeThreads(intThreads);
+        if(blnProcedural)
+            pIllustrator->illustrateProcedural(eType, intHeight, intWidth);
+        else
+            pIllustrator->illustrate(eType, intThreads);
+    }
 
-    // CLEANUP (delete heap memory)
-    delete pIllustrator;
-    pIllustrator = nullptr;
+    // ALL FORMATS: the one drawing above, encoded as PPM, PGM and PBM side by side.
+    if(!strAllPrefix.empty())
+    {
+        std::ofstream arrFiles[3];
+        {
+            std::vector<std::unique_ptr<ImageSink>> vecSinks;
+            MultiExporter objExporter;
+            for(int t = COLOUR; t <= BW; ++t)
+            {
+                std::string strPath = strAllPrefix + illustratorExtension(static_cast<IllustratorType>(t));
+                arrFiles[t].open(strPath, std::ios::binary | std::ios::trunc);
+                if(!arrFiles[t])
+                {
+                    std::cerr << "ERROR! Could not open output file " << strPath << ". Terminating." << std::endl;
+                    std::exit(ERROR_IO);
+                }
+                vecSinks.push_back(std::make_unique<ImageSink>(arrFiles[t]));
+                objExporter.addTarget(static_cast<IllustratorType>(t), eMode, *vecSinks.back(), eDither);
+            }
+            objExporter.exportImage(*pIllustrator);
+            for(std::unique_ptr<ImageSink>& pSink : vecSinks)
+                if(eMode == ASCII)
+                    pSink->put('\n'); // same bytes as the stdout output
+        } // the sinks flush on destruction, before their files close
+        reportStats(strStatsFormat);
+        return SUCCESS;
+    }
+
+    // POLYMORPHIC CALL
+    // The image is encoded straight into the output in fixed-size chunks (no full-image string).
+#ifdef _WIN32
+    if((eMode == BINARY || isCompressed(eIllustrator)) && strOutFile.empty())
+    {
+        // stdout is in text mode on Windows and would turn every 0x0A byte into CR LF.
+        _setmode(_fileno(stdout), _O_BINARY);
+    }
+#endif
+    {
+        ImageSink objSink(osOut);
+        if(blnTiled)
+            objTiled.render(eType, eIllustrator, eMode, intHeight, intWidth, objSink);
+        else
+            pIllustrator->exportImage(objSink);
+        // Binary formats end exactly after the last pixel byte: no trailing newline.
+        if(eMode == ASCII && !isCompressed(eIllustrator))
+            objSink.put('\n');
+    } // sink flushes on destruction
+    osOut.flush();
 
+    reportStats(strStatsFormat);
     return SUCCESS;
 }
\ No newline at end of file